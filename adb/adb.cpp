@@ -427,7 +427,7 @@ void handle_packet(apacket *p, atransport *t)
 
     case A_OKAY: /* READY(local-id, remote-id, "") */
         if (t->online && p->msg.arg0 != 0 && p->msg.arg1 != 0) {
-            asocket* s = find_local_socket(p->msg.arg1, 0);
+            asocket* s = find_local_socket(t, p->msg.arg1, 0);
             if (s) {
                 if(s->peer == nullptr) {
                     /* On first READY message, create the connection. */
@@ -452,7 +452,7 @@ void handle_packet(apacket *p, atransport *t)
 
     case A_CLSE: /* CLOSE(local-id, remote-id, "") or CLOSE(0, remote-id, "") */
         if (t->online && p->msg.arg1 != 0) {
-            asocket* s = find_local_socket(p->msg.arg1, p->msg.arg0);
+            asocket* s = find_local_socket(t, p->msg.arg1, p->msg.arg0);
             if (s) {
                 /* According to protocol.txt, p->msg.arg0 might be 0 to indicate
                  * a failed OPEN only. However, due to a bug in previous ADB
@@ -476,7 +476,7 @@ void handle_packet(apacket *p, atransport *t)
 
     case A_WRTE: /* WRITE(local-id, remote-id, <data>) */
         if (t->online && p->msg.arg0 != 0 && p->msg.arg1 != 0) {
-            asocket* s = find_local_socket(p->msg.arg1, p->msg.arg0);
+            asocket* s = find_local_socket(t, p->msg.arg1, p->msg.arg0);
             if (s) {
                 unsigned rid = p->msg.arg0;
                 if (s->enqueue(s, std::move(p->payload)) == 0) {
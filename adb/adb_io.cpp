@@ -129,6 +129,45 @@ bool WriteFdExactly(borrowed_fd fd, const void* buf, size_t len) {
     return true;
 }
 
+bool WriteFdExactly(borrowed_fd fd, adb_iovec* iov, int iovcnt) {
+    VLOG(RWX) << "writev: fd=" << fd.get() << " iovcnt=" << iovcnt;
+
+    while (iovcnt > 0) {
+        if (iov->iov_len == 0) {
+            ++iov;
+            --iovcnt;
+            continue;
+        }
+
+        ssize_t r = adb_writev(fd, iov, iovcnt);
+        if (r == -1) {
+            D("writev: fd=%d error %d: %s", fd.get(), errno, strerror(errno));
+            if (errno == EAGAIN) {
+                std::this_thread::yield();
+                continue;
+            } else if (errno == EPIPE) {
+                D("writev: fd=%d disconnected", fd.get());
+                errno = 0;
+                return false;
+            } else {
+                return false;
+            }
+        }
+
+        size_t written = r;
+        while (iovcnt > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (written > 0) {
+            iov->iov_base = reinterpret_cast<char*>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
 bool WriteFdExactly(borrowed_fd fd, const char* str) {
     return WriteFdExactly(fd, str, strlen(str));
 }
@@ -23,6 +23,7 @@
 #include <string_view>
 
 #include "adb_unique_fd.h"
+#include "sysdeps/uio.h"
 
 // Sends the protocol "OKAY" message.
 bool SendOkay(borrowed_fd fd);
@@ -69,6 +70,11 @@ bool ReadOrderlyShutdown(borrowed_fd fd);
 // is closed, errno will be set to 0.
 bool WriteFdExactly(borrowed_fd fd, const void* buf, size_t len);
 
+// Same as above, but gathers the data from iovcnt buffers, in as few writes as the fd allows.
+// The iovecs are advanced past whatever has been written, so their contents are undefined
+// afterwards.
+bool WriteFdExactly(borrowed_fd fd, adb_iovec* iov, int iovcnt);
+
 // Same as above, but for strings.
 bool WriteFdExactly(borrowed_fd fd, const char* s);
 bool WriteFdExactly(borrowed_fd fd, const std::string& s);
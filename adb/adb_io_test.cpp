@@ -26,9 +26,14 @@
 #include <unistd.h>
 
 #include <string>
+#include <thread>
 
 #include <android-base/file.h>
 
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#endif
+
 // All of these tests fail on Windows because they use the C Runtime open(),
 // but the adb_io APIs expect file descriptors from adb_open(). This could
 // theoretically be fixed by making adb_read()/adb_write() fallback to using
@@ -119,6 +124,57 @@ POSIX_TEST(io, WriteFdExactly_partial) {
   EXPECT_EQ(expected, s);
 }
 
+POSIX_TEST(io, WriteFdExactly_iovec) {
+  char header[] = "Foo";
+  char empty[] = "";
+  std::string payload(1024 * 1024, 'x');
+  TemporaryFile tf;
+  ASSERT_NE(-1, tf.fd);
+
+  // Test gathering a header, an empty buffer, and a payload into the file.
+  adb_iovec iov[3];
+  iov[0].iov_base = header;
+  iov[0].iov_len = strlen(header);
+  iov[1].iov_base = empty;
+  iov[1].iov_len = 0;
+  iov[2].iov_base = payload.data();
+  iov[2].iov_len = payload.size();
+  ASSERT_TRUE(WriteFdExactly(tf.fd, iov, 3)) << strerror(errno);
+  ASSERT_EQ(0, lseek(tf.fd, 0, SEEK_SET));
+
+  std::string s;
+  ASSERT_TRUE(android::base::ReadFdToString(tf.fd, &s));
+  EXPECT_EQ(header + payload, s);
+}
+
+#if !defined(_WIN32)
+TEST(io, WriteFdExactly_iovec_short_writes) {
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  unique_fd reader(fds[0]);
+  unique_fd writer(fds[1]);
+
+  // Writes into a small socket buffer return early, partway through one of the buffers.
+  int size = 4096;
+  ASSERT_EQ(0, setsockopt(writer.get(), SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)));
+
+  std::string first(10000, 'a');
+  std::string second(70000, 'b');
+  adb_iovec iov[2];
+  iov[0].iov_base = first.data();
+  iov[0].iov_len = first.size();
+  iov[1].iov_base = second.data();
+  iov[1].iov_len = second.size();
+
+  std::string s;
+  std::thread thread([&reader, &s]() { android::base::ReadFdToString(reader.get(), &s); });
+  ASSERT_TRUE(WriteFdExactly(writer.get(), iov, 2)) << strerror(errno);
+  writer.reset();
+  thread.join();
+  EXPECT_EQ(first + second, s);
+}
+#endif
+
 POSIX_TEST(io, WriteFdExactly_ENOSPC) {
     int fd = open("/dev/full", O_WRONLY);
     ASSERT_NE(-1, fd);
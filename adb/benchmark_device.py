@@ -130,6 +130,92 @@ def benchmark_pull(device=None, file_size_mb=100):
 
     analyze("pull %dMiB" % file_size_mb, speeds)
 
+def adbd_cpu_seconds(device):
+    out = device.shell(["cat", "/proc/$(pidof adbd)/stat"])[0]
+    # utime and stime, fields 14 and 15, in clock ticks of 1/100s.
+    fields = out.rsplit(")", 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / 100.0
+
+def benchmark_sync_cpu(device=None, file_size_mb=100):
+    """Compares push and pull to storage with and without adbd splicing the data.
+
+    Only uncompressed transfers are spliced, so these run with -Z.
+    """
+    if device == None:
+        device = adb.get_device()
+
+    remote_path = "/data/local/tmp/adb_benchmark_temp"
+    local_path = "/tmp/adb_benchmark_temp"
+
+    with open(local_path, "wb") as f:
+        f.write(os.urandom(file_size_mb * 1024 * 1024))
+
+    for splice in ["1", "0"]:
+        device.shell(["setprop", "debug.adbd.sync.splice", splice])
+        for direction in ["push", "pull"]:
+            speeds = list()
+            cpu = 0.0
+            for _ in range(0, 10):
+                cpu_begin = adbd_cpu_seconds(device)
+                begin = time.time()
+                if direction == "push":
+                    subprocess.check_call(device.adb_cmd + ["push", "-Z", local_path, remote_path],
+                                          stdout=subprocess.DEVNULL)
+                else:
+                    subprocess.check_call(device.adb_cmd + ["pull", "-Z", remote_path, local_path],
+                                          stdout=subprocess.DEVNULL)
+                end = time.time()
+                cpu += adbd_cpu_seconds(device) - cpu_begin
+                speeds.append(file_size_mb / float(end - begin))
+
+            name = "%s %dMiB (splice=%s)" % (direction, file_size_mb, splice)
+            analyze(name, speeds)
+            print("%s: adbd CPU %.2f s/GiB" % (name, cpu * 1024 / (10 * file_size_mb)))
+
+    device.shell(["setprop", "debug.adbd.sync.splice", "''"])
+    device.shell(["rm", remote_path])
+
+def benchmark_small_files(device=None, file_count=2000, file_size_kb=4):
+    """Pushes and pulls a directory of many small files, where per-file round trips dominate."""
+    if device == None:
+        device = adb.get_device()
+
+    remote_path = "/data/local/tmp/adb_benchmark_dir"
+    local_path = tempfile.mkdtemp()
+    pull_path = tempfile.mkdtemp()
+
+    src_path = os.path.join(local_path, "files")
+    os.mkdir(src_path)
+    for i in range(file_count):
+        with open(os.path.join(src_path, str(i)), "wb") as f:
+            f.write(os.urandom(file_size_kb * 1024))
+
+    size_mb = file_count * file_size_kb / 1024.0
+    for direction in ["push", "pull"]:
+        speeds = list()
+        rates = list()
+        for _ in range(0, 10):
+            if direction == "push":
+                device.shell(["rm", "-rf", remote_path])
+                device.shell(["mkdir", remote_path])
+            else:
+                subprocess.check_call(["rm", "-rf", os.path.join(pull_path, "files")])
+            begin = time.time()
+            if direction == "push":
+                device.push(local=src_path, remote=remote_path)
+            else:
+                device.pull(remote=remote_path + "/files", local=pull_path)
+            end = time.time()
+            speeds.append(size_mb / float(end - begin))
+            rates.append(file_count / float(end - begin))
+
+        name = "%s %d x %dKiB" % (direction, file_count, file_size_kb)
+        analyze(name, speeds)
+        print("%s: median %.0f files/s" % (name, statistics.median(rates)))
+
+    device.shell(["rm", "-rf", remote_path])
+    subprocess.check_call(["rm", "-rf", local_path, pull_path])
+
 def benchmark_shell(device=None, file_size_mb=100):
     if device == None:
         device = adb.get_device()
@@ -151,6 +237,8 @@ def main():
     benchmark_source(device)
     benchmark_push(device)
     benchmark_pull(device)
+    benchmark_sync_cpu(device)
+    benchmark_small_files(device)
 
 if __name__ == "__main__":
     main()
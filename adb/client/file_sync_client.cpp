@@ -28,12 +28,16 @@
 #include <unistd.h>
 #include <utime.h>
 
+#include <array>
 #include <chrono>
-#include <deque>
 #include <functional>
+#include <map>
 #include <memory>
+#include <numeric>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "sysdeps.h"
@@ -42,7 +46,7 @@
 #include "adb_client.h"
 #include "adb_io.h"
 #include "adb_utils.h"
-#include "brotli_utils.h"
+#include "compression_utils.h"
 #include "file_sync_protocol.h"
 #include "line_printer.h"
 #include "sysdeps/errno.h"
@@ -51,8 +55,10 @@
 #include "client/commandline.h"
 
 #include <android-base/file.h>
+#include <android-base/parseint.h>
 #include <android-base/strings.h>
 #include <android-base/stringprintf.h>
+#include <openssl/sha.h>
 
 using namespace std::literals;
 
@@ -222,12 +228,115 @@ struct TransferLedger {
     }
 };
 
+// Whether path's extension is one of a format that's already compressed, so that compressing it
+// again would only cost CPU.
+static bool IsCompressedFileName(const std::string& path) {
+    static constexpr const char* kExtensions[] = {
+            ".7z",  ".apex", ".apk", ".avif", ".br",  ".bz2",  ".gif", ".gz",  ".heic",
+            ".jar", ".jpeg", ".jpg", ".lz4",  ".m4a", ".mkv",  ".mp3", ".mp4", ".ogg",
+            ".png", ".tgz",  ".webm", ".webp", ".xz", ".zip", ".zst",
+    };
+    for (const char* extension : kExtensions) {
+        if (android::base::EndsWithIgnoreCase(path, extension)) return true;
+    }
+    return false;
+}
+
+// Whether the sample, from the start of a file, compresses well enough with LZ4 to be worth
+// compressing with anything.
+static bool LooksCompressible(const char* data, size_t size) {
+    std::vector<char> output(LZ4F_compressFrameBound(size, nullptr));
+    size_t rc = LZ4F_compressFrame(output.data(), output.size(), data, size, nullptr);
+    return !LZ4F_isError(rc) && rc < size - size / 20;
+}
+
+using ChunkHash = std::array<uint8_t, SHA256_DIGEST_LENGTH>;
+
+// Chunks that were already compressed, by their hash and how they were compressed, in the directory
+// that $ADB_SYNC_CACHE names, if it's set. That way pushing the same data to many devices, from any
+// number of adb processes, only compresses it once. adb never trims the cache; `adb --help` tells
+// the user to.
+class ChunkCache {
+  public:
+    ChunkCache() {
+        const char* dir = getenv("ADB_SYNC_CACHE");
+        if (dir && *dir) dir_ = dir;
+    }
+
+    // Returns whether the cache knew how the chunk compresses, with it compressed in *output, or
+    // empty if compressing it doesn't help. An entry that doesn't decompress back to chunk, from a
+    // bad write or another tool, is dropped rather than sent.
+    bool Get(const ChunkHash& hash, CompressionType compression, int zstd_level,
+             const Block& chunk, Block* output) {
+        if (dir_.empty()) return false;
+        std::string path = Path(hash, compression, zstd_level);
+        std::string data;
+        if (!android::base::ReadFileToString(path, &data)) {
+            return false;
+        }
+        if (!data.empty()) {
+            Block decompressed(chunk.size());
+            if (data.size() >= chunk.size() ||
+                !DecompressChunk(compression, Block(data.begin(), data.end()),
+                                 decompressed.data(), decompressed.size()) ||
+                memcmp(decompressed.data(), chunk.data(), chunk.size()) != 0) {
+                adb_unlink(path.c_str());
+                return false;
+            }
+        }
+        *output = Block(data.begin(), data.end());
+        return true;
+    }
+
+    void Put(const ChunkHash& hash, CompressionType compression, int zstd_level,
+             const Block& compressed) {
+        if (dir_.empty()) return;
+        // Write it under a name of its own first, so that no other process sees half of it.
+        std::string path = Path(hash, compression, zstd_level);
+        std::string tmp = android::base::StringPrintf("%s.%d", path.c_str(), getpid());
+        if (android::base::WriteStringToFile(std::string(compressed.begin(), compressed.end()),
+                                             tmp) &&
+            adb_rename(tmp.c_str(), path.c_str()) == 0) {
+            return;
+        }
+        adb_unlink(tmp.c_str());
+    }
+
+  private:
+    std::string Path(const ChunkHash& hash, CompressionType compression, int zstd_level) {
+        std::string name = dir_ + OS_PATH_SEPARATOR;
+        for (uint8_t byte : hash) {
+            name += android::base::StringPrintf("%02x", byte);
+        }
+        switch (compression) {
+            case CompressionType::Brotli:
+                return name + ".brotli";
+            case CompressionType::LZ4:
+                return name + ".lz4";
+            case CompressionType::Zstd:
+                return name + ".zstd" + std::to_string(zstd_level);
+            case CompressionType::None:
+            case CompressionType::Any:
+                break;
+        }
+        LOG(FATAL) << "no cache for compression type " << static_cast<int>(compression);
+        return {};
+    }
+
+    std::string dir_;
+};
+
 class SyncConnection {
   public:
-    SyncConnection() : acknowledgement_buffer_(sizeof(sync_status) + SYNC_DATA_MAX) {
+    SyncConnection() : acknowledgement_buffer_(sizeof(sync_pipe_status) + SYNC_DATA_MAX) {
         acknowledgement_buffer_.resize(0);
         max = SYNC_DATA_MAX; // TODO: decide at runtime.
 
+        const char* zstd_level = getenv("ADB_ZSTD_LEVEL");
+        if (zstd_level && !android::base::ParseInt(zstd_level, &zstd_level_, 1, ZSTD_maxCLevel())) {
+            Warning("ignoring invalid ADB_ZSTD_LEVEL '%s'", zstd_level);
+        }
+
         std::string error;
         if (!adb_get_feature_set(&features_, &error)) {
             Error("failed to get feature set: %s", error.c_str());
@@ -236,6 +345,10 @@ class SyncConnection {
             have_ls_v2_ = CanUseFeature(features_, kFeatureLs2);
             have_sendrecv_v2_ = CanUseFeature(features_, kFeatureSendRecv2);
             have_sendrecv_v2_brotli_ = CanUseFeature(features_, kFeatureSendRecv2Brotli);
+            have_sendrecv_v2_lz4_ = CanUseFeature(features_, kFeatureSendRecv2LZ4);
+            have_sendrecv_v2_zstd_ = CanUseFeature(features_, kFeatureSendRecv2Zstd);
+            have_sync_pipeline_ = CanUseFeature(features_, kFeatureSyncPipeline);
+            have_sendrecv_v2_dedup_ = CanUseFeature(features_, kFeatureSendRecv2Dedup);
             fd.reset(adb_connect("sync:", &error));
             if (fd < 0) {
                 Error("connect failed: %s", error.c_str());
@@ -260,10 +373,98 @@ class SyncConnection {
     }
 
     bool HaveSendRecv2() const { return have_sendrecv_v2_; }
-    bool HaveSendRecv2Brotli() const { return have_sendrecv_v2_brotli_; }
+
+    bool CanUseCompression(CompressionType compression) const {
+        switch (compression) {
+            case CompressionType::None:
+                return true;
+            case CompressionType::Any:
+                return have_sendrecv_v2_;
+            case CompressionType::Brotli:
+                return have_sendrecv_v2_ && have_sendrecv_v2_brotli_;
+            case CompressionType::LZ4:
+                return have_sendrecv_v2_ && have_sendrecv_v2_lz4_;
+            case CompressionType::Zstd:
+                return have_sendrecv_v2_ && have_sendrecv_v2_zstd_;
+        }
+    }
+
+    // Resolves the compression to use for a transfer of path: an algorithm the device doesn't
+    // support counts as Any, and Any is the best fit for the link, or None for files that are
+    // already compressed. Each algorithm's stream stores incompressible blocks as they are, so
+    // a mostly compressible file with the odd incompressible chunk doesn't need special casing.
+    CompressionType ResolveCompression(CompressionType compression, const std::string& path) {
+        if (compression == CompressionType::None || !have_sendrecv_v2_) {
+            return CompressionType::None;
+        }
+        if (compression != CompressionType::Any && CanUseCompression(compression)) {
+            return compression;
+        }
+        if (IsCompressedFileName(path)) {
+            return CompressionType::None;
+        }
+
+        // Compression only pays when it's faster than the link: LZ4 keeps up with USB 3 and
+        // local connections, Zstd trades some CPU for a better ratio, and Brotli has the best
+        // ratio for slow links. Until there's a measurement, LZ4 is never much of a loss.
+        std::array<CompressionType, 3> preference = {
+                CompressionType::LZ4, CompressionType::Zstd, CompressionType::Brotli};
+        if (link_bytes_ >= kMinLinkSampleBytes) {
+            double bytes_per_second = link_bytes_ / link_seconds_;
+            if (bytes_per_second < kSlowLinkBytesPerSecond) {
+                preference = {CompressionType::Brotli, CompressionType::Zstd,
+                              CompressionType::LZ4};
+            } else if (bytes_per_second < kFastLinkBytesPerSecond) {
+                preference = {CompressionType::Zstd, CompressionType::LZ4,
+                              CompressionType::Brotli};
+            }
+        }
+        for (CompressionType candidate : preference) {
+            if (CanUseCompression(candidate)) return candidate;
+        }
+        return CompressionType::None;
+    }
+
+    // Records how long it took to get bytes across the link, for transfers that the link rather
+    // than compression limited: uncompressed or LZ4.
+    void RecordLinkThroughput(CompressionType compression, uint64_t bytes,
+                              std::chrono::steady_clock::duration duration) {
+        if (compression != CompressionType::None && compression != CompressionType::LZ4) return;
+        if (bytes < kMinLinkSampleBytes / 4) return;  // dominated by latency
+        link_bytes_ += bytes;
+        link_seconds_ += std::chrono::duration<double>(duration).count();
+    }
+
+    int ZstdLevel() const { return zstd_level_; }
 
     const FeatureSet& Features() const { return features_; }
 
+    // How many sends, or recvs, may be in flight. Always 1 for recvs outside of pipelined mode.
+    size_t Window() const { return window_; }
+
+    // Switches to pipelined mode if adbd supports it, see SYNC.TXT. Sends that are still waiting
+    // for their status are acknowledged first, since those statuses aren't tagged.
+    bool StartPipeline() {
+        if (!have_sync_pipeline_ || pipelined_) return true;
+        if (!ReadAcknowledgements(true)) return false;
+
+        if (!SendRequest(ID_PIPE, "")) return false;
+        syncmsg msg;
+        if (!ReadFdExactly(fd, &msg.pipe, sizeof(msg.pipe))) {
+            Error("failed to read pipe response: %s", strerror(errno));
+            return false;
+        }
+        if (msg.pipe.id != ID_PIPE || msg.pipe.window == 0) {
+            Error("unexpected pipe response: id = %#" PRIx32 ", window = %" PRIu32, msg.pipe.id,
+                  msg.pipe.window);
+            return false;
+        }
+        pipelined_ = true;
+        window_ = msg.pipe.window;
+        next_transfer_ = 0;
+        return true;
+    }
+
     bool IsValid() { return fd >= 0; }
 
     void NewTransfer() {
@@ -277,7 +478,8 @@ class SyncConnection {
 
     void RecordFileSent(std::string from, std::string to) {
         RecordFilesTransferred(1);
-        deferred_acknowledgements_.emplace_back(std::move(from), std::move(to));
+        deferred_acknowledgements_.emplace(next_transfer_++,
+                                           std::make_pair(std::move(from), std::move(to)));
     }
 
     void RecordFilesTransferred(size_t files) {
@@ -323,7 +525,8 @@ class SyncConnection {
         return WriteFdExactly(fd, buf.data(), buf.size());
     }
 
-    bool SendSend2(std::string_view path, mode_t mode, bool compressed) {
+    bool SendSend2(std::string_view path, mode_t mode, CompressionType compression,
+                   bool dedup = false) {
         if (path.length() > 1024) {
             Error("SendRequest failed: path too long: %zu", path.length());
             errno = ENAMETOOLONG;
@@ -339,7 +542,10 @@ class SyncConnection {
         syncmsg msg;
         msg.send_v2_setup.id = ID_SEND_V2;
         msg.send_v2_setup.mode = mode;
-        msg.send_v2_setup.flags = compressed ? kSyncFlagBrotli : kSyncFlagNone;
+        msg.send_v2_setup.flags = CompressionTypeToSyncFlag(compression);
+        if (dedup) {
+            msg.send_v2_setup.flags |= kSyncFlagDedup;
+        }
 
         buf.resize(sizeof(SyncRequest) + path.length() + sizeof(msg.send_v2_setup));
 
@@ -352,32 +558,38 @@ class SyncConnection {
         return WriteFdExactly(fd, buf.data(), buf.size());
     }
 
-    bool SendRecv2(const std::string& path) {
+    // Queues a RECV_V1, or a RECV_V2 if compressed, for path. Queued requests go out in a single
+    // write on FlushRequests.
+    bool QueueRecv(const std::string& path, CompressionType compression) {
         if (path.length() > 1024) {
             Error("SendRequest failed: path too long: %zu", path.length());
             errno = ENAMETOOLONG;
             return false;
         }
 
-        Block buf;
-
+        bool v2 = compression != CompressionType::None;
         SyncRequest req;
-        req.id = ID_RECV_V2;
+        req.id = v2 ? ID_RECV_V2 : ID_RECV_V1;
         req.path_length = path.length();
+        requests_.append(reinterpret_cast<const char*>(&req), sizeof(req));
+        requests_.append(path);
 
-        syncmsg msg;
-        msg.recv_v2_setup.id = ID_RECV_V2;
-        msg.recv_v2_setup.flags = kSyncFlagBrotli;
-
-        buf.resize(sizeof(SyncRequest) + path.length() + sizeof(msg.recv_v2_setup));
-
-        void* p = buf.data();
+        if (v2) {
+            syncmsg msg;
+            msg.recv_v2_setup.id = ID_RECV_V2;
+            msg.recv_v2_setup.flags = CompressionTypeToSyncFlag(compression);
+            requests_.append(reinterpret_cast<const char*>(&msg.recv_v2_setup),
+                             sizeof(msg.recv_v2_setup));
+        }
+        return true;
+    }
 
-        p = mempcpy(p, &req, sizeof(SyncRequest));
-        p = mempcpy(p, path.data(), path.length());
-        p = mempcpy(p, &msg.recv_v2_setup, sizeof(msg.recv_v2_setup));
+    size_t QueuedRequestBytes() const { return requests_.size(); }
 
-        return WriteFdExactly(fd, buf.data(), buf.size());
+    bool FlushRequests() {
+        bool result = WriteFdExactly(fd, requests_.data(), requests_.size());
+        requests_.clear();
+        return result;
     }
 
     bool SendStat(const std::string& path) {
@@ -534,8 +746,9 @@ class SyncConnection {
     }
 
     bool SendLargeFileCompressed(const std::string& path, mode_t mode, const std::string& lpath,
-                                 const std::string& rpath, unsigned mtime) {
-        if (!SendSend2(path, mode, true)) {
+                                 const std::string& rpath, unsigned mtime,
+                                 CompressionType compression) {
+        if (!SendSend2(path, mode, compression)) {
             Error("failed to send ID_SEND_V2 message '%s': %s", path.c_str(), strerror(errno));
             return false;
         }
@@ -558,7 +771,9 @@ class SyncConnection {
         syncsendbuf sbuf;
         sbuf.id = ID_DATA;
 
-        BrotliEncoder<SYNC_DATA_MAX> encoder;
+        auto begin = std::chrono::steady_clock::now();
+        uint64_t bytes_sent = 0;
+        std::unique_ptr<Encoder> encoder = MakeEncoder(compression, SYNC_DATA_MAX, zstd_level_);
         bool sending = true;
         while (sending) {
             Block input(SYNC_DATA_MAX);
@@ -569,10 +784,10 @@ class SyncConnection {
             }
 
             if (r == 0) {
-                encoder.Finish();
+                encoder->Finish();
             } else {
                 input.resize(r);
-                encoder.Append(std::move(input));
+                encoder->Append(std::move(input));
                 RecordBytesTransferred(r);
                 bytes_copied += r;
                 ReportProgress(rpath, bytes_copied, total_size);
@@ -580,8 +795,8 @@ class SyncConnection {
 
             while (true) {
                 Block output;
-                BrotliEncodeResult result = encoder.Encode(&output);
-                if (result == BrotliEncodeResult::Error) {
+                EncodeResult result = encoder->Encode(&output);
+                if (result == EncodeResult::Error) {
                     Error("compressing '%s' locally failed", lpath.c_str());
                     return false;
                 }
@@ -590,14 +805,15 @@ class SyncConnection {
                     sbuf.size = output.size();
                     memcpy(sbuf.data, output.data(), output.size());
                     WriteOrDie(lpath, rpath, &sbuf, sizeof(SyncRequest) + output.size());
+                    bytes_sent += output.size();
                 }
 
-                if (result == BrotliEncodeResult::Done) {
+                if (result == EncodeResult::Done) {
                     sending = false;
                     break;
-                } else if (result == BrotliEncodeResult::NeedInput) {
+                } else if (result == EncodeResult::NeedInput) {
                     break;
-                } else if (result == BrotliEncodeResult::MoreOutput) {
+                } else if (result == EncodeResult::MoreOutput) {
                     continue;
                 }
             }
@@ -607,13 +823,183 @@ class SyncConnection {
         msg.data.id = ID_DONE;
         msg.data.size = mtime;
         RecordFileSent(lpath, rpath);
-        return WriteOrDie(lpath, rpath, &msg.data, sizeof(msg.data));
+        bool result = WriteOrDie(lpath, rpath, &msg.data, sizeof(msg.data));
+        RecordLinkThroughput(compression, bytes_sent, std::chrono::steady_clock::now() - begin);
+        return result;
+    }
+
+    // Asks adbd which of the chunks it has, with HAVE requests. Their responses come after the
+    // statuses of the sends before them, so this waits for those.
+    bool QueryChunks(const std::vector<ChunkHash>& hashes, std::vector<bool>* have) {
+        if (!ReadAcknowledgements(true)) return false;
+
+        have->clear();
+        for (size_t offset = 0; offset < hashes.size(); offset += SYNC_HAVE_MAX) {
+            uint32_t count = std::min<size_t>(SYNC_HAVE_MAX, hashes.size() - offset);
+            std::string request(sizeof(SyncRequest), '\0');
+            SyncRequest* req = reinterpret_cast<SyncRequest*>(request.data());
+            req->id = ID_HAVE;
+            req->path_length = count;
+            request.append(reinterpret_cast<const char*>(hashes[offset].data()),
+                           count * sizeof(ChunkHash));
+            if (!WriteFdExactly(fd, request)) {
+                Error("failed to send ID_HAVE: %s", strerror(errno));
+                return false;
+            }
+
+            syncmsg msg;
+            if (!ReadFdExactly(fd, &msg.data, sizeof(msg.data))) {
+                Error("failed to read ID_HAVE response: %s", strerror(errno));
+                return false;
+            }
+            if (msg.data.id != ID_HAVE || msg.data.size != count) {
+                Error("unexpected ID_HAVE response: id = %#" PRIx32 ", size = %" PRIu32,
+                      msg.data.id, msg.data.size);
+                return false;
+            }
+            std::vector<char> response(count);
+            if (!ReadFdExactly(fd, response.data(), count)) {
+                Error("failed to read ID_HAVE response: %s", strerror(errno));
+                return false;
+            }
+            have->insert(have->end(), response.begin(), response.end());
+        }
+        return true;
+    }
+
+    // Sends a file in chunks that adbd can fill in itself if it already has them, see SYNC.TXT.
+    // Each chunk that does have to go is compressed on its own, unless chunk_cache_ already has it
+    // compressed. If adbd no longer has one of the chunks by the time it needs it, the file is sent
+    // again in full.
+    bool SendLargeFileDedup(const std::string& path, mode_t mode, const std::string& lpath,
+                            const std::string& rpath, unsigned mtime,
+                            CompressionType compression) {
+        unique_fd lfd(adb_open(lpath.c_str(), O_RDONLY | O_CLOEXEC));
+        if (lfd < 0) {
+            Error("opening '%s' locally failed: %s", lpath.c_str(), strerror(errno));
+            return false;
+        }
+
+        // Hash all of the chunks first, to ask about them all at once.
+        std::vector<ChunkHash> hashes;
+        std::vector<uint32_t> sizes;
+        Block chunk(SYNC_DATA_MAX);
+        while (true) {
+            ssize_t r = ReadChunk(lfd, &chunk);
+            if (r < 0) {
+                Error("reading '%s' locally failed: %s", lpath.c_str(), strerror(errno));
+                return false;
+            } else if (r == 0) {
+                break;
+            }
+            ChunkHash& hash = hashes.emplace_back();
+            SHA256(reinterpret_cast<const uint8_t*>(chunk.data()), r, hash.data());
+            sizes.push_back(r);
+        }
+        if (adb_lseek(lfd, 0, SEEK_SET) == -1) {
+            Error("seeking in '%s' locally failed: %s", lpath.c_str(), strerror(errno));
+            return false;
+        }
+
+        std::vector<bool> have;
+        if (!QueryChunks(hashes, &have)) return false;
+
+        // Counted again if the file has to be sent again.
+        TransferLedger current_ledger = current_ledger_;
+        TransferLedger global_ledger = global_ledger_;
+
+        if (!SendSend2(path, mode, compression, true)) {
+            Error("failed to send ID_SEND_V2 message '%s': %s", path.c_str(), strerror(errno));
+            return false;
+        }
+
+        uint64_t total_size = std::accumulate(sizes.begin(), sizes.end(), uint64_t(0));
+        uint64_t bytes_copied = 0;
+        uint64_t bytes_sent = 0;
+        auto begin = std::chrono::steady_clock::now();
+        std::vector<char> buf(sizeof(sync_chunk) + SYNC_DATA_MAX);
+        for (size_t i = 0; i < hashes.size(); ++i) {
+            sync_chunk* header = reinterpret_cast<sync_chunk*>(buf.data());
+            header->id = ID_CHNK;
+            header->size = sizes[i];
+            header->data_size = 0;
+            memcpy(header->hash, hashes[i].data(), sizeof(header->hash));
+
+            if (have[i]) {
+                if (adb_lseek(lfd, sizes[i], SEEK_CUR) == -1) {
+                    Error("seeking in '%s' locally failed: %s", lpath.c_str(), strerror(errno));
+                    return false;
+                }
+            } else {
+                ssize_t r = ReadChunk(lfd, &chunk);
+                if (r != static_cast<ssize_t>(sizes[i])) {
+                    Error("reading '%s' locally failed: %s", lpath.c_str(),
+                          r < 0 ? strerror(errno) : "file changed");
+                    return false;
+                }
+
+                Block compressed;
+                if (compression != CompressionType::None &&
+                    !chunk_cache_.Get(hashes[i], compression, zstd_level_, chunk, &compressed)) {
+                    if (!CompressChunk(compression, zstd_level_, chunk.data(), r, &compressed)) {
+                        compressed.clear();
+                    }
+                    chunk_cache_.Put(hashes[i], compression, zstd_level_, compressed);
+                }
+                const Block& data = compressed.empty() ? chunk : compressed;
+                header->data_size = data.size();
+                memcpy(buf.data() + sizeof(sync_chunk), data.data(), data.size());
+            }
+
+            WriteOrDie(lpath, rpath, buf.data(), sizeof(sync_chunk) + header->data_size);
+            bytes_sent += header->data_size;
+            RecordBytesTransferred(sizes[i]);
+            bytes_copied += sizes[i];
+            ReportProgress(rpath, bytes_copied, total_size);
+        }
+
+        syncmsg msg;
+        msg.data.id = ID_DONE;
+        msg.data.size = mtime;
+        uint32_t transfer = next_transfer_;
+        RecordFileSent(lpath, rpath);
+        if (!WriteOrDie(lpath, rpath, &msg.data, sizeof(msg.data))) return false;
+        RecordLinkThroughput(compression, bytes_sent, std::chrono::steady_clock::now() - begin);
+
+        // Whether the chunks were all still there is only known from the status, so wait for it.
+        dedup_transfer_ = transfer;
+        bool result = ReadAcknowledgements(true);
+        dedup_transfer_.reset();
+        if (!std::exchange(dedup_chunk_missing_, false)) {
+            return result;
+        }
+        if (!result) return false;
+
+        current_ledger_ = current_ledger;
+        global_ledger_ = global_ledger;
+        return SendLargeFile(path, mode, lpath, rpath, mtime, compression, false);
     }
 
     bool SendLargeFile(const std::string& path, mode_t mode, const std::string& lpath,
-                       const std::string& rpath, unsigned mtime, bool compressed) {
-        if (compressed && HaveSendRecv2Brotli()) {
-            return SendLargeFileCompressed(path, mode, lpath, rpath, mtime);
+                       const std::string& rpath, unsigned mtime, CompressionType compression,
+                       bool allow_dedup = true) {
+        CompressionType resolved = ResolveCompression(compression, lpath);
+        if (compression == CompressionType::Any && resolved != CompressionType::None) {
+            // Don't spend CPU on a file that starts out incompressible.
+            unique_fd lfd(adb_open(lpath.c_str(), O_RDONLY | O_CLOEXEC));
+            std::vector<char> sample(SYNC_DATA_MAX);
+            ssize_t r = lfd < 0 ? -1 : adb_read(lfd, sample.data(), sample.size());
+            if (r > 0 && !LooksCompressible(sample.data(), r)) {
+                resolved = CompressionType::None;
+            }
+        }
+        struct stat st;
+        if (allow_dedup && have_sendrecv_v2_dedup_ && stat(lpath.c_str(), &st) == 0 &&
+            st.st_size >= kMinDedupFileSize) {
+            return SendLargeFileDedup(path, mode, lpath, rpath, mtime, resolved);
+        }
+        if (resolved != CompressionType::None) {
+            return SendLargeFileCompressed(path, mode, lpath, rpath, mtime, resolved);
         }
 
         std::string path_and_mode = android::base::StringPrintf("%s,%d", path.c_str(), mode);
@@ -623,7 +1009,6 @@ class SyncConnection {
             return false;
         }
 
-        struct stat st;
         if (stat(lpath.c_str(), &st) == -1) {
             Error("cannot stat '%s': %s", lpath.c_str(), strerror(errno));
             return false;
@@ -641,6 +1026,7 @@ class SyncConnection {
         syncsendbuf sbuf;
         sbuf.id = ID_DATA;
 
+        auto begin = std::chrono::steady_clock::now();
         while (true) {
             int bytes_read = adb_read(lfd, sbuf.data, max);
             if (bytes_read == -1) {
@@ -662,7 +1048,10 @@ class SyncConnection {
         msg.data.id = ID_DONE;
         msg.data.size = mtime;
         RecordFileSent(lpath, rpath);
-        return WriteOrDie(lpath, rpath, &msg.data, sizeof(msg.data));
+        bool result = WriteOrDie(lpath, rpath, &msg.data, sizeof(msg.data));
+        RecordLinkThroughput(CompressionType::None, bytes_copied,
+                             std::chrono::steady_clock::now() - begin);
+        return result;
     }
 
     bool ReportCopyFailure(const std::string& from, const std::string& to, const syncmsg& msg) {
@@ -677,12 +1066,20 @@ class SyncConnection {
         return false;
     }
 
-    void CopyDone() { deferred_acknowledgements_.pop_front(); }
+    void CopyDone(uint32_t transfer) { deferred_acknowledgements_.erase(transfer); }
 
-    void ReportDeferredCopyFailure(const std::string& msg) {
-        auto& [from, to] = deferred_acknowledgements_.front();
+    // Returns false if the failure ends the sync, rather than a deduplicated send that is going to
+    // be retried.
+    bool ReportDeferredCopyFailure(uint32_t transfer, const std::string& msg) {
+        if (dedup_transfer_ == transfer && msg == SYNC_CHUNK_MISSING) {
+            dedup_chunk_missing_ = true;
+            deferred_acknowledgements_.erase(transfer);
+            return true;
+        }
+        auto& [from, to] = deferred_acknowledgements_[transfer];
         Error("failed to copy '%s' to '%s': remote %s", from.c_str(), to.c_str(), msg.c_str());
-        deferred_acknowledgements_.pop_front();
+        deferred_acknowledgements_.erase(transfer);
+        return false;
     }
 
     bool ReadAcknowledgements(bool read_all = false) {
@@ -691,20 +1088,27 @@ class SyncConnection {
         // overhead per write. The worst case scenario is a continuous string of failures, since
         // each logical packet is divided into two writes. If our packet size if conservatively 512
         // bytes long, this leaves us with space for 128 responses.
-        constexpr size_t max_deferred_acks = 128;
+        //
+        // In pipelined mode adbd queues statuses rather than block on them, and tells us how many
+        // sends it's willing to have in flight.
+        const size_t max_deferred_acks = pipelined_ ? window_ : 128;
+        // Statuses are tagged with their send's number in pipelined mode, since they can come in
+        // any order. Otherwise they come in the order of the sends.
+        const size_t header_size = pipelined_ ? sizeof(sync_pipe_status) : sizeof(sync_status);
         auto& buf = acknowledgement_buffer_;
         adb_pollfd pfd = {.fd = fd.get(), .events = POLLIN};
         while (!deferred_acknowledgements_.empty()) {
             bool should_block = read_all || deferred_acknowledgements_.size() >= max_deferred_acks;
 
-            ssize_t rc = adb_poll(&pfd, 1, should_block ? -1 : 0);
-            if (rc == 0) {
-                CHECK(!should_block);
-                return true;
-            }
+            // A previous non-blocking pass may have left a whole header in the buffer, in which
+            // case there might be nothing more coming to wait for.
+            if (buf.size() < header_size) {
+                if (adb_poll(&pfd, 1, should_block ? -1 : 0) == 0) {
+                    CHECK(!should_block);
+                    return true;
+                }
 
-            if (acknowledgement_buffer_.size() < sizeof(sync_status)) {
-                const ssize_t header_bytes_left = sizeof(sync_status) - buf.size();
+                const ssize_t header_bytes_left = header_size - buf.size();
                 ssize_t rc = adb_read(fd, buf.end(), header_bytes_left);
                 if (rc <= 0) {
                     Error("failed to read copy response");
@@ -716,31 +1120,42 @@ class SyncConnection {
                     // Early exit if we run out of data in the socket.
                     return true;
                 }
+            }
 
-                if (!should_block) {
-                    // We don't want to read again yet, because the socket might be empty.
-                    continue;
+            uint32_t id, msglen, transfer;
+            if (pipelined_) {
+                auto* hdr = reinterpret_cast<sync_pipe_status*>(buf.data());
+                id = hdr->id;
+                msglen = hdr->msglen;
+                transfer = hdr->transfer;
+                if (!deferred_acknowledgements_.count(transfer)) {
+                    Error("unexpected response from daemon: transfer = %" PRIu32, transfer);
+                    return false;
                 }
+            } else {
+                auto* hdr = reinterpret_cast<sync_status*>(buf.data());
+                id = hdr->id;
+                msglen = hdr->msglen;
+                transfer = deferred_acknowledgements_.begin()->first;
             }
 
-            auto* hdr = reinterpret_cast<sync_status*>(buf.data());
-            if (hdr->id == ID_OKAY) {
+            if (id == ID_OKAY) {
                 buf.resize(0);
-                if (hdr->msglen != 0) {
-                    Error("received ID_OKAY with msg_len (%" PRIu32 " != 0", hdr->msglen);
+                if (msglen != 0) {
+                    Error("received ID_OKAY with msg_len (%" PRIu32 " != 0", msglen);
                     return false;
                 }
-                CopyDone();
+                CopyDone(transfer);
                 continue;
-            } else if (hdr->id != ID_FAIL) {
-                Error("unexpected response from daemon: id = %#" PRIx32, hdr->id);
+            } else if (id != ID_FAIL) {
+                Error("unexpected response from daemon: id = %#" PRIx32, id);
                 return false;
-            } else if (hdr->msglen > SYNC_DATA_MAX) {
-                Error("too-long message length from daemon: msglen = %" PRIu32, hdr->msglen);
+            } else if (msglen > SYNC_DATA_MAX) {
+                Error("too-long message length from daemon: msglen = %" PRIu32, msglen);
                 return false;
             }
 
-            const ssize_t msg_bytes_left = hdr->msglen + sizeof(sync_status) - buf.size();
+            const ssize_t msg_bytes_left = msglen + header_size - buf.size();
             CHECK_GE(msg_bytes_left, 0);
             if (msg_bytes_left > 0) {
                 ssize_t rc = adb_read(fd, buf.end(), msg_bytes_left);
@@ -758,9 +1173,9 @@ class SyncConnection {
                     }
                 }
 
-                std::string msg(buf.begin() + sizeof(sync_status), buf.end());
-                ReportDeferredCopyFailure(msg);
+                std::string msg(buf.begin() + header_size, buf.end());
                 buf.resize(0);
+                if (ReportDeferredCopyFailure(transfer, msg)) continue;
                 return false;
             }
         }
@@ -833,18 +1248,56 @@ class SyncConnection {
     size_t max;
 
   private:
-    std::deque<std::pair<std::string, std::string>> deferred_acknowledgements_;
+    // Keyed by the send's number.
+    std::map<uint32_t, std::pair<std::string, std::string>> deferred_acknowledgements_;
+    uint32_t next_transfer_ = 0;
     Block acknowledgement_buffer_;
+    std::string requests_;
     FeatureSet features_;
     bool have_stat_v2_;
     bool have_ls_v2_;
     bool have_sendrecv_v2_;
     bool have_sendrecv_v2_brotli_;
+    bool have_sendrecv_v2_lz4_ = false;
+    bool have_sendrecv_v2_zstd_ = false;
+    bool have_sync_pipeline_ = false;
+    bool have_sendrecv_v2_dedup_ = false;
+    // The deduplicated send whose status SendLargeFileDedup is waiting for, and whether it failed
+    // for a missing chunk.
+    std::optional<uint32_t> dedup_transfer_;
+    bool dedup_chunk_missing_ = false;
+    bool pipelined_ = false;
+    size_t window_ = 1;
+
+    // Smaller files aren't worth the round trip to ask adbd which of their chunks it has.
+    static constexpr off_t kMinDedupFileSize = 1024 * 1024;
+    ChunkCache chunk_cache_;
+
+    static constexpr uint64_t kMinLinkSampleBytes = 4 * 1024 * 1024;
+    static constexpr double kSlowLinkBytesPerSecond = 20 * 1024 * 1024;
+    static constexpr double kFastLinkBytesPerSecond = 100 * 1024 * 1024;
+    uint64_t link_bytes_ = 0;
+    double link_seconds_ = 0;
+    int zstd_level_ = 3;
 
     TransferLedger global_ledger_;
     TransferLedger current_ledger_;
     LinePrinter line_printer_;
 
+    // Reads up to a chunk's worth of fd into chunk, which is resized to fit.
+    static ssize_t ReadChunk(borrowed_fd fd, Block* chunk) {
+        chunk->resize(SYNC_DATA_MAX);
+        size_t size = 0;
+        while (size < SYNC_DATA_MAX) {
+            ssize_t r = adb_read(fd, chunk->data() + size, SYNC_DATA_MAX - size);
+            if (r < 0) return -1;
+            if (r == 0) break;
+            size += r;
+        }
+        chunk->resize(size);
+        return size;
+    }
+
     bool SendQuit() {
         return SendRequest(ID_QUIT, ""); // TODO: add a SendResponse?
     }
@@ -852,7 +1305,10 @@ class SyncConnection {
     bool WriteOrDie(const std::string& from, const std::string& to, const void* data,
                     size_t data_length) {
         if (!WriteFdExactly(fd, data, data_length)) {
-            if (errno == ECONNRESET) {
+            if (errno == ECONNRESET && pipelined_) {
+                // The failed send needn't be this one, let its tagged status say which.
+                ReadAcknowledgements(true);
+            } else if (errno == ECONNRESET) {
                 // Assume adbd told us why it was closing the connection, and
                 // try to read failure reason from adbd.
                 syncmsg msg;
@@ -921,7 +1377,7 @@ static bool sync_stat_fallback(SyncConnection& sc, const std::string& path, stru
 }
 
 static bool sync_send(SyncConnection& sc, const std::string& lpath, const std::string& rpath,
-                      unsigned mtime, mode_t mode, bool sync, bool compressed) {
+                      unsigned mtime, mode_t mode, bool sync, CompressionType compression) {
     if (sync) {
         struct stat st;
         if (sync_lstat(sc, rpath, &st)) {
@@ -964,7 +1420,7 @@ static bool sync_send(SyncConnection& sc, const std::string& lpath, const std::s
             return false;
         }
     } else {
-        if (!sc.SendLargeFile(rpath, mode, lpath, rpath, mtime, compressed)) {
+        if (!sc.SendLargeFile(rpath, mode, lpath, rpath, mtime, compression)) {
             return false;
         }
     }
@@ -973,8 +1429,6 @@ static bool sync_send(SyncConnection& sc, const std::string& lpath, const std::s
 
 static bool sync_recv_v1(SyncConnection& sc, const char* rpath, const char* lpath, const char* name,
                          uint64_t expected_size) {
-    if (!sc.SendRequest(ID_RECV_V1, rpath)) return false;
-
     adb_unlink(lpath);
     unique_fd lfd(adb_creat(lpath, 0644));
     if (lfd < 0) {
@@ -982,6 +1436,7 @@ static bool sync_recv_v1(SyncConnection& sc, const char* rpath, const char* lpat
         return false;
     }
 
+    auto begin = std::chrono::steady_clock::now();
     uint64_t bytes_copied = 0;
     while (true) {
         syncmsg msg;
@@ -1022,14 +1477,14 @@ static bool sync_recv_v1(SyncConnection& sc, const char* rpath, const char* lpat
         sc.ReportProgress(name != nullptr ? name : rpath, bytes_copied, expected_size);
     }
 
+    sc.RecordLinkThroughput(CompressionType::None, bytes_copied,
+                            std::chrono::steady_clock::now() - begin);
     sc.RecordFilesTransferred(1);
     return true;
 }
 
 static bool sync_recv_v2(SyncConnection& sc, const char* rpath, const char* lpath, const char* name,
-                         uint64_t expected_size) {
-    if (!sc.SendRecv2(rpath)) return false;
-
+                         uint64_t expected_size, CompressionType compression) {
     adb_unlink(lpath);
     unique_fd lfd(adb_creat(lpath, 0644));
     if (lfd < 0) {
@@ -1037,10 +1492,13 @@ static bool sync_recv_v2(SyncConnection& sc, const char* rpath, const char* lpat
         return false;
     }
 
+    auto begin = std::chrono::steady_clock::now();
     uint64_t bytes_copied = 0;
+    uint64_t bytes_received = 0;
 
     Block buffer(SYNC_DATA_MAX);
-    BrotliDecoder decoder(std::span(buffer.data(), buffer.size()));
+    std::unique_ptr<Decoder> decoder =
+            MakeDecoder(compression, std::span(buffer.data(), buffer.size()));
     bool reading = true;
     while (reading) {
         syncmsg msg;
@@ -1072,13 +1530,14 @@ static bool sync_recv_v2(SyncConnection& sc, const char* rpath, const char* lpat
             adb_unlink(lpath);
             return false;
         }
-        decoder.Append(std::move(block));
+        bytes_received += msg.data.size;
+        decoder->Append(std::move(block));
 
         while (true) {
             std::span<char> output;
-            BrotliDecodeResult result = decoder.Decode(&output);
+            DecodeResult result = decoder->Decode(&output);
 
-            if (result == BrotliDecodeResult::Error) {
+            if (result == DecodeResult::Error) {
                 sc.Error("decompress failed");
                 adb_unlink(lpath);
                 return false;
@@ -1094,18 +1553,18 @@ static bool sync_recv_v2(SyncConnection& sc, const char* rpath, const char* lpat
 
             bytes_copied += output.size();
 
-            sc.RecordBytesTransferred(msg.data.size);
+            sc.RecordBytesTransferred(output.size());
             sc.ReportProgress(name != nullptr ? name : rpath, bytes_copied, expected_size);
 
-            if (result == BrotliDecodeResult::NeedInput) {
+            if (result == DecodeResult::NeedInput) {
                 break;
-            } else if (result == BrotliDecodeResult::MoreOutput) {
+            } else if (result == DecodeResult::MoreOutput) {
                 continue;
-            } else if (result == BrotliDecodeResult::Done) {
+            } else if (result == DecodeResult::Done) {
                 reading = false;
                 break;
             } else {
-                LOG(FATAL) << "invalid BrotliDecodeResult: " << static_cast<int>(result);
+                LOG(FATAL) << "invalid DecodeResult: " << static_cast<int>(result);
             }
         }
     }
@@ -1121,19 +1580,30 @@ static bool sync_recv_v2(SyncConnection& sc, const char* rpath, const char* lpat
         return false;
     }
 
+    sc.RecordLinkThroughput(compression, bytes_received, std::chrono::steady_clock::now() - begin);
     sc.RecordFilesTransferred(1);
     return true;
 }
 
-static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath, const char* name,
-                      uint64_t expected_size, bool compressed) {
-    if (sc.HaveSendRecv2() && compressed) {
-        return sync_recv_v2(sc, rpath, lpath, name, expected_size);
+// Receives the file for a recv request that was queued, and flushed, earlier, with the
+// compression that it was queued with.
+static bool sync_recv_finish(SyncConnection& sc, const char* rpath, const char* lpath,
+                             const char* name, uint64_t expected_size,
+                             CompressionType compression) {
+    if (compression != CompressionType::None) {
+        return sync_recv_v2(sc, rpath, lpath, name, expected_size, compression);
     } else {
         return sync_recv_v1(sc, rpath, lpath, name, expected_size);
     }
 }
 
+static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath, const char* name,
+                      uint64_t expected_size, CompressionType compression) {
+    compression = sc.ResolveCompression(compression, rpath);
+    return sc.QueueRecv(rpath, compression) && sc.FlushRequests() &&
+           sync_recv_finish(sc, rpath, lpath, name, expected_size, compression);
+}
+
 bool do_sync_ls(const char* path) {
     SyncConnection sc;
     if (!sc.IsValid()) return false;
@@ -1210,7 +1680,8 @@ static bool is_root_dir(std::string_view path) {
 }
 
 static bool copy_local_dir_remote(SyncConnection& sc, std::string lpath, std::string rpath,
-                                  bool check_timestamps, bool list_only, bool compressed) {
+                                  bool check_timestamps, bool list_only,
+                                  CompressionType compression) {
     sc.NewTransfer();
 
     // Make sure that both directory paths end in a slash.
@@ -1287,12 +1758,16 @@ static bool copy_local_dir_remote(SyncConnection& sc, std::string lpath, std::st
 
     sc.ComputeExpectedTotalBytes(file_list);
 
+    if (!list_only && file_list.size() > 1 && !sc.StartPipeline()) {
+        return false;
+    }
+
     for (const copyinfo& ci : file_list) {
         if (!ci.skip) {
             if (list_only) {
                 sc.Println("would push: %s -> %s", ci.lpath.c_str(), ci.rpath.c_str());
             } else {
-                if (!sync_send(sc, ci.lpath, ci.rpath, ci.time, ci.mode, false, compressed)) {
+                if (!sync_send(sc, ci.lpath, ci.rpath, ci.time, ci.mode, false, compression)) {
                     return false;
                 }
             }
@@ -1308,7 +1783,7 @@ static bool copy_local_dir_remote(SyncConnection& sc, std::string lpath, std::st
 }
 
 bool do_sync_push(const std::vector<const char*>& srcs, const char* dst, bool sync,
-                  bool compressed) {
+                  CompressionType compression) {
     SyncConnection sc;
     if (!sc.IsValid()) return false;
 
@@ -1373,7 +1848,7 @@ bool do_sync_push(const std::vector<const char*>& srcs, const char* dst, bool sy
                 dst_dir.append(android::base::Basename(src_path));
             }
 
-            success &= copy_local_dir_remote(sc, src_path, dst_dir, sync, false, compressed);
+            success &= copy_local_dir_remote(sc, src_path, dst_dir, sync, false, compression);
             continue;
         } else if (!should_push_file(st.st_mode)) {
             sc.Warning("skipping special file '%s' (mode = 0o%o)", src_path, st.st_mode);
@@ -1394,7 +1869,7 @@ bool do_sync_push(const std::vector<const char*>& srcs, const char* dst, bool sy
 
         sc.NewTransfer();
         sc.SetExpectedTotalBytes(st.st_size);
-        success &= sync_send(sc, src_path, dst_path, st.st_mtime, st.st_mode, sync, compressed);
+        success &= sync_send(sc, src_path, dst_path, st.st_mtime, st.st_mode, sync, compression);
         sc.ReportTransferRate(src_path, TransferDirection::push);
     }
 
@@ -1480,7 +1955,7 @@ static int set_time_and_mode(const std::string& lpath, time_t time,
 }
 
 static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath, std::string lpath,
-                                  bool copy_attrs, bool compressed) {
+                                  bool copy_attrs, CompressionType compression) {
     sc.NewTransfer();
 
     // Make sure that both directory paths end in a slash.
@@ -1497,6 +1972,7 @@ static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath, std::st
     sc.ComputeExpectedTotalBytes(file_list);
 
     int skipped = 0;
+    std::vector<const copyinfo*> pulls;
     for (const copyinfo &ci : file_list) {
         if (!ci.skip) {
             if (S_ISDIR(ci.mode)) {
@@ -1509,16 +1985,46 @@ static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath, std::st
                 }
                 continue;
             }
+            pulls.push_back(&ci);
+        } else {
+            skipped++;
+        }
+    }
 
-            if (!sync_recv(sc, ci.rpath.c_str(), ci.lpath.c_str(), nullptr, ci.size, compressed)) {
-                return false;
-            }
+    if (pulls.size() > 1 && !sc.StartPipeline()) {
+        return false;
+    }
 
-            if (copy_attrs && set_time_and_mode(ci.lpath, ci.time, ci.mode)) {
+    // Keep requests for the next files in flight, so that adbd doesn't wait on a round trip
+    // between files. Neither side reads while it writes, the requests or the files, so they're
+    // topped up in batches that stay well within the socket buffers.
+    constexpr size_t kMaxRequestBytes = 64 * 1024;
+    std::vector<CompressionType> compressions(pulls.size());
+    size_t requested = 0;
+    for (size_t i = 0; i < pulls.size(); ++i) {
+        if (requested - i <= sc.Window() / 2) {
+            while (requested < pulls.size() && requested - i < sc.Window() &&
+                   (requested == i || sc.QueuedRequestBytes() < kMaxRequestBytes)) {
+                const std::string& rpath = pulls[requested]->rpath;
+                compressions[requested] = sc.ResolveCompression(compression, rpath);
+                if (!sc.QueueRecv(rpath, compressions[requested])) {
+                    return false;
+                }
+                ++requested;
+            }
+            if (!sc.FlushRequests()) {
                 return false;
             }
-        } else {
-            skipped++;
+        }
+
+        const copyinfo& ci = *pulls[i];
+        if (!sync_recv_finish(sc, ci.rpath.c_str(), ci.lpath.c_str(), nullptr, ci.size,
+                              compressions[i])) {
+            return false;
+        }
+
+        if (copy_attrs && set_time_and_mode(ci.lpath, ci.time, ci.mode)) {
+            return false;
         }
     }
 
@@ -1528,7 +2034,7 @@ static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath, std::st
 }
 
 bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst, bool copy_attrs,
-                  bool compressed, const char* name) {
+                  CompressionType compression, const char* name) {
     SyncConnection sc;
     if (!sc.IsValid()) return false;
 
@@ -1602,7 +2108,7 @@ bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst, bool co
                 dst_dir.append(android::base::Basename(src_path));
             }
 
-            success &= copy_remote_dir_local(sc, src_path, dst_dir, copy_attrs, compressed);
+            success &= copy_remote_dir_local(sc, src_path, dst_dir, copy_attrs, compression);
             continue;
         } else if (!should_pull_file(src_st.st_mode)) {
             sc.Warning("skipping special file '%s' (mode = 0o%o)", src_path, src_st.st_mode);
@@ -1621,7 +2127,7 @@ bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst, bool co
 
         sc.NewTransfer();
         sc.SetExpectedTotalBytes(src_st.st_size);
-        if (!sync_recv(sc, src_path, dst_path, name, src_st.st_size, compressed)) {
+        if (!sync_recv(sc, src_path, dst_path, name, src_st.st_size, compression)) {
             success = false;
             continue;
         }
@@ -1638,11 +2144,11 @@ bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst, bool co
 }
 
 bool do_sync_sync(const std::string& lpath, const std::string& rpath, bool list_only,
-                  bool compressed) {
+                  CompressionType compression) {
     SyncConnection sc;
     if (!sc.IsValid()) return false;
 
-    bool success = copy_local_dir_remote(sc, lpath, rpath, true, list_only, compressed);
+    bool success = copy_local_dir_remote(sc, lpath, rpath, true, list_only, compression);
     if (!list_only) {
         sc.ReportOverallTransferRate(TransferDirection::push);
     }
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "incremental_block_preparer.h"
+
+namespace incremental {
+
+BlockPreparer::BlockPreparer(PrepareFunction prepare, size_t threads)
+    : prepare_(std::move(prepare)) {
+    for (size_t i = 0; i < threads; ++i) {
+        threads_.emplace_back([this]() { Run(); });
+    }
+}
+
+BlockPreparer::~BlockPreparer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+bool BlockPreparer::Schedule(int16_t fileId, int32_t blockIdx) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entries_.size() >= kMaxPreparedBlocks) {
+        return false;
+    }
+    auto [it, inserted] = entries_.try_emplace(Key(fileId, blockIdx));
+    if (inserted) {
+        queue_.push_back(it->first);
+        work_cv_.notify_one();
+    }
+    return true;
+}
+
+std::optional<PreparedBlock> BlockPreparer::Take(int16_t fileId, int32_t blockIdx) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = entries_.find(Key(fileId, blockIdx));
+    if (it == entries_.end()) {
+        return {};
+    }
+    if (it->second.state == State::Queued) {
+        entries_.erase(it);
+        return {};
+    }
+    // Entries stay put when the map rehashes, unlike iterators.
+    Entry& entry = it->second;
+    done_cv_.wait(lock, [&]() { return entry.state == State::Ready; });
+    std::optional<PreparedBlock> result = std::move(entry.block);
+    entries_.erase(Key(fileId, blockIdx));
+    return result;
+}
+
+void BlockPreparer::Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        work_cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+        if (stopping_) {
+            return;
+        }
+
+        uint64_t key = queue_.front();
+        queue_.pop_front();
+        auto it = entries_.find(key);
+        if (it == entries_.end() || it->second.state != State::Queued) {
+            // Taken before we got to it.
+            continue;
+        }
+        it->second.state = State::Preparing;
+
+        lock.unlock();
+        int16_t fileId = key >> 32;
+        int32_t blockIdx = static_cast<uint32_t>(key);
+        PreparedBlock block = prepare_(fileId, blockIdx);
+        lock.lock();
+
+        // Only Take erases an entry that's being prepared, and it waits for us first.
+        it = entries_.find(key);
+        it->second.block = std::move(block);
+        it->second.state = State::Ready;
+        done_cv_.notify_all();
+    }
+}
+
+}  // namespace incremental
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace incremental {
+
+// A data block, read and compressed if that was worth it, ready to be sent as is.
+struct PreparedBlock {
+    // A ResponseHeader followed by the block's data, or empty if the read failed.
+    std::vector<char> data;
+    bool compressed = false;
+    int error = 0;
+};
+
+// Prepares the data blocks that prefetching is about to send on a pool of threads, so that
+// compression keeps up with the connection, and keeps up to kMaxPreparedBlocks of them around
+// until they're taken. Every block that was scheduled has to be taken, even if it's not going
+// to be sent, or it keeps taking up room.
+class BlockPreparer {
+  public:
+    static constexpr size_t kMaxPreparedBlocks = 256;
+
+    using PrepareFunction = std::function<PreparedBlock(int16_t fileId, int32_t blockIdx)>;
+
+    BlockPreparer(PrepareFunction prepare, size_t threads);
+    ~BlockPreparer();
+
+    // Queues up a block to be prepared, unless it already is, or there are too many already.
+    // Returns false once there's no room for more.
+    bool Schedule(int16_t fileId, int32_t blockIdx);
+
+    // Takes a block that was scheduled, waiting for it if it's being prepared. Returns nothing if
+    // it wasn't scheduled, or no thread has gotten to it yet, in which case the caller is better
+    // off preparing it itself than waiting behind the rest of the queue.
+    std::optional<PreparedBlock> Take(int16_t fileId, int32_t blockIdx);
+
+  private:
+    enum class State { Queued, Preparing, Ready };
+    struct Entry {
+        State state = State::Queued;
+        PreparedBlock block;
+    };
+
+    static uint64_t Key(int16_t fileId, int32_t blockIdx) {
+        return (uint64_t(uint16_t(fileId)) << 32) | uint32_t(blockIdx);
+    }
+
+    void Run();
+
+    const PrepareFunction prepare_;
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    bool stopping_ = false;
+    std::deque<uint64_t> queue_;
+    std::unordered_map<uint64_t, Entry> entries_;
+
+    std::vector<std::thread> threads_;
+};
+
+}  // namespace incremental
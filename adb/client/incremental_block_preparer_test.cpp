@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "incremental_block_preparer.h"
+
+#include <gtest/gtest.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace incremental;
+
+namespace {
+
+// Prepares a block as its file id and block index, and can be made to hold on to it until
+// released, so that the tests know which state each block is in.
+class FakeBlocks {
+  public:
+    PreparedBlock Prepare(int16_t fileId, int32_t blockIdx) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ++started_;
+        cv_.notify_all();
+        cv_.wait(lock, [this]() { return !blocked_; });
+        std::string name = std::to_string(fileId) + ":" + std::to_string(blockIdx);
+        return {.data = std::vector<char>(name.begin(), name.end())};
+    }
+
+    void Block() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        blocked_ = true;
+    }
+
+    void Unblock() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        blocked_ = false;
+        cv_.notify_all();
+    }
+
+    void WaitForStarted(int count) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]() { return started_ >= count; });
+    }
+
+    int started() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return started_;
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool blocked_ = false;
+    int started_ = 0;
+};
+
+std::string Name(const std::optional<PreparedBlock>& block) {
+    return block ? std::string(block->data.begin(), block->data.end()) : "(none)";
+}
+
+}  // namespace
+
+TEST(BlockPreparer, take_prepared) {
+    FakeBlocks blocks;
+    BlockPreparer preparer([&](int16_t f, int32_t b) { return blocks.Prepare(f, b); }, 1);
+
+    blocks.Block();
+    ASSERT_TRUE(preparer.Schedule(1, 42));
+    blocks.WaitForStarted(1);
+
+    // Being prepared, so Take waits for it.
+    std::thread unblock([&]() { blocks.Unblock(); });
+    ASSERT_EQ("1:42", Name(preparer.Take(1, 42)));
+    unblock.join();
+
+    // Taken once only.
+    ASSERT_EQ("(none)", Name(preparer.Take(1, 42)));
+}
+
+TEST(BlockPreparer, take_unscheduled) {
+    FakeBlocks blocks;
+    BlockPreparer preparer([&](int16_t f, int32_t b) { return blocks.Prepare(f, b); }, 1);
+    ASSERT_EQ("(none)", Name(preparer.Take(0, 0)));
+}
+
+TEST(BlockPreparer, take_queued_drops) {
+    FakeBlocks blocks;
+    BlockPreparer preparer([&](int16_t f, int32_t b) { return blocks.Prepare(f, b); }, 1);
+
+    // The only thread is stuck on the first block, so the second stays queued.
+    blocks.Block();
+    ASSERT_TRUE(preparer.Schedule(0, 1));
+    blocks.WaitForStarted(1);
+    ASSERT_TRUE(preparer.Schedule(0, 2));
+
+    // The caller is better off preparing a queued block itself, and the thread skips it.
+    ASSERT_EQ("(none)", Name(preparer.Take(0, 2)));
+    blocks.Unblock();
+    ASSERT_EQ("0:1", Name(preparer.Take(0, 1)));
+    ASSERT_EQ(1, blocks.started());
+}
+
+TEST(BlockPreparer, bounded) {
+    FakeBlocks blocks;
+    BlockPreparer preparer([&](int16_t f, int32_t b) { return blocks.Prepare(f, b); }, 1);
+
+    blocks.Block();
+    for (size_t i = 0; i < BlockPreparer::kMaxPreparedBlocks; ++i) {
+        ASSERT_TRUE(preparer.Schedule(0, i));
+    }
+    blocks.WaitForStarted(1);
+    ASSERT_FALSE(preparer.Schedule(0, BlockPreparer::kMaxPreparedBlocks));
+
+    // Every block that's taken, sent or not, makes room for another.
+    ASSERT_EQ("(none)", Name(preparer.Take(0, 1)));
+    ASSERT_TRUE(preparer.Schedule(0, BlockPreparer::kMaxPreparedBlocks));
+    ASSERT_FALSE(preparer.Schedule(0, BlockPreparer::kMaxPreparedBlocks + 1));
+
+    blocks.Unblock();
+    for (size_t i = 0; i <= BlockPreparer::kMaxPreparedBlocks; ++i) {
+        preparer.Take(0, i);
+    }
+    for (size_t i = 0; i < BlockPreparer::kMaxPreparedBlocks; ++i) {
+        ASSERT_TRUE(preparer.Schedule(1, i));
+    }
+}
+
+TEST(BlockPreparer, destroyed_while_preparing) {
+    FakeBlocks blocks;
+    std::thread unblock;
+    {
+        BlockPreparer preparer([&](int16_t f, int32_t b) { return blocks.Prepare(f, b); }, 4);
+        blocks.Block();
+        for (int i = 0; i < 16; ++i) {
+            ASSERT_TRUE(preparer.Schedule(0, i));
+        }
+        blocks.WaitForStarted(4);
+        unblock = std::thread([&]() { blocks.Unblock(); });
+    }
+    unblock.join();
+}
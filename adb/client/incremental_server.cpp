@@ -27,9 +27,11 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
 #include <deque>
 #include <fstream>
+#include <optional>
 #include <thread>
 #include <type_traits>
 #include <unordered_set>
@@ -39,6 +41,7 @@
 #include "adb_trace.h"
 #include "adb_unique_fd.h"
 #include "adb_utils.h"
+#include "incremental_block_preparer.h"
 #include "incremental_utils.h"
 #include "sysdeps.h"
 
@@ -53,6 +56,8 @@ static constexpr int8_t kCompressionLZ4 = 1;
 static constexpr int kCompressBound = std::max(kBlockSize, LZ4_COMPRESSBOUND(kBlockSize));
 static constexpr auto kReadBufferSize = 128 * 1024;
 static constexpr int kPollTimeoutMillis = 300000;  // 5 minutes
+static constexpr size_t kMaxCompressionThreads = 4;
+static constexpr size_t kProfileSaveInterval = 64;  // misses
 
 using BlockSize = int16_t;
 using FileId = int16_t;
@@ -154,7 +159,17 @@ class File {
         : File(filepath, id, size, tree_offset) {
         this->fd_ = std::move(fd);
         this->tree_fd_ = std::move(tree_fd);
-        priority_blocks_ = PriorityBlocksForFile(filepath, fd_.get(), size);
+
+        // What the device asked for the last time comes first, then whatever else we'd guess
+        // that it needs from the layout of the file.
+        profile_blocks_ = ReadAccessProfile(filepath);
+        priority_blocks_ = profile_blocks_;
+        std::unordered_set<BlockIdx> prioritized(priority_blocks_.begin(), priority_blocks_.end());
+        for (auto block_idx : PriorityBlocksForFile(filepath, fd_.get(), size)) {
+            if (prioritized.insert(block_idx).second) {
+                priority_blocks_.push_back(block_idx);
+            }
+        }
     }
     int64_t ReadDataBlock(BlockIdx block_idx, void* buf, bool* is_zip_compressed) const {
         int64_t bytes_read = -1;
@@ -171,6 +186,31 @@ class File {
 
     const std::vector<BlockIdx>& PriorityBlocks() const { return priority_blocks_; }
 
+    // Records a block that the device had to ask for, saving the access profile every so often,
+    // so that a session that never gets to DESTROY still leaves most of it behind.
+    void RecordMiss(BlockIdx block_idx) {
+        misses_.push_back(block_idx);
+        if (misses_.size() - saved_misses_ >= kProfileSaveInterval) {
+            SaveAccessProfile();
+        }
+    }
+
+    // Adds the blocks that the device missed this time to the end of the access profile.
+    void SaveAccessProfile() {
+        if (misses_.size() == saved_misses_) {
+            return;
+        }
+        std::vector<BlockIdx> blocks = profile_blocks_;
+        std::unordered_set<BlockIdx> profiled(blocks.begin(), blocks.end());
+        for (auto block_idx : misses_) {
+            if (profiled.insert(block_idx).second) {
+                blocks.push_back(block_idx);
+            }
+        }
+        WriteAccessProfile(filepath, blocks);
+        saved_misses_ = misses_.size();
+    }
+
     std::vector<bool> sentBlocks;
     NumBlocks sentBlocksCount = 0;
 
@@ -188,15 +228,65 @@ class File {
     }
     unique_fd fd_;
     std::vector<BlockIdx> priority_blocks_;
+    std::vector<BlockIdx> profile_blocks_;
+    std::vector<BlockIdx> misses_;
+    size_t saved_misses_ = 0;
 
     unique_fd tree_fd_;
     const int64_t tree_offset_;
 };
 
+static PreparedBlock PrepareDataBlock(const File& file, FileId fileId, BlockIdx blockIdx) {
+    PreparedBlock result;
+
+    BlockBuffer raw;
+    bool isZipCompressed = false;
+    const int64_t bytesRead = file.ReadDataBlock(blockIdx, raw.data, &isZipCompressed);
+    if (bytesRead < 0) {
+        result.error = errno;
+        return result;
+    }
+
+    BlockBuffer<kCompressBound> compressed;
+    int16_t compressedSize = 0;
+    if (!isZipCompressed) {
+        compressedSize = LZ4_compress_default(raw.data, compressed.data, bytesRead, kCompressBound);
+    }
+    int16_t blockSize;
+    ResponseHeader* header;
+    if (compressedSize > 0 && compressedSize < kCompressedSizeMax) {
+        result.compressed = true;
+        blockSize = compressedSize;
+        header = &compressed.header;
+        header->compression_type = kCompressionLZ4;
+    } else {
+        blockSize = bytesRead;
+        header = &raw.header;
+        header->compression_type = kCompressionNone;
+    }
+
+    header->block_type = kTypeData;
+    header->file_id = toBigEndian(fileId);
+    header->block_size = toBigEndian(blockSize);
+    header->block_idx = toBigEndian(blockIdx);
+
+    auto begin = reinterpret_cast<const char*>(header);
+    result.data.assign(begin, begin + ResponseHeader::responseSizeFor(blockSize));
+    return result;
+}
+
 class IncrementalServer {
   public:
     IncrementalServer(unique_fd adb_fd, unique_fd output_fd, std::vector<File> files)
-        : adb_fd_(std::move(adb_fd)), output_fd_(std::move(output_fd)), files_(std::move(files)) {
+        : adb_fd_(std::move(adb_fd)),
+          output_fd_(std::move(output_fd)),
+          files_(std::move(files)),
+          preparer_(
+                  [this](FileId fileId, BlockIdx blockIdx) {
+                      return PrepareDataBlock(files_[fileId], fileId, blockIdx);
+                  },
+                  std::clamp<size_t>(std::thread::hardware_concurrency(), 1,
+                                     kMaxCompressionThreads)) {
         buffer_.reserve(kReadBufferSize);
         pendingBlocksBuffer_.resize(kChunkFlushSize + 2 * kBlockSize);
         pendingBlocks_ = pendingBlocksBuffer_.data() + sizeof(ChunkHeader);
@@ -240,6 +330,7 @@ class IncrementalServer {
     bool SendTreeBlocksForDataBlock(FileId fileId, BlockIdx blockIdx);
 
     bool SendDone();
+    void SchedulePrefetching();
     void RunPrefetching();
 
     void Send(const void* data, size_t size, bool flush);
@@ -255,6 +346,7 @@ class IncrementalServer {
     std::vector<char> buffer_;
 
     std::deque<PrefetchState> prefetches_;
+    BlockPreparer preparer_;
     int compressed_ = 0, uncompressed_ = 0;
     long long sentSize_ = 0;
 
@@ -409,6 +501,9 @@ auto IncrementalServer::SendDataBlock(FileId fileId, BlockIdx blockIdx, bool flu
         D("Skipped reading file %s at block %" PRId32 " (past end).", file.filepath, blockIdx);
         return SendResult::Skipped;
     }
+
+    // Whatever happens to the block from here on, the preparer can let go of it.
+    std::optional<PreparedBlock> block = preparer_.Take(fileId, blockIdx);
     if (file.sentBlocks[blockIdx]) {
         return SendResult::Skipped;
     }
@@ -417,42 +512,23 @@ auto IncrementalServer::SendDataBlock(FileId fileId, BlockIdx blockIdx, bool flu
         return SendResult::Error;
     }
 
-    BlockBuffer raw;
-    bool isZipCompressed = false;
-    const int64_t bytesRead = file.ReadDataBlock(blockIdx, raw.data, &isZipCompressed);
-    if (bytesRead < 0) {
+    if (!block) {
+        block = PrepareDataBlock(file, fileId, blockIdx);
+    }
+    if (block->data.empty()) {
         fprintf(stderr, "Failed to get data for %s at blockIdx=%d (%d).\n", file.filepath, blockIdx,
-                errno);
+                block->error);
         return SendResult::Error;
     }
-
-    BlockBuffer<kCompressBound> compressed;
-    int16_t compressedSize = 0;
-    if (!isZipCompressed) {
-        compressedSize = LZ4_compress_default(raw.data, compressed.data, bytesRead, kCompressBound);
-    }
-    int16_t blockSize;
-    ResponseHeader* header;
-    if (compressedSize > 0 && compressedSize < kCompressedSizeMax) {
+    if (block->compressed) {
         ++compressed_;
-        blockSize = compressedSize;
-        header = &compressed.header;
-        header->compression_type = kCompressionLZ4;
     } else {
         ++uncompressed_;
-        blockSize = bytesRead;
-        header = &raw.header;
-        header->compression_type = kCompressionNone;
     }
 
-    header->block_type = kTypeData;
-    header->file_id = toBigEndian(fileId);
-    header->block_size = toBigEndian(blockSize);
-    header->block_idx = toBigEndian(blockIdx);
-
     file.sentBlocks[blockIdx] = true;
     file.sentBlocksCount += 1;
-    Send(header, ResponseHeader::responseSizeFor(blockSize), flush);
+    Send(block->data.data(), block->data.size(), flush);
 
     return SendResult::Sent;
 }
@@ -468,9 +544,40 @@ bool IncrementalServer::SendDone() {
     return true;
 }
 
+// Hands the blocks that RunPrefetching is going to send next to the preparer, in the same order.
+void IncrementalServer::SchedulePrefetching() {
+    // Don't go looking too far past blocks that were already sent some other way.
+    size_t blocksToLookAt = 4 * BlockPreparer::kMaxPreparedBlocks;
+    auto schedule = [&](const File& file, BlockIdx blockIdx) {
+        --blocksToLookAt;
+        if (blockIdx >= static_cast<BlockIdx>(file.sentBlocks.size()) ||
+            file.sentBlocks[blockIdx]) {
+            return true;
+        }
+        return preparer_.Schedule(file.id, blockIdx);
+    };
+
+    for (const auto& prefetch : prefetches_) {
+        const auto& file = *prefetch.file;
+        const auto& priority_blocks = file.PriorityBlocks();
+        for (auto i = prefetch.priorityIndex; i < (BlockIdx)priority_blocks.size(); ++i) {
+            if (blocksToLookAt == 0 || !schedule(file, priority_blocks[i])) {
+                return;
+            }
+        }
+        for (auto i = prefetch.overallIndex; i < prefetch.overallEnd; ++i) {
+            if (blocksToLookAt == 0 || !schedule(file, i)) {
+                return;
+            }
+        }
+    }
+}
+
 void IncrementalServer::RunPrefetching() {
     constexpr auto kPrefetchBlocksPerIteration = 128;
 
+    SchedulePrefetching();
+
     int blocksToSend = kPrefetchBlocksPerIteration;
     while (!prefetches_.empty() && blocksToSend > 0) {
         auto& prefetch = prefetches_.front();
@@ -579,11 +686,17 @@ bool IncrementalServer::Serve() {
             switch (request->request_type) {
                 case DESTROY: {
                     // Stop everything.
+                    for (auto& file : files_) {
+                        file.SaveAccessProfile();
+                    }
                     return true;
                 }
                 case SERVING_COMPLETE: {
                     // Not stopping the server here.
                     ServingComplete(startTime, missesCount, missesSent);
+                    for (auto& file : files_) {
+                        file.SaveAccessProfile();
+                    }
                     break;
                 }
                 case BLOCK_MISSING: {
@@ -597,6 +710,7 @@ bool IncrementalServer::Serve() {
                                 fileId, blockIdx);
                         break;
                     }
+                    files_[fileId].RecordMiss(blockIdx);
 
                     if (VLOG_IS_ON(INCREMENTAL)) {
                         auto& file = files_[fileId];
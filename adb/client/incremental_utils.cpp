@@ -19,7 +19,10 @@
 #include "incremental_utils.h"
 
 #include <android-base/endian.h>
+#include <android-base/file.h>
 #include <android-base/mapped_file.h>
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <ziparchive/zip_archive.h>
 #include <ziparchive/zip_writer.h>
@@ -30,6 +33,7 @@
 
 #include "adb_io.h"
 #include "adb_trace.h"
+#include "adb_utils.h"
 #include "sysdeps.h"
 
 namespace incremental {
@@ -363,4 +367,73 @@ std::vector<int32_t> PriorityBlocksForFile(const std::string& filepath, borrowed
     return priorityBlocks;
 }
 
+// Profiles live in ~/.android/incremental, named after the file's name, size and modification
+// time, so that a rebuilt file doesn't get prefetched in the order of its predecessor.
+static std::string AccessProfilePath(const std::string& filepath, Size* size = nullptr) {
+    struct stat st;
+    if (stat(filepath.c_str(), &st)) {
+        return {};
+    }
+    if (size) {
+        *size = st.st_size;
+    }
+    return android::base::StringPrintf(
+            "%s%cincremental%c%s-%" PRId64 "-%" PRId64 ".profile",
+            adb_get_android_dir_path().c_str(), OS_PATH_SEPARATOR, OS_PATH_SEPARATOR,
+            android::base::Basename(filepath).c_str(), static_cast<int64_t>(st.st_size),
+            static_cast<int64_t>(st.st_mtime));
+}
+
+std::vector<int32_t> ReadAccessProfile(const std::string& filepath) {
+    Size size = 0;
+    std::string path = AccessProfilePath(filepath, &size);
+    std::string content;
+    if (path.empty() || !android::base::ReadFileToString(path, &content)) {
+        return {};
+    }
+
+    // It's only a hint, so whatever doesn't look like a block of this file is skipped.
+    const int32_t blockCount = (size + kBlockSize - 1) / kBlockSize;
+    std::vector<int32_t> blocks;
+    std::unordered_set<int32_t> seen;
+    for (const auto& line : android::base::Split(content, "\n")) {
+        int32_t block;
+        if (android::base::ParseInt(line, &block, 0, blockCount - 1) && seen.insert(block).second) {
+            blocks.push_back(block);
+        }
+    }
+    D("Loaded %d blocks of access profile from %s", int(blocks.size()), path.c_str());
+    return blocks;
+}
+
+void WriteAccessProfile(const std::string& filepath, const std::vector<int32_t>& blocks) {
+    std::string path = AccessProfilePath(filepath);
+    if (path.empty()) {
+        return;
+    }
+    adb_mkdir(android::base::Dirname(path), 0750);
+
+    std::string content;
+    for (auto block : blocks) {
+        content += std::to_string(block);
+        content += '\n';
+    }
+    // Written to the side and renamed into place, so that a reader, or a server killed half way
+    // through, never sees a partial profile.
+    std::string temp_path = path + ".tmp";
+    if (!android::base::WriteStringToFile(content, temp_path)) {
+        D("Failed to write access profile %s: %s", temp_path.c_str(), strerror(errno));
+        adb_unlink(temp_path.c_str());
+        return;
+    }
+    if (adb_rename(temp_path.c_str(), path.c_str()) != 0) {
+        // Windows won't rename over an existing file.
+        adb_unlink(path.c_str());
+        if (adb_rename(temp_path.c_str(), path.c_str()) != 0) {
+            D("Failed to rename access profile %s: %s", path.c_str(), strerror(errno));
+            adb_unlink(temp_path.c_str());
+        }
+    }
+}
+
 }  // namespace incremental
@@ -39,6 +39,11 @@ constexpr std::string_view IDSIG = ".idsig";
 std::vector<int32_t> PriorityBlocksForFile(const std::string& filepath, borrowed_fd fd,
                                            Size fileSize);
 
+// Page-access profiles are the blocks of a file that the device asked for while it was last
+// served, in the order in which it asked, so that they can be prefetched first the next time.
+std::vector<int32_t> ReadAccessProfile(const std::string& filepath);
+void WriteAccessProfile(const std::string& filepath, const std::vector<int32_t>& blocks);
+
 Size verity_tree_blocks_for_file(Size fileSize);
 Size verity_tree_size_for_file(Size fileSize);
 
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "incremental_utils.h"
+
+#include <dirent.h>
+#include <stdlib.h>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+using namespace incremental;
+
+namespace {
+
+// Points $HOME, and so the profile directory, at a temporary directory, next to a 10-block file
+// to profile.
+class AccessProfileTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        if (const char* home = getenv("HOME")) {
+            old_home_ = home;
+        }
+        setenv("HOME", home_.path, 1);
+        file_ = std::string(home_.path) + "/test.apk";
+        ASSERT_TRUE(android::base::WriteStringToFile(std::string(10 * kBlockSize - 1, 'x'),
+                                                     file_));
+    }
+
+    void TearDown() override {
+        if (old_home_) {
+            setenv("HOME", old_home_->c_str(), 1);
+        } else {
+            unsetenv("HOME");
+        }
+    }
+
+    // The names of the files in the profile directory.
+    std::vector<std::string> ProfileFiles() {
+        std::vector<std::string> names;
+        std::string dir = std::string(home_.path) + "/.android/incremental";
+        if (DIR* d = opendir(dir.c_str())) {
+            while (dirent* entry = readdir(d)) {
+                if (entry->d_name[0] != '.') {
+                    names.push_back(dir + "/" + entry->d_name);
+                }
+            }
+            closedir(d);
+        }
+        return names;
+    }
+
+    TemporaryDir home_;
+    std::optional<std::string> old_home_;
+    std::string file_;
+};
+
+}  // namespace
+
+TEST_F(AccessProfileTest, missing) {
+    ASSERT_TRUE(ReadAccessProfile(file_).empty());
+    ASSERT_TRUE(ReadAccessProfile(file_ + ".missing").empty());
+}
+
+TEST_F(AccessProfileTest, round_trip) {
+    WriteAccessProfile(file_, {7, 0, 3, 9});
+    ASSERT_EQ((std::vector<int32_t>{7, 0, 3, 9}), ReadAccessProfile(file_));
+
+    // Rewritten in place, without leaving anything else behind.
+    WriteAccessProfile(file_, {7, 0, 3, 9, 1});
+    ASSERT_EQ((std::vector<int32_t>{7, 0, 3, 9, 1}), ReadAccessProfile(file_));
+    ASSERT_EQ(1u, ProfileFiles().size());
+}
+
+TEST_F(AccessProfileTest, changed_file) {
+    WriteAccessProfile(file_, {1, 2});
+    ASSERT_TRUE(android::base::WriteStringToFile(std::string(kBlockSize, 'y'), file_));
+    ASSERT_TRUE(ReadAccessProfile(file_).empty());
+}
+
+TEST_F(AccessProfileTest, corrupt) {
+    WriteAccessProfile(file_, {1, 2});
+    auto files = ProfileFiles();
+    ASSERT_EQ(1u, files.size());
+
+    // Only in-range blocks are kept, once each, in order.
+    ASSERT_TRUE(android::base::WriteStringToFile(
+            "3\ngarbage\n-1\n10\n3\n0x4\n\n99999999999999\n9\n5 6\n\xff\xfe", files[0]));
+    ASSERT_EQ((std::vector<int32_t>{3, 4, 9}), ReadAccessProfile(file_));
+
+    ASSERT_TRUE(android::base::WriteStringToFile("", files[0]));
+    ASSERT_TRUE(ReadAccessProfile(file_).empty());
+}
@@ -28,6 +28,7 @@
 #include <android-base/errors.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/stringprintf.h>
 
 #include "adb.h"
@@ -117,6 +118,21 @@ int adb_server_main(int is_daemon, const std::string& socket_spec, int ack_reply
 
     atexit(adb_server_cleanup);
 
+    // $ADB_EVENT_LOOPS spreads the transports, and all of the socket traffic for them, across that
+    // many event loop threads, so that a single server can keep up with a lot of devices. The main
+    // thread keeps the server-level services: the smart socket, host services, and transport
+    // registration. Off by default.
+    size_t event_loops = 0;
+    if (const char* loops = getenv("ADB_EVENT_LOOPS")) {
+        if (!android::base::ParseUint(loops, &event_loops, size_t{64})) {
+            LOG(ERROR) << "ignoring invalid $ADB_EVENT_LOOPS: " << loops;
+            event_loops = 0;
+        }
+    }
+    if (event_loops > 0) {
+        fdevent_start_shard_loops(event_loops);
+    }
+
     init_transport_registration();
     init_reconnect_handler();
 
@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <span>
+
+#include <android-base/logging.h>
+
+#include <brotli/decode.h>
+#include <brotli/encode.h>
+#include <lz4frame.h>
+#include <zstd.h>
+
+#include "file_sync_protocol.h"
+#include "types.h"
+
+enum class DecodeResult {
+    Error,
+    Done,
+    NeedInput,
+    MoreOutput,
+};
+
+// Decodes a stream appended a block at a time. Decode writes into the output buffer given at
+// construction, so each output span is only valid until the next call.
+struct Decoder {
+    virtual ~Decoder() = default;
+
+    void Append(Block&& block) { input_buffer_.append(std::move(block)); }
+
+    virtual DecodeResult Decode(std::span<char>* output) = 0;
+
+  protected:
+    explicit Decoder(std::span<char> output_buffer) : output_buffer_(output_buffer) {}
+
+    IOVector input_buffer_;
+    std::span<char> output_buffer_;
+};
+
+enum class EncodeResult {
+    Error,
+    Done,
+    NeedInput,
+    MoreOutput,
+};
+
+// Encodes a stream appended a block at a time, into blocks of at most output_block_size bytes.
+struct Encoder {
+    virtual ~Encoder() = default;
+
+    void Append(Block input) { input_buffer_.append(std::move(input)); }
+    void Finish() { finished_ = true; }
+
+    virtual EncodeResult Encode(Block* output) = 0;
+
+  protected:
+    explicit Encoder(size_t output_block_size) : output_block_size_(output_block_size) {}
+
+    const size_t output_block_size_;
+    bool finished_ = false;
+    IOVector input_buffer_;
+};
+
+struct BrotliDecoder final : public Decoder {
+    explicit BrotliDecoder(std::span<char> output_buffer)
+        : Decoder(output_buffer),
+          decoder_(BrotliDecoderCreateInstance(nullptr, nullptr, nullptr),
+                   BrotliDecoderDestroyInstance) {}
+
+    DecodeResult Decode(std::span<char>* output) final {
+        size_t available_in = input_buffer_.front_size();
+        const uint8_t* next_in = reinterpret_cast<const uint8_t*>(input_buffer_.front_data());
+
+        size_t available_out = output_buffer_.size();
+        uint8_t* next_out = reinterpret_cast<uint8_t*>(output_buffer_.data());
+
+        BrotliDecoderResult r = BrotliDecoderDecompressStream(
+                decoder_.get(), &available_in, &next_in, &available_out, &next_out, nullptr);
+
+        size_t bytes_consumed = input_buffer_.front_size() - available_in;
+        input_buffer_.drop_front(bytes_consumed);
+
+        size_t bytes_emitted = output_buffer_.size() - available_out;
+        *output = std::span<char>(output_buffer_.data(), bytes_emitted);
+
+        switch (r) {
+            case BROTLI_DECODER_RESULT_SUCCESS:
+                return DecodeResult::Done;
+            case BROTLI_DECODER_RESULT_ERROR:
+                return DecodeResult::Error;
+            case BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT:
+                // Brotli guarantees as one of its invariants that if it returns NEEDS_MORE_INPUT,
+                // it will consume the entire input buffer passed in, so we don't have to worry
+                // about bytes left over in the front block with more input remaining.
+                return input_buffer_.empty() ? DecodeResult::NeedInput : DecodeResult::MoreOutput;
+            case BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT:
+                return DecodeResult::MoreOutput;
+        }
+    }
+
+  private:
+    std::unique_ptr<BrotliDecoderState, void (*)(BrotliDecoderState*)> decoder_;
+};
+
+struct BrotliEncoder final : public Encoder {
+    explicit BrotliEncoder(size_t output_block_size)
+        : Encoder(output_block_size),
+          output_block_(output_block_size),
+          output_bytes_left_(output_block_size),
+          encoder_(BrotliEncoderCreateInstance(nullptr, nullptr, nullptr),
+                   BrotliEncoderDestroyInstance) {
+        BrotliEncoderSetParameter(encoder_.get(), BROTLI_PARAM_QUALITY, 1);
+    }
+
+    EncodeResult Encode(Block* output) final {
+        output->clear();
+        while (true) {
+            size_t available_in = input_buffer_.front_size();
+            const uint8_t* next_in = reinterpret_cast<const uint8_t*>(input_buffer_.front_data());
+
+            size_t available_out = output_bytes_left_;
+            uint8_t* next_out = reinterpret_cast<uint8_t*>(
+                    output_block_.data() + (output_block_size_ - output_bytes_left_));
+
+            // Only finish with the last of the input.
+            BrotliEncoderOperation op = BROTLI_OPERATION_PROCESS;
+            if (finished_ && available_in == input_buffer_.size()) {
+                op = BROTLI_OPERATION_FINISH;
+            }
+
+            if (!BrotliEncoderCompressStream(encoder_.get(), op, &available_in, &next_in,
+                                             &available_out, &next_out, nullptr)) {
+                return EncodeResult::Error;
+            }
+
+            size_t bytes_consumed = input_buffer_.front_size() - available_in;
+            input_buffer_.drop_front(bytes_consumed);
+
+            output_bytes_left_ = available_out;
+
+            if (BrotliEncoderIsFinished(encoder_.get())) {
+                output_block_.resize(output_block_size_ - output_bytes_left_);
+                *output = std::move(output_block_);
+                return EncodeResult::Done;
+            } else if (output_bytes_left_ == 0) {
+                *output = std::move(output_block_);
+                output_block_.resize(output_block_size_);
+                output_bytes_left_ = output_block_size_;
+                return EncodeResult::MoreOutput;
+            } else if (input_buffer_.empty() && !finished_) {
+                return EncodeResult::NeedInput;
+            }
+        }
+    }
+
+  private:
+    Block output_block_;
+    size_t output_bytes_left_;
+    std::unique_ptr<BrotliEncoderState, void (*)(BrotliEncoderState*)> encoder_;
+};
+
+struct LZ4Decoder final : public Decoder {
+    explicit LZ4Decoder(std::span<char> output_buffer)
+        : Decoder(output_buffer), decoder_(nullptr, nullptr) {
+        LZ4F_dctx* dctx;
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) {
+            LOG(FATAL) << "failed to create LZ4 decompression context";
+        }
+        decoder_ = std::unique_ptr<LZ4F_dctx, decltype(&LZ4F_freeDecompressionContext)>(
+                dctx, LZ4F_freeDecompressionContext);
+    }
+
+    DecodeResult Decode(std::span<char>* output) final {
+        size_t available_in = input_buffer_.front_size();
+        size_t available_out = output_buffer_.size();
+
+        // On return, available_in and available_out are how much was consumed and emitted.
+        size_t rc = LZ4F_decompress(decoder_.get(), output_buffer_.data(), &available_out,
+                                    input_buffer_.front_data(), &available_in, nullptr);
+        if (LZ4F_isError(rc)) {
+            LOG(ERROR) << "LZ4F_decompress failed: " << LZ4F_getErrorName(rc);
+            return DecodeResult::Error;
+        }
+
+        input_buffer_.drop_front(available_in);
+        *output = std::span<char>(output_buffer_.data(), available_out);
+
+        if (rc == 0) {
+            // The frame is complete and flushed.
+            return DecodeResult::Done;
+        } else if (input_buffer_.empty() && available_out < output_buffer_.size()) {
+            return DecodeResult::NeedInput;
+        }
+        return DecodeResult::MoreOutput;
+    }
+
+  private:
+    std::unique_ptr<LZ4F_dctx, decltype(&LZ4F_freeDecompressionContext)> decoder_;
+};
+
+struct LZ4Encoder final : public Encoder {
+    explicit LZ4Encoder(size_t output_block_size)
+        : Encoder(output_block_size), encoder_(nullptr, nullptr) {
+        LZ4F_cctx* cctx;
+        if (LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION))) {
+            LOG(FATAL) << "failed to create LZ4 compression context";
+        }
+        encoder_ = std::unique_ptr<LZ4F_cctx, decltype(&LZ4F_freeCompressionContext)>(
+                cctx, LZ4F_freeCompressionContext);
+
+        Block header(LZ4F_HEADER_SIZE_MAX);
+        size_t rc = LZ4F_compressBegin(encoder_.get(), header.data(), header.size(), nullptr);
+        if (LZ4F_isError(rc)) {
+            LOG(FATAL) << "LZ4F_compressBegin failed: " << LZ4F_getErrorName(rc);
+        }
+        header.resize(rc);
+        output_buffer_.append(std::move(header));
+    }
+
+    EncodeResult Encode(Block* output) final {
+        // LZ4F needs an output buffer of LZ4F_compressBound bytes for each update, which is more
+        // than the input, so compress an LZ4 block at a time into a buffer of our own, and hand
+        // that out in output blocks. Incompressible blocks are stored as they are by LZ4F.
+        constexpr size_t kMaxInputSize = 64 * 1024;
+        const size_t encode_block_size = LZ4F_compressBound(kMaxInputSize, nullptr);
+
+        while (!input_buffer_.empty() && output_buffer_.size() < output_block_size_) {
+            size_t available_in = std::min(input_buffer_.front_size(), kMaxInputSize);
+
+            Block encode_block(encode_block_size);
+            size_t rc = LZ4F_compressUpdate(encoder_.get(), encode_block.data(),
+                                            encode_block.size(), input_buffer_.front_data(),
+                                            available_in, nullptr);
+            if (LZ4F_isError(rc)) {
+                LOG(ERROR) << "LZ4F_compressUpdate failed: " << LZ4F_getErrorName(rc);
+                return EncodeResult::Error;
+            }
+            input_buffer_.drop_front(available_in);
+
+            if (rc != 0) {
+                encode_block.resize(rc);
+                output_buffer_.append(std::move(encode_block));
+            }
+        }
+
+        if (finished_ && input_buffer_.empty() && !lz4_finished_) {
+            Block final_block(encode_block_size);
+            size_t rc = LZ4F_compressEnd(encoder_.get(), final_block.data(), final_block.size(),
+                                         nullptr);
+            if (LZ4F_isError(rc)) {
+                LOG(ERROR) << "LZ4F_compressEnd failed: " << LZ4F_getErrorName(rc);
+                return EncodeResult::Error;
+            }
+            final_block.resize(rc);
+            output_buffer_.append(std::move(final_block));
+            lz4_finished_ = true;
+        }
+
+        // Only hand out full output blocks, but for the last one.
+        output->clear();
+        if (output_buffer_.size() >= output_block_size_ || lz4_finished_) {
+            size_t length = std::min(output_block_size_, output_buffer_.size());
+            *output = output_buffer_.take_front(length).coalesce();
+        }
+
+        if (lz4_finished_ && output_buffer_.empty()) {
+            return EncodeResult::Done;
+        } else if (output_buffer_.size() >= output_block_size_ || lz4_finished_ ||
+                   !input_buffer_.empty() || finished_) {
+            return EncodeResult::MoreOutput;
+        }
+        return EncodeResult::NeedInput;
+    }
+
+  private:
+    IOVector output_buffer_;
+    bool lz4_finished_ = false;
+    std::unique_ptr<LZ4F_cctx, decltype(&LZ4F_freeCompressionContext)> encoder_;
+};
+
+struct ZstdDecoder final : public Decoder {
+    explicit ZstdDecoder(std::span<char> output_buffer)
+        : Decoder(output_buffer), decoder_(ZSTD_createDStream(), ZSTD_freeDStream) {
+        if (!decoder_) {
+            LOG(FATAL) << "failed to create Zstd decompression context";
+        }
+    }
+
+    DecodeResult Decode(std::span<char>* output) final {
+        ZSTD_inBuffer in = {input_buffer_.front_data(), input_buffer_.front_size(), 0};
+        ZSTD_outBuffer out = {output_buffer_.data(), output_buffer_.size(), 0};
+
+        size_t rc = ZSTD_decompressStream(decoder_.get(), &out, &in);
+        if (ZSTD_isError(rc)) {
+            LOG(ERROR) << "ZSTD_decompressStream failed: " << ZSTD_getErrorName(rc);
+            return DecodeResult::Error;
+        }
+
+        input_buffer_.drop_front(in.pos);
+        *output = std::span<char>(output_buffer_.data(), out.pos);
+
+        if (rc == 0) {
+            // The frame is complete and flushed.
+            return DecodeResult::Done;
+        } else if (input_buffer_.empty() && out.pos < out.size) {
+            return DecodeResult::NeedInput;
+        }
+        return DecodeResult::MoreOutput;
+    }
+
+  private:
+    std::unique_ptr<ZSTD_DStream, decltype(&ZSTD_freeDStream)> decoder_;
+};
+
+struct ZstdEncoder final : public Encoder {
+    ZstdEncoder(size_t output_block_size, int level)
+        : Encoder(output_block_size),
+          output_block_(output_block_size),
+          output_bytes_left_(output_block_size),
+          encoder_(ZSTD_createCStream(), ZSTD_freeCStream) {
+        if (!encoder_) {
+            LOG(FATAL) << "failed to create Zstd compression context";
+        }
+        ZSTD_CCtx_setParameter(encoder_.get(), ZSTD_c_compressionLevel, level);
+    }
+
+    EncodeResult Encode(Block* output) final {
+        output->clear();
+        while (true) {
+            ZSTD_inBuffer in = {input_buffer_.front_data(), input_buffer_.front_size(), 0};
+            ZSTD_outBuffer out = {output_block_.data() + (output_block_size_ - output_bytes_left_),
+                                  output_bytes_left_, 0};
+
+            // Only end the frame with the last of the input.
+            ZSTD_EndDirective op = ZSTD_e_continue;
+            if (finished_ && in.size == input_buffer_.size()) {
+                op = ZSTD_e_end;
+            }
+
+            size_t rc = ZSTD_compressStream2(encoder_.get(), &out, &in, op);
+            if (ZSTD_isError(rc)) {
+                LOG(ERROR) << "ZSTD_compressStream2 failed: " << ZSTD_getErrorName(rc);
+                return EncodeResult::Error;
+            }
+
+            input_buffer_.drop_front(in.pos);
+            output_bytes_left_ -= out.pos;
+
+            if (op == ZSTD_e_end && rc == 0) {
+                output_block_.resize(output_block_size_ - output_bytes_left_);
+                *output = std::move(output_block_);
+                return EncodeResult::Done;
+            } else if (output_bytes_left_ == 0) {
+                *output = std::move(output_block_);
+                output_block_.resize(output_block_size_);
+                output_bytes_left_ = output_block_size_;
+                return EncodeResult::MoreOutput;
+            } else if (input_buffer_.empty() && !finished_) {
+                return EncodeResult::NeedInput;
+            }
+        }
+    }
+
+  private:
+    Block output_block_;
+    size_t output_bytes_left_;
+    std::unique_ptr<ZSTD_CStream, decltype(&ZSTD_freeCStream)> encoder_;
+};
+
+// The Zstd level adbd compresses at, since it's the device's CPU that pays for it.
+constexpr int kDefaultDeviceZstdLevel = 1;
+
+inline std::unique_ptr<Decoder> MakeDecoder(CompressionType type, std::span<char> output_buffer) {
+    switch (type) {
+        case CompressionType::Brotli:
+            return std::make_unique<BrotliDecoder>(output_buffer);
+        case CompressionType::LZ4:
+            return std::make_unique<LZ4Decoder>(output_buffer);
+        case CompressionType::Zstd:
+            return std::make_unique<ZstdDecoder>(output_buffer);
+        case CompressionType::None:
+        case CompressionType::Any:
+            break;
+    }
+    LOG(FATAL) << "no decoder for compression type " << static_cast<int>(type);
+    return nullptr;
+}
+
+inline std::unique_ptr<Encoder> MakeEncoder(CompressionType type, size_t output_block_size,
+                                            int zstd_level) {
+    switch (type) {
+        case CompressionType::Brotli:
+            return std::make_unique<BrotliEncoder>(output_block_size);
+        case CompressionType::LZ4:
+            return std::make_unique<LZ4Encoder>(output_block_size);
+        case CompressionType::Zstd:
+            return std::make_unique<ZstdEncoder>(output_block_size, zstd_level);
+        case CompressionType::None:
+        case CompressionType::Any:
+            break;
+    }
+    LOG(FATAL) << "no encoder for compression type " << static_cast<int>(type);
+    return nullptr;
+}
+
+// The sync flag for a concrete compression type, and back.
+inline uint32_t CompressionTypeToSyncFlag(CompressionType type) {
+    switch (type) {
+        case CompressionType::Brotli:
+            return kSyncFlagBrotli;
+        case CompressionType::LZ4:
+            return kSyncFlagLZ4;
+        case CompressionType::Zstd:
+            return kSyncFlagZstd;
+        case CompressionType::None:
+        case CompressionType::Any:
+            break;
+    }
+    return kSyncFlagNone;
+}
+
+// Compresses a chunk of at most SYNC_DATA_MAX bytes as a stream of its own, the way that the
+// chunks of a send with kSyncFlagDedup are. Fails if that doesn't make the chunk any smaller.
+inline bool CompressChunk(CompressionType type, int zstd_level, const char* data, size_t size,
+                          Block* output) {
+    std::unique_ptr<Encoder> encoder = MakeEncoder(type, SYNC_DATA_MAX, zstd_level);
+    encoder->Append(Block(data, data + size));
+    encoder->Finish();
+
+    IOVector result;
+    while (true) {
+        Block block;
+        EncodeResult r = encoder->Encode(&block);
+        if (r == EncodeResult::Error || r == EncodeResult::NeedInput) return false;
+        if (!block.empty()) {
+            result.append(std::move(block));
+            if (result.size() >= size) return false;
+        }
+        if (r == EncodeResult::Done) break;
+    }
+    *output = std::move(result).coalesce();
+    return true;
+}
+
+// Decompresses a chunk compressed by CompressChunk into exactly size bytes at output.
+inline bool DecompressChunk(CompressionType type, Block&& input, char* output, size_t size) {
+    Block buffer(SYNC_DATA_MAX);
+    std::unique_ptr<Decoder> decoder = MakeDecoder(type, std::span(buffer.data(), buffer.size()));
+    decoder->Append(std::move(input));
+
+    size_t offset = 0;
+    while (true) {
+        std::span<char> decoded;
+        DecodeResult r = decoder->Decode(&decoded);
+        if (r == DecodeResult::Error || decoded.size() > size - offset) return false;
+        memcpy(output + offset, decoded.data(), decoded.size());
+        offset += decoded.size();
+        if (r == DecodeResult::Done) return offset == size;
+        if (r == DecodeResult::NeedInput) return false;
+    }
+}
+
+// Takes the compression flag out of flags. Fails if there's more than one.
+inline bool TakeCompressionSyncFlag(uint32_t* flags, CompressionType* type) {
+    *type = CompressionType::None;
+    for (CompressionType candidate :
+         {CompressionType::Brotli, CompressionType::LZ4, CompressionType::Zstd}) {
+        uint32_t flag = CompressionTypeToSyncFlag(candidate);
+        if (*flags & flag) {
+            if (*type != CompressionType::None) return false;
+            *flags &= ~flag;
+            *type = candidate;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "compression_utils.h"
+#include "file_sync_protocol.h"
+
+static std::vector<char> compressible_data(size_t len) {
+    std::vector<char> data;
+    while (data.size() < len) {
+        std::string line = "line " + std::to_string(data.size() % 1000) + "\n";
+        data.insert(data.end(), line.begin(), line.end());
+    }
+    data.resize(len);
+    return data;
+}
+
+static std::vector<char> random_data(size_t len) {
+    std::mt19937 rng(42);
+    std::vector<char> data(len);
+    for (char& c : data) {
+        c = static_cast<char>(rng());
+    }
+    return data;
+}
+
+// Compresses input the way the sync client does, a SYNC_DATA_MAX block at a time.
+static std::vector<Block> encode(CompressionType type, const std::vector<char>& input) {
+    std::vector<Block> blocks;
+    std::unique_ptr<Encoder> encoder = MakeEncoder(type, SYNC_DATA_MAX, kDefaultDeviceZstdLevel);
+    size_t offset = 0;
+    while (true) {
+        size_t len = std::min<size_t>(SYNC_DATA_MAX, input.size() - offset);
+        if (len == 0) {
+            encoder->Finish();
+        } else {
+            encoder->Append(Block(input.begin() + offset, input.begin() + offset + len));
+            offset += len;
+        }
+
+        while (true) {
+            Block output;
+            EncodeResult result = encoder->Encode(&output);
+            EXPECT_NE(EncodeResult::Error, result);
+            if (result == EncodeResult::Error) return {};
+            EXPECT_LE(output.size(), SYNC_DATA_MAX);
+            if (!output.empty()) {
+                blocks.push_back(std::move(output));
+            }
+            if (result == EncodeResult::Done) {
+                return blocks;
+            } else if (result == EncodeResult::NeedInput) {
+                break;
+            }
+        }
+    }
+}
+
+static std::vector<char> decode(CompressionType type, std::vector<Block> blocks) {
+    std::vector<char> result;
+    std::vector<char> buffer(SYNC_DATA_MAX);
+    std::unique_ptr<Decoder> decoder = MakeDecoder(type, std::span(buffer.data(), buffer.size()));
+    for (Block& block : blocks) {
+        decoder->Append(std::move(block));
+        while (true) {
+            std::span<char> output;
+            DecodeResult r = decoder->Decode(&output);
+            EXPECT_NE(DecodeResult::Error, r);
+            result.insert(result.end(), output.begin(), output.end());
+            if (r == DecodeResult::Error || r == DecodeResult::Done) {
+                return result;
+            } else if (r == DecodeResult::NeedInput) {
+                break;
+            }
+        }
+    }
+    ADD_FAILURE() << "stream ended without DecodeResult::Done";
+    return result;
+}
+
+static void check_round_trip(CompressionType type, const std::vector<char>& input) {
+    std::vector<Block> blocks = encode(type, input);
+    ASSERT_FALSE(blocks.empty());
+    ASSERT_EQ(input, decode(type, std::move(blocks)));
+}
+
+static void check_all_sizes(CompressionType type) {
+    for (size_t len : {0, 1, 1000, SYNC_DATA_MAX, SYNC_DATA_MAX + 1, 1024 * 1024 + 7}) {
+        SCOPED_TRACE(len);
+        check_round_trip(type, compressible_data(len));
+        check_round_trip(type, random_data(len));
+    }
+}
+
+TEST(compression_utils, brotli) {
+    check_all_sizes(CompressionType::Brotli);
+}
+
+TEST(compression_utils, lz4) {
+    check_all_sizes(CompressionType::LZ4);
+}
+
+TEST(compression_utils, zstd) {
+    check_all_sizes(CompressionType::Zstd);
+}
+
+TEST(compression_utils, compressible_shrinks) {
+    std::vector<char> input = compressible_data(1024 * 1024);
+    for (CompressionType type :
+         {CompressionType::Brotli, CompressionType::LZ4, CompressionType::Zstd}) {
+        size_t compressed_size = 0;
+        for (const Block& block : encode(type, input)) {
+            compressed_size += block.size();
+        }
+        ASSERT_LT(compressed_size, input.size() / 4);
+    }
+}
+
+TEST(compression_utils, sync_flags) {
+    uint32_t flags = kSyncFlagLZ4;
+    CompressionType type = CompressionType::None;
+    ASSERT_TRUE(TakeCompressionSyncFlag(&flags, &type));
+    ASSERT_EQ(CompressionType::LZ4, type);
+    ASSERT_EQ(0U, flags);
+
+    flags = 0;
+    ASSERT_TRUE(TakeCompressionSyncFlag(&flags, &type));
+    ASSERT_EQ(CompressionType::None, type);
+
+    flags = kSyncFlagBrotli | kSyncFlagZstd;
+    ASSERT_FALSE(TakeCompressionSyncFlag(&flags, &type));
+
+    ASSERT_EQ(kSyncFlagZstd, CompressionTypeToSyncFlag(CompressionType::Zstd));
+}
+
+TEST(compression_utils, chunks) {
+    for (CompressionType type :
+         {CompressionType::Brotli, CompressionType::LZ4, CompressionType::Zstd}) {
+        SCOPED_TRACE(static_cast<int>(type));
+        for (size_t len : {1000, SYNC_DATA_MAX}) {
+            std::vector<char> input = compressible_data(len);
+            Block compressed;
+            ASSERT_TRUE(CompressChunk(type, kDefaultDeviceZstdLevel, input.data(), input.size(),
+                                      &compressed));
+            ASSERT_LT(compressed.size(), input.size());
+
+            std::vector<char> output(len);
+            ASSERT_TRUE(DecompressChunk(type, std::move(compressed), output.data(), len));
+            ASSERT_EQ(input, output);
+
+            // The size has to be right, too.
+            ASSERT_TRUE(CompressChunk(type, kDefaultDeviceZstdLevel, input.data(), input.size(),
+                                      &compressed));
+            ASSERT_FALSE(DecompressChunk(type, std::move(compressed), output.data(), len - 1));
+        }
+
+        // Compressing random data doesn't pay, so it's sent as it is.
+        std::vector<char> input = random_data(SYNC_DATA_MAX);
+        Block compressed;
+        ASSERT_FALSE(CompressChunk(type, kDefaultDeviceZstdLevel, input.data(), input.size(),
+                                   &compressed));
+    }
+}
@@ -22,6 +22,8 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,18 +33,27 @@
 #include <unistd.h>
 #include <utime.h>
 
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <set>
 #include <span>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
 #include <android-base/macros.h>
+#include <android-base/properties.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 
 #include <adbd_fs.h>
+#include <openssl/sha.h>
 
 // Needed for __android_log_security_bswrite.
 #include <private/android_logger.h>
@@ -57,7 +68,7 @@
 #include "adb_io.h"
 #include "adb_trace.h"
 #include "adb_utils.h"
-#include "brotli_utils.h"
+#include "compression_utils.h"
 #include "file_sync_protocol.h"
 #include "security_log_tags.h"
 #include "sysdeps/errno.h"
@@ -266,10 +277,202 @@ static bool SendSyncFailErrno(borrowed_fd fd, const std::string& reason) {
     return SendSyncFail(fd, StringPrintf("%s: %s", reason.c_str(), strerror(errno)));
 }
 
-static bool handle_send_file_compressed(borrowed_fd s, unique_fd fd, uint32_t* timestamp) {
+// A connection in pipelined mode, see PIPE in SYNC.TXT. Sends whose data all came in a single DATA
+// message are written out by a pool of threads, so that the open, chown, restorecon and close of
+// many small files overlap, and each send is acknowledged with its number once it's done.
+//
+// The client only reads statuses once it has a window's worth of sends in flight, so they're
+// queued and written out by a thread of their own: nothing that reads from the socket ever waits
+// for the socket to take a status.
+class SyncPipeline {
+  public:
+    // How many sends the client may have in flight.
+    static constexpr uint32_t kWindow = 256;
+
+    // A send read ahead in full, for the pool.
+    struct Send {
+        uint32_t transfer;
+        std::string path;
+        uid_t uid;
+        gid_t gid;
+        uint64_t capabilities;
+        mode_t mode;
+        bool do_unlink;
+        uint32_t timestamp;
+        Block data;
+    };
+
+    explicit SyncPipeline(borrowed_fd fd);
+    // Waits for all the sends.
+    ~SyncPipeline();
+
+    uint32_t NextTransfer() { return next_transfer_++; }
+
+    // Queues send for the pool, waiting while the queue is full.
+    void Submit(Send send);
+    // Waits until no send to path is queued or running.
+    void WaitFor(const std::string& path);
+    // Waits until no send is queued or running and all statuses are written, after which only the
+    // caller writes to the socket.
+    void Wait();
+
+    // Queues a status for the socket.
+    bool SendStatus(uint32_t id, uint32_t transfer, const std::string& message);
+
+  private:
+    static constexpr size_t kThreads = 4;
+    static constexpr size_t kMaxQueued = 2 * kThreads;
+
+    void Run();
+    void WriteStatuses();
+
+    borrowed_fd fd_;
+    uint32_t next_transfer_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Send> queue_;
+    std::set<std::string> paths_;  // of the sends queued or running
+    std::string statuses_;         // not written yet
+    bool writing_ = false;
+    bool quit_ = false;
+    std::vector<std::thread> threads_;
+    std::thread writer_;
+};
+
+// Reports how a send went. That's an OKAY or a FAIL, after which adbd closes the connection, or in
+// pipelined mode a sync_pipe_status tagged with the send's number.
+class SendReporter {
+  public:
+    explicit SendReporter(borrowed_fd fd) : fd_(fd) {}
+    SendReporter(borrowed_fd fd, SyncPipeline* pipeline, uint32_t transfer)
+        : fd_(fd), pipeline_(pipeline), transfer_(transfer) {}
+
+    SyncPipeline* pipeline() const { return pipeline_; }
+    uint32_t transfer() const { return transfer_; }
+
+    bool Okay() {
+        if (pipeline_) return pipeline_->SendStatus(ID_OKAY, transfer_, "");
+
+        syncmsg msg;
+        msg.status.id = ID_OKAY;
+        msg.status.msglen = 0;
+        return WriteFdExactly(fd_, &msg.status, sizeof(msg.status));
+    }
+
+    bool Fail(const std::string& reason) {
+        if (pipeline_) {
+            D("sync: transfer %u failure: %s", transfer_, reason.c_str());
+            return pipeline_->SendStatus(ID_FAIL, transfer_, reason);
+        }
+        return SendSyncFail(fd_, reason);
+    }
+
+    bool FailErrno(const std::string& reason) {
+        return Fail(StringPrintf("%s: %s", reason.c_str(), strerror(errno)));
+    }
+
+  private:
+    borrowed_fd fd_;
+    SyncPipeline* pipeline_ = nullptr;
+    uint32_t transfer_ = 0;
+};
+
+// Where adbd can find the chunks of the files that it received in sends with kSyncFlagDedup, by
+// their SHA-256, so that a later send of the same data, to any path, can leave them out. Entries
+// are only hints, checked against the file whenever they're used. The oldest go once there are
+// kMaxChunks of them.
+class ChunkInventory {
+  public:
+    using Hash = std::array<uint8_t, SHA256_DIGEST_LENGTH>;
+
+    static ChunkInventory& Instance() {
+        static ChunkInventory& instance = *new ChunkInventory();
+        return instance;
+    }
+
+    void Add(std::shared_ptr<const std::string> path, uint64_t offset, uint32_t size,
+             const Hash& hash) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto [it, inserted] = chunks_.insert_or_assign(hash, Location{path, offset, size});
+        if (inserted) {
+            order_.push_back(hash);
+        }
+        while (order_.size() > kMaxChunks) {
+            chunks_.erase(order_.front());
+            order_.pop_front();
+        }
+    }
+
+    // Reads the chunk with the given hash into buffer, if it's still where it was, and the right
+    // size.
+    bool Read(const Hash& hash, uint32_t size, char* buffer) {
+        std::optional<Location> location = Find(hash);
+        if (!location || location->size != size) return false;
+
+        unique_fd fd(adb_open(location->path->c_str(), O_RDONLY | O_CLOEXEC));
+        bool found =
+                fd >= 0 && android::base::ReadFullyAtOffset(fd, buffer, size, location->offset);
+        if (found) {
+            Hash actual;
+            SHA256(reinterpret_cast<uint8_t*>(buffer), size, actual.data());
+            found = actual == hash;
+        }
+        if (!found) {
+            D("sync: chunk at %s+%" PRIu64 " is gone", location->path->c_str(), location->offset);
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = chunks_.find(hash);
+            if (it != chunks_.end() && it->second.path == location->path &&
+                it->second.offset == location->offset) {
+                chunks_.erase(it);
+            }
+            return false;
+        }
+        return true;
+    }
+
+    bool Has(const Hash& hash) {
+        std::optional<Location> location = Find(hash);
+        if (!location) return false;
+        std::vector<char> buffer(location->size);
+        return Read(hash, location->size, buffer.data());
+    }
+
+  private:
+    static constexpr size_t kMaxChunks = 64 * 1024;
+
+    struct Location {
+        std::shared_ptr<const std::string> path;
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    std::optional<Location> Find(const Hash& hash) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = chunks_.find(hash);
+        if (it == chunks_.end()) return std::nullopt;
+        return it->second;
+    }
+
+    std::mutex mutex_;
+    std::map<Hash, Location> chunks_;
+    // The hashes in chunks_, oldest first.
+    std::deque<Hash> order_;
+};
+
+// The start of a send that was read ahead in pipelined mode: the payload of its first DATA message,
+// if it had one that fit in the sync buffer, and the message header that came next.
+struct SendPrefix {
+    Block head;
+    sync_data next;
+};
+
+static bool handle_send_file_compressed(borrowed_fd s, unique_fd fd, uint32_t* timestamp,
+                                        CompressionType compression, SendReporter& reporter) {
     syncmsg msg;
     Block decode_buffer(SYNC_DATA_MAX);
-    BrotliDecoder decoder(std::span(decode_buffer.data(), decode_buffer.size()));
+    std::unique_ptr<Decoder> decoder =
+            MakeDecoder(compression, std::span(decode_buffer.data(), decode_buffer.size()));
     while (true) {
         if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) return false;
 
@@ -278,35 +481,35 @@ static bool handle_send_file_compressed(borrowed_fd s, unique_fd fd, uint32_t* t
                 *timestamp = msg.data.size;
                 return true;
             }
-            SendSyncFail(s, "invalid data message");
+            reporter.Fail("invalid data message");
             return false;
         }
 
         Block block(msg.data.size);
         if (!ReadFdExactly(s, block.data(), msg.data.size)) return false;
-        decoder.Append(std::move(block));
+        decoder->Append(std::move(block));
 
         while (true) {
             std::span<char> output;
-            BrotliDecodeResult result = decoder.Decode(&output);
-            if (result == BrotliDecodeResult::Error) {
-                SendSyncFailErrno(s, "decompress failed");
+            DecodeResult result = decoder->Decode(&output);
+            if (result == DecodeResult::Error) {
+                reporter.FailErrno("decompress failed");
                 return false;
             }
 
             if (!WriteFdExactly(fd, output.data(), output.size())) {
-                SendSyncFailErrno(s, "write failed");
+                reporter.FailErrno("write failed");
                 return false;
             }
 
-            if (result == BrotliDecodeResult::NeedInput) {
+            if (result == DecodeResult::NeedInput) {
                 break;
-            } else if (result == BrotliDecodeResult::MoreOutput) {
+            } else if (result == DecodeResult::MoreOutput) {
                 continue;
-            } else if (result == BrotliDecodeResult::Done) {
+            } else if (result == DecodeResult::Done) {
                 break;
             } else {
-                LOG(FATAL) << "invalid BrotliDecodeResult: " << static_cast<int>(result);
+                LOG(FATAL) << "invalid DecodeResult: " << static_cast<int>(result);
             }
         }
     }
@@ -314,48 +517,156 @@ static bool handle_send_file_compressed(borrowed_fd s, unique_fd fd, uint32_t* t
     __builtin_unreachable();
 }
 
+// Uncompressed DATA payloads go through a pipe with splice(2), socket to pipe to file for a send
+// and the other way around for a recv, so that adbd never copies them. If the file (or anything
+// else) can't be spliced, the rest of the transfer is copied through the sync buffer instead.
+class SplicePipe {
+  public:
+    SplicePipe() {
+#if defined(__linux__)
+        if (!android::base::GetBoolProperty("debug.adbd.sync.splice", true)) return;
+
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) != 0) {
+            D("sync: pipe2 failed, not splicing: %s", strerror(errno));
+            return;
+        }
+        read_end_.reset(fds[0]);
+        write_end_.reset(fds[1]);
+
+        // A whole DATA payload fits in the pipe, which we always empty before filling it again,
+        // so neither splice can block on the pipe itself.
+        fcntl(write_end_.get(), F_SETPIPE_SZ, SYNC_DATA_MAX);
+#endif
+    }
+
+    bool enabled() const { return read_end_ != -1; }
+
+    // Splices up to len bytes from in into the empty pipe. Returns the number of bytes spliced,
+    // 0 at EOF, or -1 with errno set. EINVAL means that in can't be spliced from: nothing was
+    // read, and the pipe is disabled.
+    ssize_t Fill(borrowed_fd in, size_t len) {
+#if defined(__linux__)
+        ssize_t rc = TEMP_FAILURE_RETRY(
+                splice(in.get(), nullptr, write_end_.get(), nullptr, len, SPLICE_F_MOVE));
+        if (rc == -1 && errno == EINVAL) {
+            D("sync: splice from fd %d unsupported, copying", in.get());
+            Disable();
+            errno = EINVAL;
+        }
+        return rc;
+#else
+        UNUSED(in, len);
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+
+    // Moves all len bytes in the pipe to out. If out can't be spliced to, copies them through
+    // buffer and disables the pipe. Returns false with errno set if writing to out failed.
+    bool Drain(borrowed_fd out, size_t len, std::vector<char>& buffer) {
+#if defined(__linux__)
+        while (len > 0) {
+            ssize_t rc = TEMP_FAILURE_RETRY(
+                    splice(read_end_.get(), nullptr, out.get(), nullptr, len, SPLICE_F_MOVE));
+            if (rc == -1 && errno == EINVAL) {
+                D("sync: splice to fd %d unsupported, copying", out.get());
+                if (!ReadFdExactly(read_end_.get(), &buffer[0], len)) return false;
+                Disable();
+                return WriteFdExactly(out, &buffer[0], len);
+            } else if (rc <= 0) {
+                if (rc == 0) errno = EPIPE;
+                return false;
+            }
+            len -= rc;
+        }
+        return true;
+#else
+        UNUSED(out, len, buffer);
+        errno = ENOSYS;
+        return false;
+#endif
+    }
+
+    // Moves exactly len bytes from in to out through the pipe, or through buffer once the pipe
+    // is disabled. Returns false with errno set and *read_failed telling which side failed.
+    bool Transfer(borrowed_fd in, borrowed_fd out, size_t len, std::vector<char>& buffer,
+                  bool* read_failed) {
+        while (len > 0 && enabled()) {
+            ssize_t rc = Fill(in, len);
+            if (rc == -1 && errno == EINVAL) break;
+            if (rc <= 0) {
+                *read_failed = true;
+                return false;
+            }
+            if (!Drain(out, rc, buffer)) {
+                *read_failed = false;
+                return false;
+            }
+            len -= rc;
+        }
+        if (len == 0) return true;
+
+        *read_failed = !ReadFdExactly(in, &buffer[0], len);
+        return !*read_failed && WriteFdExactly(out, &buffer[0], len);
+    }
+
+  private:
+    void Disable() {
+        read_end_.reset();
+        write_end_.reset();
+    }
+
+    unique_fd read_end_;
+    unique_fd write_end_;
+};
+
+// If first isn't null, it's the first message's header, already read.
 static bool handle_send_file_uncompressed(borrowed_fd s, unique_fd fd, uint32_t* timestamp,
-                                          std::vector<char>& buffer) {
+                                          std::vector<char>& buffer, SendReporter& reporter,
+                                          const sync_data* first) {
     syncmsg msg;
+    SplicePipe pipe;
 
     while (true) {
-        if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) return false;
+        if (first) {
+            msg.data = *first;
+            first = nullptr;
+        } else if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) {
+            return false;
+        }
 
         if (msg.data.id != ID_DATA) {
             if (msg.data.id == ID_DONE) {
                 *timestamp = msg.data.size;
                 return true;
             }
-            SendSyncFail(s, "invalid data message");
+            reporter.Fail("invalid data message");
             return false;
         }
 
         if (msg.data.size > buffer.size()) {  // TODO: resize buffer?
-            SendSyncFail(s, "oversize data message");
+            reporter.Fail("oversize data message");
             return false;
         }
-        if (!ReadFdExactly(s, &buffer[0], msg.data.size)) return false;
-        if (!WriteFdExactly(fd, &buffer[0], msg.data.size)) {
-            SendSyncFailErrno(s, "write failed");
+        bool read_failed;
+        if (!pipe.Transfer(s, fd, msg.data.size, buffer, &read_failed)) {
+            if (!read_failed) reporter.FailErrno("write failed");
             return false;
         }
     }
 }
 
-static bool handle_send_file(borrowed_fd s, const char* path, uint32_t* timestamp, uid_t uid,
-                             gid_t gid, uint64_t capabilities, mode_t mode, bool compressed,
-                             std::vector<char>& buffer, bool do_unlink) {
-    int rc;
-    syncmsg msg;
-
-    __android_log_security_bswrite(SEC_TAG_ADB_SEND_FILE, path);
-
+// Opens path to write a sent file to, creating it and its parent directories as needed, and gives
+// it its owner and mode. Reports the failure if it can't.
+static unique_fd open_send_file(const char* path, uid_t uid, gid_t gid, mode_t mode,
+                                SendReporter& reporter) {
     unique_fd fd(adb_open_mode(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode));
 
     if (fd < 0 && errno == ENOENT) {
         if (!secure_mkdirs(Dirname(path))) {
-            SendSyncFailErrno(s, "secure_mkdirs failed");
-            goto fail;
+            reporter.FailErrno("secure_mkdirs failed");
+            return unique_fd();
         }
         fd.reset(adb_open_mode(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode));
     }
@@ -363,23 +674,166 @@ static bool handle_send_file(borrowed_fd s, const char* path, uint32_t* timestam
         fd.reset(adb_open_mode(path, O_WRONLY | O_CLOEXEC, mode));
     }
     if (fd < 0) {
-        SendSyncFailErrno(s, "couldn't create file");
-        goto fail;
-    } else {
-        if (fchown(fd.get(), uid, gid) == -1) {
-            SendSyncFailErrno(s, "fchown failed");
-            goto fail;
+        reporter.FailErrno("couldn't create file");
+        return unique_fd();
+    }
+
+    if (fchown(fd.get(), uid, gid) == -1) {
+        reporter.FailErrno("fchown failed");
+        return unique_fd();
+    }
+
+#if defined(__ANDROID__)
+    // Not all filesystems support setting SELinux labels. http://b/23530370.
+    selinux_android_restorecon(path, 0);
+#endif
+
+    // fchown clears the setuid bit - restore it if present.
+    // Ignore the result of calling fchmod. It's not supported
+    // by all filesystems, so we don't check for success. b/12441485
+    fchmod(fd.get(), mode);
+    return fd;
+}
+
+// A send with kSyncFlagDedup: a CHNK message for each chunk, see SYNC.TXT. If replace is set, the
+// file is written next to path and renamed over it at the end, so that the chunks of what was there
+// can still be found in the meantime. *chunk_missing is set if the send failed only because one of
+// the chunks it referred to is gone, in which case the whole send was still read.
+static bool handle_send_file_dedup(borrowed_fd s, const std::string& path, uint32_t* timestamp,
+                                   uid_t uid, gid_t gid, uint64_t capabilities, mode_t mode,
+                                   CompressionType compression, bool replace,
+                                   SendReporter& reporter, bool* chunk_missing) {
+    __android_log_security_bswrite(SEC_TAG_ADB_SEND_FILE, path.c_str());
+
+    std::string write_path = replace ? path + ".adb-dedup" : path;
+    if (replace) {
+        adb_unlink(write_path.c_str());
+    }
+    unique_fd fd = open_send_file(write_path.c_str(), uid, gid, mode, reporter);
+
+    struct Received {
+        uint64_t offset;
+        uint32_t size;
+        ChunkInventory::Hash hash;
+    };
+    std::vector<Received> received;
+    uint64_t offset = 0;
+    Block data(SYNC_DATA_MAX);
+    Block chunk(SYNC_DATA_MAX);
+
+    // Once it's failed, keep reading until DONE, like handle_send_file.
+    bool failed = fd < 0;
+    bool missing = false;
+    bool result = false;
+    while (true) {
+        syncmsg msg;
+        if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) break;
+        if (msg.data.id == ID_DONE) {
+            *timestamp = msg.data.size;
+            result = !failed;
+            *chunk_missing = missing;
+            break;
+        }
+        if (msg.data.id != ID_CHNK) {
+            if (!failed) reporter.Fail("invalid chunk message");
+            break;
+        }
+
+        // The id and size were the first two fields of the sync_chunk.
+        static_assert(offsetof(sync_chunk, data_size) == sizeof(sync_data));
+        if (!ReadFdExactly(s, reinterpret_cast<char*>(&msg.chunk) + sizeof(msg.data),
+                           sizeof(msg.chunk) - sizeof(msg.data))) {
+            break;
+        }
+        if (msg.chunk.size > SYNC_DATA_MAX || msg.chunk.data_size > msg.chunk.size) {
+            if (!failed) reporter.Fail("oversize chunk message");
+            break;
+        }
+        if (!ReadFdExactly(s, data.data(), msg.chunk.data_size)) break;
+        if (failed) continue;
+
+        ChunkInventory::Hash hash;
+        memcpy(hash.data(), msg.chunk.hash, hash.size());
+        const char* chunk_data = data.data();
+        if (msg.chunk.data_size == 0 && msg.chunk.size != 0) {
+            if (!ChunkInventory::Instance().Read(hash, msg.chunk.size, chunk.data())) {
+                reporter.Fail(SYNC_CHUNK_MISSING);
+                failed = true;
+                missing = true;
+                continue;
+            }
+            chunk_data = chunk.data();
+        } else if (msg.chunk.data_size < msg.chunk.size) {
+            Block compressed(data.begin(), data.begin() + msg.chunk.data_size);
+            if (!DecompressChunk(compression, std::move(compressed), chunk.data(),
+                                 msg.chunk.size)) {
+                reporter.Fail("decompress failed");
+                failed = true;
+                continue;
+            }
+            chunk_data = chunk.data();
+        }
+        if (msg.chunk.data_size != 0) {
+            // Chunks read back from the inventory were verified by Read; the ones sent inline
+            // must match the hash we are about to record for them.
+            ChunkInventory::Hash actual;
+            SHA256(reinterpret_cast<const uint8_t*>(chunk_data), msg.chunk.size, actual.data());
+            if (actual != hash) {
+                reporter.Fail("chunk hash mismatch");
+                failed = true;
+                continue;
+            }
         }
 
+        if (!WriteFdExactly(fd, chunk_data, msg.chunk.size)) {
+            reporter.FailErrno("write failed");
+            failed = true;
+            continue;
+        }
+        received.push_back({offset, msg.chunk.size, hash});
+        offset += msg.chunk.size;
+    }
+    fd.reset();
+
+    if (result && replace && rename(write_path.c_str(), path.c_str()) != 0) {
+        reporter.FailErrno("rename failed");
+        result = false;
+    }
+    if (!result) {
+        if (replace) adb_unlink(write_path.c_str());
+        return false;
+    }
+
 #if defined(__ANDROID__)
-        // Not all filesystems support setting SELinux labels. http://b/23530370.
-        selinux_android_restorecon(path, 0);
+    // Label the file for where it ended up, rather than where it was written.
+    if (replace) selinux_android_restorecon(path.c_str(), 0);
 #endif
+    if (!update_capabilities(path.c_str(), capabilities)) {
+        reporter.FailErrno("update_capabilities failed");
+        return false;
+    }
 
-        // fchown clears the setuid bit - restore it if present.
-        // Ignore the result of calling fchmod. It's not supported
-        // by all filesystems, so we don't check for success. b/12441485
-        fchmod(fd.get(), mode);
+    auto shared_path = std::make_shared<const std::string>(path);
+    for (const Received& r : received) {
+        ChunkInventory::Instance().Add(shared_path, r.offset, r.size, r.hash);
+    }
+    return reporter.Okay();
+}
+
+static bool handle_send_file(borrowed_fd s, const char* path, uint32_t* timestamp, uid_t uid,
+                             gid_t gid, uint64_t capabilities, mode_t mode,
+                             CompressionType compression, std::vector<char>& buffer, bool do_unlink,
+                             SendReporter& reporter, const SendPrefix* prefix) {
+    int rc;
+    syncmsg msg;
+    // Whether prefix->next still has to be handled, as the next message.
+    bool pending = prefix != nullptr;
+
+    __android_log_security_bswrite(SEC_TAG_ADB_SEND_FILE, path);
+
+    unique_fd fd = open_send_file(path, uid, gid, mode, reporter);
+    if (fd < 0) {
+        goto fail;
     }
 
     {
@@ -390,10 +844,17 @@ static bool handle_send_file(borrowed_fd s, const char* path, uint32_t* timestam
         }
 
         bool result;
-        if (compressed) {
-            result = handle_send_file_compressed(s, std::move(fd), timestamp);
+        if (compression != CompressionType::None) {
+            result = handle_send_file_compressed(s, std::move(fd), timestamp, compression,
+                                                 reporter);
         } else {
-            result = handle_send_file_uncompressed(s, std::move(fd), timestamp, buffer);
+            if (prefix && !WriteFdExactly(fd, prefix->head.data(), prefix->head.size())) {
+                reporter.FailErrno("write failed");
+                goto fail;
+            }
+            pending = false;
+            result = handle_send_file_uncompressed(s, std::move(fd), timestamp, buffer, reporter,
+                                                   prefix ? &prefix->next : nullptr);
         }
 
         if (!result) {
@@ -401,13 +862,11 @@ static bool handle_send_file(borrowed_fd s, const char* path, uint32_t* timestam
         }
 
         if (!update_capabilities(path, capabilities)) {
-            SendSyncFailErrno(s, "update_capabilities failed");
+            reporter.FailErrno("update_capabilities failed");
             goto fail;
         }
 
-        msg.status.id = ID_OKAY;
-        msg.status.msglen = 0;
-        return WriteFdExactly(s, &msg.status, sizeof(msg.status));
+        return reporter.Okay();
     }
 
 fail:
@@ -418,7 +877,12 @@ fail:
     // reading and throwing away ID_DATA packets until the other side notices
     // that we've reported an error.
     while (true) {
-        if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) break;
+        if (pending) {
+            msg.data = prefix->next;
+            pending = false;
+        } else if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) {
+            break;
+        }
 
         if (msg.data.id == ID_DONE) {
             break;
@@ -445,23 +909,24 @@ fail:
 
 #if defined(_WIN32)
 extern bool handle_send_link(int s, const std::string& path,
-                             uint32_t* timestamp, std::vector<char>& buffer)
+                             uint32_t* timestamp, std::vector<char>& buffer,
+                             SendReporter& reporter)
         __attribute__((error("no symlinks on Windows")));
 #else
 static bool handle_send_link(int s, const std::string& path, uint32_t* timestamp,
-                             std::vector<char>& buffer) {
+                             std::vector<char>& buffer, SendReporter& reporter) {
     syncmsg msg;
 
     if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) return false;
 
     if (msg.data.id != ID_DATA) {
-        SendSyncFail(s, "invalid data message: expected ID_DATA");
+        reporter.Fail("invalid data message: expected ID_DATA");
         return false;
     }
 
     unsigned int len = msg.data.size;
     if (len > buffer.size()) { // TODO: resize buffer?
-        SendSyncFail(s, "oversize data message");
+        reporter.Fail("oversize data message");
         return false;
     }
     if (!ReadFdExactly(s, &buffer[0], len)) return false;
@@ -472,13 +937,13 @@ static bool handle_send_link(int s, const std::string& path, uint32_t* timestamp
         auto ret = symlink(&buffer[0], path.c_str());
         if (ret && errno == ENOENT) {
             if (!secure_mkdirs(Dirname(path))) {
-                SendSyncFailErrno(s, "secure_mkdirs failed");
+                reporter.FailErrno("secure_mkdirs failed");
                 return false;
             }
             ret = symlink(&buffer[0], path.c_str());
         }
         if (ret) {
-            SendSyncFailErrno(s, "symlink failed");
+            reporter.FailErrno("symlink failed");
             return false;
         }
     }
@@ -487,11 +952,9 @@ static bool handle_send_link(int s, const std::string& path, uint32_t* timestamp
 
     if (msg.data.id == ID_DONE) {
         *timestamp = msg.data.size;
-        msg.status.id = ID_OKAY;
-        msg.status.msglen = 0;
-        if (!WriteFdExactly(s, &msg.status, sizeof(msg.status))) return false;
+        if (!reporter.Okay()) return false;
     } else {
-        SendSyncFail(s, "invalid data message: expected ID_DONE");
+        reporter.Fail("invalid data message: expected ID_DONE");
         return false;
     }
 
@@ -499,20 +962,153 @@ static bool handle_send_link(int s, const std::string& path, uint32_t* timestamp
 }
 #endif
 
-static bool send_impl(int s, const std::string& path, mode_t mode, bool compressed,
-                      std::vector<char>& buffer) {
+static void set_send_timestamp(const std::string& path, uint32_t timestamp) {
+    struct timeval tv[2];
+    tv[0].tv_sec = timestamp;
+    tv[0].tv_usec = 0;
+    tv[1].tv_sec = timestamp;
+    tv[1].tv_usec = 0;
+    lutimes(path.c_str(), tv);
+}
+
+// Writes out a send that was read ahead in full, on one of the pipeline's threads.
+static void send_file_from_memory(const SyncPipeline::Send& send, SendReporter& reporter) {
+    __android_log_security_bswrite(SEC_TAG_ADB_SEND_FILE, send.path.c_str());
+
+    unique_fd fd = open_send_file(send.path.c_str(), send.uid, send.gid, send.mode, reporter);
+    if (fd >= 0) {
+        if (!WriteFdExactly(fd, send.data.data(), send.data.size())) {
+            reporter.FailErrno("write failed");
+        } else if (!update_capabilities(send.path.c_str(), send.capabilities)) {
+            reporter.FailErrno("update_capabilities failed");
+        } else {
+            fd.reset();
+            set_send_timestamp(send.path, send.timestamp);
+            reporter.Okay();
+            return;
+        }
+    }
+
+    if (send.do_unlink) adb_unlink(send.path.c_str());
+}
+
+SyncPipeline::SyncPipeline(borrowed_fd fd) : fd_(fd) {
+    for (size_t i = 0; i < kThreads; ++i) {
+        threads_.emplace_back([this]() { Run(); });
+    }
+    writer_ = std::thread([this]() { WriteStatuses(); });
+}
+
+SyncPipeline::~SyncPipeline() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        quit_ = true;
+    }
+    cv_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+    writer_.join();
+}
+
+void SyncPipeline::Submit(Send send) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return queue_.size() < kMaxQueued; });
+    paths_.insert(send.path);
+    queue_.push_back(std::move(send));
+    cv_.notify_all();
+}
+
+void SyncPipeline::WaitFor(const std::string& path) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this, &path]() { return paths_.count(path) == 0; });
+}
+
+void SyncPipeline::Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return paths_.empty() && statuses_.empty() && !writing_; });
+}
+
+bool SyncPipeline::SendStatus(uint32_t id, uint32_t transfer, const std::string& message) {
+    syncmsg msg;
+    msg.pipe_status.id = id;
+    msg.pipe_status.transfer = transfer;
+    msg.pipe_status.msglen = message.size();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    statuses_.append(reinterpret_cast<const char*>(&msg.pipe_status), sizeof(msg.pipe_status));
+    statuses_.append(message);
+    cv_.notify_all();
+    return true;
+}
+
+void SyncPipeline::WriteStatuses() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    bool failed = false;
+    while (true) {
+        cv_.wait(lock, [this]() { return !statuses_.empty() || (quit_ && paths_.empty()); });
+        if (statuses_.empty()) return;
+
+        // Write out whatever has accumulated in one go.
+        std::string statuses = std::move(statuses_);
+        statuses_.clear();
+        writing_ = true;
+        lock.unlock();
+
+        // Once the socket is gone, keep going so that Wait() doesn't hang.
+        if (!failed && !WriteFdExactly(fd_, statuses)) {
+            D("sync: failed to write statuses: %s", strerror(errno));
+            failed = true;
+        }
+
+        lock.lock();
+        writing_ = false;
+        cv_.notify_all();
+    }
+}
+
+void SyncPipeline::Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this]() { return quit_ || !queue_.empty(); });
+        if (queue_.empty()) return;
+
+        Send send = std::move(queue_.front());
+        queue_.pop_front();
+        cv_.notify_all();
+        lock.unlock();
+
+        SendReporter reporter(fd_, this, send.transfer);
+        send_file_from_memory(send, reporter);
+
+        lock.lock();
+        paths_.erase(send.path);
+        cv_.notify_all();
+    }
+}
+
+static bool send_impl(int s, const std::string& path, mode_t mode, CompressionType compression,
+                      bool dedup, std::vector<char>& buffer, SendReporter& reporter) {
+    SyncPipeline* pipeline = reporter.pipeline();
+    if (pipeline) {
+        // Sends to the same path must happen in order.
+        pipeline->WaitFor(path);
+    }
+
     // Don't delete files before copying if they are not "regular" or symlinks.
     struct stat st;
     bool do_unlink = (lstat(path.c_str(), &st) == -1) || S_ISREG(st.st_mode) ||
                      (S_ISLNK(st.st_mode) && !S_ISLNK(mode));
-    if (do_unlink) {
+    // A deduplicated send may need chunks of the old file, and replaces it at the end instead.
+    bool replace = dedup && !S_ISLNK(mode) && do_unlink;
+    if (do_unlink && !replace) {
         adb_unlink(path.c_str());
     }
 
     bool result;
     uint32_t timestamp;
     if (S_ISLNK(mode)) {
-        result = handle_send_link(s, path, &timestamp, buffer);
+        result = handle_send_link(s, path, &timestamp, buffer, reporter);
     } else {
         // Copy user permission bits to "group" and "other" permissions.
         mode &= 0777;
@@ -526,28 +1122,59 @@ static bool send_impl(int s, const std::string& path, mode_t mode, bool compress
             adbd_fs_config(path.c_str(), 0, nullptr, &uid, &gid, &mode, &capabilities);
         }
 
-        result = handle_send_file(s, path.c_str(), &timestamp, uid, gid, capabilities, mode,
-                                  compressed, buffer, do_unlink);
+        if (dedup) {
+            bool chunk_missing = false;
+            result = handle_send_file_dedup(s, path, &timestamp, uid, gid, capabilities, mode,
+                                            compression, replace, reporter, &chunk_missing);
+            // The client sends the file again without dedup on this connection.
+            if (chunk_missing) return true;
+        } else if (pipeline && compression == CompressionType::None) {
+            // Read ahead, to hand the send to the pool if its data is all in one message.
+            SendPrefix prefix;
+            if (!ReadFdExactly(s, &prefix.next, sizeof(prefix.next))) return false;
+            if (prefix.next.id == ID_DATA && prefix.next.size <= buffer.size()) {
+                prefix.head = Block(prefix.next.size);
+                if (!ReadFdExactly(s, prefix.head.data(), prefix.head.size()) ||
+                    !ReadFdExactly(s, &prefix.next, sizeof(prefix.next))) {
+                    return false;
+                }
+            }
+
+            if (prefix.next.id == ID_DONE) {
+                pipeline->Submit({.transfer = reporter.transfer(),
+                                  .path = path,
+                                  .uid = uid,
+                                  .gid = gid,
+                                  .capabilities = capabilities,
+                                  .mode = mode,
+                                  .do_unlink = do_unlink,
+                                  .timestamp = prefix.next.size,
+                                  .data = std::move(prefix.head)});
+                return true;
+            }
+
+            result = handle_send_file(s, path.c_str(), &timestamp, uid, gid, capabilities, mode,
+                                      compression, buffer, do_unlink, reporter, &prefix);
+        } else {
+            result = handle_send_file(s, path.c_str(), &timestamp, uid, gid, capabilities, mode,
+                                      compression, buffer, do_unlink, reporter, nullptr);
+        }
     }
 
     if (!result) {
       return false;
     }
 
-    struct timeval tv[2];
-    tv[0].tv_sec = timestamp;
-    tv[0].tv_usec = 0;
-    tv[1].tv_sec = timestamp;
-    tv[1].tv_usec = 0;
-    lutimes(path.c_str(), tv);
+    set_send_timestamp(path, timestamp);
     return true;
 }
 
-static bool do_send_v1(int s, const std::string& spec, std::vector<char>& buffer) {
+static bool do_send_v1(int s, const std::string& spec, std::vector<char>& buffer,
+                       SendReporter& reporter) {
     // 'spec' is of the form "/some/path,0755". Break it up.
     size_t comma = spec.find_last_of(',');
     if (comma == std::string::npos) {
-        SendSyncFail(s, "missing , in ID_SEND_V1");
+        reporter.Fail("missing , in ID_SEND_V1");
         return false;
     }
 
@@ -556,14 +1183,15 @@ static bool do_send_v1(int s, const std::string& spec, std::vector<char>& buffer
     errno = 0;
     mode_t mode = strtoul(spec.substr(comma + 1).c_str(), nullptr, 0);
     if (errno != 0) {
-        SendSyncFail(s, "bad mode");
+        reporter.Fail("bad mode");
         return false;
     }
 
-    return send_impl(s, path, mode, false, buffer);
+    return send_impl(s, path, mode, CompressionType::None, false, buffer, reporter);
 }
 
-static bool do_send_v2(int s, const std::string& path, std::vector<char>& buffer) {
+static bool do_send_v2(int s, const std::string& path, std::vector<char>& buffer,
+                       SendReporter& reporter) {
     // Read the setup packet.
     syncmsg msg;
     int rc = ReadFdExactly(s, &msg.send_v2_setup, sizeof(msg.send_v2_setup));
@@ -574,26 +1202,34 @@ static bool do_send_v2(int s, const std::string& path, std::vector<char>& buffer
         PLOG(ERROR) << "failed to read send_v2 setup packet";
     }
 
-    bool compressed = false;
-    if (msg.send_v2_setup.flags & kSyncFlagBrotli) {
-        msg.send_v2_setup.flags &= ~kSyncFlagBrotli;
-        compressed = true;
+    CompressionType compression;
+    if (!TakeCompressionSyncFlag(&msg.send_v2_setup.flags, &compression)) {
+        reporter.Fail("multiple compression flags");
+        return false;
     }
+    bool dedup = msg.send_v2_setup.flags & kSyncFlagDedup;
+    msg.send_v2_setup.flags &= ~kSyncFlagDedup;
     if (msg.send_v2_setup.flags) {
-        SendSyncFail(s, android::base::StringPrintf("unknown flags: %d", msg.send_v2_setup.flags));
+        reporter.Fail(android::base::StringPrintf("unknown flags: %d", msg.send_v2_setup.flags));
         return false;
     }
 
     errno = 0;
-    return send_impl(s, path, msg.send_v2_setup.mode, compressed, buffer);
+    return send_impl(s, path, msg.send_v2_setup.mode, compression, dedup, buffer, reporter);
 }
 
 static bool recv_uncompressed(borrowed_fd s, unique_fd fd, std::vector<char>& buffer) {
     syncmsg msg;
     msg.data.id = ID_DATA;
-    std::optional<BrotliEncoder<SYNC_DATA_MAX>> encoder;
+    SplicePipe pipe;
     while (true) {
-        int r = adb_read(fd.get(), &buffer[0], buffer.size() - sizeof(msg.data));
+        ssize_t r = -1;
+        if (pipe.enabled()) {
+            r = pipe.Fill(fd, buffer.size() - sizeof(msg.data));
+        }
+        if (!pipe.enabled()) {
+            r = adb_read(fd.get(), &buffer[0], buffer.size() - sizeof(msg.data));
+        }
         if (r <= 0) {
             if (r == 0) break;
             SendSyncFailErrno(s, "read failed");
@@ -601,7 +1237,10 @@ static bool recv_uncompressed(borrowed_fd s, unique_fd fd, std::vector<char>& bu
         }
         msg.data.size = r;
 
-        if (!WriteFdExactly(s, &msg.data, sizeof(msg.data)) || !WriteFdExactly(s, &buffer[0], r)) {
+        if (!WriteFdExactly(s, &msg.data, sizeof(msg.data))) return false;
+        if (pipe.enabled()) {
+            if (!pipe.Drain(s, r, buffer)) return false;
+        } else if (!WriteFdExactly(s, &buffer[0], r)) {
             return false;
         }
     }
@@ -609,11 +1248,12 @@ static bool recv_uncompressed(borrowed_fd s, unique_fd fd, std::vector<char>& bu
     return true;
 }
 
-static bool recv_compressed(borrowed_fd s, unique_fd fd) {
+static bool recv_compressed(borrowed_fd s, unique_fd fd, CompressionType compression) {
     syncmsg msg;
     msg.data.id = ID_DATA;
 
-    BrotliEncoder<SYNC_DATA_MAX> encoder;
+    std::unique_ptr<Encoder> encoder =
+            MakeEncoder(compression, SYNC_DATA_MAX, kDefaultDeviceZstdLevel);
 
     bool sending = true;
     while (sending) {
@@ -625,16 +1265,16 @@ static bool recv_compressed(borrowed_fd s, unique_fd fd) {
         }
 
         if (r == 0) {
-            encoder.Finish();
+            encoder->Finish();
         } else {
             input.resize(r);
-            encoder.Append(std::move(input));
+            encoder->Append(std::move(input));
         }
 
         while (true) {
             Block output;
-            BrotliEncodeResult result = encoder.Encode(&output);
-            if (result == BrotliEncodeResult::Error) {
+            EncodeResult result = encoder->Encode(&output);
+            if (result == EncodeResult::Error) {
                 SendSyncFailErrno(s, "compress failed");
                 return false;
             }
@@ -647,12 +1287,12 @@ static bool recv_compressed(borrowed_fd s, unique_fd fd) {
                 }
             }
 
-            if (result == BrotliEncodeResult::Done) {
+            if (result == EncodeResult::Done) {
                 sending = false;
                 break;
-            } else if (result == BrotliEncodeResult::NeedInput) {
+            } else if (result == EncodeResult::NeedInput) {
                 break;
-            } else if (result == BrotliEncodeResult::MoreOutput) {
+            } else if (result == EncodeResult::MoreOutput) {
                 continue;
             }
         }
@@ -661,7 +1301,8 @@ static bool recv_compressed(borrowed_fd s, unique_fd fd) {
     return true;
 }
 
-static bool recv_impl(borrowed_fd s, const char* path, bool compressed, std::vector<char>& buffer) {
+static bool recv_impl(borrowed_fd s, const char* path, CompressionType compression,
+                      std::vector<char>& buffer) {
     __android_log_security_bswrite(SEC_TAG_ADB_RECV_FILE, path);
 
     unique_fd fd(adb_open(path, O_RDONLY | O_CLOEXEC));
@@ -676,8 +1317,8 @@ static bool recv_impl(borrowed_fd s, const char* path, bool compressed, std::vec
     }
 
     bool result;
-    if (compressed) {
-        result = recv_compressed(s, std::move(fd));
+    if (compression != CompressionType::None) {
+        result = recv_compressed(s, std::move(fd), compression);
     } else {
         result = recv_uncompressed(s, std::move(fd), buffer);
     }
@@ -693,7 +1334,7 @@ static bool recv_impl(borrowed_fd s, const char* path, bool compressed, std::vec
 }
 
 static bool do_recv_v1(borrowed_fd s, const char* path, std::vector<char>& buffer) {
-    return recv_impl(s, path, false, buffer);
+    return recv_impl(s, path, CompressionType::None, buffer);
 }
 
 static bool do_recv_v2(borrowed_fd s, const char* path, std::vector<char>& buffer) {
@@ -707,17 +1348,17 @@ static bool do_recv_v2(borrowed_fd s, const char* path, std::vector<char>& buffe
         PLOG(ERROR) << "failed to read recv_v2 setup packet";
     }
 
-    bool compressed = false;
-    if (msg.recv_v2_setup.flags & kSyncFlagBrotli) {
-        msg.recv_v2_setup.flags &= ~kSyncFlagBrotli;
-        compressed = true;
+    CompressionType compression;
+    if (!TakeCompressionSyncFlag(&msg.recv_v2_setup.flags, &compression)) {
+        SendSyncFail(s, "multiple compression flags");
+        return false;
     }
     if (msg.recv_v2_setup.flags) {
         SendSyncFail(s, android::base::StringPrintf("unknown flags: %d", msg.recv_v2_setup.flags));
         return false;
     }
 
-    return recv_impl(s, path, compressed, buffer);
+    return recv_impl(s, path, compression, buffer);
 }
 
 static const char* sync_id_to_name(uint32_t id) {
@@ -740,6 +1381,10 @@ static const char* sync_id_to_name(uint32_t id) {
         return "recv_v1";
     case ID_RECV_V2:
         return "recv_v2";
+    case ID_PIPE:
+        return "pipe";
+    case ID_HAVE:
+        return "have";
     case ID_QUIT:
         return "quit";
     default:
@@ -747,21 +1392,72 @@ static const char* sync_id_to_name(uint32_t id) {
   }
 }
 
-static bool handle_sync_command(int fd, std::vector<char>& buffer) {
+static bool do_pipe(int s, std::unique_ptr<SyncPipeline>* pipeline) {
+    if (*pipeline) {
+        SendSyncFail(s, "already pipelined");
+        return false;
+    }
+    *pipeline = std::make_unique<SyncPipeline>(s);
+
+    syncmsg msg;
+    msg.pipe.id = ID_PIPE;
+    msg.pipe.window = SyncPipeline::kWindow;
+    return WriteFdExactly(s, &msg.pipe, sizeof(msg.pipe));
+}
+
+static bool do_have(int s, uint32_t count) {
+    if (count > SYNC_HAVE_MAX) {
+        SendSyncFail(s, "too many chunks");
+        return false;
+    }
+    std::vector<ChunkInventory::Hash> hashes(count);
+    if (!ReadFdExactly(s, hashes.data(), count * sizeof(ChunkInventory::Hash))) {
+        SendSyncFail(s, "chunk hash read failure");
+        return false;
+    }
+
+    std::string response(sizeof(sync_data) + count, '\0');
+    sync_data* header = reinterpret_cast<sync_data*>(response.data());
+    header->id = ID_HAVE;
+    header->size = count;
+    for (uint32_t i = 0; i < count; ++i) {
+        response[sizeof(sync_data) + i] = ChunkInventory::Instance().Has(hashes[i]);
+    }
+    return WriteFdExactly(s, response);
+}
+
+static bool handle_sync_command(int fd, std::vector<char>& buffer,
+                                std::unique_ptr<SyncPipeline>* pipeline) {
     D("sync: waiting for request");
 
     SyncRequest request;
     if (!ReadFdExactly(fd, &request, sizeof(request))) {
+        if (*pipeline) (*pipeline)->Wait();
         SendSyncFail(fd, "command read failure");
         return false;
     }
+
+    // Only sends write to the socket while the pool might be writing statuses.
+    bool is_send = request.id == ID_SEND_V1 || request.id == ID_SEND_V2;
+    if (*pipeline && !is_send) {
+        (*pipeline)->Wait();
+    }
+
+    // HAVE is followed by hashes rather than a path.
+    if (request.id == ID_HAVE) {
+        D("sync: have(%u)", request.path_length);
+        return do_have(fd, request.path_length);
+    }
+
     size_t path_length = request.path_length;
     if (path_length > 1024) {
+        if (*pipeline) (*pipeline)->Wait();
         SendSyncFail(fd, "path too long");
         return false;
     }
     char name[1025];
     if (!ReadFdExactly(fd, name, path_length)) {
+        if (*pipeline) (*pipeline)->Wait();
         SendSyncFail(fd, "filename read failure");
         return false;
     }
@@ -785,17 +1481,26 @@ static bool handle_sync_command(int fd, std::vector<char>& buffer) {
             if (!do_list_v2(fd, name)) return false;
             break;
         case ID_SEND_V1:
-            if (!do_send_v1(fd, name, buffer)) return false;
-            break;
-        case ID_SEND_V2:
-            if (!do_send_v2(fd, name, buffer)) return false;
+        case ID_SEND_V2: {
+            SendReporter reporter =
+                    *pipeline ? SendReporter(fd, pipeline->get(), (*pipeline)->NextTransfer())
+                              : SendReporter(fd);
+            if (request.id == ID_SEND_V1) {
+                if (!do_send_v1(fd, name, buffer, reporter)) return false;
+            } else {
+                if (!do_send_v2(fd, name, buffer, reporter)) return false;
+            }
             break;
+        }
         case ID_RECV_V1:
             if (!do_recv_v1(fd, name, buffer)) return false;
             break;
         case ID_RECV_V2:
             if (!do_recv_v2(fd, name, buffer)) return false;
             break;
+        case ID_PIPE:
+            if (!do_pipe(fd, pipeline)) return false;
+            break;
         case ID_QUIT:
             return false;
         default:
@@ -808,9 +1513,11 @@ static bool handle_sync_command(int fd, std::vector<char>& buffer) {
 
 void file_sync_service(unique_fd fd) {
     std::vector<char> buffer(SYNC_DATA_MAX);
+    std::unique_ptr<SyncPipeline> pipeline;
 
-    while (handle_sync_command(fd.get(), buffer)) {
+    while (handle_sync_command(fd.get(), buffer, &pipeline)) {
     }
+    pipeline.reset();
 
     D("sync: done");
 }
@@ -57,6 +57,7 @@
 #include "daemon/logging.h"
 #include "daemon/restart_service.h"
 #include "daemon/shell_service.h"
+#include "daemon/usb_ffs.h"
 
 void reconnect_service(unique_fd fd, atransport* t) {
     WriteFdExactly(fd.get(), "done");
@@ -329,6 +330,10 @@ unique_fd daemon_service_to_fd(std::string_view name, atransport* transport) {
                 "reconnect", std::bind(reconnect_service, std::placeholders::_1, transport));
     } else if (name == "spin") {
         return create_service_thread("spin", spin_service);
+    } else if (name == "usb-stats") {
+        return create_service_thread("usb-stats", [](unique_fd fd) {
+            WriteFdExactly(fd.get(), usb_ffs_stats());
+        });
     }
 
     return unique_fd{};
@@ -40,29 +40,24 @@
 
 #include <asyncio/AsyncIO.h>
 
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/macros.h>
 #include <android-base/properties.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
 #include <android-base/thread_annotations.h>
 
 #include "adb_unique_fd.h"
 #include "adb_utils.h"
 #include "daemon/usb_ffs.h"
+#include "daemon/usb_transfer_tuner.h"
 #include "sysdeps/chrono.h"
 #include "transport.h"
 #include "types.h"
 
 using android::base::StringPrintf;
 
-// Not all USB controllers support operations larger than 16k, so don't go above that.
-// Also, each submitted operation does an allocation in the kernel of that size, so we want to
-// minimize our queue depth while still maintaining a deep enough queue to keep the USB stack fed.
-static constexpr size_t kUsbReadQueueDepth = 8;
-static constexpr size_t kUsbReadSize = 4 * PAGE_SIZE;
-
-static constexpr size_t kUsbWriteQueueDepth = 8;
-static constexpr size_t kUsbWriteSize = 4 * PAGE_SIZE;
-
 static const char* to_string(enum usb_functionfs_event_type type) {
     switch (type) {
         case FUNCTIONFS_BIND:
@@ -117,6 +112,10 @@ struct TransferId {
 template <class Payload>
 struct IoBlock {
     bool pending = false;
+    // The most that this transfer could have moved, to tell whether it came back full.
+    size_t capacity = 0;
+    // Whether it could have come back full at all, see UsbTransferTuner::Record.
+    bool could_fill = true;
     struct iocb control = {};
     Payload payload;
 
@@ -169,6 +168,29 @@ struct ScopedAioContext {
     aio_context_t context_ = 0;
 };
 
+// The speed that the UDC that we're bound to negotiated with the host, as the kernel names it
+// (e.g. "high-speed", "super-speed"), or "unknown".
+static std::string GetUsbLinkSpeed() {
+    std::string controller = android::base::GetProperty("sys.usb.controller", "");
+    if (controller.empty()) {
+        return "unknown";
+    }
+
+    std::string speed;
+    std::string path = "/sys/class/udc/" + controller + "/current_speed";
+    if (!android::base::ReadFileToString(path, &speed)) {
+        PLOG(WARNING) << "failed to read " << path;
+        return "unknown";
+    }
+    return android::base::Trim(speed);
+}
+
+struct UsbFfsConnection;
+
+// The connection that usb_ffs_stats reports on, if any.
+static std::mutex& g_usb_connection_mutex = *new std::mutex();
+static UsbFfsConnection* g_usb_connection GUARDED_BY(g_usb_connection_mutex) = nullptr;
+
 struct UsbFfsConnection : public Connection {
     UsbFfsConnection(unique_fd control, unique_fd read, unique_fd write,
                      std::promise<void> destruction_notifier)
@@ -189,11 +211,21 @@ struct UsbFfsConnection : public Connection {
             PLOG(FATAL) << "failed to create eventfd";
         }
 
-        aio_context_ = ScopedAioContext::Create(kUsbReadQueueDepth + kUsbWriteQueueDepth);
+        aio_context_ = ScopedAioContext::Create(2 * kUsbMaxQueueDepth);
+
+        std::lock_guard<std::mutex> lock(g_usb_connection_mutex);
+        g_usb_connection = this;
     }
 
     ~UsbFfsConnection() {
         LOG(INFO) << "UsbFfsConnection being destroyed";
+        {
+            std::lock_guard<std::mutex> lock(g_usb_connection_mutex);
+            if (g_usb_connection == this) {
+                g_usb_connection = nullptr;
+            }
+            LOG(INFO) << "USB stats:\n" << DumpStats();
+        }
         Stop();
         monitor_thread_.join();
 
@@ -212,9 +244,11 @@ struct UsbFfsConnection : public Connection {
         auto header = std::make_shared<Block>(sizeof(packet->msg));
         memcpy(header->data(), &packet->msg, sizeof(packet->msg));
 
+        size_t transfer_size = write_tuner_.transfer_size();
+
         std::lock_guard<std::mutex> lock(write_mutex_);
-        write_requests_.push_back(
-                CreateWriteBlock(std::move(header), 0, sizeof(packet->msg), next_write_id_++));
+        write_requests_.push_back(CreateWriteBlock(std::move(header), 0, sizeof(packet->msg),
+                                                   transfer_size, false, next_write_id_++));
         if (!packet->payload.empty()) {
             // The kernel attempts to allocate a contiguous block of memory for each write,
             // which can fail if the write is large and the kernel heap is fragmented.
@@ -224,9 +258,11 @@ struct UsbFfsConnection : public Connection {
             size_t len = payload->size();
 
             while (len > 0) {
-                size_t write_size = std::min(kUsbWriteSize, len);
-                write_requests_.push_back(
-                        CreateWriteBlock(payload, offset, write_size, next_write_id_++));
+                size_t write_size = std::min(transfer_size, len);
+                bool tail = offset > 0 && write_size == len;
+                write_requests_.push_back(CreateWriteBlock(payload, offset, write_size,
+                                                           transfer_size, !tail,
+                                                           next_write_id_++));
                 len -= write_size;
                 offset += write_size;
             }
@@ -358,6 +394,16 @@ struct UsbFfsConnection : public Connection {
                         }
 
                         enabled = true;
+                        {
+                            std::string speed = GetUsbLinkSpeed();
+                            LOG(INFO) << "USB link speed: " << speed;
+                            bool super_speed = android::base::StartsWith(speed, "super-speed");
+                            read_tuner_.SetSuperSpeed(super_speed);
+                            write_tuner_.SetSuperSpeed(super_speed);
+
+                            std::lock_guard<std::mutex> lock(g_usb_connection_mutex);
+                            link_speed_ = std::move(speed);
+                        }
                         StartWorker();
                         break;
 
@@ -433,11 +479,11 @@ struct UsbFfsConnection : public Connection {
             adb_thread_setname("UsbFfs-worker");
             LOG(INFO) << "UsbFfs-worker thread spawned";
 
-            for (size_t i = 0; i < kUsbReadQueueDepth; ++i) {
-                read_requests_[i] = CreateReadBlock(next_read_id_++);
-                if (!SubmitRead(&read_requests_[i])) {
-                    return;
-                }
+            for (IoReadBlock& block : read_requests_) {
+                InitReadBlock(&block);
+            }
+            if (!SubmitReads()) {
+                return;
             }
 
             while (!stopped_) {
@@ -485,33 +531,46 @@ struct UsbFfsConnection : public Connection {
         worker_thread_.join();
     }
 
-    void PrepareReadBlock(IoReadBlock* block, uint64_t id) {
+    void PrepareReadBlock(IoReadBlock* block, uint64_t id, size_t size) {
         block->pending = false;
-        if (block->payload.capacity() >= kUsbReadSize) {
-            block->payload.resize(kUsbReadSize);
+        // Each slot keeps its buffer across reads, and only reallocates it to grow.
+        if (block->payload.capacity() >= size) {
+            block->payload.resize(size);
         } else {
-            block->payload = Block(kUsbReadSize);
+            block->payload = Block(size);
         }
+        block->capacity = size;
         block->control.aio_data = static_cast<uint64_t>(TransferId::read(id));
         block->control.aio_buf = reinterpret_cast<uintptr_t>(block->payload.data());
         block->control.aio_nbytes = block->payload.size();
     }
 
-    IoReadBlock CreateReadBlock(uint64_t id) {
-        IoReadBlock block;
-        PrepareReadBlock(&block, id);
-        block.control.aio_rw_flags = 0;
-        block.control.aio_lio_opcode = IOCB_CMD_PREAD;
-        block.control.aio_reqprio = 0;
-        block.control.aio_fildes = read_fd_.get();
-        block.control.aio_offset = 0;
-        block.control.aio_flags = IOCB_FLAG_RESFD;
-        block.control.aio_resfd = worker_event_fd_.get();
-        return block;
+    void InitReadBlock(IoReadBlock* block) {
+        block->control.aio_rw_flags = 0;
+        block->control.aio_lio_opcode = IOCB_CMD_PREAD;
+        block->control.aio_reqprio = 0;
+        block->control.aio_fildes = read_fd_.get();
+        block->control.aio_offset = 0;
+        block->control.aio_flags = IOCB_FLAG_RESFD;
+        block->control.aio_resfd = worker_event_fd_.get();
+    }
+
+    // Submit reads until as many are in flight as the read tuner wants.
+    bool SubmitReads() {
+        size_t size = read_tuner_.transfer_size();
+        size_t queue_depth = read_tuner_.queue_depth();
+        while (next_read_id_ - needed_read_id_ < queue_depth) {
+            IoReadBlock* block = &read_requests_[next_read_id_ % kUsbMaxQueueDepth];
+            PrepareReadBlock(block, next_read_id_++, size);
+            if (!SubmitRead(block)) {
+                return false;
+            }
+        }
+        return true;
     }
 
     void ReadEvents() {
-        static constexpr size_t kMaxEvents = kUsbReadQueueDepth + kUsbWriteQueueDepth;
+        static constexpr size_t kMaxEvents = 2 * kUsbMaxQueueDepth;
         struct io_event events[kMaxEvents];
         struct timespec timeout = {.tv_sec = 0, .tv_nsec = 0};
         int rc = io_getevents(aio_context_.get(), 0, kMaxEvents, events, &timeout);
@@ -538,13 +597,13 @@ struct UsbFfsConnection : public Connection {
                     return;
                 }
             } else {
-                HandleWrite(id);
+                HandleWrite(id, event.res);
             }
         }
     }
 
     bool HandleRead(TransferId id, int64_t size) {
-        uint64_t read_idx = id.id % kUsbReadQueueDepth;
+        uint64_t read_idx = id.id % kUsbMaxQueueDepth;
         IoReadBlock* block = &read_requests_[read_idx];
         block->pending = false;
         block->payload.resize(size);
@@ -556,8 +615,8 @@ struct UsbFfsConnection : public Connection {
             return true;
         }
 
-        for (uint64_t id = needed_read_id_;; ++id) {
-            size_t read_idx = id % kUsbReadQueueDepth;
+        for (; needed_read_id_ != next_read_id_; ++needed_read_id_) {
+            size_t read_idx = needed_read_id_ % kUsbMaxQueueDepth;
             IoReadBlock* current_block = &read_requests_[read_idx];
             if (current_block->pending) {
                 break;
@@ -565,13 +624,19 @@ struct UsbFfsConnection : public Connection {
             if (!ProcessRead(current_block)) {
                 return false;
             }
-            ++needed_read_id_;
         }
 
-        return true;
+        return SubmitReads();
     }
 
     bool ProcessRead(IoReadBlock* block) {
+        // Reads are recorded in order, so that headers and tails can be told apart.
+        size_t size = block->payload.size();
+        bool could_fill = incoming_header_.has_value() &&
+                          (incoming_payload_size_ == 0 ||
+                           incoming_payload_size_ + size < incoming_header_->data_length);
+        read_tuner_.Record(size, block->capacity, could_fill);
+
         if (!block->payload.empty()) {
             if (!incoming_header_.has_value()) {
                 if (block->payload.size() != sizeof(amessage)) {
@@ -581,35 +646,37 @@ struct UsbFfsConnection : public Connection {
                 amessage& msg = incoming_header_.emplace();
                 memcpy(&msg, block->payload.data(), sizeof(msg));
                 LOG(DEBUG) << "USB read:" << dump_header(&msg);
-                incoming_header_ = msg;
+                if (msg.data_length > MAX_PAYLOAD) {
+                    HandleError("received packet header with oversized payload length");
+                    return false;
+                }
+
+                // The read buffers stay with their slots, so the payload gets copied out of them
+                // into a buffer of its own as it arrives.
+                incoming_payload_ = Block(msg.data_length);
+                incoming_payload_size_ = 0;
             } else {
-                size_t bytes_left = incoming_header_->data_length - incoming_payload_.size();
+                size_t bytes_left = incoming_header_->data_length - incoming_payload_size_;
                 if (block->payload.size() > bytes_left) {
                     HandleError("received too many bytes while waiting for payload");
                     return false;
                 }
-                incoming_payload_.append(std::move(block->payload));
+                memcpy(incoming_payload_.data() + incoming_payload_size_, block->payload.data(),
+                       block->payload.size());
+                incoming_payload_size_ += block->payload.size();
             }
 
-            if (incoming_header_->data_length == incoming_payload_.size()) {
+            if (incoming_header_->data_length == incoming_payload_size_) {
                 auto packet = std::make_unique<apacket>();
                 packet->msg = *incoming_header_;
-
-                // TODO: Make apacket contain an IOVector so we don't have to coalesce.
-                packet->payload = std::move(incoming_payload_).coalesce();
+                packet->payload = std::move(incoming_payload_);
                 read_callback_(this, std::move(packet));
 
                 incoming_header_.reset();
-                // reuse the capacity of the incoming payload while we can.
-                auto free_block = incoming_payload_.clear();
-                if (block->payload.capacity() == 0) {
-                    block->payload = std::move(free_block);
-                }
+                incoming_payload_size_ = 0;
             }
         }
 
-        PrepareReadBlock(block, block->id().id + kUsbReadQueueDepth);
-        SubmitRead(block);
         return true;
     }
 
@@ -624,13 +691,14 @@ struct UsbFfsConnection : public Connection {
         return true;
     }
 
-    void HandleWrite(TransferId id) {
+    void HandleWrite(TransferId id, int64_t size) {
         std::lock_guard<std::mutex> lock(write_mutex_);
         auto it =
                 std::find_if(write_requests_.begin(), write_requests_.end(), [id](const auto& req) {
                     return static_cast<uint64_t>(req.id()) == static_cast<uint64_t>(id);
                 });
         CHECK(it != write_requests_.end());
+        write_tuner_.Record(size, it->capacity, it->could_fill);
 
         write_requests_.erase(it);
         size_t outstanding_writes = --writes_submitted_;
@@ -638,9 +706,11 @@ struct UsbFfsConnection : public Connection {
     }
 
     IoWriteBlock CreateWriteBlock(std::shared_ptr<Block> payload, size_t offset, size_t len,
-                                  uint64_t id) {
+                                  size_t capacity, bool could_fill, uint64_t id) {
         auto block = IoWriteBlock();
         block.payload = std::move(payload);
+        block.capacity = capacity;
+        block.could_fill = could_fill;
         block.control.aio_data = static_cast<uint64_t>(TransferId::write(id));
         block.control.aio_rw_flags = 0;
         block.control.aio_lio_opcode = IOCB_CMD_PWRITE;
@@ -656,22 +726,24 @@ struct UsbFfsConnection : public Connection {
 
     IoWriteBlock CreateWriteBlock(Block&& payload, uint64_t id) {
         size_t len = payload.size();
-        return CreateWriteBlock(std::make_shared<Block>(std::move(payload)), 0, len, id);
+        return CreateWriteBlock(std::make_shared<Block>(std::move(payload)), 0, len, len, true, id);
     }
 
     void SubmitWrites() REQUIRES(write_mutex_) {
-        if (writes_submitted_ == kUsbWriteQueueDepth) {
+        // The tuner may have shrunk the queue below what's already in flight.
+        size_t queue_depth = write_tuner_.queue_depth();
+        if (writes_submitted_ >= queue_depth) {
             return;
         }
 
-        ssize_t writes_to_submit = std::min(kUsbWriteQueueDepth - writes_submitted_,
+        ssize_t writes_to_submit = std::min(queue_depth - writes_submitted_,
                                             write_requests_.size() - writes_submitted_);
         CHECK_GE(writes_to_submit, 0);
         if (writes_to_submit == 0) {
             return;
         }
 
-        struct iocb* iocbs[kUsbWriteQueueDepth];
+        struct iocb* iocbs[kUsbMaxQueueDepth];
         for (int i = 0; i < writes_to_submit; ++i) {
             CHECK(!write_requests_[writes_submitted_ + i].pending);
             write_requests_[writes_submitted_ + i].pending = true;
@@ -691,6 +763,12 @@ struct UsbFfsConnection : public Connection {
         }
     }
 
+  public:
+    std::string DumpStats() REQUIRES(g_usb_connection_mutex) {
+        return "link speed: " + link_speed_ + "\n" + read_tuner_.Dump() + write_tuner_.Dump();
+    }
+
+  private:
     void HandleError(const std::string& error) {
         std::call_once(error_flag_, [&]() {
             error_callback_(this, error);
@@ -718,9 +796,11 @@ struct UsbFfsConnection : public Connection {
     unique_fd write_fd_;
 
     std::optional<amessage> incoming_header_;
-    IOVector incoming_payload_;
+    Block incoming_payload_;
+    size_t incoming_payload_size_ = 0;
 
-    std::array<IoReadBlock, kUsbReadQueueDepth> read_requests_;
+    // Reads in flight are [needed_read_id_, next_read_id_), in slot id % kUsbMaxQueueDepth.
+    std::array<IoReadBlock, kUsbMaxQueueDepth> read_requests_;
     IOVector read_data_;
 
     // ID of the next request that we're going to send out.
@@ -734,6 +814,10 @@ struct UsbFfsConnection : public Connection {
     size_t next_write_id_ GUARDED_BY(write_mutex_) = 0;
     size_t writes_submitted_ GUARDED_BY(write_mutex_) = 0;
 
+    UsbTransferTuner read_tuner_{"read"};
+    UsbTransferTuner write_tuner_{"write"};
+    std::string link_speed_ GUARDED_BY(g_usb_connection_mutex) = "unknown";
+
     static constexpr int kInterruptionSignal = SIGUSR1;
 };
 
@@ -761,6 +845,14 @@ static void usb_ffs_open_thread() {
     }
 }
 
+std::string usb_ffs_stats() {
+    std::lock_guard<std::mutex> lock(g_usb_connection_mutex);
+    if (!g_usb_connection) {
+        return "no USB connection\n";
+    }
+    return g_usb_connection->DumpStats();
+}
+
 void usb_init() {
     std::thread(usb_ffs_open_thread).detach();
 }
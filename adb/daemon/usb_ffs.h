@@ -16,7 +16,12 @@
 
 #pragma once
 
+#include <string>
+
 #include <android-base/unique_fd.h>
 
 bool open_functionfs(android::base::unique_fd* control, android::base::unique_fd* bulk_out,
                      android::base::unique_fd* bulk_in);
+
+// Transfer statistics and sizing for each endpoint of the current FunctionFS connection.
+std::string usb_ffs_stats();
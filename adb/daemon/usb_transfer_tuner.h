@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <mutex>
+#include <string>
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <android-base/thread_annotations.h>
+
+#include "sysdeps/chrono.h"
+
+// Not all USB controllers support operations larger than 16k, so don't go above that unless the
+// link is SuperSpeed or better, where the controllers that negotiate it handle 64k.
+// Also, each submitted operation does an allocation in the kernel of that size, so we want to
+// minimize our queue depth while still maintaining a deep enough queue to keep the USB stack fed.
+// UsbTransferTuner picks where to sit between these for each endpoint.
+static constexpr size_t kUsbMinQueueDepth = 8;
+static constexpr size_t kUsbMinTransferSize = 4 * PAGE_SIZE;
+
+static constexpr size_t kUsbMaxQueueDepth = 16;
+static constexpr size_t kUsbMaxTransferSize = 16 * PAGE_SIZE;
+
+// Picks the transfer size and the number of transfers to keep in flight for one endpoint.
+//
+// Below SuperSpeed, this stays at kUsbMinTransferSize x kUsbMinQueueDepth, which is enough to
+// saturate the link. Above that, it looks at each window of completed transfers: while they keep
+// coming back full, it steps up through kLevels, unless the last step up made throughput worse, in
+// which case it steps back down and stays there. Once transfers stop coming back full, it steps
+// back down, since every transfer in flight pins a kernel allocation of its size.
+class UsbTransferTuner {
+  public:
+    explicit UsbTransferTuner(const char* name) : name_(name) {}
+
+    void SetSuperSpeed(bool super_speed) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        max_level_ = super_speed ? std::size(kLevels) - 1 : 0;
+        ceiling_ = max_level_;
+        level_ = std::min(level_, max_level_);
+    }
+
+    size_t transfer_size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return kLevels[level_].transfer_size;
+    }
+
+    size_t queue_depth() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return kLevels[level_].queue_depth;
+    }
+
+    // Record the completion of a transfer of `bytes` out of at most `capacity`. A packet's header,
+    // and the tail of a payload that already filled a transfer, come back short however big the
+    // transfers are, so they're recorded with `could_fill` unset: they count towards throughput,
+    // but not towards how many transfers came back full.
+    void Record(size_t bytes, size_t capacity, bool could_fill,
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        total_bytes_ += bytes;
+        ++total_transfers_;
+        if (bytes >= capacity) {
+            ++total_full_transfers_;
+        }
+
+        // Don't let an idle link drag down the throughput of the window it ends up in.
+        if (window_transfers_ == 0 || now - last_completion_ > kWindowDuration) {
+            window_start_ = now;
+            window_bytes_ = 0;
+            window_transfers_ = 0;
+            window_fillable_transfers_ = 0;
+            window_full_transfers_ = 0;
+        }
+        last_completion_ = now;
+
+        window_bytes_ += bytes;
+        ++window_transfers_;
+        if (could_fill) {
+            ++window_fillable_transfers_;
+            if (bytes >= capacity) {
+                ++window_full_transfers_;
+            }
+        }
+
+        auto elapsed = now - window_start_;
+        if (window_transfers_ < kWindowTransfers || elapsed < kWindowDuration) {
+            return;
+        }
+
+        double throughput = window_bytes_ / std::chrono::duration<double>(elapsed).count();
+        bool saturated = window_fillable_transfers_ > 0 &&
+                         window_full_transfers_ * 4 >= window_fillable_transfers_ * 3;
+        Adjust(throughput, saturated);
+        window_transfers_ = 0;
+    }
+
+    std::string Dump() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return android::base::StringPrintf("%s: %" PRIu64 " bytes in %" PRIu64 " transfers (%" PRIu64
+                            " full), %zu KiB x %zu in flight, %zu resizes\n",
+                            name_, total_bytes_, total_transfers_, total_full_transfers_,
+                            kLevels[level_].transfer_size / 1024, kLevels[level_].queue_depth,
+                            resizes_);
+    }
+
+  private:
+    void Adjust(double throughput, bool saturated) REQUIRES(mutex_) {
+        size_t old_level = level_;
+        if (!saturated) {
+            // We're not filling what we have. Whatever we learned about the ceiling was for
+            // different traffic, so forget it.
+            if (level_ > 0) {
+                --level_;
+            }
+            ceiling_ = max_level_;
+            stepped_up_ = false;
+        } else if (stepped_up_ && throughput < last_throughput_ * 0.95) {
+            --level_;
+            ceiling_ = level_;
+            stepped_up_ = false;
+        } else if (level_ < ceiling_) {
+            ++level_;
+            stepped_up_ = true;
+        } else {
+            stepped_up_ = false;
+        }
+        last_throughput_ = throughput;
+
+        if (level_ != old_level) {
+            ++resizes_;
+            LOG(INFO) << name_ << ": " << (level_ > old_level ? "growing" : "shrinking") << " to "
+                      << kLevels[level_].transfer_size / 1024 << " KiB x "
+                      << kLevels[level_].queue_depth << " at "
+                      << static_cast<uint64_t>(throughput / 1024) << " KiB/s";
+        }
+    }
+
+    struct Level {
+        size_t transfer_size;
+        size_t queue_depth;
+    };
+    static constexpr Level kLevels[] = {
+            {kUsbMinTransferSize, kUsbMinQueueDepth},
+            {2 * kUsbMinTransferSize, kUsbMinQueueDepth},
+            {kUsbMaxTransferSize, kUsbMinQueueDepth},
+            {kUsbMaxTransferSize, kUsbMaxQueueDepth},
+    };
+    static_assert(kUsbMaxTransferSize == 4 * kUsbMinTransferSize);
+
+    static constexpr size_t kWindowTransfers = 16;
+    static constexpr auto kWindowDuration = 100ms;
+
+    const char* name_;
+
+    std::mutex mutex_;
+    size_t level_ GUARDED_BY(mutex_) = 0;
+    size_t max_level_ GUARDED_BY(mutex_) = 0;
+    size_t ceiling_ GUARDED_BY(mutex_) = 0;
+    bool stepped_up_ GUARDED_BY(mutex_) = false;
+    double last_throughput_ GUARDED_BY(mutex_) = 0;
+
+    std::chrono::steady_clock::time_point window_start_ GUARDED_BY(mutex_);
+    std::chrono::steady_clock::time_point last_completion_ GUARDED_BY(mutex_);
+    uint64_t window_bytes_ GUARDED_BY(mutex_) = 0;
+    size_t window_transfers_ GUARDED_BY(mutex_) = 0;
+    size_t window_fillable_transfers_ GUARDED_BY(mutex_) = 0;
+    size_t window_full_transfers_ GUARDED_BY(mutex_) = 0;
+
+    uint64_t total_bytes_ GUARDED_BY(mutex_) = 0;
+    uint64_t total_transfers_ GUARDED_BY(mutex_) = 0;
+    uint64_t total_full_transfers_ GUARDED_BY(mutex_) = 0;
+    size_t resizes_ GUARDED_BY(mutex_) = 0;
+};
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "daemon/usb_transfer_tuner.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+
+using Clock = std::chrono::steady_clock;
+
+// Records a window's worth of transfers, `interval` apart, each of them full or half full.
+static void RecordWindow(UsbTransferTuner* tuner, Clock::time_point* now, bool full,
+                         Clock::duration interval = 10ms) {
+    size_t capacity = tuner->transfer_size();
+    for (int i = 0; i < 16; ++i) {
+        *now += interval;
+        tuner->Record(full ? capacity : capacity / 2, capacity, true, *now);
+    }
+}
+
+TEST(UsbTransferTunerTest, below_super_speed) {
+    UsbTransferTuner tuner("test");
+    tuner.SetSuperSpeed(false);
+    Clock::time_point now = Clock::now();
+    for (int i = 0; i < 4; ++i) {
+        RecordWindow(&tuner, &now, true);
+    }
+    ASSERT_EQ(kUsbMinTransferSize, tuner.transfer_size());
+    ASSERT_EQ(kUsbMinQueueDepth, tuner.queue_depth());
+}
+
+TEST(UsbTransferTunerTest, step_up_and_down) {
+    UsbTransferTuner tuner("test");
+    tuner.SetSuperSpeed(true);
+    Clock::time_point now = Clock::now();
+    ASSERT_EQ(kUsbMinTransferSize, tuner.transfer_size());
+
+    RecordWindow(&tuner, &now, true);
+    ASSERT_EQ(2 * kUsbMinTransferSize, tuner.transfer_size());
+    RecordWindow(&tuner, &now, true);
+    ASSERT_EQ(kUsbMaxTransferSize, tuner.transfer_size());
+    ASSERT_EQ(kUsbMinQueueDepth, tuner.queue_depth());
+    RecordWindow(&tuner, &now, true);
+    ASSERT_EQ(kUsbMaxTransferSize, tuner.transfer_size());
+    ASSERT_EQ(kUsbMaxQueueDepth, tuner.queue_depth());
+
+    // There's nowhere further up to go.
+    RecordWindow(&tuner, &now, true);
+    ASSERT_EQ(kUsbMaxQueueDepth, tuner.queue_depth());
+
+    // Transfers stopped coming back full.
+    RecordWindow(&tuner, &now, false);
+    ASSERT_EQ(kUsbMaxTransferSize, tuner.transfer_size());
+    ASSERT_EQ(kUsbMinQueueDepth, tuner.queue_depth());
+    RecordWindow(&tuner, &now, false);
+    ASSERT_EQ(2 * kUsbMinTransferSize, tuner.transfer_size());
+}
+
+TEST(UsbTransferTunerTest, ceiling) {
+    UsbTransferTuner tuner("test");
+    tuner.SetSuperSpeed(true);
+    Clock::time_point now = Clock::now();
+
+    RecordWindow(&tuner, &now, true);
+    ASSERT_EQ(2 * kUsbMinTransferSize, tuner.transfer_size());
+
+    // Bigger transfers made throughput worse, so go back and stay there.
+    RecordWindow(&tuner, &now, true, 30ms);
+    ASSERT_EQ(kUsbMinTransferSize, tuner.transfer_size());
+    RecordWindow(&tuner, &now, true, 30ms);
+    ASSERT_EQ(kUsbMinTransferSize, tuner.transfer_size());
+
+    // Until the traffic changes.
+    RecordWindow(&tuner, &now, false);
+    RecordWindow(&tuner, &now, true);
+    ASSERT_EQ(2 * kUsbMinTransferSize, tuner.transfer_size());
+}
+
+TEST(UsbTransferTunerTest, headers_and_tails) {
+    UsbTransferTuner tuner("test");
+    tuner.SetSuperSpeed(true);
+    Clock::time_point now = Clock::now();
+
+    // Packets of a header, three full transfers and a short tail: only three in five transfers
+    // come back full, but the link is saturated.
+    size_t capacity = tuner.transfer_size();
+    for (int packet = 0; packet < 4; ++packet) {
+        now += 10ms;
+        tuner.Record(24, capacity, false, now);
+        for (int i = 0; i < 3; ++i) {
+            now += 10ms;
+            tuner.Record(capacity, capacity, true, now);
+        }
+        now += 10ms;
+        tuner.Record(capacity / 4, capacity, false, now);
+    }
+    ASSERT_EQ(2 * kUsbMinTransferSize, tuner.transfer_size());
+
+    // Small packets never fill a transfer.
+    capacity = tuner.transfer_size();
+    for (int packet = 0; packet < 8; ++packet) {
+        now += 10ms;
+        tuner.Record(24, capacity, false, now);
+        now += 10ms;
+        tuner.Record(100, capacity, true, now);
+    }
+    ASSERT_EQ(kUsbMinTransferSize, tuner.transfer_size());
+}
@@ -19,6 +19,12 @@
 #include "sysdeps.h"
 
 #include <inttypes.h>
+#include <stdlib.h>
+
+#include <future>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 #include <android-base/logging.h>
 #include <android-base/stringprintf.h>
@@ -27,6 +33,7 @@
 #include "adb_utils.h"
 #include "fdevent.h"
 #include "fdevent_epoll.h"
+#include "fdevent_io_uring.h"
 #include "fdevent_poll.h"
 
 using namespace std::chrono_literals;
@@ -171,6 +178,10 @@ void fdevent_context::CheckMainThread() {
     }
 }
 
+bool fdevent_context::IsMainThread() {
+    return !main_thread_id_ || *main_thread_id_ == android::base::GetThreadId();
+}
+
 void fdevent_context::Run(std::function<void()> fn) {
     {
         std::lock_guard<std::mutex> lock(run_queue_mutex_);
@@ -185,10 +196,28 @@ void fdevent_context::TerminateLoop() {
     Interrupt();
 }
 
+// $ADB_FDEVENT_BACKEND picks the implementation: epoll (the default on Linux), io_uring, or poll
+// (the default elsewhere). io_uring falls back to epoll if the kernel doesn't support it.
 static std::unique_ptr<fdevent_context> fdevent_create_context() {
+    const char* backend = getenv("ADB_FDEVENT_BACKEND");
+    std::string_view name = backend ? backend : "";
+    if (name == "poll") {
+        return std::make_unique<fdevent_context_poll>();
+    }
 #if defined(__linux__)
+    if (name == "io_uring") {
+        if (fdevent_context_io_uring::IsSupported()) {
+            return std::make_unique<fdevent_context_io_uring>();
+        }
+        LOG(WARNING) << "io_uring is unavailable, falling back to epoll";
+    } else if (!name.empty() && name != "epoll") {
+        LOG(WARNING) << "unknown ADB_FDEVENT_BACKEND '" << name << "', using epoll";
+    }
     return std::make_unique<fdevent_context_epoll>();
 #else
+    if (!name.empty()) {
+        LOG(WARNING) << "unknown ADB_FDEVENT_BACKEND '" << name << "', using poll";
+    }
     return std::make_unique<fdevent_context_poll>();
 #endif
 }
@@ -198,7 +227,22 @@ static auto& g_ambient_fdevent_context() {
     return context;
 }
 
+struct fdevent_shard_loop {
+    fdevent_context* context;
+    std::thread thread;
+};
+
+static auto& g_shard_loops = *new std::vector<fdevent_shard_loop>();
+
+// The shard loop that's running on this thread, if any.
+static thread_local fdevent_context* current_shard_loop = nullptr;
+
+// fdevents belong to the loop of the thread that they're used on: the shard loop on one of its
+// threads, and the main loop everywhere else.
 static fdevent_context* fdevent_get_ambient() {
+    if (current_shard_loop) {
+        return current_shard_loop;
+    }
     return g_ambient_fdevent_context();
 }
 
@@ -237,26 +281,66 @@ void fdevent_set_timeout(fdevent* fde, std::optional<std::chrono::milliseconds>
 }
 
 void fdevent_run_on_main_thread(std::function<void()> fn) {
-    fdevent_get_ambient()->Run(std::move(fn));
+    g_ambient_fdevent_context()->Run(std::move(fn));
 }
 
 void fdevent_loop() {
-    fdevent_get_ambient()->Loop();
+    g_ambient_fdevent_context()->Loop();
 }
 
 void check_main_thread() {
-    fdevent_get_ambient()->CheckMainThread();
+    g_ambient_fdevent_context()->CheckMainThread();
 }
 
 void fdevent_terminate_loop() {
-    fdevent_get_ambient()->TerminateLoop();
+    g_ambient_fdevent_context()->TerminateLoop();
 }
 
 size_t fdevent_installed_count() {
-    return fdevent_get_ambient()->InstalledCount();
+    return g_ambient_fdevent_context()->InstalledCount();
+}
+
+void fdevent_start_shard_loops(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        fdevent_context* context = fdevent_create_context().release();
+
+        // Wait for the loop to have claimed its thread, so that IsMainThread gives the right
+        // answer from the start.
+        auto started = std::make_shared<std::promise<void>>();
+        std::future<void> running = started->get_future();
+        context->Run([started]() { started->set_value(); });
+
+        std::thread thread([context, i]() {
+            adb_thread_setname(android::base::StringPrintf("fdevent shard %zu", i));
+            current_shard_loop = context;
+            context->Loop();
+            current_shard_loop = nullptr;
+        });
+        running.wait();
+        g_shard_loops.push_back({context, std::move(thread)});
+    }
+    LOG(INFO) << "started " << count << " fdevent shard loops";
+}
+
+fdevent_context* fdevent_get_shard_loop(uint64_t key) {
+    if (g_shard_loops.empty()) {
+        return g_ambient_fdevent_context();
+    }
+    return g_shard_loops[key % g_shard_loops.size()].context;
+}
+
+bool fdevent_is_main_loop(const fdevent_context* context) {
+    return context == g_ambient_fdevent_context();
 }
 
 void fdevent_reset() {
+    for (auto& loop : g_shard_loops) {
+        loop.context->TerminateLoop();
+        loop.thread.join();
+        delete loop.context;
+    }
+    g_shard_loops.clear();
+
     auto old = std::exchange(g_ambient_fdevent_context(), fdevent_create_context().release());
     delete old;
 }
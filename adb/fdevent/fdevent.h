@@ -112,6 +112,10 @@ struct fdevent_context {
     // active main thread.
     void CheckMainThread();
 
+    // Whether the caller is running on the context's main thread, or there is no active main
+    // thread.
+    bool IsMainThread();
+
     // Queue an operation to be run on the main thread.
     void Run(std::function<void()> fn);
 
@@ -152,9 +156,22 @@ void check_main_thread();
 // Queue an operation to run on the main thread.
 void fdevent_run_on_main_thread(std::function<void()> fn);
 
+// Start |count| more event loops, each on a thread of its own, for work to be sharded across.
+// fdevents created on one of these threads belong to its loop, and the fdevent_* functions above
+// that take an fdevent act on that loop when they're called there; fdevent_loop,
+// check_main_thread and fdevent_run_on_main_thread always refer to the main loop.
+void fdevent_start_shard_loops(size_t count);
+
+// Get the loop that work identified by |key| is sharded to: one of the shard loops, or the main
+// loop if none have been started.
+fdevent_context* fdevent_get_shard_loop(uint64_t key);
+bool fdevent_is_main_loop(const fdevent_context* context);
+
 // The following functions are used only for tests.
 void fdevent_terminate_loop();
 size_t fdevent_installed_count();
+
+// Stops any shard loops, and replaces the main loop with a fresh one.
 void fdevent_reset();
 
 #endif
@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fdevent_io_uring.h"
+
+#if defined(__linux__)
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/threads.h>
+
+#include "adb_unique_fd.h"
+#include "fdevent.h"
+
+// Completions that aren't for a poll: the loop's timeout, and poll removals.
+static constexpr uint64_t kTimeoutToken = UINT64_MAX;
+static constexpr uint64_t kIgnoredToken = UINT64_MAX - 1;
+
+// Enough submissions for a loop iteration's rearms in the common case; more get submitted early.
+// The completion queue is larger, since every armed poll can fire at once, and the kernel
+// buffers overflowing completions anyway with IORING_FEAT_NODROP.
+static constexpr unsigned kSubmissionEntries = 256;
+static constexpr unsigned kCompletionEntries = 4096;
+
+static int io_uring_setup(unsigned entries, io_uring_params* params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void fdevent_interrupt(int fd, unsigned, void*) {
+    uint64_t buf;
+    ssize_t rc = TEMP_FAILURE_RETRY(adb_read(fd, &buf, sizeof(buf)));
+    if (rc == -1) {
+        PLOG(FATAL) << "failed to read from fdevent interrupt fd";
+    }
+}
+
+bool fdevent_context_io_uring::IsSupported() {
+    static bool supported = []() {
+        io_uring_params params = {};
+        unique_fd fd(io_uring_setup(1, &params));
+        if (fd == -1) {
+            PLOG(INFO) << "io_uring_setup failed";
+            return false;
+        }
+        if (!(params.features & IORING_FEAT_NODROP)) {
+            LOG(INFO) << "io_uring doesn't support IORING_FEAT_NODROP";
+            return false;
+        }
+
+        std::vector<char> buf(sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op));
+        auto* probe = reinterpret_cast<io_uring_probe*>(buf.data());
+        if (io_uring_register(fd.get(), IORING_REGISTER_PROBE, probe, IORING_OP_LAST) != 0) {
+            PLOG(INFO) << "failed to probe io_uring ops";
+            return false;
+        }
+        for (int op : {IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE, IORING_OP_TIMEOUT}) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                LOG(INFO) << "io_uring doesn't support op " << op;
+                return false;
+            }
+        }
+        return true;
+    }();
+    return supported;
+}
+
+fdevent_context_io_uring::fdevent_context_io_uring() {
+    io_uring_params params = {};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = kCompletionEntries;
+    ring_fd_.reset(io_uring_setup(kSubmissionEntries, &params));
+    if (ring_fd_ == -1) {
+        PLOG(FATAL) << "failed to create io_uring";
+    }
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring_fd_.get(), IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+        PLOG(FATAL) << "failed to map io_uring submission queue";
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ring_ = sq_ring_;
+    } else {
+        cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring_fd_.get(), IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED) {
+            PLOG(FATAL) << "failed to map io_uring completion queue";
+        }
+    }
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd_.get(), IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        PLOG(FATAL) << "failed to map io_uring submission queue entries";
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_entries_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sq_tail_local_ = *sq_tail_;
+
+    char* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    unique_fd interrupt_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+    if (interrupt_fd == -1) {
+        PLOG(FATAL) << "failed to create fdevent interrupt eventfd";
+    }
+
+    unique_fd interrupt_fd_dup(fcntl(interrupt_fd.get(), F_DUPFD_CLOEXEC, 3));
+    if (interrupt_fd_dup == -1) {
+        PLOG(FATAL) << "failed to dup fdevent interrupt eventfd";
+    }
+
+    this->interrupt_fd_ = std::move(interrupt_fd_dup);
+    this->interrupt_fde_ = this->Create(std::move(interrupt_fd), fdevent_interrupt, nullptr);
+    CHECK(this->interrupt_fde_ != nullptr);
+    this->Add(this->interrupt_fde_, FDE_READ);
+}
+
+fdevent_context_io_uring::~fdevent_context_io_uring() {
+    // Destroy calls virtual methods, but this class is final, so that's okay.
+    this->Destroy(this->interrupt_fde_);
+
+    // Closing the ring cancels whatever is still armed.
+    ring_fd_.reset();
+    munmap(sqes_, sqes_size_);
+    if (cq_ring_ != sq_ring_) {
+        munmap(cq_ring_, cq_ring_size_);
+    }
+    munmap(sq_ring_, sq_ring_size_);
+}
+
+io_uring_sqe* fdevent_context_io_uring::GetSqe() {
+    if (sq_tail_local_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+        Submit(0);
+        if (sq_tail_local_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+            LOG(FATAL) << "io_uring submission queue is full";
+        }
+    }
+
+    unsigned index = sq_tail_local_ & sq_mask_;
+    sq_array_[index] = index;
+    io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ++sq_tail_local_;
+    return sqe;
+}
+
+void fdevent_context_io_uring::Submit(unsigned min_complete) {
+    __atomic_store_n(sq_tail_, sq_tail_local_, __ATOMIC_RELEASE);
+    unsigned to_submit = sq_tail_local_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    if (io_uring_enter(ring_fd_.get(), to_submit, min_complete, flags) == -1) {
+        // Whatever wasn't submitted goes with the next call, after the loop has had a chance to
+        // reap completions.
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            PLOG(FATAL) << "io_uring_enter failed";
+        }
+    }
+}
+
+static unsigned calculate_poll_mask(fdevent* fde) {
+    unsigned result = 0;
+    if (fde->state & FDE_READ) {
+        result |= POLLIN;
+    }
+    if (fde->state & FDE_WRITE) {
+        result |= POLLOUT;
+    }
+    if (fde->state & FDE_ERROR) {
+        result |= POLLERR;
+    }
+    result |= POLLRDHUP;
+    return result;
+}
+
+void fdevent_context_io_uring::Arm(fdevent* fde, Poll* poll) {
+    CHECK_EQ(0U, poll->token);
+    poll->token = next_token_++;
+    poll->mask = calculate_poll_mask(fde);
+    armed_[poll->token] = fde;
+
+    io_uring_sqe* sqe = GetSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fde->fd.get();
+    sqe->poll_events = poll->mask;
+    sqe->user_data = poll->token;
+}
+
+void fdevent_context_io_uring::Disarm(Poll* poll) {
+    CHECK_NE(0U, poll->token);
+    io_uring_sqe* sqe = GetSqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = poll->token;
+    sqe->user_data = kIgnoredToken;
+
+    armed_.erase(poll->token);
+    poll->token = 0;
+}
+
+void fdevent_context_io_uring::Register(fdevent* fde) {
+    Arm(fde, &polls_[fde]);
+}
+
+void fdevent_context_io_uring::Unregister(fdevent* fde) {
+    auto it = polls_.find(fde);
+    CHECK(it != polls_.end());
+    if (it->second.token != 0) {
+        Disarm(&it->second);
+    }
+    polls_.erase(it);
+    fired_.erase(fde);
+}
+
+void fdevent_context_io_uring::Set(fdevent* fde, unsigned events) {
+    unsigned previous_state = fde->state;
+    fde->state = events;
+
+    // If the state is the same, or only differed by FDE_TIMEOUT, we don't need to rearm.
+    if ((previous_state & ~FDE_TIMEOUT) == (events & ~FDE_TIMEOUT)) {
+        return;
+    }
+
+    // A poll that fired gets rearmed with the new state after the callbacks, anyway.
+    Poll& poll = polls_[fde];
+    if (poll.token != 0 && poll.mask != calculate_poll_mask(fde)) {
+        Disarm(&poll);
+        Arm(fde, &poll);
+    }
+}
+
+void fdevent_context_io_uring::Loop() {
+    main_thread_id_ = android::base::GetThreadId();
+
+    std::vector<fdevent_event> fde_events;
+    std::unordered_map<fdevent*, unsigned> event_map;
+    while (true) {
+        if (terminate_loop_) {
+            break;
+        }
+
+        for (fdevent* fde : fired_) {
+            Arm(fde, &polls_[fde]);
+        }
+        fired_.clear();
+
+        // The timeout completes on the first completion of anything else, so that there's never
+        // more than one in flight.
+        std::optional<std::chrono::milliseconds> timeout = CalculatePollDuration();
+        if (timeout) {
+            timeout_ts_.tv_sec = timeout->count() / 1000;
+            timeout_ts_.tv_nsec = (timeout->count() % 1000) * 1000000;
+            io_uring_sqe* sqe = GetSqe();
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = reinterpret_cast<uint64_t>(&timeout_ts_);
+            sqe->len = 1;
+            sqe->off = 1;
+            sqe->user_data = kTimeoutToken;
+        }
+
+        Submit(1);
+
+        auto post_poll = std::chrono::steady_clock::now();
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+            auto it = armed_.find(cqe.user_data);
+            if (it == armed_.end()) {
+                // The timeout, a removal, or a poll that was disarmed before it fired.
+                continue;
+            }
+            fdevent* fde = it->second;
+            armed_.erase(it);
+            polls_[fde].token = 0;
+            fired_.insert(fde);
+
+            unsigned events = 0;
+            if (cqe.res < 0) {
+                LOG(ERROR) << dump_fde(fde) << " poll failed: " << strerror(-cqe.res);
+                events |= FDE_READ | FDE_ERROR;
+            } else {
+                if (cqe.res & POLLIN) {
+                    CHECK(fde->state & FDE_READ);
+                    events |= FDE_READ;
+                }
+                if (cqe.res & POLLOUT) {
+                    CHECK(fde->state & FDE_WRITE);
+                    events |= FDE_WRITE;
+                }
+                if (cqe.res & (POLLERR | POLLHUP | POLLRDHUP)) {
+                    // We fake a read, as the rest of the code assumes that errors will
+                    // be detected at that point.
+                    events |= FDE_READ | FDE_ERROR;
+                }
+            }
+            event_map[fde] |= events;
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+        for (auto& [fd, fde] : installed_fdevents_) {
+            unsigned events = 0;
+            if (auto it = event_map.find(&fde); it != event_map.end()) {
+                events = it->second;
+            }
+
+            if (events == 0) {
+                if (fde.timeout) {
+                    auto deadline = fde.last_active + *fde.timeout;
+                    if (deadline < post_poll) {
+                        events |= FDE_TIMEOUT;
+                    }
+                }
+            }
+
+            if (events != 0) {
+                LOG(DEBUG) << dump_fde(&fde) << " got events " << std::hex << std::showbase
+                           << events;
+                fde_events.push_back({&fde, events});
+                fde.last_active = post_poll;
+            }
+        }
+        this->HandleEvents(fde_events);
+        fde_events.clear();
+        event_map.clear();
+    }
+
+    main_thread_id_.reset();
+}
+
+size_t fdevent_context_io_uring::InstalledCount() {
+    // We always have an installed fde for interrupt.
+    return this->installed_fdevents_.size() - 1;
+}
+
+void fdevent_context_io_uring::Interrupt() {
+    uint64_t i = 1;
+    ssize_t rc = TEMP_FAILURE_RETRY(adb_write(this->interrupt_fd_, &i, sizeof(i)));
+    if (rc != sizeof(i)) {
+        PLOG(FATAL) << "failed to write to fdevent interrupt eventfd";
+    }
+}
+
+#endif  // defined(__linux__)
@@ -0,0 +1,104 @@
+#pragma once
+
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if defined(__linux__)
+
+#include "sysdeps.h"
+
+#include <linux/io_uring.h>
+
+#include <unordered_map>
+#include <unordered_set>
+
+#include "adb_unique_fd.h"
+#include "fdevent.h"
+
+// An fdevent_context that keeps a one-shot poll armed in an io_uring for each fdevent that's
+// waiting for something, along with a timeout for the nearest fdevent timeout.
+//
+// Rearming polls, changing what an fdevent waits for, and waiting for the next batch of
+// completions all go to the kernel in a single io_uring_enter per loop iteration, where epoll
+// needs an epoll_ctl for every change of an fdevent's state on top of the epoll_wait.
+struct fdevent_context_io_uring final : public fdevent_context {
+    fdevent_context_io_uring();
+    virtual ~fdevent_context_io_uring();
+
+    // Whether the kernel has everything that this needs: IORING_FEAT_NODROP, and the poll and
+    // timeout ops.
+    static bool IsSupported();
+
+    virtual void Register(fdevent* fde) final;
+    virtual void Unregister(fdevent* fde) final;
+
+    virtual void Set(fdevent* fde, unsigned events) final;
+
+    virtual void Loop() final;
+    size_t InstalledCount() final;
+
+  protected:
+    virtual void Interrupt() final;
+
+  private:
+    // The poll currently armed for an fdevent, if any.
+    struct Poll {
+        uint64_t token = 0;
+        unsigned mask = 0;
+    };
+
+    io_uring_sqe* GetSqe();
+    void Submit(unsigned min_complete);
+    void Arm(fdevent* fde, Poll* poll);
+    void Disarm(Poll* poll);
+
+    unique_fd ring_fd_;
+    void* sq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    void* cq_ring_ = nullptr;
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned sq_mask_;
+    unsigned sq_entries_;
+    unsigned* sq_array_;
+    // The tail of what's been queued, which only goes to the kernel on Submit.
+    unsigned sq_tail_local_;
+
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    io_uring_cqe* cqes_;
+
+    __kernel_timespec timeout_ts_;
+
+    // Tokens are the user_data of armed polls, so that completions of polls that have since
+    // been disarmed, possibly for an fdevent that's gone, can be told apart and dropped.
+    uint64_t next_token_ = 1;
+    std::unordered_map<fdevent*, Poll> polls_;
+    std::unordered_map<uint64_t, fdevent*> armed_;
+
+    // fdevents whose poll fired, to be rearmed once their callbacks have run.
+    std::unordered_set<fdevent*> fired_;
+
+    unique_fd interrupt_fd_;
+    fdevent* interrupt_fde_ = nullptr;
+};
+
+#endif  // defined(__linux__)
@@ -19,6 +19,7 @@
 #include <gtest/gtest.h>
 
 #include <chrono>
+#include <future>
 #include <limits>
 #include <memory>
 #include <queue>
@@ -26,11 +27,41 @@
 #include <thread>
 #include <vector>
 
+#include <android-base/threads.h>
+
 #include "adb_io.h"
+#include "fdevent_io_uring.h"
 #include "fdevent_test.h"
 
 using namespace std::chrono_literals;
 
+// Runs a test against each fdevent_context implementation, as picked by $ADB_FDEVENT_BACKEND.
+class FdeventBackendTest : public FdeventTest, public ::testing::WithParamInterface<std::string> {
+  protected:
+    void SetUp() override {
+#if defined(__linux__)
+        if (GetParam() == "io_uring" && !fdevent_context_io_uring::IsSupported()) {
+            GTEST_SKIP() << "io_uring is unsupported";
+        }
+        setenv("ADB_FDEVENT_BACKEND", GetParam().c_str(), 1);
+#endif
+        FdeventTest::SetUp();
+    }
+
+    void TearDown() override {
+#if defined(__linux__)
+        unsetenv("ADB_FDEVENT_BACKEND");
+#endif
+    }
+};
+
+#if defined(__linux__)
+INSTANTIATE_TEST_SUITE_P(Backends, FdeventBackendTest,
+                         ::testing::Values("epoll", "io_uring", "poll"));
+#else
+INSTANTIATE_TEST_SUITE_P(Backends, FdeventBackendTest, ::testing::Values("poll"));
+#endif
+
 class FdHandler {
   public:
     FdHandler(int read_fd, int write_fd, bool use_new_callback)
@@ -110,12 +141,12 @@ struct ThreadArg {
     size_t middle_pipe_count;
 };
 
-TEST_F(FdeventTest, fdevent_terminate) {
+TEST_P(FdeventBackendTest, fdevent_terminate) {
     PrepareThread();
     TerminateThread();
 }
 
-TEST_F(FdeventTest, smoke) {
+TEST_P(FdeventBackendTest, smoke) {
     for (bool use_new_callback : {true, false}) {
         fdevent_reset();
         const size_t PIPE_COUNT = 512;
@@ -172,7 +203,7 @@ TEST_F(FdeventTest, smoke) {
     }
 }
 
-TEST_F(FdeventTest, run_on_main_thread) {
+TEST_P(FdeventBackendTest, run_on_main_thread) {
     std::vector<int> vec;
 
     PrepareThread();
@@ -210,7 +241,7 @@ static std::function<void()> make_appender(std::vector<int>* vec, int value) {
     };
 }
 
-TEST_F(FdeventTest, run_on_main_thread_reentrant) {
+TEST_P(FdeventBackendTest, run_on_main_thread_reentrant) {
     std::vector<int> vec;
 
     PrepareThread();
@@ -223,7 +254,54 @@ TEST_F(FdeventTest, run_on_main_thread_reentrant) {
     }
 }
 
-TEST_F(FdeventTest, timeout) {
+TEST_P(FdeventBackendTest, shard_loops) {
+    PrepareThread();
+    fdevent_start_shard_loops(2);
+
+    fdevent_context* first = fdevent_get_shard_loop(0);
+    fdevent_context* second = fdevent_get_shard_loop(1);
+    ASSERT_NE(first, second);
+    ASSERT_EQ(first, fdevent_get_shard_loop(2));
+    ASSERT_FALSE(fdevent_is_main_loop(first));
+    ASSERT_FALSE(fdevent_is_main_loop(second));
+
+    // fdevents created on a shard loop's thread belong to that loop, and fire on its thread.
+    struct Fired {
+        fdevent_context* loop;
+        std::promise<uint64_t> thread_id;
+    };
+
+    for (fdevent_context* loop : {first, second}) {
+        ASSERT_FALSE(loop->IsMainThread());
+
+        int fds[2];
+        ASSERT_EQ(0, adb_socketpair(fds));
+        unique_fd peer(fds[0]);
+
+        Fired fired = {.loop = loop};
+        loop->Run([fd = fds[1], &fired]() {
+            fdevent* fde = fdevent_create(
+                    fd,
+                    [](fdevent* fde, unsigned, void* arg) {
+                        auto fired = static_cast<Fired*>(arg);
+                        CHECK(fired->loop->IsMainThread());
+                        fdevent_destroy(fde);
+                        fired->thread_id.set_value(android::base::GetThreadId());
+                    },
+                    &fired);
+            fdevent_add(fde, FDE_READ);
+        });
+
+        ASSERT_TRUE(WriteFdExactly(peer, "x", 1));
+        uint64_t thread_id = fired.thread_id.get_future().get();
+        ASSERT_NE(android::base::GetThreadId(), thread_id);
+    }
+
+    TerminateThread();
+    fdevent_reset();
+}
+
+TEST_P(FdeventBackendTest, timeout) {
     fdevent_reset();
     PrepareThread();
 
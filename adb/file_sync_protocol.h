@@ -36,6 +36,9 @@
 #define ID_OKAY MKID('O', 'K', 'A', 'Y')
 #define ID_FAIL MKID('F', 'A', 'I', 'L')
 #define ID_QUIT MKID('Q', 'U', 'I', 'T')
+#define ID_PIPE MKID('P', 'I', 'P', 'E')
+#define ID_HAVE MKID('H', 'A', 'V', 'E')
+#define ID_CHNK MKID('C', 'H', 'N', 'K')
 
 struct SyncRequest {
     uint32_t id;           // ID_STAT, et cetera.
@@ -92,6 +95,20 @@ struct __attribute__((packed)) sync_dent_v2 {
 enum SyncFlag : uint32_t {
     kSyncFlagNone = 0,
     kSyncFlagBrotli = 1,
+    kSyncFlagLZ4 = 2,
+    kSyncFlagZstd = 4,
+    // The file is sent as CHNK messages rather than DATA, see SYNC.TXT.
+    kSyncFlagDedup = 8,
+};
+
+// The compression of a send_v2 or recv_v2 transfer. At most one of the compression flags is set.
+// Any is only ever a request of the user's, that the client resolves to one of the others.
+enum class CompressionType {
+    None,
+    Any,
+    Brotli,
+    LZ4,
+    Zstd,
 };
 
 // send_v1 sent the path in a buffer, followed by a comma and the mode as a string.
@@ -119,6 +136,31 @@ struct __attribute__((packed)) sync_status {
     uint32_t msglen;
 };  // followed by `msglen` bytes of error message, if id == ID_FAIL.
 
+// The reply to ID_PIPE, see SYNC.TXT.
+struct __attribute__((packed)) sync_pipe {
+    uint32_t id;
+    uint32_t window;  // How many sends or recvs the client may have in flight.
+};
+
+// In pipelined mode, the status of a send, in place of sync_status.
+struct __attribute__((packed)) sync_pipe_status {
+    uint32_t id;
+    uint32_t transfer;  // The send's number: the first send on the connection is 0.
+    uint32_t msglen;
+};  // followed by `msglen` bytes of error message, if id == ID_FAIL.
+
+// In a send with kSyncFlagDedup, one chunk of the file, in place of DATA.
+struct __attribute__((packed)) sync_chunk {
+    uint32_t id;
+    uint32_t size;       // of the chunk, at most SYNC_DATA_MAX
+    uint32_t data_size;  // 0 if adbd already has the chunk, size if it's not compressed
+    uint8_t hash[32];    // SHA-256 of the chunk
+};  // followed by `data_size` bytes of data.
+
+// The reason a send with kSyncFlagDedup fails when a chunk it refers to is gone. The connection
+// stays open, so that the client can send the file again without dedup.
+#define SYNC_CHUNK_MISSING "chunk no longer on device"
+
 union syncmsg {
     sync_stat_v1 stat_v1;
     sync_stat_v2 stat_v2;
@@ -128,6 +170,12 @@ union syncmsg {
     sync_status status;
     sync_send_v2 send_v2_setup;
     sync_recv_v2 recv_v2_setup;
+    sync_pipe pipe;
+    sync_pipe_status pipe_status;
+    sync_chunk chunk;
 };
 
 #define SYNC_DATA_MAX (64 * 1024)
+
+// The most chunk hashes that a HAVE request may ask about.
+#define SYNC_HAVE_MAX 1024
@@ -98,7 +98,7 @@ struct asocket {
     size_t get_max_payload() const;
 };
 
-asocket *find_local_socket(unsigned local_id, unsigned remote_id);
+asocket* find_local_socket(atransport* t, unsigned local_id, unsigned remote_id);
 void install_local_socket(asocket *s);
 void remove_socket(asocket *s);
 void close_all_sockets(atransport *t);
@@ -110,6 +110,13 @@ asocket *create_remote_socket(unsigned id, atransport *t);
 void connect_to_remote(asocket* s, std::string_view destination);
 void connect_to_smartsocket(asocket *s);
 
+// Bind a local socket that was set up on the main thread to |t|, and connect it to |destination|.
+// Must be called on the main thread. Returns true if the socket stays on the main loop. Otherwise
+// it was either closed, because |t| is going away, or moved to |t|'s shard loop: its fdevent is
+// released before this returns and recreated on that loop. Either way the caller must not touch
+// |s| again, which from the socket's own fdevent callback means returning straight away.
+bool connect_local_socket_to_remote(asocket* s, atransport* t, std::string_view destination);
+
 // Internal functions that are only made available here for testing purposes.
 namespace internal {
 
@@ -19,6 +19,7 @@
 #include <gtest/gtest.h>
 
 #include <array>
+#include <future>
 #include <limits>
 #include <queue>
 #include <string>
@@ -33,6 +34,7 @@
 #include "socket.h"
 #include "sysdeps.h"
 #include "sysdeps/chrono.h"
+#include "transport.h"
 
 using namespace std::string_literals;
 using namespace std::string_view_literals;
@@ -308,6 +310,123 @@ TEST_F(LocalSocketTest, close_socket_in_CLOSE_WAIT_state) {
 
 #if ADB_HOST
 
+// Reads a packet that the server sent to a fake device.
+static bool ReadPacket(borrowed_fd fd, amessage* msg, std::string* payload) {
+    if (!ReadFdExactly(fd, msg, sizeof(*msg))) {
+        return false;
+    }
+    payload->resize(msg->data_length);
+    return ReadFdExactly(fd, payload->data(), payload->size());
+}
+
+// Sends a packet to the server from a fake device.
+static bool WritePacket(borrowed_fd fd, uint32_t command, uint32_t arg0, uint32_t arg1,
+                        std::string_view payload) {
+    amessage msg = {};
+    msg.command = command;
+    msg.arg0 = arg0;
+    msg.arg1 = arg1;
+    msg.data_length = payload.size();
+    msg.magic = command ^ 0xffffffff;
+    return WriteFdExactly(fd, &msg, sizeof(msg)) &&
+           WriteFdExactly(fd, payload.data(), payload.size());
+}
+
+// This test checks that a client can connect to a device service through a smart socket when
+// the device's transport lives on a shard loop: the client's local socket is moved over to that
+// loop from within its own fdevent callback, when the smart socket gets the service name.
+TEST_F(LocalSocketTest, smart_socket_connect_to_shard_loop) {
+    fdevent_start_shard_loops(1);
+    PrepareThread();
+    fdevent_run_on_main_thread([]() { init_transport_registration(); });
+    WaitForFdeventLoop();
+
+    int device_fds[2];
+    ASSERT_EQ(0, adb_socketpair(device_fds)) << strerror(errno);
+    unique_fd device(device_fds[0]);
+
+    // Answer the server's CNXN, so that the transport comes online.
+    std::thread handshake([&device]() {
+        amessage msg;
+        std::string payload;
+        ASSERT_TRUE(ReadPacket(device, &msg, &payload));
+        ASSERT_EQ(static_cast<uint32_t>(A_CNXN), msg.command);
+        ASSERT_TRUE(WritePacket(device, A_CNXN, A_VERSION, MAX_PAYLOAD, "device::"));
+    });
+    int error;
+    ASSERT_TRUE(register_socket_transport(
+            unique_fd(device_fds[1]), "smart_socket_test", 5555, 0,
+            [](atransport*) { return ReconnectResult::Abort; }, false, &error))
+            << strerror(error);
+    handshake.join();
+
+    int client_fds[2];
+    ASSERT_EQ(0, adb_socketpair(client_fds)) << strerror(errno);
+    unique_fd client(client_fds[0]);
+    fdevent_run_on_main_thread([fd = client_fds[1]]() {
+        asocket* s = create_local_socket(unique_fd(fd));
+        ASSERT_TRUE(s != nullptr);
+        connect_to_smartsocket(s);
+    });
+
+    char status[4];
+    ASSERT_TRUE(SendProtocolString(client, "host:transport-any"));
+    ASSERT_TRUE(ReadFdExactly(client, status, sizeof(status)));
+    ASSERT_EQ("OKAY", std::string(status, sizeof(status)));
+
+    // Hold the shard loop up until the main loop is done with the request, so that the main loop
+    // can't get away with touching the socket after handing it over.
+    std::promise<void> release;
+    fdevent_get_shard_loop(0)->Run([done = release.get_future().share()]() { done.wait(); });
+    ASSERT_TRUE(SendProtocolString(client, "shell:echo"));
+    WaitForFdeventLoop();
+    release.set_value();
+
+    // The socket opens the service from the shard loop...
+    amessage msg;
+    std::string payload;
+    ASSERT_TRUE(ReadPacket(device, &msg, &payload));
+    ASSERT_EQ(static_cast<uint32_t>(A_OPEN), msg.command);
+    ASSERT_EQ("shell:echo"s, payload.c_str());
+    const uint32_t local_id = msg.arg0;
+    constexpr uint32_t kRemoteId = 1;
+    ASSERT_TRUE(WritePacket(device, A_OKAY, kRemoteId, local_id, ""));
+    ASSERT_TRUE(ReadFdExactly(client, status, sizeof(status)));
+    ASSERT_EQ("OKAY", std::string(status, sizeof(status)));
+
+    // ...and then reads from the client there.
+    ASSERT_TRUE(WriteFdExactly(client, "hello"));
+    ASSERT_TRUE(ReadPacket(device, &msg, &payload));
+    ASSERT_EQ(static_cast<uint32_t>(A_WRTE), msg.command);
+    ASSERT_EQ(local_id, msg.arg0);
+    ASSERT_EQ(kRemoteId, msg.arg1);
+    ASSERT_EQ("hello", payload);
+
+    // Take the transport down, and wait for it to be gone before the loops are.
+    client.reset();
+    fdevent_run_on_main_thread([]() {
+        std::string error;
+        atransport* t = acquire_one_transport(kTransportAny, nullptr, 0, nullptr, &error);
+        ASSERT_TRUE(t != nullptr) << error;
+        t->Kick();
+    });
+    device.reset();
+    for (int i = 0; i < 50; ++i) {
+        WaitForFdeventLoop();
+        std::promise<bool> gone;
+        fdevent_run_on_main_thread([&gone]() {
+            std::string error;
+            gone.set_value(acquire_one_transport(kTransportAny, nullptr, 0, nullptr, &error,
+                                                 true) == nullptr);
+        });
+        if (gone.get_future().get()) {
+            break;
+        }
+    }
+    WaitForFdeventLoop();
+    TerminateThread();
+}
+
 #define VerifyParseHostServiceFailed(s)                                         \
     do {                                                                        \
         std::string service(s);                                                 \
@@ -57,10 +57,13 @@ static auto& local_socket_list = *new std::vector<asocket*>();
 */
 static auto& local_socket_closing_list = *new std::vector<asocket*>();
 
-// Parse the global list of sockets to find one with id |local_id|.
+// Parse the global list of sockets to find one with id |local_id|, that belongs to transport |t|.
 // If |peer_id| is not 0, also check that it is connected to a peer
 // with id |peer_id|. Returns an asocket handle on success, NULL on failure.
-asocket* find_local_socket(unsigned local_id, unsigned peer_id) {
+//
+// Sockets on other transports are off limits, both because the remote shouldn't be able to reach
+// them, and because they might be in use on another event loop.
+asocket* find_local_socket(atransport* t, unsigned local_id, unsigned peer_id) {
     asocket* result = nullptr;
 
     std::lock_guard<std::recursive_mutex> lock(local_socket_list_lock);
@@ -68,6 +71,10 @@ asocket* find_local_socket(unsigned local_id, unsigned peer_id) {
         if (s->id != local_id) {
             continue;
         }
+        if (s->transport != t && !(s->peer && s->peer->transport == t)) {
+            D("LS(%d): doesn't belong to transport %s", s->id, t->serial.c_str());
+            break;
+        }
         if (peer_id == 0 || (s->peer && s->peer->id == peer_id)) {
             result = s;
         }
@@ -99,6 +106,13 @@ void remove_socket(asocket* s) {
 }
 
 void close_all_sockets(atransport* t) {
+    // The transport's sockets may only be touched from its event loop.
+    fdevent_context* loop = t->event_loop();
+    if (!loop->IsMainThread()) {
+        loop->Run([t]() { close_all_sockets(t); });
+        return;
+    }
+
     /* this is a little gross, but since s->close() *will* modify
     ** the list out from under you, your options are limited.
     */
@@ -520,6 +534,38 @@ void connect_to_remote(asocket* s, std::string_view destination) {
     send_packet(p, s->transport);
 }
 
+bool connect_local_socket_to_remote(asocket* s, atransport* t, std::string_view destination) {
+    if (fdevent_is_main_loop(t->event_loop())) {
+        s->transport = t;
+        connect_to_remote(s, destination);
+        return true;
+    }
+
+    // Both callers run on the main thread, which owns the socket's fdevent until it's released
+    // here. Doing that right away, rather than from a later callback, means the socket can't be
+    // closed by an event on the main loop while it's being handed over.
+    check_main_thread();
+
+    // The transport might already be on its way out. While it's still listed, it can't be deleted
+    // before everything we queue up on its loop has run.
+    std::string error;
+    if (acquire_one_transport(kTransportAny, nullptr, t->id, nullptr, &error, true) != t) {
+        LOG(VERBOSE) << "LS(" << s->id << "): " << error;
+        s->close(s);
+        return false;
+    }
+
+    int fd = fdevent_release(s->fde).release();
+    s->fde = nullptr;
+    t->event_loop()->Run([s, t, fd, destination = std::string(destination)]() {
+        s->fde = fdevent_create(fd, local_socket_event_func, s);
+        s->transport = t;
+        D("LS(%d): moved to the event loop of transport %s", s->id, t->serial.c_str());
+        connect_to_remote(s, destination);
+    });
+    return false;
+}
+
 /* this is used by magic sockets to rig local sockets to
    send the go-ahead message when they connect */
 static void local_socket_ready_notify(asocket* s) {
@@ -873,12 +919,15 @@ static int smart_socket_enqueue(asocket* s, apacket::payload_type data) {
     s->peer->close = local_socket_close_notify;
     s->peer->peer = nullptr;
     /* give him our transport and upref it */
-    s->peer->transport = s->transport;
-
-    connect_to_remote(s->peer, std::string_view(s->smart_socket_data).substr(4));
-    s->peer = nullptr;
-    s->close(s);
-    return 1;
+    {
+        // If our peer was moved to another loop or closed, it must return from its fdevent
+        // callback without touching itself, as it does when we close it.
+        bool peer_kept = connect_local_socket_to_remote(
+                s->peer, s->transport, std::string_view(s->smart_socket_data).substr(4));
+        s->peer = nullptr;
+        s->close(s);
+        return peer_kept ? 1 : -1;
+    }
 
 fail:
     /* we're going to close our peer as a side-effect, so
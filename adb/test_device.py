@@ -1017,6 +1017,111 @@ class FileOperationsTest(DeviceTest):
             if host_dir is not None:
                 shutil.rmtree(host_dir)
 
+    def test_push_pull_dir_mixed(self):
+        """Push and pull back a directory of many small files and a few large ones.
+
+        With sync_pipeline, the small files are sent concurrently and the large ones inline.
+        """
+        self.device.shell(['rm', '-rf', self.DEVICE_TEMP_DIR])
+        self.device.shell(['mkdir', self.DEVICE_TEMP_DIR])
+
+        host_dir = None
+        pull_dir = None
+        try:
+            host_dir = tempfile.mkdtemp()
+            pull_dir = tempfile.mkdtemp()
+
+            # Make sure the temp directory isn't setuid, or else adb will complain.
+            os.chmod(host_dir, 0o700)
+
+            temp_files = make_random_host_files(in_dir=host_dir, num_files=300)
+            for i in range(3):
+                path = os.path.join(host_dir, 'large{}'.format(i))
+                rand_str = os.urandom(1024 * 1024 + i)
+                with open(path, 'wb') as f:
+                    f.write(rand_str)
+                temp_files.append(HostFile(f, compute_md5(rand_str)))
+
+            self.device.push(host_dir, self.DEVICE_TEMP_DIR)
+            remote_dir = posixpath.join(self.DEVICE_TEMP_DIR, os.path.basename(host_dir))
+            self.device.pull(remote=remote_dir, local=pull_dir)
+
+            for temp_file in temp_files:
+                host_path = os.path.join(pull_dir, os.path.basename(host_dir),
+                                         temp_file.base_name)
+                self._verify_local(temp_file.checksum, host_path)
+
+            self.device.shell(['rm', '-rf', self.DEVICE_TEMP_DIR])
+        finally:
+            if host_dir is not None:
+                shutil.rmtree(host_dir)
+            if pull_dir is not None:
+                shutil.rmtree(pull_dir)
+
+    def test_push_pull_compression(self):
+        """Push and pull back compressible and incompressible files with each algorithm."""
+        self.device.shell(['rm', '-rf', self.DEVICE_TEMP_DIR])
+        self.device.shell(['mkdir', self.DEVICE_TEMP_DIR])
+
+        host_dir = None
+        try:
+            host_dir = tempfile.mkdtemp()
+            contents = {
+                'text': b''.join(b'line %d\n' % i for i in range(300000)),
+                'random': os.urandom(1024 * 1024 + 1),
+                'empty': b'',
+            }
+            for name, data in contents.items():
+                with open(os.path.join(host_dir, name), 'wb') as f:
+                    f.write(data)
+
+            for algorithm in ['any', 'none', 'brotli', 'lz4', 'zstd']:
+                for name, data in contents.items():
+                    host_path = os.path.join(host_dir, name)
+                    device_path = posixpath.join(self.DEVICE_TEMP_DIR, name)
+                    pull_path = host_path + '.' + algorithm
+                    subprocess.check_call(self.device.adb_cmd +
+                                          ['push', '-z', algorithm, host_path, device_path])
+                    subprocess.check_call(self.device.adb_cmd +
+                                          ['pull', '-z', algorithm, device_path, pull_path])
+                    self._verify_local(compute_md5(data), pull_path)
+
+            self.device.shell(['rm', '-rf', self.DEVICE_TEMP_DIR])
+        finally:
+            if host_dir is not None:
+                shutil.rmtree(host_dir)
+
+    def test_push_pull_no_compression(self):
+        """Push and pull back a file uncompressed, with and without adbd splicing it."""
+        self.device.shell(['rm', '-rf', self.DEVICE_TEMP_DIR])
+        self.device.shell(['mkdir', self.DEVICE_TEMP_DIR])
+
+        host_dir = None
+        try:
+            host_dir = tempfile.mkdtemp()
+            # Not a multiple of the sync buffer, so that the last DATA is short.
+            data = os.urandom(4 * 1024 * 1024 + 1)
+            host_path = os.path.join(host_dir, 'random')
+            with open(host_path, 'wb') as f:
+                f.write(data)
+
+            device_path = posixpath.join(self.DEVICE_TEMP_DIR, 'random')
+            for splice in ['1', '0']:
+                self.device.shell(['setprop', 'debug.adbd.sync.splice', splice])
+                pull_path = host_path + '.' + splice
+                subprocess.check_call(self.device.adb_cmd +
+                                      ['push', '-Z', host_path, device_path])
+                self._verify_remote(compute_md5(data), device_path)
+                subprocess.check_call(self.device.adb_cmd +
+                                      ['pull', '-Z', device_path, pull_path])
+                self._verify_local(compute_md5(data), pull_path)
+
+            self.device.shell(['rm', '-rf', self.DEVICE_TEMP_DIR])
+        finally:
+            self.device.shell(['setprop', 'debug.adbd.sync.splice', "''"])
+            if host_dir is not None:
+                shutil.rmtree(host_dir)
+
     def test_pull_dir_symlink(self):
         """Pull a directory into a symlink to a directory.
 
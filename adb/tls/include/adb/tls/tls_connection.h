@@ -108,6 +108,13 @@ class TlsConnection {
     // Returns false otherwise.
     virtual bool WriteFully(std::string_view data) = 0;
 
+    // Writes the concatenation of |data|, without concatenating it first.
+    // Leading pieces that fit in a single TLS record share one, so that a
+    // small header in front of a payload doesn't cost a record (and a write)
+    // of its own. Returns true if all of the data was written, false
+    // otherwise.
+    virtual bool WriteFully(const std::vector<std::string_view>& data) = 0;
+
     // Create a new TlsConnection instance. |cert| and |priv_key| cannot be
     // empty.
     static std::unique_ptr<TlsConnection> Create(Role role, std::string_view cert,
@@ -315,6 +315,33 @@ TEST_F(AdbWifiTlsConnectionTest, NoCertificateVerification) {
     WaitForClientConnection();
 }
 
+TEST_F(AdbWifiTlsConnectionTest, WriteFullyGathered) {
+    server_->SetCertVerifyCallback([](X509_STORE_CTX*) { return 1; });
+    client_->SetCertVerifyCallback([](X509_STORE_CTX*) { return 1; });
+    StartClientHandshakeAsync(TlsError::Success);
+
+    ASSERT_EQ(server_->DoHandshake(), TlsError::Success);
+    WaitForClientConnection();
+
+    // A header, an empty piece, and a payload spanning several records
+    std::string header(24, 'h');
+    std::string payload(100000, 'p');
+    for (size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = static_cast<char>(i);
+    }
+    client_thread_ = std::thread([&]() {
+        EXPECT_TRUE(client_->WriteFully({header, "", payload}));
+        EXPECT_TRUE(client_->WriteFully(std::vector<std::string_view>{header}));
+    });
+
+    std::string expected = header + payload + header;
+    std::vector<uint8_t> buf(expected.size());
+    ASSERT_TRUE(server_->ReadFully(buf.data(), buf.size()));
+    EXPECT_EQ(expected, std::string(buf.begin(), buf.end()));
+
+    WaitForClientConnection();
+}
+
 TEST_F(AdbWifiTlsConnectionTest, NoTrustedCertificates) {
     StartClientHandshakeAsync(TlsError::CertificateRejected);
 
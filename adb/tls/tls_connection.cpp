@@ -16,6 +16,8 @@
 
 #include "adb/tls/tls_connection.h"
 
+#include <string.h>
+
 #include <algorithm>
 #include <vector>
 
@@ -49,6 +51,7 @@ class TlsConnectionImpl : public TlsConnection {
     std::vector<uint8_t> ReadFully(size_t size) override;
     bool ReadFully(void* buf, size_t size) override;
     bool WriteFully(std::string_view data) override;
+    bool WriteFully(const std::vector<std::string_view>& data) override;
 
     static bssl::UniquePtr<EVP_PKEY> EvpPkeyFromPEM(std::string_view pem);
     static bssl::UniquePtr<CRYPTO_BUFFER> BufferFromPEM(std::string_view pem);
@@ -355,6 +358,34 @@ bool TlsConnectionImpl::WriteFully(std::string_view data) {
     }
     return true;
 }
+
+bool TlsConnectionImpl::WriteFully(const std::vector<std::string_view>& data) {
+    // Fill the first record from as many of the pieces as it holds. Whatever is left goes
+    // straight to SSL_write.
+    char record[SSL3_RT_MAX_PLAIN_LENGTH];
+    size_t record_size = 0;
+    std::string_view rest;
+    auto it = data.begin();
+    for (; it != data.end() && rest.empty(); ++it) {
+        size_t n = std::min(it->size(), sizeof(record) - record_size);
+        memcpy(record + record_size, it->data(), n);
+        record_size += n;
+        rest = it->substr(n);
+    }
+
+    if (record_size > 0 && !WriteFully(std::string_view(record, record_size))) {
+        return false;
+    }
+    if (!rest.empty() && !WriteFully(rest)) {
+        return false;
+    }
+    for (; it != data.end(); ++it) {
+        if (!it->empty() && !WriteFully(*it)) {
+            return false;
+        }
+    }
+    return true;
+}
 }  // namespace
 
 // static
@@ -83,6 +83,10 @@ const char* const kFeatureAbbExec = "abb_exec";
 const char* const kFeatureRemountShell = "remount_shell";
 const char* const kFeatureSendRecv2 = "sendrecv_v2";
 const char* const kFeatureSendRecv2Brotli = "sendrecv_v2_brotli";
+const char* const kFeatureSendRecv2LZ4 = "sendrecv_v2_lz4";
+const char* const kFeatureSendRecv2Zstd = "sendrecv_v2_zstd";
+const char* const kFeatureSyncPipeline = "sync_pipeline";
+const char* const kFeatureSendRecv2Dedup = "sendrecv_v2_dedup";
 
 namespace {
 
@@ -441,16 +445,19 @@ bool FdConnection::DispatchRead(void* buf, size_t len) {
     return ReadFdExactly(fd_.get(), buf, len);
 }
 
-bool FdConnection::DispatchWrite(void* buf, size_t len) {
+// The header and payload go out together, in one writev, or in a shared TLS record, rather than
+// in a write each.
+bool FdConnection::DispatchWrite(std::string_view header, std::string_view payload) {
     if (tls_ != nullptr) {
-        // The TlsConnection doesn't allow 0 byte writes
-        if (len == 0) {
-            return true;
-        }
-        return tls_->WriteFully(std::string_view(reinterpret_cast<const char*>(buf), len));
+        return tls_->WriteFully(std::vector<std::string_view>{header, payload});
     }
 
-    return WriteFdExactly(fd_.get(), buf, len);
+    adb_iovec iov[2];
+    iov[0].iov_base = const_cast<char*>(header.data());
+    iov[0].iov_len = header.size();
+    iov[1].iov_base = const_cast<char*>(payload.data());
+    iov[1].iov_len = payload.size();
+    return WriteFdExactly(fd_.get(), iov, 2);
 }
 
 bool FdConnection::Read(apacket* packet) {
@@ -475,18 +482,13 @@ bool FdConnection::Read(apacket* packet) {
 }
 
 bool FdConnection::Write(apacket* packet) {
-    if (!DispatchWrite(&packet->msg, sizeof(packet->msg))) {
+    std::string_view header(reinterpret_cast<const char*>(&packet->msg), sizeof(packet->msg));
+    std::string_view payload(packet->payload.data(), packet->msg.data_length);
+    if (!DispatchWrite(header, payload)) {
         D("remote local: write terminated");
         return false;
     }
 
-    if (packet->msg.data_length) {
-        if (!DispatchWrite(&packet->payload[0], packet->msg.data_length)) {
-            D("remote local: write terminated");
-            return false;
-        }
-    }
-
     return true;
 }
 
@@ -782,9 +784,19 @@ static void transport_registration_func(int _fd, unsigned ev, void*) {
             transport_list.remove(t);
         }
 
-        delete t;
-
-        update_transports();
+        auto destroy = [t]() {
+            delete t;
+            update_transports();
+        };
+
+        // Packets for the transport's sockets and closing them might still be queued up on its
+        // event loop, so let those run first.
+        fdevent_context* loop = t->event_loop();
+        if (fdevent_is_main_loop(loop)) {
+            destroy();
+        } else {
+            loop->Run([destroy]() { fdevent_run_on_main_thread(destroy); });
+        }
         return;
     }
 
@@ -800,10 +812,7 @@ static void transport_registration_func(int _fd, unsigned ev, void*) {
             }
 
             VLOG(TRANSPORT) << dump_packet(t->serial.c_str(), "from remote", p.get());
-            apacket* packet = p.release();
-
-            // TODO: Does this need to run on the main thread?
-            fdevent_run_on_main_thread([packet, t]() { handle_packet(packet, t); });
+            t->DispatchPacket(p.release());
             return true;
         });
         t->connection()->SetErrorCallback([t](Connection*, const std::string& error) {
@@ -912,6 +921,7 @@ static void transport_destroy(atransport* t) {
 
     std::lock_guard<std::recursive_mutex> lock(transport_lock);
     LOG(INFO) << "destroying transport " << t->serial_name();
+    VLOG(TRANSPORT) << BlockPool::DumpStats();
     t->connection()->Stop();
 #if ADB_HOST
     if (t->IsTcpDevice() && !t->kicked()) {
@@ -1094,6 +1104,42 @@ int atransport::Write(apacket* p) {
     return this->connection()->Write(std::unique_ptr<apacket>(p)) ? 0 : -1;
 }
 
+void atransport::DispatchPacket(apacket* p) {
+    fdevent_context* loop = event_loop();
+    if (fdevent_is_main_loop(loop)) {
+        fdevent_run_on_main_thread([p, this]() { handle_packet(p, this); });
+        return;
+    }
+
+    bool socket_packet = false;
+    switch (p->msg.command) {
+        case A_OPEN:
+        case A_OKAY:
+        case A_WRTE:
+        case A_CLSE:
+            socket_packet = true;
+            break;
+    }
+
+    // Packets are read on a single thread, so this can't race with itself. To keep socket packets
+    // in order with whatever came before them, they only skip the main thread when nothing is
+    // queued up for it: the count only drops once a socket packet has been passed on to the loop.
+    if (socket_packet && main_thread_packets_ == 0) {
+        loop->Run([p, this]() { handle_packet(p, this); });
+        return;
+    }
+
+    ++main_thread_packets_;
+    fdevent_run_on_main_thread([p, this, loop, socket_packet]() {
+        if (socket_packet) {
+            loop->Run([p, this]() { handle_packet(p, this); });
+        } else {
+            handle_packet(p, this);
+        }
+        --main_thread_packets_;
+    });
+}
+
 void atransport::Reset() {
     if (!kicked_.exchange(true)) {
         LOG(INFO) << "resetting transport " << this << " " << this->serial;
@@ -1184,6 +1230,10 @@ const FeatureSet& supported_features() {
             kFeatureRemountShell,
             kFeatureSendRecv2,
             kFeatureSendRecv2Brotli,
+            kFeatureSendRecv2LZ4,
+            kFeatureSendRecv2Zstd,
+            kFeatureSyncPipeline,
+            kFeatureSendRecv2Dedup,
             // Increment ADB_SERVER_VERSION when adding a feature that adbd needs
             // to know about. Otherwise, the client can be stuck running an old
             // version of the server even after upgrading their copy of adb.
@@ -87,6 +87,14 @@ extern const char* const kFeatureRemountShell;
 extern const char* const kFeatureSendRecv2;
 // adbd supports brotli for send/recv v2.
 extern const char* const kFeatureSendRecv2Brotli;
+// adbd supports LZ4 for send/recv v2.
+extern const char* const kFeatureSendRecv2LZ4;
+// adbd supports Zstd for send/recv v2.
+extern const char* const kFeatureSendRecv2Zstd;
+// adbd supports pipelined sync transfers, see SYNC.TXT.
+extern const char* const kFeatureSyncPipeline;
+// adbd supports deduplicated sends, see SYNC.TXT.
+extern const char* const kFeatureSendRecv2Dedup;
 
 TransportId NextTransportId();
 
@@ -196,7 +204,7 @@ struct FdConnection : public BlockingConnection {
 
   private:
     bool DispatchRead(void* buf, size_t len);
-    bool DispatchWrite(void* buf, size_t len);
+    bool DispatchWrite(std::string_view header, std::string_view payload);
 
     unique_fd fd_;
     std::unique_ptr<adb::tls::TlsConnection> tls_;
@@ -288,7 +296,8 @@ class atransport : public enable_weak_from_this<atransport> {
 
     const TransportId id;
 
-    bool online = false;
+    // Written on the main thread, and read on the transport's event loop.
+    std::atomic<bool> online = false;
     TransportType type = kTransportAny;
 
     // Used to identify transports for clients.
@@ -367,6 +376,15 @@ class atransport : public enable_weak_from_this<atransport> {
     // Attempts to reconnect with the underlying Connection.
     ReconnectResult Reconnect();
 
+    // The event loop that the transport's sockets live on, and that packets for them are handled
+    // on. This is one of the shard loops, if the server has started any, or the main loop.
+    fdevent_context* event_loop() const { return fdevent_get_shard_loop(id); }
+
+    // Queue up a packet that was read from the connection to be handled on the right thread:
+    // OPEN, OKAY, WRTE and CLSE on the transport's event loop, and everything else, which can
+    // change the state of the transport as a whole, on the main thread.
+    void DispatchPacket(apacket* p);
+
   private:
     std::atomic<bool> kicked_;
 
@@ -380,6 +398,10 @@ class atransport : public enable_weak_from_this<atransport> {
     std::list<adisconnect*> disconnects_;
 
     std::atomic<ConnectionState> connection_state_;
+
+    // The number of packets that DispatchPacket has queued up for the main thread, and that
+    // haven't been handled (or passed on to the event loop) yet.
+    std::atomic<size_t> main_thread_packets_ = 0;
 #if ADB_HOST
     std::deque<std::shared_ptr<RSA>> keys_;
 #endif
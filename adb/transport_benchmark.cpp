@@ -16,10 +16,18 @@
 
 #include <malloc.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <android-base/logging.h>
 #include <benchmark/benchmark.h>
 
+#include "adb_io.h"
 #include "adb_trace.h"
 #include "sysdeps.h"
 #include "transport.h"
@@ -51,6 +59,15 @@ std::unique_ptr<Connection> MakeConnection<NonblockingFdConnection>(unique_fd fd
     return Connection::FromFd(std::move(fd));
 }
 
+// Reports how many of the Blocks allocated per iteration came from the BlockPool.
+static void ReportBlockPool(benchmark::State& state, const BlockPool::Stats& before) {
+    BlockPool::Stats after = BlockPool::GetStats();
+    state.counters["pool_hits"] =
+            benchmark::Counter(after.hits - before.hits, benchmark::Counter::kAvgIterations);
+    state.counters["pool_misses"] =
+            benchmark::Counter(after.misses - before.misses, benchmark::Counter::kAvgIterations);
+}
+
 template <typename ConnectionType>
 void BM_Connection_Unidirectional(benchmark::State& state) {
     int fds[2];
@@ -77,6 +94,7 @@ void BM_Connection_Unidirectional(benchmark::State& state) {
     client->Start();
     server->Start();
 
+    BlockPool::Stats before = BlockPool::GetStats();
     for (auto _ : state) {
         size_t data_size = state.range(0);
         std::unique_ptr<apacket> packet = std::make_unique<apacket>();
@@ -94,6 +112,7 @@ void BM_Connection_Unidirectional(benchmark::State& state) {
         }
     }
     state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+    ReportBlockPool(state, before);
 
     client->Stop();
     server->Stop();
@@ -101,6 +120,58 @@ void BM_Connection_Unidirectional(benchmark::State& state) {
 
 ADB_CONNECTION_BENCHMARK(BM_Connection_Unidirectional);
 
+// Payload sized Block allocations, filled as a read would, with a few kept alive at a time as
+// packets queued on a transport are.
+void BM_Block_Allocate(benchmark::State& state) {
+    BlockPool::Stats before = BlockPool::GetStats();
+    size_t data_size = state.range(0);
+    std::vector<Block> in_flight(8);
+    size_t i = 0;
+    for (auto _ : state) {
+        Block block(data_size);
+        memset(block.data(), 0xff, data_size);
+        in_flight[i++ % in_flight.size()] = std::move(block);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * data_size);
+    ReportBlockPool(state, before);
+}
+BENCHMARK(BM_Block_Allocate)->Arg(16384)->Arg(MAX_PAYLOAD);
+
+// The same, straight from the allocator, as Block used to.
+void BM_Block_Allocate_Unpooled(benchmark::State& state) {
+    size_t data_size = state.range(0);
+    std::vector<std::unique_ptr<char[]>> in_flight(8);
+    size_t i = 0;
+    for (auto _ : state) {
+        std::unique_ptr<char[]> data(new char[data_size]);
+        memset(data.get(), 0xff, data_size);
+        in_flight[i++ % in_flight.size()] = std::move(data);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * data_size);
+}
+BENCHMARK(BM_Block_Allocate_Unpooled)->Arg(16384)->Arg(MAX_PAYLOAD);
+
+// A read as NonblockingFdConnection does one, into a MAX_PAYLOAD Block, followed by the
+// coalescing of a payload that spans two of them.
+void BM_IOVector_Coalesce(benchmark::State& state) {
+    BlockPool::Stats before = BlockPool::GetStats();
+    size_t data_size = state.range(0);
+    for (auto _ : state) {
+        IOVector chain;
+        for (int i = 0; i < 2; ++i) {
+            Block block(MAX_PAYLOAD);
+            memset(block.data(), 0xff, data_size / 2);
+            block.resize(data_size / 2);
+            chain.append(std::move(block));
+        }
+        Block payload = chain.coalesce();
+        benchmark::DoNotOptimize(payload.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * data_size);
+    ReportBlockPool(state, before);
+}
+BENCHMARK(BM_IOVector_Coalesce)->Arg(16384)->Arg(MAX_PAYLOAD);
+
 enum class ThreadPolicy {
     MainThread,
     SameThread,
@@ -182,6 +253,231 @@ void BM_Connection_Echo(benchmark::State& state) {
 ADB_CONNECTION_BENCHMARK(BM_Connection_Echo, ThreadPolicy::SameThread);
 ADB_CONNECTION_BENCHMARK(BM_Connection_Echo, ThreadPolicy::MainThread);
 
+// Echoes a byte through each of state.range(0) sockets watched by the fdevent loop, to measure
+// the loop itself with many fds attached, as on a server with lots of devices. Like the server's,
+// the fdevents are created once the loop is running.
+static void BM_Fdevent_Echo(benchmark::State& state, const char* backend) {
+    setenv("ADB_FDEVENT_BACKEND", backend, 1);
+    fdevent_reset();
+    unsetenv("ADB_FDEVENT_BACKEND");
+    std::thread fdevent_thread([]() { fdevent_loop(); });
+
+    std::vector<unique_fd> peers;
+    std::vector<int> fds;
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        int sockets[2];
+        if (adb_socketpair(sockets) != 0) {
+            LOG(FATAL) << "failed to create socketpair";
+        }
+        peers.emplace_back(sockets[0]);
+        fds.push_back(sockets[1]);
+    }
+
+    std::vector<fdevent*> fdes;
+    std::promise<void> created;
+    fdevent_run_on_main_thread([&]() {
+        for (int fd : fds) {
+            fdevent* fde = fdevent_create(fd, [](int fd, unsigned, void*) {
+                char c;
+                if (adb_read(fd, &c, 1) == 1) {
+                    adb_write(fd, &c, 1);
+                }
+            }, nullptr);
+            fdevent_add(fde, FDE_READ);
+            fdes.push_back(fde);
+        }
+        created.set_value();
+    });
+    created.get_future().wait();
+
+    for (auto _ : state) {
+        char c = 'x';
+        for (const unique_fd& peer : peers) {
+            adb_write(peer, &c, 1);
+        }
+        for (const unique_fd& peer : peers) {
+            adb_read(peer, &c, 1);
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+
+    fdevent_run_on_main_thread([&fdes]() {
+        for (fdevent* fde : fdes) {
+            fdevent_destroy(fde);
+        }
+    });
+    fdevent_terminate_loop();
+    fdevent_thread.join();
+}
+
+// Not a macro, since sysdeps.h defines poll to keep it from being called directly.
+BENCHMARK_CAPTURE(BM_Fdevent_Echo, epoll, "epoll")->Arg(1)->Arg(64)->Arg(512)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Fdevent_Echo, io_uring, "io_uring")->Arg(1)->Arg(64)->Arg(512)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Fdevent_Echo, poll, "poll")->Arg(1)->Arg(64)->Arg(512)->UseRealTime();
+
+// Streams data from state.range(0) devices at once, each through one socket on a transport of
+// its own, to clients that just drain it, as a device farm's server does with lots of concurrent
+// pulls. Every packet goes through handle_packet, and the socket's fdevent, on the transport's
+// event loop, which is the main loop unless state.range(1) shard loops have been started.
+static void BM_Transport_Load(benchmark::State& state) {
+    constexpr size_t kPayloadSize = 16384;
+    constexpr size_t kPacketsPerRound = 16;
+    constexpr unsigned kRemoteId = 1;
+
+    fdevent_reset();
+    fdevent_start_shard_loops(state.range(1));
+    std::thread fdevent_thread([]() { fdevent_loop(); });
+
+    struct Device {
+        std::unique_ptr<atransport> transport;
+        asocket* socket;
+        unsigned local_id;
+
+        // The device's end of the transport's connection, and the client's end of the socket.
+        unique_fd fd;
+        unique_fd client;
+    };
+
+    std::vector<Device> devices(state.range(0));
+    for (Device& device : devices) {
+        int connection_fds[2];
+        int socket_fds[2];
+        if (adb_socketpair(connection_fds) != 0 || adb_socketpair(socket_fds) != 0) {
+            LOG(FATAL) << "failed to create socketpair";
+        }
+        device.fd.reset(connection_fds[0]);
+        device.client.reset(socket_fds[0]);
+
+        atransport* t = new atransport(kCsDevice);
+        device.transport.reset(t);
+        t->update_version(A_VERSION, MAX_PAYLOAD);
+        t->online = true;
+        t->SetConnection(MakeConnection<FdConnection>(unique_fd(connection_fds[1])));
+        t->connection()->SetReadCallback([t](Connection*, std::unique_ptr<apacket> p) {
+            t->DispatchPacket(p.release());
+            return true;
+        });
+        t->connection()->SetErrorCallback([](Connection*, const std::string&) {});
+        t->connection()->Start();
+
+        // Like one for a reverse forward, the socket is opened on the transport's event loop.
+        std::promise<void> created;
+        t->event_loop()->Run([&device, &created, t, fd = socket_fds[1]]() {
+            device.socket = create_local_socket(unique_fd(fd));
+            device.socket->peer = create_remote_socket(kRemoteId, t);
+            device.socket->peer->peer = device.socket;
+            device.local_id = device.socket->id;
+            created.set_value();
+        });
+        created.get_future().wait();
+    }
+
+    std::vector<std::thread> clients;
+    for (Device& device : devices) {
+        clients.emplace_back([fd = device.client.get()]() {
+            char buf[65536];
+            while (adb_read(fd, buf, sizeof(buf)) > 0) {
+                continue;
+            }
+        });
+    }
+
+    // Each round, every device writes kPacketsPerRound packets, waiting for each to be
+    // acknowledged before sending the next, as adbd does.
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t round = 0;
+    size_t finished = 0;
+    bool stop = false;
+
+    std::vector<std::thread> device_threads;
+    for (Device& device : devices) {
+        device_threads.emplace_back([&, fd = device.fd.get(), local_id = device.local_id]() {
+            std::vector<char> payload(kPayloadSize, 'x');
+            amessage msg = {};
+            msg.command = A_WRTE;
+            msg.arg0 = kRemoteId;
+            msg.arg1 = local_id;
+            msg.data_length = kPayloadSize;
+            msg.magic = A_WRTE ^ 0xffffffff;
+
+            for (size_t seen = 0;;) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&]() { return stop || round != seen; });
+                    if (stop) {
+                        return;
+                    }
+                    seen = round;
+                }
+
+                for (size_t i = 0; i < kPacketsPerRound; ++i) {
+                    amessage reply;
+                    if (!WriteFdExactly(fd, &msg, sizeof(msg)) ||
+                        !WriteFdExactly(fd, payload.data(), payload.size()) ||
+                        !ReadFdExactly(fd, &reply, sizeof(reply))) {
+                        LOG(FATAL) << "device connection failed";
+                    }
+                    CHECK_EQ(static_cast<uint32_t>(A_OKAY), reply.command);
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ++finished;
+                }
+                cv.notify_all();
+            }
+        });
+    }
+
+    for (auto _ : state) {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished = 0;
+        ++round;
+        cv.notify_all();
+        cv.wait(lock, [&]() { return finished == devices.size(); });
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * devices.size() *
+                            kPacketsPerRound * kPayloadSize);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    cv.notify_all();
+    for (std::thread& thread : device_threads) {
+        thread.join();
+    }
+
+    for (Device& device : devices) {
+        std::promise<void> closed;
+        device.transport->event_loop()->Run([&device, &closed]() {
+            device.socket->close(device.socket);
+            closed.set_value();
+        });
+        closed.get_future().wait();
+        device.transport->connection()->Stop();
+    }
+    for (std::thread& client : clients) {
+        client.join();
+    }
+    devices.clear();
+
+    fdevent_terminate_loop();
+    fdevent_run_on_main_thread([]() {});
+    fdevent_thread.join();
+    fdevent_reset();
+}
+
+BENCHMARK(BM_Transport_Load)
+        ->ArgNames({"devices", "loops"})
+        ->Args({16, 0})
+        ->Args({16, 4})
+        ->Args({64, 0})
+        ->Args({64, 2})
+        ->Args({64, 4})
+        ->UseRealTime();
+
 int main(int argc, char** argv) {
     // Set M_DECAY_TIME so that our allocations aren't immediately purged on free.
     mallopt(M_DECAY_TIME, 1);
@@ -16,6 +16,138 @@
 
 #include "types.h"
 
+#include <atomic>
+#include <mutex>
+
+#include <android-base/stringprintf.h>
+
+namespace {
+
+struct SizeClass {
+    std::mutex mutex;
+    std::vector<char*> free;
+    size_t hits = 0;
+    size_t misses = 0;
+};
+
+// Size classes are kMinPooledSize << index.
+constexpr size_t kSizeClasses = 9;
+static_assert((BlockPool::kMinPooledSize << (kSizeClasses - 1)) == BlockPool::kMaxPooledSize);
+
+struct Pool {
+    SizeClass classes[kSizeClasses];
+    std::atomic<size_t> unpooled = 0;
+    // Bytes in all of the free lists, bounded by kMaxCachedBytes.
+    std::atomic<size_t> cached = 0;
+};
+
+// Never destroyed, Blocks may still be released during static destruction.
+Pool& pool() {
+    static Pool& pool = *new Pool();
+    return pool;
+}
+
+// Reserves room for capacity more bytes in the free lists, or returns false if they're full.
+bool reserve_cached(size_t capacity) {
+    std::atomic<size_t>& cached = pool().cached;
+    size_t current = cached.load(std::memory_order_relaxed);
+    do {
+        if (current + capacity > BlockPool::kMaxCachedBytes) {
+            return false;
+        }
+    } while (!cached.compare_exchange_weak(current, current + capacity,
+                                           std::memory_order_relaxed));
+    return true;
+}
+
+// Returns the index of the smallest size class that fits size, or -1 if it isn't pooled.
+int size_class(size_t size) {
+    if (size < BlockPool::kMinPooledSize || size > BlockPool::kMaxPooledSize) {
+        return -1;
+    }
+    int index = 0;
+    while ((BlockPool::kMinPooledSize << index) < size) {
+        ++index;
+    }
+    return index;
+}
+
+}  // namespace
+
+char* BlockPool::Allocate(size_t size, size_t* capacity) {
+    int index = size_class(size);
+    if (index < 0) {
+        pool().unpooled.fetch_add(1, std::memory_order_relaxed);
+        *capacity = size;
+        return new char[size];
+    }
+
+    size_t class_size = kMinPooledSize << index;
+    *capacity = class_size;
+    SizeClass& size_class = pool().classes[index];
+    {
+        std::lock_guard<std::mutex> lock(size_class.mutex);
+        if (!size_class.free.empty()) {
+            char* data = size_class.free.back();
+            size_class.free.pop_back();
+            pool().cached.fetch_sub(class_size, std::memory_order_relaxed);
+            ++size_class.hits;
+            return data;
+        }
+        ++size_class.misses;
+    }
+    return new char[class_size];
+}
+
+void BlockPool::Release(char* data, size_t capacity) {
+    int index = size_class(capacity);
+    if (index < 0 || (kMinPooledSize << index) != capacity) {
+        delete[] data;
+        return;
+    }
+
+    if (!reserve_cached(capacity)) {
+        delete[] data;
+        return;
+    }
+    SizeClass& size_class = pool().classes[index];
+    std::lock_guard<std::mutex> lock(size_class.mutex);
+    size_class.free.push_back(data);
+}
+
+void BlockPool::Trim() {
+    for (size_t i = 0; i < kSizeClasses; ++i) {
+        SizeClass& size_class = pool().classes[i];
+        std::lock_guard<std::mutex> lock(size_class.mutex);
+        for (char* data : size_class.free) {
+            delete[] data;
+        }
+        pool().cached.fetch_sub(size_class.free.size() * (kMinPooledSize << i),
+                                std::memory_order_relaxed);
+        size_class.free.clear();
+    }
+}
+
+BlockPool::Stats BlockPool::GetStats() {
+    Stats stats = {};
+    for (size_t i = 0; i < kSizeClasses; ++i) {
+        SizeClass& size_class = pool().classes[i];
+        std::lock_guard<std::mutex> lock(size_class.mutex);
+        stats.hits += size_class.hits;
+        stats.misses += size_class.misses;
+        stats.cached += size_class.free.size() * (kMinPooledSize << i);
+    }
+    stats.unpooled = pool().unpooled.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::string BlockPool::DumpStats() {
+    Stats stats = GetStats();
+    return android::base::StringPrintf(
+            "block pool: %zu hits, %zu misses, %zu unpooled, %zu KiB cached", stats.hits,
+            stats.misses, stats.unpooled, stats.cached / 1024);
+}
+
 IOVector& IOVector::operator=(IOVector&& move) noexcept {
     chain_ = std::move(move.chain_);
     chain_length_ = move.chain_length_;
@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -28,7 +29,36 @@
 #include "fdevent/fdevent.h"
 #include "sysdeps/uio.h"
 
+// Recycles the allocations behind Blocks, so that the stream of payload sized Blocks that a
+// transfer goes through doesn't turn into as many trips through malloc. Sizes from
+// kMinPooledSize up to kMaxPooledSize are rounded up to a power of two, and each of those size
+// classes keeps a free list. The free lists hold at most kMaxCachedBytes between them, anything
+// released beyond that goes back to the allocator. Thread-safe.
+struct BlockPool {
+    static constexpr size_t kMinPooledSize = 4096;
+    static constexpr size_t kMaxPooledSize = 1024 * 1024;  // MAX_PAYLOAD
+    static constexpr size_t kMaxCachedBytes = 8 * 1024 * 1024;
+
+    struct Stats {
+        size_t hits;      // pooled allocations served from a free list
+        size_t misses;    // pooled allocations that had to go to the allocator
+        size_t unpooled;  // allocations too small or too large to pool
+        size_t cached;    // bytes currently in the free lists
+    };
+
+    // Returns an allocation of at least size bytes, and its actual size in *capacity.
+    static char* Allocate(size_t size, size_t* capacity);
+    // Takes back an allocation returned by Allocate(), along with its capacity.
+    static void Release(char* data, size_t capacity);
+    // Frees everything in the free lists. Tests use this to start from an empty pool.
+    static void Trim();
+
+    static Stats GetStats();
+    static std::string DumpStats();
+};
+
 // Essentially std::vector<char>, except without zero initialization or reallocation.
+// The memory comes from the BlockPool.
 struct Block {
     using iterator = char*;
 
@@ -38,7 +68,7 @@ struct Block {
 
     template <typename Iterator>
     Block(Iterator begin, Iterator end) : Block(end - begin) {
-        std::copy(begin, end, data_.get());
+        std::copy(begin, end, data_);
     }
 
     Block(const Block& copy) = delete;
@@ -56,7 +86,7 @@ struct Block {
         return *this;
     }
 
-    ~Block() = default;
+    ~Block() { clear(); }
 
     void resize(size_t new_size) {
         if (!data_) {
@@ -71,11 +101,13 @@ struct Block {
     void assign(InputIt begin, InputIt end) {
         clear();
         allocate(end - begin);
-        std::copy(begin, end, data_.get());
+        std::copy(begin, end, data_);
     }
 
     void clear() {
-        data_.reset();
+        if (data_) {
+            BlockPool::Release(std::exchange(data_, nullptr), capacity_);
+        }
         capacity_ = 0;
         size_ = 0;
     }
@@ -84,11 +116,11 @@ struct Block {
     size_t size() const { return size_; }
     bool empty() const { return size() == 0; }
 
-    char* data() { return data_.get(); }
-    const char* data() const { return data_.get(); }
+    char* data() { return data_; }
+    const char* data() const { return data_; }
 
-    char* begin() { return data_.get(); }
-    const char* begin() const { return data_.get(); }
+    char* begin() { return data_; }
+    const char* begin() const { return data_; }
 
     char* end() { return data() + size_; }
     const char* end() const { return data() + size_; }
@@ -106,16 +138,13 @@ struct Block {
         CHECK_EQ(0ULL, capacity_);
         CHECK_EQ(0ULL, size_);
         if (size != 0) {
-            // This isn't std::make_unique because that's equivalent to `new char[size]()`, which
-            // value-initializes the array instead of leaving it uninitialized. As an optimization,
-            // call new without parentheses to avoid this costly initialization.
-            data_.reset(new char[size]);
-            capacity_ = size;
+            // The pool leaves the memory uninitialized, as an optimization.
+            data_ = BlockPool::Allocate(size, &capacity_);
             size_ = size;
         }
     }
 
-    std::unique_ptr<char[]> data_;
+    char* data_ = nullptr;
     size_t capacity_ = 0;
     size_t size_ = 0;
 };
@@ -17,6 +17,9 @@
 #include <gtest/gtest.h>
 
 #include <memory>
+#include <thread>
+#include <vector>
+
 #include "types.h"
 
 static IOVector::block_type create_block(const std::string& string) {
@@ -117,3 +120,66 @@ TEST(IOVector, misaligned_split) {
     ASSERT_EQ(1ULL, bc.size());
     ASSERT_EQ(create_block("x"), bc.coalesce());
 }
+
+TEST(BlockPool, recycles) {
+    // Other tests leave blocks behind, which could be handed out instead.
+    BlockPool::Trim();
+    auto before = BlockPool::GetStats();
+    ASSERT_EQ(0ULL, before.cached);
+    const char* data;
+    {
+        Block block(16384);
+        ASSERT_EQ(16384ULL, block.capacity());
+        data = block.data();
+    }
+
+    // Rounded up to the same size class, and handed the same allocation back.
+    Block block(10000);
+    ASSERT_EQ(10000ULL, block.size());
+    ASSERT_EQ(16384ULL, block.capacity());
+    ASSERT_EQ(data, block.data());
+    ASSERT_EQ(before.hits + 1, BlockPool::GetStats().hits);
+
+    // The extra capacity is usable.
+    block.resize(16384);
+    ASSERT_EQ(16384ULL, block.size());
+}
+
+TEST(BlockPool, unpooled) {
+    auto before = BlockPool::GetStats();
+    Block small(BlockPool::kMinPooledSize - 1);
+    ASSERT_EQ(BlockPool::kMinPooledSize - 1, small.capacity());
+    Block large(BlockPool::kMaxPooledSize + 1);
+    ASSERT_EQ(BlockPool::kMaxPooledSize + 1, large.capacity());
+    ASSERT_EQ(before.unpooled + 2, BlockPool::GetStats().unpooled);
+}
+
+TEST(BlockPool, bounded) {
+    // Fill every size class past the limit, the total stays bounded.
+    std::vector<Block> blocks;
+    for (size_t size = BlockPool::kMinPooledSize; size <= BlockPool::kMaxPooledSize; size *= 2) {
+        for (size_t i = 0; i < 2 * BlockPool::kMaxCachedBytes / size && i < 1024; ++i) {
+            blocks.emplace_back(size);
+        }
+    }
+    blocks.clear();
+    ASSERT_GE(BlockPool::kMaxCachedBytes, BlockPool::GetStats().cached);
+}
+
+TEST(BlockPool, threads) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([i]() {
+            std::vector<Block> blocks;
+            for (size_t j = 0; j < 1000; ++j) {
+                size_t size = 1 + ((i + 1) * j * 7919) % BlockPool::kMaxPooledSize;
+                blocks.emplace_back(size);
+                memset(blocks.back().data(), i, size);
+                if (blocks.size() > 8) blocks.erase(blocks.begin());
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
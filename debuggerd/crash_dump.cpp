@@ -20,16 +20,20 @@
 #include <stdlib.h>
 #include <sys/prctl.h>
 #include <sys/ptrace.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <sys/wait.h>
 #include <syscall.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <limits>
 #include <map>
 #include <memory>
 #include <set>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -50,6 +54,7 @@
 #include <utils/Trace.h>
 
 #include <unwindstack/DexFiles.h>
+#include <unwindstack/Elf.h>
 #include <unwindstack/JitDebug.h>
 #include <unwindstack/Maps.h>
 #include <unwindstack/Memory.h>
@@ -364,6 +369,66 @@ static pid_t wait_for_vm_process(pid_t pseudothread_tid) {
   return vm_pid;
 }
 
+// Unwinds every thread ahead of the dump on a few worker threads, so that
+// only writing the dump, in thread order, is left to do serially. Each worker
+// unwinds with a copy of unwinder, which shares its maps, elf files and
+// process memory but has its own registers and frames.
+static void unwind_threads(unwindstack::Unwinder* unwinder,
+                           std::map<pid_t, ThreadInfo>* thread_info) {
+  constexpr size_t kMaxUnwindThreads = 4;
+
+  std::vector<ThreadInfo*> threads;
+  for (auto& [tid, thread] : *thread_info) {
+    threads.push_back(&thread);
+  }
+
+  std::atomic<size_t> next_thread = 0;
+  auto worker = [unwinder, &threads, &next_thread]() {
+    unwindstack::Unwinder thread_unwinder(*unwinder);
+    for (size_t i = next_thread++; i < threads.size(); i = next_thread++) {
+      ThreadInfo* thread = threads[i];
+      // Unwind will mutate the registers, so make a copy first.
+      std::unique_ptr<unwindstack::Regs> regs_copy(thread->registers->Clone());
+      thread_unwinder.SetRegs(regs_copy.get());
+      thread_unwinder.Unwind();
+      thread->elf_from_memory_not_file = thread_unwinder.elf_from_memory_not_file();
+      thread->frames = thread_unwinder.ConsumeFrames();
+    }
+  };
+
+  size_t worker_count = std::min({threads.size(), kMaxUnwindThreads,
+                                  std::max<size_t>(1, std::thread::hardware_concurrency())});
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < worker_count; i++) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : workers) {
+    thread.join();
+  }
+}
+
+// Keeps the decompressed .gnu_debugdata sections of earlier dumps under
+// /data/tombstones/debugdata, when that directory exists. Cached files are
+// only trusted when they were written by the same uid, so each uid gets a
+// directory of its own. The parent directory is setgid system, and the
+// directory is group writable, so that tombstoned can trim it.
+static void enable_gnu_debugdata_cache() {
+  std::string dir = StringPrintf("/data/tombstones/debugdata/%d", geteuid());
+  if (mkdir(dir.c_str(), 0770) != 0 && errno != EEXIST) {
+    return;
+  }
+  struct stat st;
+  if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != geteuid() ||
+      (st.st_mode & S_IWOTH) != 0) {
+    return;
+  }
+  if ((st.st_mode & 0777) != 0770 && chmod(dir.c_str(), 0770) != 0) {
+    return;
+  }
+  unwindstack::Elf::SetGnuDebugdataCacheDir(dir);
+}
+
 static void InstallSigPipeHandler() {
   struct sigaction action = {};
   action.sa_handler = SIG_IGN;
@@ -586,12 +651,34 @@ int main(int argc, char** argv) {
     }
   }
 
+  enable_gnu_debugdata_cache();
+
   // TODO: Use seccomp to lock ourselves down.
   unwindstack::UnwinderFromPid unwinder(256, vm_pid);
+  unwinder.SetThreadCachedMemory(true);
   if (!unwinder.Init(unwindstack::Regs::CurrentArch())) {
     LOG(FATAL) << "Failed to init unwinder object.";
   }
 
+  {
+    // The vm process is a frozen copy of the target, so copy every thread's
+    // stack out of it in one go rather than making a system call for each
+    // read the unwinds do.
+    ATRACE_NAME("snapshot stacks");
+    std::vector<uint64_t> sps;
+    for (const auto& [tid, thread] : thread_info) {
+      sps.push_back(thread.registers->sp());
+    }
+    if (!unwinder.SnapshotStacks(sps)) {
+      LOG(WARNING) << "failed to snapshot thread stacks, reading them from the process";
+    }
+  }
+
+  {
+    ATRACE_NAME("unwind threads");
+    unwind_threads(&unwinder, &thread_info);
+  }
+
   std::string amfd_data;
   if (backtrace) {
     ATRACE_NAME("dump_backtrace");
@@ -22,7 +22,10 @@
 #include <unistd.h>
 
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 #include <benchmark/benchmark.h>
 #include <debuggerd/client.h>
@@ -92,6 +95,36 @@ static void PerformDump() {
   }
 }
 
+// Blocked threads that give a dump of this process many threads to unwind.
+class IdleThreads {
+ public:
+  explicit IdleThreads(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      threads_.emplace_back([this]() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return stopping_; });
+      });
+    }
+  }
+
+  ~IdleThreads() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
 template <typename Fn>
 static void BM_maximum_pause_impl(benchmark::State& state, const Fn& function) {
   SetScheduler();
@@ -122,7 +155,21 @@ static void BM_maximum_pause_debuggerd(benchmark::State& state) {
   BM_maximum_pause_impl(state, []() { PerformDump(); });
 }
 
+static void BM_maximum_pause_debuggerd_many_threads(benchmark::State& state) {
+  IdleThreads threads(state.range(0));
+  BM_maximum_pause_impl(state, []() { PerformDump(); });
+}
+
+static void BM_dump_latency(benchmark::State& state) {
+  IdleThreads threads(state.range(0));
+  for (auto _ : state) {
+    PerformDump();
+  }
+}
+
 BENCHMARK(BM_maximum_pause_noop)->Iterations(128)->UseManualTime();
 BENCHMARK(BM_maximum_pause_debuggerd)->Iterations(128)->UseManualTime();
+BENCHMARK(BM_maximum_pause_debuggerd_many_threads)->Arg(256)->Iterations(32)->UseManualTime();
+BENCHMARK(BM_dump_latency)->Arg(1)->Arg(64)->Arg(256)->Unit(benchmark::kMillisecond);
 
 BENCHMARK_MAIN();
@@ -67,14 +67,14 @@ void dump_backtrace_thread(int output_fd, unwindstack::Unwinder* unwinder,
 
   _LOG(&log, logtype::BACKTRACE, "\n\"%s\" sysTid=%d\n", thread.thread_name.c_str(), thread.tid);
 
-  unwinder->SetRegs(thread.registers.get());
-  unwinder->Unwind();
-  if (unwinder->NumFrames() == 0) {
+  bool elf_from_memory_not_file;
+  const auto& frames = unwind_thread(unwinder, thread, &elf_from_memory_not_file);
+  if (frames.empty()) {
     _LOG(&log, logtype::THREAD, "Unwind failed: tid = %d", thread.tid);
     return;
   }
 
-  log_backtrace(&log, unwinder, "  ");
+  log_backtrace(&log, unwinder, frames, elf_from_memory_not_file, "  ");
 }
 
 void dump_backtrace(android::base::unique_fd output_fd, unwindstack::Unwinder* unwinder,
@@ -17,9 +17,12 @@
  */
 
 #include <memory>
+#include <optional>
 #include <string>
+#include <vector>
 
 #include <unwindstack/Regs.h>
+#include <unwindstack/Unwinder.h>
 
 struct ThreadInfo {
   std::unique_ptr<unwindstack::Regs> registers;
@@ -34,4 +37,9 @@ struct ThreadInfo {
 
   int signo = 0;
   siginfo_t* siginfo = nullptr;
+
+  // Set when the thread was unwound before the dump started, otherwise the
+  // dump unwinds it.
+  std::optional<std::vector<unwindstack::FrameData>> frames;
+  bool elf_from_memory_not_file = false;
 };
@@ -25,6 +25,7 @@
 #include <sys/types.h>
 
 #include <string>
+#include <vector>
 
 #include <android-base/macros.h>
 
@@ -77,9 +78,19 @@ void _VLOG(log_t* log, logtype ltype, const char* fmt, va_list ap);
 namespace unwindstack {
 class Unwinder;
 class Memory;
+struct FrameData;
 }
 
-void log_backtrace(log_t* log, unwindstack::Unwinder* unwinder, const char* prefix);
+struct ThreadInfo;
+
+// Unwinds the thread, unless its frames are already known, and returns them.
+const std::vector<unwindstack::FrameData>& unwind_thread(unwindstack::Unwinder* unwinder,
+                                                         const ThreadInfo& thread,
+                                                         bool* elf_from_memory_not_file);
+
+void log_backtrace(log_t* log, unwindstack::Unwinder* unwinder,
+                   const std::vector<unwindstack::FrameData>& frames,
+                   bool elf_from_memory_not_file, const char* prefix);
 
 void dump_memory(log_t* log, unwindstack::Memory* backtrace, uint64_t addr, const std::string&);
 
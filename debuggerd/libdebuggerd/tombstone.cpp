@@ -401,15 +401,13 @@ static bool dump_thread(log_t* log, unwindstack::Unwinder* unwinder, const Threa
 
   dump_registers(log, thread_info.registers.get());
 
-  // Unwind will mutate the registers, so make a copy first.
-  std::unique_ptr<unwindstack::Regs> regs_copy(thread_info.registers->Clone());
-  unwinder->SetRegs(regs_copy.get());
-  unwinder->Unwind();
-  if (unwinder->NumFrames() == 0) {
+  bool elf_from_memory_not_file;
+  const auto& frames = unwind_thread(unwinder, thread_info, &elf_from_memory_not_file);
+  if (frames.empty()) {
     _LOG(log, logtype::THREAD, "Failed to unwind");
   } else {
     _LOG(log, logtype::BACKTRACE, "\nbacktrace:\n");
-    log_backtrace(log, unwinder, "    ");
+    log_backtrace(log, unwinder, frames, elf_from_memory_not_file, "    ");
   }
 
   if (primary_thread) {
@@ -28,7 +28,9 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <android-base/logging.h>
 #include <android-base/properties.h>
@@ -39,8 +41,11 @@
 #include <debuggerd/handler.h>
 #include <log/log.h>
 #include <unwindstack/Memory.h>
+#include <unwindstack/Regs.h>
 #include <unwindstack/Unwinder.h>
 
+#include "libdebuggerd/types.h"
+
 using android::base::unique_fd;
 
 // Whitelist output desired in the logcat output.
@@ -431,8 +436,29 @@ const char* get_sigcode(const siginfo_t* si) {
   return "?";
 }
 
-void log_backtrace(log_t* log, unwindstack::Unwinder* unwinder, const char* prefix) {
-  if (unwinder->elf_from_memory_not_file()) {
+const std::vector<unwindstack::FrameData>& unwind_thread(unwindstack::Unwinder* unwinder,
+                                                         const ThreadInfo& thread,
+                                                         bool* elf_from_memory_not_file) {
+  if (thread.frames) {
+    unwinder->SetRegs(thread.registers.get());
+    *elf_from_memory_not_file = thread.elf_from_memory_not_file;
+    return *thread.frames;
+  }
+
+  // Unwind will mutate the registers, so make a copy first.
+  std::unique_ptr<unwindstack::Regs> regs_copy(thread.registers->Clone());
+  unwinder->SetRegs(regs_copy.get());
+  unwinder->Unwind();
+  // Formatting the frames still needs the registers.
+  unwinder->SetRegs(thread.registers.get());
+  *elf_from_memory_not_file = unwinder->elf_from_memory_not_file();
+  return unwinder->frames();
+}
+
+void log_backtrace(log_t* log, unwindstack::Unwinder* unwinder,
+                   const std::vector<unwindstack::FrameData>& frames,
+                   bool elf_from_memory_not_file, const char* prefix) {
+  if (elf_from_memory_not_file) {
     _LOG(log, logtype::BACKTRACE,
          "%sNOTE: Function names and BuildId information is missing for some frames due\n", prefix);
     _LOG(log, logtype::BACKTRACE,
@@ -445,7 +471,7 @@ void log_backtrace(log_t* log, unwindstack::Unwinder* unwinder, const char* pref
   }
 
   unwinder->SetDisplayBuildID(true);
-  for (size_t i = 0; i < unwinder->NumFrames(); i++) {
-    _LOG(log, logtype::BACKTRACE, "%s%s\n", prefix, unwinder->FormatFrame(i).c_str());
+  for (const auto& frame : frames) {
+    _LOG(log, logtype::BACKTRACE, "%s%s\n", prefix, unwinder->FormatFrame(frame).c_str());
   }
 }
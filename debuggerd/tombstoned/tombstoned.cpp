@@ -14,18 +14,23 @@
  * limitations under the License.
  */
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
 #include <deque>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include <event2/event.h>
 #include <event2/listener.h>
@@ -46,6 +51,7 @@
 #include "intercept_manager.h"
 
 using android::base::GetIntProperty;
+using android::base::GetUintProperty;
 using android::base::SendFileDescriptors;
 using android::base::StringPrintf;
 using android::base::unique_fd;
@@ -201,6 +207,79 @@ class CrashQueue {
   DISALLOW_COPY_AND_ASSIGN(CrashQueue);
 };
 
+// crash_dump keeps the decompressed .gnu_debugdata sections of the libraries
+// it unwinds through in a directory per uid under here, see
+// enable_gnu_debugdata_cache in crash_dump.cpp. Nothing happens until the
+// directory is created, as 03773 system system, which waits on the SELinux
+// policy that lets crash_dump use it.
+static constexpr char kDebugdataCacheDir[] = "/data/tombstones/debugdata";
+
+// Temporary files older than this were left behind by a crash_dump that died
+// while writing them.
+static constexpr time_t kDebugdataStaleTmpAge = 10 * 60;
+
+// Removes stale temporary files from the gnu_debugdata cache, then the least
+// recently used files until the cache is no bigger than max_size.
+static void trim_debugdata_cache(uint64_t max_size) {
+  std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(kDebugdataCacheDir), closedir);
+  if (!dir) {
+    return;
+  }
+
+  struct CacheFile {
+    std::string path;
+    time_t mtime;
+    uint64_t size;
+  };
+  std::vector<CacheFile> files;
+  uint64_t total_size = 0;
+  time_t now = time(nullptr);
+  while (dirent* uid_entry = readdir(dir.get())) {
+    if (uid_entry->d_name[0] == '.' || uid_entry->d_type != DT_DIR) {
+      continue;
+    }
+    std::string uid_path = StringPrintf("%s/%s", kDebugdataCacheDir, uid_entry->d_name);
+    std::unique_ptr<DIR, decltype(&closedir)> uid_dir(opendir(uid_path.c_str()), closedir);
+    if (!uid_dir) {
+      PLOG(WARNING) << "failed to open " << uid_path;
+      continue;
+    }
+    while (dirent* entry = readdir(uid_dir.get())) {
+      std::string path = uid_path + "/" + entry->d_name;
+      struct stat st;
+      if (entry->d_name[0] == '.' || lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        continue;
+      }
+      std::string name = entry->d_name;
+      bool tmp = name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0;
+      if (tmp && now - st.st_mtime > kDebugdataStaleTmpAge) {
+        unlink(path.c_str());
+        continue;
+      }
+      total_size += st.st_size;
+      files.push_back({std::move(path), st.st_mtime, static_cast<uint64_t>(st.st_size)});
+    }
+  }
+
+  std::sort(files.begin(), files.end(),
+            [](const CacheFile& a, const CacheFile& b) { return a.mtime < b.mtime; });
+  for (const CacheFile& file : files) {
+    if (total_size <= max_size) {
+      break;
+    }
+    if (unlink(file.path.c_str()) != 0) {
+      PLOG(WARNING) << "failed to unlink " << file.path;
+      continue;
+    }
+    total_size -= file.size;
+  }
+}
+
+static void trim_debugdata_cache() {
+  trim_debugdata_cache(
+      GetUintProperty<uint64_t>("tombstoned.max_debugdata_cache_size", 64 * 1024 * 1024));
+}
+
 // Whether java trace dumps are produced via tombstoned.
 static constexpr bool kJavaTraceDumpsEnabled = true;
 
@@ -383,6 +462,7 @@ static void crash_completed_cb(evutil_socket_t sockfd, short ev, void* arg) {
         // tombstone associated with a given native crash was written. Any changes
         // to this message must be carefully considered.
         LOG(ERROR) << "Tombstone written to: " << tombstone_path;
+        trim_debugdata_cache();
       }
     }
 
@@ -453,6 +533,8 @@ int main(int, char* []) {
     }
   }
 
+  trim_debugdata_cache();
+
   LOG(INFO) << "tombstoned successfully initialized";
   event_base_dispatch(base);
 }
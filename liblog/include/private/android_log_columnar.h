@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Columnar log export, as written by logcat -B -v columnar, see liblog_columnar */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <log/log_read.h>
+#include <log/log_time.h>
+
+/*
+ * A file is a sequence of self-contained blocks, so that rotated or cut off
+ * captures stay readable. Each block is an android_log_columnar_block_t
+ * followed by:
+ *
+ * - the zlib compressed columns, for each of count entries in turn: sec,
+ *   nsec, pid, tid and uid (uint32_t), lid and priority (uint8_t), tag
+ *   (uint16_t index into the tag set) and message length (uint32_t), then
+ *   all the messages back to back.
+ * - the index, an android_log_columnar_index_t followed by tag_count null
+ *   terminated tags. Binary buffers' tags are their event tag number in
+ *   decimal.
+ *
+ * The index is not compressed, so that readers can skip blocks outside of a
+ * time range, or without any tag of interest, and only inflate the others.
+ * A text entry's message is everything after its tag, for binary buffers
+ * everything after the event tag number. Entries are reassembled as the
+ * original log_msg.
+ */
+
+#define ANDROID_LOG_COLUMNAR_MAGIC 0x6b6c4263 /* "cBlk" */
+
+typedef struct __attribute__((__packed__)) {
+  uint32_t magic;
+  uint32_t count;
+  uint32_t columns_size; /* compressed */
+  uint32_t columns_raw_size;
+  uint32_t index_size;
+} android_log_columnar_block_t;
+
+typedef struct __attribute__((__packed__)) {
+  log_time first; /* of the entries, which need not be in order */
+  log_time last;
+  uint32_t lid_mask;
+  uint16_t tag_count;
+} android_log_columnar_index_t;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+struct android_log_columnar_writer;
+
+/* Writes blocks to fd, which stays owned by the caller. */
+struct android_log_columnar_writer* android_log_columnar_writer_alloc(int fd);
+/*
+ * Adds msg to the current block. Returns the number of bytes written to fd if
+ * this completed a block, else 0, or a negative errno.
+ */
+ssize_t android_log_columnar_writer_add(struct android_log_columnar_writer* writer,
+                                        struct log_msg* msg);
+/* Writes out the current block, returns the number of bytes written. */
+ssize_t android_log_columnar_writer_flush(struct android_log_columnar_writer* writer);
+/* Does not flush. */
+void android_log_columnar_writer_free(struct android_log_columnar_writer* writer);
+
+struct android_log_columnar_reader;
+
+/* Reads blocks from fd, which stays owned by the caller and should be seekable. */
+struct android_log_columnar_reader* android_log_columnar_reader_alloc(int fd);
+/* Only return entries at or after start. Must be called before the first read. */
+void android_log_columnar_reader_set_start(struct android_log_columnar_reader* reader,
+                                           log_time start);
+/* Only return entries with one of the added tags. Must be called before the first read. */
+int android_log_columnar_reader_add_tag(struct android_log_columnar_reader* reader,
+                                        const char* tag);
+/* Returns the length of the entry read into msg, 0 at the end of the file, or a negative errno. */
+int android_log_columnar_reader_read(struct android_log_columnar_reader* reader,
+                                     struct log_msg* msg);
+/* Number of blocks inflated so far, those that the index could not rule out. */
+size_t android_log_columnar_reader_inflated(struct android_log_columnar_reader* reader);
+void android_log_columnar_reader_free(struct android_log_columnar_reader* reader);
+
+#if defined(__cplusplus)
+}
+#endif
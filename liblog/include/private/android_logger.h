@@ -119,6 +119,39 @@ typedef struct __attribute__((__packed__)) {
   char data[];
 } android_log_event_string_t;
 
+/*
+ * Shared memory ring to logd, see __android_log_set_logd_ring().
+ *
+ * The writing process registers a memfd, sealed against shrinking, and an
+ * eventfd doorbell with logd over /dev/socket/logdring. The memfd holds an
+ * android_log_ring_header_t padded to LOG_RING_HEADER_SIZE, followed by a
+ * power of two sized data area of 8 byte aligned android_log_ring_entry_t.
+ *
+ * Writers reserve space by advancing reserve, fill in the entry, then
+ * publish it by storing its size. logd consumes published entries in order,
+ * zeroes them and advances head. An entry with LOG_RING_PAD set in its size
+ * skips to the end of the data area. logd sets sleeping before it waits on
+ * the doorbell, the writer that clears it writes to the eventfd. All fields
+ * are accessed with __atomic builtins.
+ */
+#define LOG_RING_MAGIC 0x676e6972 /* "ring" */
+#define LOG_RING_HEADER_SIZE 4096
+#define LOG_RING_MIN_SIZE (64 * 1024)
+#define LOG_RING_MAX_SIZE (1024 * 1024)
+#define LOG_RING_PAD 0x80000000U
+
+typedef struct {
+  uint32_t magic;
+  uint32_t sleeping; /* written by logd and the writer ringing the doorbell */
+  uint64_t head;     /* written by logd */
+  uint64_t reserve;  /* written by the writers */
+} android_log_ring_header_t;
+
+typedef struct __attribute__((__packed__)) {
+  uint32_t size; /* of the entry and payload, 0 until published */
+  android_log_header_t header;
+} android_log_ring_entry_t;
+
 #define ANDROID_LOG_PMSG_FILE_MAX_SEQUENCE 256 /* 1MB file */
 #define ANDROID_LOG_PMSG_FILE_SEQUENCE 1000
 
@@ -159,6 +192,44 @@ bool __android_logger_property_get_bool(const char* key, int flag);
 unsigned long __android_logger_get_buffer_size(log_id_t logId);
 bool __android_logger_valid_buffer_size(unsigned long value);
 
+/*
+ * Ask logd to only send the entries of the text buffers that the filterspec,
+ * as accepted by android_log_addFilterString(), would print. The reader should
+ * still apply the same filter, older logd ignore it, and it is not sent at all
+ * if it would make the command longer than older logd read. Must be called
+ * before the first android_logger_list_read().
+ */
+int android_logger_list_set_filter(struct logger_list* logger_list,
+                                   const char* filterspec);
+/*
+ * Ask logd to send each entry formatted by android_log_formatLogLine() with
+ * the given android_log_formatFromString() format(s). The payload of each
+ * log_msg is then the formatted line. Must be called before the first
+ * android_logger_list_read().
+ */
+int android_logger_list_set_format(struct logger_list* logger_list,
+                                   const char* format);
+
+/*
+ * Opt in to batching of this process' writes to logd. Each thread buffers its
+ * entries until threshold_bytes are pending, or the oldest is delay_ms old,
+ * then sends them all with one sendmmsg(). Crash, security and fatal entries
+ * flush the thread's batch and are never delayed. A threshold_bytes of 0, the
+ * default, turns batching off again.
+ */
+void __android_log_set_logd_batching(size_t threshold_bytes,
+                                     unsigned int delay_ms);
+
+/*
+ * Register a shared memory ring of size bytes, rounded up to a power of two,
+ * with logd. This process' writes then no longer make a syscall while logd
+ * keeps up, they fall back to /dev/socket/logdw while the ring is full and
+ * for crash and security entries. Cannot be undone, forked children fall
+ * back to the socket until they register their own ring. Returns 0 or a
+ * negative errno, -ENOENT if logd does not support rings.
+ */
+int __android_log_set_logd_ring(size_t size);
+
 /* Retrieve the composed event buffer */
 int android_log_write_list_buffer(android_log_context ctx, const char** msg);
 
@@ -0,0 +1,445 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <android-base/macros.h>
+#include <private/android_log_columnar.h>
+#include <zlib.h>
+
+// Bounds the memory either side needs for a block.
+static const size_t kMaxBlockEntries = 8192;
+static const size_t kMaxBlockMessages = 256 * 1024;
+static const size_t kMaxBlockTags = UINT16_MAX;
+static const size_t kMaxIndexSize = 2 * 1024 * 1024;
+
+// Bytes per entry in the columns, before the messages.
+static const size_t kColumnsEntrySize = 5 * sizeof(uint32_t) + 2 * sizeof(uint8_t) +
+                                        sizeof(uint16_t) + sizeof(uint32_t);
+
+// Set in the priority column if the payload could not be split, the message is then the whole
+// payload.
+static const uint8_t kRawPayload = 0x80;
+
+static bool IsBinary(uint32_t lid) {
+  return lid == LOG_ID_EVENTS || lid == LOG_ID_STATS || lid == LOG_ID_SECURITY;
+}
+
+struct android_log_columnar_writer {
+  int fd;
+  std::vector<uint32_t> sec;
+  std::vector<uint32_t> nsec;
+  std::vector<uint32_t> pid;
+  std::vector<uint32_t> tid;
+  std::vector<uint32_t> uid;
+  std::vector<uint8_t> lid;
+  std::vector<uint8_t> prio;
+  std::vector<uint16_t> tag;
+  std::vector<uint32_t> length;
+  std::string messages;
+  std::vector<std::string> tags;
+  std::unordered_map<std::string, uint16_t> tag_ids;
+  log_time first;
+  log_time last;
+  uint32_t lid_mask;
+};
+
+struct android_log_columnar_writer* android_log_columnar_writer_alloc(int fd) {
+  android_log_columnar_writer* writer = new android_log_columnar_writer;
+  writer->fd = fd;
+  writer->lid_mask = 0;
+  return writer;
+}
+
+void android_log_columnar_writer_free(struct android_log_columnar_writer* writer) {
+  delete writer;
+}
+
+ssize_t android_log_columnar_writer_add(struct android_log_columnar_writer* writer,
+                                        struct log_msg* msg) {
+  const char* payload = msg->msg();
+  if (!payload) {
+    return -EINVAL;
+  }
+  size_t len = msg->entry.len;
+  uint32_t lid = msg->entry.lid;
+
+  uint8_t prio = kRawPayload;
+  std::string tag;
+  const char* message = payload;
+  size_t message_len = len;
+  if (IsBinary(lid)) {
+    if (len >= sizeof(uint32_t)) {
+      uint32_t tag_number;
+      memcpy(&tag_number, payload, sizeof(tag_number));
+      prio = 0;
+      tag = std::to_string(tag_number);
+      message += sizeof(tag_number);
+      message_len -= sizeof(tag_number);
+    }
+  } else if (len >= 2) {
+    const char* nul = static_cast<const char*>(memchr(payload + 1, '\0', len - 1));
+    if (nul) {
+      prio = payload[0] & ~kRawPayload;
+      tag.assign(payload + 1, nul - payload - 1);
+      message = nul + 1;
+      message_len = payload + len - message;
+    }
+  }
+
+  auto it = writer->tag_ids.find(tag);
+  if (it == writer->tag_ids.end()) {
+    it = writer->tag_ids.emplace(tag, writer->tags.size()).first;
+    writer->tags.emplace_back(tag);
+  }
+
+  log_time realtime(msg->entry.sec, msg->entry.nsec);
+  if (writer->sec.empty() || realtime < writer->first) writer->first = realtime;
+  if (writer->sec.empty() || realtime > writer->last) writer->last = realtime;
+  writer->lid_mask |= 1U << (lid & 31);
+
+  writer->sec.push_back(msg->entry.sec);
+  writer->nsec.push_back(msg->entry.nsec);
+  writer->pid.push_back(msg->entry.pid);
+  writer->tid.push_back(msg->entry.tid);
+  writer->uid.push_back(msg->entry.hdr_size >= sizeof(msg->entry) ? msg->entry.uid : 0);
+  writer->lid.push_back(lid);
+  writer->prio.push_back(prio);
+  writer->tag.push_back(it->second);
+  writer->length.push_back(message_len);
+  writer->messages.append(message, message_len);
+
+  if (writer->sec.size() >= kMaxBlockEntries || writer->messages.size() >= kMaxBlockMessages ||
+      writer->tags.size() >= kMaxBlockTags) {
+    return android_log_columnar_writer_flush(writer);
+  }
+  return 0;
+}
+
+template <typename T>
+static void AppendColumn(std::string* columns, const std::vector<T>& column) {
+  columns->append(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(T));
+}
+
+ssize_t android_log_columnar_writer_flush(struct android_log_columnar_writer* writer) {
+  if (writer->sec.empty()) {
+    return 0;
+  }
+
+  std::string columns;
+  columns.reserve(writer->sec.size() * kColumnsEntrySize + writer->messages.size());
+  AppendColumn(&columns, writer->sec);
+  AppendColumn(&columns, writer->nsec);
+  AppendColumn(&columns, writer->pid);
+  AppendColumn(&columns, writer->tid);
+  AppendColumn(&columns, writer->uid);
+  AppendColumn(&columns, writer->lid);
+  AppendColumn(&columns, writer->prio);
+  AppendColumn(&columns, writer->tag);
+  AppendColumn(&columns, writer->length);
+  columns.append(writer->messages);
+
+  uLongf compressed_len = compressBound(columns.size());
+  std::vector<Bytef> compressed(compressed_len);
+  if (compress2(compressed.data(), &compressed_len,
+                reinterpret_cast<const Bytef*>(columns.data()), columns.size(),
+                Z_DEFAULT_COMPRESSION) != Z_OK) {
+    return -ENOMEM;
+  }
+
+  android_log_columnar_index_t index = {};
+  index.first = writer->first;
+  index.last = writer->last;
+  index.lid_mask = writer->lid_mask;
+  index.tag_count = writer->tags.size();
+  std::string index_tags;
+  for (const auto& tag : writer->tags) {
+    index_tags.append(tag.c_str(), tag.size() + 1);
+  }
+
+  android_log_columnar_block_t block = {};
+  block.magic = ANDROID_LOG_COLUMNAR_MAGIC;
+  block.count = writer->sec.size();
+  block.columns_size = compressed_len;
+  block.columns_raw_size = columns.size();
+  block.index_size = sizeof(index) + index_tags.size();
+
+  struct iovec iov[] = {
+      {&block, sizeof(block)},
+      {compressed.data(), compressed_len},
+      {&index, sizeof(index)},
+      {const_cast<char*>(index_tags.data()), index_tags.size()},
+  };
+  size_t total = 0;
+  for (const auto& vec : iov) {
+    total += vec.iov_len;
+  }
+  size_t written = 0;
+  size_t i = 0;
+  while (written < total) {
+    ssize_t ret = TEMP_FAILURE_RETRY(writev(writer->fd, &iov[i], arraysize(iov) - i));
+    if (ret <= 0) {
+      return ret ? -errno : -EIO;
+    }
+    written += ret;
+    while (ret > 0 && static_cast<size_t>(ret) >= iov[i].iov_len) {
+      ret -= iov[i].iov_len;
+      ++i;
+    }
+    if (ret > 0) {
+      iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + ret;
+      iov[i].iov_len -= ret;
+    }
+  }
+
+  writer->sec.clear();
+  writer->nsec.clear();
+  writer->pid.clear();
+  writer->tid.clear();
+  writer->uid.clear();
+  writer->lid.clear();
+  writer->prio.clear();
+  writer->tag.clear();
+  writer->length.clear();
+  writer->messages.clear();
+  writer->tags.clear();
+  writer->tag_ids.clear();
+  writer->lid_mask = 0;
+  return written;
+}
+
+struct android_log_columnar_reader {
+  int fd;
+  log_time start;
+  bool has_start;
+  std::unordered_set<std::string> tags;
+  size_t inflated;
+
+  // The current block
+  std::vector<char> columns;
+  uint32_t count;
+  uint32_t next;
+  size_t message_offset;
+  std::vector<std::string> block_tags;
+  std::vector<bool> tag_wanted;
+};
+
+struct android_log_columnar_reader* android_log_columnar_reader_alloc(int fd) {
+  android_log_columnar_reader* reader = new android_log_columnar_reader;
+  reader->fd = fd;
+  reader->has_start = false;
+  reader->inflated = 0;
+  reader->count = 0;
+  reader->next = 0;
+  reader->message_offset = 0;
+  return reader;
+}
+
+void android_log_columnar_reader_free(struct android_log_columnar_reader* reader) {
+  delete reader;
+}
+
+void android_log_columnar_reader_set_start(struct android_log_columnar_reader* reader,
+                                           log_time start) {
+  reader->start = start;
+  reader->has_start = true;
+}
+
+int android_log_columnar_reader_add_tag(struct android_log_columnar_reader* reader,
+                                        const char* tag) {
+  if (!tag) {
+    return -EINVAL;
+  }
+  reader->tags.emplace(tag);
+  return 0;
+}
+
+size_t android_log_columnar_reader_inflated(struct android_log_columnar_reader* reader) {
+  return reader->inflated;
+}
+
+// Returns the number of bytes read, short only at the end of the file.
+static ssize_t ReadFully(int fd, void* buf, size_t len) {
+  size_t total = 0;
+  while (total < len) {
+    ssize_t ret = TEMP_FAILURE_RETRY(read(fd, static_cast<char*>(buf) + total, len - total));
+    if (ret < 0) {
+      return -errno;
+    }
+    if (!ret) {
+      break;
+    }
+    total += ret;
+  }
+  return total;
+}
+
+template <typename T>
+static T Column(const android_log_columnar_reader* reader, size_t column_offset, size_t i) {
+  T value;
+  memcpy(&value, &reader->columns[column_offset * reader->count + i * sizeof(T)], sizeof(T));
+  return value;
+}
+
+// Loads the next block the index does not rule out. Returns 1, 0 at the end of the file, or a
+// negative errno. A block cut off by the end of the file counts as the end.
+static int NextBlock(android_log_columnar_reader* reader) {
+  for (;;) {
+    android_log_columnar_block_t block;
+    ssize_t ret = ReadFully(reader->fd, &block, sizeof(block));
+    if (ret != sizeof(block)) {
+      return (ret < 0) ? ret : 0;
+    }
+    if (block.magic != ANDROID_LOG_COLUMNAR_MAGIC || block.count > kMaxBlockEntries ||
+        block.index_size < sizeof(android_log_columnar_index_t) ||
+        block.index_size > kMaxIndexSize ||
+        block.columns_raw_size < block.count * kColumnsEntrySize ||
+        block.columns_raw_size > block.count * (kColumnsEntrySize + LOGGER_ENTRY_MAX_PAYLOAD)) {
+      return -EINVAL;
+    }
+
+    // The index follows the columns, so look at it before reading the columns.
+    off_t columns_offset = lseek(reader->fd, block.columns_size, SEEK_CUR);
+    if (columns_offset < 0) {
+      return -errno;
+    }
+    columns_offset -= block.columns_size;
+    std::vector<char> index_buf(block.index_size);
+    ret = ReadFully(reader->fd, index_buf.data(), index_buf.size());
+    if (ret != static_cast<ssize_t>(index_buf.size())) {
+      return (ret < 0) ? ret : 0;
+    }
+    android_log_columnar_index_t index;
+    memcpy(&index, index_buf.data(), sizeof(index));
+
+    std::vector<std::string> block_tags;
+    std::vector<bool> tag_wanted;
+    bool any_wanted = reader->tags.empty();
+    const char* tag = index_buf.data() + sizeof(index);
+    const char* end = index_buf.data() + index_buf.size();
+    for (size_t i = 0; i < index.tag_count; ++i) {
+      const char* nul = static_cast<const char*>(memchr(tag, '\0', end - tag));
+      if (!nul) {
+        return -EINVAL;
+      }
+      block_tags.emplace_back(tag, nul - tag);
+      tag_wanted.push_back(reader->tags.empty() || reader->tags.count(block_tags.back()));
+      any_wanted = any_wanted || tag_wanted.back();
+      tag = nul + 1;
+    }
+
+    if (!any_wanted || (reader->has_start && index.last < reader->start)) {
+      continue;
+    }
+
+    std::vector<Bytef> compressed(block.columns_size);
+    ret = TEMP_FAILURE_RETRY(pread(reader->fd, compressed.data(), compressed.size(),
+                                   columns_offset));
+    if (ret != static_cast<ssize_t>(compressed.size())) {
+      return (ret < 0) ? -errno : 0;
+    }
+    reader->columns.resize(block.columns_raw_size);
+    uLongf raw_size = block.columns_raw_size;
+    if (uncompress(reinterpret_cast<Bytef*>(reader->columns.data()), &raw_size,
+                   compressed.data(), compressed.size()) != Z_OK ||
+        raw_size != block.columns_raw_size) {
+      return -EINVAL;
+    }
+    ++reader->inflated;
+
+    reader->count = block.count;
+    reader->next = 0;
+    reader->message_offset = block.count * kColumnsEntrySize;
+    reader->block_tags.swap(block_tags);
+    reader->tag_wanted.swap(tag_wanted);
+    return 1;
+  }
+}
+
+int android_log_columnar_reader_read(struct android_log_columnar_reader* reader,
+                                     struct log_msg* msg) {
+  for (;;) {
+    while (reader->next < reader->count) {
+      size_t i = reader->next++;
+      uint32_t message_len = Column<uint32_t>(reader, 24, i);
+      size_t message_offset = reader->message_offset;
+      reader->message_offset += message_len;
+      if (reader->message_offset > reader->columns.size()) {
+        return -EINVAL;
+      }
+
+      uint16_t tag = Column<uint16_t>(reader, 22, i);
+      if (tag >= reader->block_tags.size()) {
+        return -EINVAL;
+      }
+      log_time realtime(Column<uint32_t>(reader, 0, i), Column<uint32_t>(reader, 4, i));
+      if (!reader->tag_wanted[tag] || (reader->has_start && realtime < reader->start)) {
+        continue;
+      }
+
+      uint8_t lid = Column<uint8_t>(reader, 20, i);
+      uint8_t prio = Column<uint8_t>(reader, 21, i);
+      const std::string& tag_string = reader->block_tags[tag];
+      size_t len = message_len;
+      if (!(prio & kRawPayload)) {
+        len += IsBinary(lid) ? sizeof(uint32_t) : (1 + tag_string.size() + 1);
+      }
+      if (len > LOGGER_ENTRY_MAX_PAYLOAD) {
+        return -EINVAL;
+      }
+
+      memset(&msg->entry, 0, sizeof(msg->entry));
+      msg->entry.len = len;
+      msg->entry.hdr_size = sizeof(msg->entry);
+      msg->entry.sec = realtime.tv_sec;
+      msg->entry.nsec = realtime.tv_nsec;
+      msg->entry.pid = Column<uint32_t>(reader, 8, i);
+      msg->entry.tid = Column<uint32_t>(reader, 12, i);
+      msg->entry.uid = Column<uint32_t>(reader, 16, i);
+      msg->entry.lid = lid;
+
+      char* payload = msg->msg();
+      if (prio & kRawPayload) {
+        // The message is the whole payload.
+      } else if (IsBinary(lid)) {
+        uint32_t tag_number = strtoul(tag_string.c_str(), nullptr, 10);
+        memcpy(payload, &tag_number, sizeof(tag_number));
+        payload += sizeof(tag_number);
+      } else {
+        *payload++ = prio;
+        memcpy(payload, tag_string.c_str(), tag_string.size() + 1);
+        payload += tag_string.size() + 1;
+      }
+      memcpy(payload, &reader->columns[message_offset], message_len);
+      msg->buf[msg->len()] = '\0';
+      return msg->entry.len;
+    }
+
+    int ret = NextBlock(reader);
+    if (ret <= 0) {
+      return ret;
+    }
+  }
+}
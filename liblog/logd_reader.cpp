@@ -259,8 +259,11 @@ int android_logger_set_prune_list(struct logger_list* logger_list, const char* b
   return check_log_success(cmd.data(), SendLogdControlMessage(cmd.data(), cmd.size()));
 }
 
+// logd before filter= and format= reads at most this much of the command.
+static constexpr size_t kOldLogdCommandMax = 254;
+
 static int logdOpen(struct logger_list* logger_list) {
-  char buffer[256], *cp, c;
+  char buffer[1024], *cp, c;
   int ret, remaining, sock;
 
   sock = atomic_load(&logger_list->fd);
@@ -319,6 +322,23 @@ static int logdOpen(struct logger_list* logger_list) {
   if (logger_list->pid) {
     ret = snprintf(cp, remaining, " pid=%u", logger_list->pid);
     ret = MIN(ret, remaining);
+    remaining -= ret;
+    cp += ret;
+  }
+
+  if (logger_list->format) {
+    ret = snprintf(cp, remaining, " format=%s", logger_list->format);
+    ret = MIN(ret, remaining);
+    remaining -= ret;
+    cp += ret;
+  }
+
+  // Keep the command within what older logd read. A filter that doesn't fit is left to the
+  // reader, which has to apply it anyway.
+  if (logger_list->filter &&
+      (cp - buffer) + strlen(" filter=") + strlen(logger_list->filter) <= kOldLogdCommandMax) {
+    ret = snprintf(cp, remaining, " filter=%s", logger_list->filter);
+    ret = MIN(ret, remaining);
     cp += ret;
   }
 
@@ -20,18 +20,24 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <poll.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <private/android_filesystem_config.h>
 #include <private/android_logger.h>
 
@@ -39,6 +45,11 @@
 #include "uio.h"
 
 static atomic_int logd_socket;
+static atomic_int dropped;
+static atomic_int droppedSecurity;
+
+static void LogdCloseRing();
+static void LogdCloseBatches();
 
 // Note that it is safe to call connect() multiple times on DGRAM Unix domain sockets, so this
 // function is used to reconnect to logd without requiring a new socket.
@@ -77,12 +88,486 @@ static void GetSocket() {
 // This is the one exception to the above.  Zygote uses this to clean up open FD's after fork() and
 // before specialization.  It is single threaded at this point and therefore this function is
 // explicitly not thread safe.  It sets logd_socket to 0, so future logs will be safely initialized
-// whenever they happen.
+// whenever they happen. Pending batches are sent before the socket is closed.
 void LogdClose() {
+  LogdCloseBatches();
   if (logd_socket > 0) {
     close(logd_socket);
   }
   logd_socket = 0;
+  LogdCloseRing();
+}
+
+// Opt-in shared memory ring, see __android_log_set_logd_ring() and android_log_ring_header_t.
+// Once published, logd_ring is only replaced by a forked child registering its own ring, writers
+// check that the ring belongs to their process before touching it.
+struct LogdRing {
+  android_log_ring_header_t* header;
+  char* data;
+  size_t size;   // of data, a power of two
+  int doorbell;  // eventfd
+  int socket;    // logd drops the ring when this is closed
+  pid_t pid;
+};
+
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static LogdRing* logd_ring;
+
+static void LogdUnmapRing(LogdRing* ring) {
+  munmap(ring->header, LOG_RING_HEADER_SIZE + ring->size);
+  close(ring->doorbell);
+  close(ring->socket);
+}
+
+// Hands the memfd and the doorbell to logd and waits for its verdict.
+static int LogdSendRing(int socket, int memfd, int doorbell) {
+  sockaddr_un un = {};
+  un.sun_family = AF_UNIX;
+  strcpy(un.sun_path, "/dev/socket/logdring");
+  if (TEMP_FAILURE_RETRY(connect(socket, reinterpret_cast<sockaddr*>(&un), sizeof(un))) < 0) {
+    return -errno;
+  }
+
+  static const char command[] = "ring";
+  struct iovec iov = {const_cast<char*>(command), sizeof(command)};
+  alignas(struct cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))] = {};
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+  int fds[2] = {memfd, doorbell};
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  if (TEMP_FAILURE_RETRY(sendmsg(socket, &msg, 0)) < 0) {
+    return -errno;
+  }
+
+  struct pollfd pfd = {socket, POLLIN, 0};
+  int32_t status;
+  int ret = TEMP_FAILURE_RETRY(poll(&pfd, 1, 1000));
+  if (ret <= 0) {
+    return ret ? -errno : -ETIMEDOUT;
+  }
+  if (TEMP_FAILURE_RETRY(read(socket, &status, sizeof(status))) != sizeof(status)) {
+    return -EIO;
+  }
+  return status;
+}
+
+static int LogdRegisterRing(size_t size, LogdRing* ring) {
+  ring->size = LOG_RING_MIN_SIZE;
+  while (ring->size < size && ring->size < LOG_RING_MAX_SIZE) {
+    ring->size <<= 1;
+  }
+  ring->pid = getpid();
+
+  int memfd = syscall(__NR_memfd_create, "logd_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (memfd < 0) {
+    return -errno;
+  }
+  void* map = MAP_FAILED;
+  if (!ftruncate(memfd, LOG_RING_HEADER_SIZE + ring->size) &&
+      !fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) {
+    map = mmap(nullptr, LOG_RING_HEADER_SIZE + ring->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               memfd, 0);
+  }
+  if (map == MAP_FAILED) {
+    int ret = -errno;
+    close(memfd);
+    return ret;
+  }
+  ring->header = static_cast<android_log_ring_header_t*>(map);
+  ring->data = static_cast<char*>(map) + LOG_RING_HEADER_SIZE;
+  ring->header->magic = LOG_RING_MAGIC;
+
+  ring->doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  ring->socket = TEMP_FAILURE_RETRY(socket(PF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0));
+  int ret = (ring->doorbell < 0 || ring->socket < 0)
+                ? -errno
+                : LogdSendRing(ring->socket, memfd, ring->doorbell);
+  close(memfd);
+  if (ret) {
+    LogdUnmapRing(ring);
+  }
+  return ret;
+}
+
+int LogdSetRing(size_t size) {
+  if (getuid() == AID_LOGD) {
+    return -EPERM;
+  }
+
+  pthread_mutex_lock(&ring_lock);
+  LogdRing* old = logd_ring;
+  if (old && old->pid == getpid()) {
+    pthread_mutex_unlock(&ring_lock);
+    return 0;
+  }
+
+  LogdRing* ring = static_cast<LogdRing*>(calloc(1, sizeof(LogdRing)));
+  int ret = ring ? LogdRegisterRing(size, ring) : -ENOMEM;
+  if (ret) {
+    free(ring);
+  } else {
+    __atomic_store_n(&logd_ring, ring, __ATOMIC_RELEASE);
+    if (old) {
+      // Our parent's, writers in this process skip it but may still be looking at it.
+      LogdUnmapRing(old);
+    }
+  }
+  pthread_mutex_unlock(&ring_lock);
+  return ret;
+}
+
+// Zygote, single threaded, see LogdClose().
+static void LogdCloseRing() {
+  if (logd_ring) {
+    LogdUnmapRing(logd_ring);
+    free(logd_ring);
+    logd_ring = nullptr;
+  }
+}
+
+// vec[0] is the android_log_header_t, size that of the whole entry. Returns false if the entry
+// should go to the socket instead.
+static bool LogdRingWrite(struct iovec* vec, size_t nr, size_t size) {
+  LogdRing* ring = __atomic_load_n(&logd_ring, __ATOMIC_ACQUIRE);
+  if (!ring || ring->pid != getpid()) {
+    return false;
+  }
+  android_log_ring_header_t* header = ring->header;
+
+  size += sizeof(uint32_t);
+  uint64_t aligned = (size + 7) & ~7ULL;
+  uint64_t reserve = __atomic_load_n(&header->reserve, __ATOMIC_RELAXED);
+  uint64_t offset, pad;
+  do {
+    offset = reserve & (ring->size - 1);
+    pad = ((ring->size - offset) < aligned) ? (ring->size - offset) : 0;
+    uint64_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+    if ((reserve + pad + aligned - head) > ring->size) {
+      return false;
+    }
+  } while (!__atomic_compare_exchange_n(&header->reserve, &reserve, reserve + pad + aligned, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  if (pad) {
+    __atomic_store_n(reinterpret_cast<uint32_t*>(ring->data + offset), LOG_RING_PAD | pad,
+                     __ATOMIC_RELEASE);
+    offset = 0;
+  }
+  char* entry = ring->data + offset;
+  char* p = entry + sizeof(uint32_t);
+  for (size_t i = 0; i < nr; ++i) {
+    memcpy(p, vec[i].iov_base, vec[i].iov_len);
+    p += vec[i].iov_len;
+  }
+  // Publish, then check whether logd went to sleep before it could see the entry.
+  __atomic_store_n(reinterpret_cast<uint32_t*>(entry), size, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&header->sleeping, __ATOMIC_SEQ_CST) &&
+      __atomic_exchange_n(&header->sleeping, 0, __ATOMIC_SEQ_CST)) {
+    uint64_t one = 1;
+    TEMP_FAILURE_RETRY(write(ring->doorbell, &one, sizeof(one)));
+  }
+  return true;
+}
+
+// Opt-in batching, see __android_log_set_logd_batching(). Each thread appends its entries,
+// header and payload, to its own LogdBatch. The batch is sent with a single sendmmsg(), one
+// datagram per entry, once it reaches batch_threshold bytes, when the thread logs something that
+// must not wait, or by the flusher thread once its oldest entry is batch_delay_ms old. The
+// flusher sleeps on batch_cond until the next batch is due, and not at all while none is pending.
+static constexpr size_t kBatchMaxBytes = 32 * 1024;
+static constexpr size_t kBatchMaxEntries = 64;
+
+struct LogdBatch {
+  pthread_mutex_t lock;
+  LogdBatch* next;  // in batch_list, guarded by batch_list_lock
+  size_t count;
+  size_t used;
+  struct timespec oldest;  // CLOCK_MONOTONIC when the first pending entry was added
+  uint16_t lengths[kBatchMaxEntries];
+  char buffer[kBatchMaxBytes];
+};
+
+static atomic_size_t batch_threshold;  // 0 when batching is off
+static atomic_uint batch_delay_ms;
+static pthread_once_t batch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t batch_key;
+static pthread_mutex_t batch_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batch_cond;  // CLOCK_MONOTONIC, used with batch_list_lock
+static LogdBatch* batch_list;
+// Written with batch_list_lock held, read without it so that logging threads only take the lock
+// when the flusher has to be started.
+static atomic_int batch_flusher_pid;
+
+// Called with batch->lock held.
+static void LogdFlushBatch(LogdBatch* batch) {
+  if (!batch->count) {
+    return;
+  }
+
+  struct iovec iov[kBatchMaxEntries];
+  struct mmsghdr msgs[kBatchMaxEntries] = {};
+  char* entry = batch->buffer;
+  for (size_t i = 0; i < batch->count; ++i) {
+    iov[i].iov_base = entry;
+    iov[i].iov_len = batch->lengths[i];
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    entry += batch->lengths[i];
+  }
+
+  // As LogdWrite(), never block, reconnect and retry once on errors other than EAGAIN.
+  GetSocket();
+  int sent = -1;
+  if (logd_socket > 0) {
+    sent = TEMP_FAILURE_RETRY(sendmmsg(logd_socket, msgs, batch->count, 0));
+    if (sent < 0 && errno != EAGAIN) {
+      LogdConnect();
+      sent = TEMP_FAILURE_RETRY(sendmmsg(logd_socket, msgs, batch->count, 0));
+    }
+  }
+  if (sent < 0) {
+    sent = 0;
+  }
+  if ((size_t)sent < batch->count) {
+    atomic_fetch_add_explicit(&dropped, batch->count - sent, memory_order_relaxed);
+  }
+
+  batch->count = 0;
+  batch->used = 0;
+}
+
+static void LogdFreeBatch(void* arg) {
+  LogdBatch* batch = static_cast<LogdBatch*>(arg);
+
+  pthread_mutex_lock(&batch_list_lock);
+  for (LogdBatch** it = &batch_list; *it; it = &(*it)->next) {
+    if (*it == batch) {
+      *it = batch->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&batch_list_lock);
+
+  pthread_mutex_lock(&batch->lock);
+  LogdFlushBatch(batch);
+  pthread_mutex_unlock(&batch->lock);
+  pthread_mutex_destroy(&batch->lock);
+  free(batch);
+}
+
+static void LogdInitBatchCond() {
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&batch_cond, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+// Hold every batch lock across fork(), in the order the flusher takes them, so that neither
+// process is left with a lock some other thread had mid-flush.
+static void LogdBatchAtForkPrepare() {
+  pthread_mutex_lock(&batch_list_lock);
+  for (LogdBatch* batch = batch_list; batch; batch = batch->next) {
+    pthread_mutex_lock(&batch->lock);
+  }
+}
+
+static void LogdBatchAtForkParent() {
+  for (LogdBatch* batch = batch_list; batch; batch = batch->next) {
+    pthread_mutex_unlock(&batch->lock);
+  }
+  pthread_mutex_unlock(&batch_list_lock);
+}
+
+// The child must not send what its parent still holds, and only the forking thread survives.
+static void LogdBatchAtForkChild() {
+  for (LogdBatch* batch = batch_list; batch; batch = batch->next) {
+    pthread_mutex_init(&batch->lock, nullptr);
+    batch->count = 0;
+    batch->used = 0;
+  }
+  pthread_mutex_init(&batch_list_lock, nullptr);
+  LogdInitBatchCond();
+  atomic_store(&batch_flusher_pid, 0);
+}
+
+// Zygote, single threaded, see LogdClose().
+static void LogdCloseBatches() {
+  for (LogdBatch* batch = batch_list; batch; batch = batch->next) {
+    LogdFlushBatch(batch);
+  }
+}
+
+static void LogdBatchInit() {
+  pthread_key_create(&batch_key, LogdFreeBatch);
+  LogdInitBatchCond();
+  pthread_atfork(LogdBatchAtForkPrepare, LogdBatchAtForkParent, LogdBatchAtForkChild);
+}
+
+static bool Before(const struct timespec& a, const struct timespec& b) {
+  return (a.tv_sec < b.tv_sec) || ((a.tv_sec == b.tv_sec) && (a.tv_nsec < b.tv_nsec));
+}
+
+static void* LogdBatchFlusher(void*) {
+  pthread_mutex_lock(&batch_list_lock);
+  for (;;) {
+    unsigned int delay_ms = atomic_load(&batch_delay_ms);
+    bool enabled = atomic_load(&batch_threshold) != 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // Send what is due, and find when the next of the rest will be.
+    bool pending = false;
+    struct timespec next;
+    for (LogdBatch* batch = batch_list; batch; batch = batch->next) {
+      pthread_mutex_lock(&batch->lock);
+      if (batch->count) {
+        struct timespec due = batch->oldest;
+        due.tv_sec += delay_ms / 1000;
+        due.tv_nsec += (delay_ms % 1000) * 1000000L;
+        if (due.tv_nsec >= 1000000000L) {
+          due.tv_sec++;
+          due.tv_nsec -= 1000000000L;
+        }
+        if (!enabled || !Before(now, due)) {
+          LogdFlushBatch(batch);
+        } else if (!pending || Before(due, next)) {
+          next = due;
+          pending = true;
+        }
+      }
+      pthread_mutex_unlock(&batch->lock);
+    }
+    if (!enabled) {
+      atomic_store(&batch_flusher_pid, 0);
+      pthread_mutex_unlock(&batch_list_lock);
+      return nullptr;
+    }
+
+    // Woken by LogdBatchWrite() when a batch gets its first entry, or by LogdSetBatching().
+    if (pending) {
+      pthread_cond_timedwait(&batch_cond, &batch_list_lock, &next);
+    } else {
+      pthread_cond_wait(&batch_cond, &batch_list_lock);
+    }
+  }
+}
+
+static LogdBatch* GetBatch() {
+  pthread_once(&batch_once, LogdBatchInit);
+
+  LogdBatch* batch = static_cast<LogdBatch*>(pthread_getspecific(batch_key));
+  if (!batch) {
+    batch = static_cast<LogdBatch*>(calloc(1, sizeof(LogdBatch)));
+    if (!batch) {
+      return nullptr;
+    }
+    pthread_mutex_init(&batch->lock, nullptr);
+    pthread_setspecific(batch_key, batch);
+
+    pthread_mutex_lock(&batch_list_lock);
+    batch->next = batch_list;
+    batch_list = batch;
+    pthread_mutex_unlock(&batch_list_lock);
+  }
+
+  pid_t pid = getpid();
+  if (atomic_load(&batch_flusher_pid) != pid) {
+    pthread_mutex_lock(&batch_list_lock);
+    if (atomic_load(&batch_flusher_pid) != pid) {
+      pthread_attr_t attr;
+      pthread_t thread;
+      pthread_attr_init(&attr);
+      pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+      if (!pthread_create(&thread, &attr, LogdBatchFlusher, nullptr)) {
+        atomic_store(&batch_flusher_pid, pid);
+      }
+      pthread_attr_destroy(&attr);
+    }
+    pthread_mutex_unlock(&batch_list_lock);
+  }
+
+  return batch;
+}
+
+void LogdSetBatching(size_t threshold, unsigned int delay_ms) {
+  if (threshold) {
+    threshold = std::clamp(threshold, sizeof(android_log_header_t) + LOGGER_ENTRY_MAX_PAYLOAD,
+                           kBatchMaxBytes);
+    delay_ms = std::max(delay_ms, 1U);
+  }
+  atomic_store(&batch_delay_ms, delay_ms);
+  atomic_store(&batch_threshold, threshold);
+
+  // Have a running flusher pick up the new settings, or exit.
+  if (atomic_load(&batch_flusher_pid) == getpid()) {
+    pthread_mutex_lock(&batch_list_lock);
+    pthread_cond_signal(&batch_cond);
+    pthread_mutex_unlock(&batch_list_lock);
+  }
+}
+
+// Returns false if the entry should be sent right away instead.
+static bool LogdBatchWrite(log_id_t logId, struct iovec* vec, size_t nr, size_t size) {
+  size_t threshold = atomic_load_explicit(&batch_threshold, memory_order_relaxed);
+  if (!threshold) {
+    return false;
+  }
+
+  bool urgent = logId == LOG_ID_CRASH || logId == LOG_ID_SECURITY || logId == LOG_ID_KERNEL;
+  if (!urgent && logId != LOG_ID_EVENTS && logId != LOG_ID_STATS) {
+    // Text buffers, vec[1] is the priority, vec[0] our header.
+    urgent = nr > 1 && vec[1].iov_len &&
+             *static_cast<const char*>(vec[1].iov_base) >= ANDROID_LOG_FATAL;
+  }
+
+  LogdBatch* batch = GetBatch();
+  if (!batch) {
+    return false;
+  }
+
+  pthread_mutex_lock(&batch->lock);
+  if (urgent) {
+    // Keep this thread's entries in order ahead of the one sent directly.
+    LogdFlushBatch(batch);
+    pthread_mutex_unlock(&batch->lock);
+    return false;
+  }
+
+  if ((batch->used + size > kBatchMaxBytes) || (batch->count == kBatchMaxEntries)) {
+    LogdFlushBatch(batch);
+  }
+  bool first = !batch->count;
+  if (first) {
+    clock_gettime(CLOCK_MONOTONIC, &batch->oldest);
+  }
+  char* entry = batch->buffer + batch->used;
+  for (size_t i = 0; i < nr; ++i) {
+    memcpy(entry, vec[i].iov_base, vec[i].iov_len);
+    entry += vec[i].iov_len;
+  }
+  batch->lengths[batch->count++] = size;
+  batch->used += size;
+  if (batch->used >= threshold) {
+    LogdFlushBatch(batch);
+  }
+  bool wake = first && batch->count;
+  pthread_mutex_unlock(&batch->lock);
+
+  // Not under batch->lock, the flusher takes batch_list_lock first.
+  if (wake) {
+    pthread_mutex_lock(&batch_list_lock);
+    pthread_cond_signal(&batch_cond);
+    pthread_mutex_unlock(&batch_list_lock);
+  }
+  return true;
 }
 
 int LogdWrite(log_id_t logId, struct timespec* ts, struct iovec* vec, size_t nr) {
@@ -91,8 +576,6 @@ int LogdWrite(log_id_t logId, struct timespec* ts, struct iovec* vec, size_t nr)
   struct iovec newVec[nr + headerLength];
   android_log_header_t header;
   size_t i, payloadSize;
-  static atomic_int dropped;
-  static atomic_int droppedSecurity;
 
   GetSocket();
 
@@ -168,6 +651,17 @@ int LogdWrite(log_id_t logId, struct timespec* ts, struct iovec* vec, size_t nr)
     }
   }
 
+  // Crash and security entries always take the socket. logd only accepts security entries along
+  // with the sender's credentials, and crashes must get through even if the ring is stuck.
+  if (logId != LOG_ID_CRASH && logId != LOG_ID_SECURITY &&
+      LogdRingWrite(newVec, i, sizeof(header) + payloadSize)) {
+    return payloadSize;
+  }
+
+  if (LogdBatchWrite(logId, newVec, i, sizeof(header) + payloadSize)) {
+    return payloadSize;
+  }
+
   // The write below could be lost, but will never block.
   // EAGAIN occurs if logd is overloaded, other errors indicate that something went wrong with
   // the connection, so we reset it and try again.
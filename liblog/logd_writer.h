@@ -22,3 +22,5 @@
 
 int LogdWrite(log_id_t logId, struct timespec* ts, struct iovec* vec, size_t nr);
 void LogdClose();
+void LogdSetBatching(size_t threshold, unsigned int delay_ms);
+int LogdSetRing(size_t size);
@@ -32,6 +32,8 @@ struct logger_list {
   log_time start;
   pid_t pid;
   uint32_t log_mask;
+  char* filter; /* comma separated filterspecs pushed down to logd, or NULL */
+  char* format; /* comma separated formats requested from logd, or NULL */
 };
 
 // Format for a 'logger' entry: uintptr_t where only the bottom 32 bits are used.
@@ -26,7 +26,11 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <string>
+
 #include <android/log.h>
+#include <log/logprint.h>
+#include <private/android_logger.h>
 
 #include "logd_reader.h"
 #include "logger.h"
@@ -60,6 +64,85 @@ struct logger_list* android_logger_list_alloc_time(int mode, log_time start, pid
   return android_logger_list_alloc_internal(mode, 0, start, pid);
 }
 
+// The logdr command must fit in logd's read buffer along with the other arguments.
+static constexpr size_t kMaxFilterLen = 512;
+static constexpr size_t kMaxFormatLen = 64;
+
+int android_logger_list_set_filter(struct logger_list* logger_list, const char* filterspec) {
+  if (!logger_list || !filterspec) {
+    return -EINVAL;
+  }
+
+  // Validate with liblog's own parser, and use commas as logd splits arguments on spaces.
+  AndroidLogFormat* format = android_log_format_new();
+  std::string filter;
+  std::string spec = filterspec;
+  int ret = 0;
+  for (size_t pos = 0; pos < spec.size();) {
+    size_t len = strcspn(spec.c_str() + pos, " \t,");
+    if (len) {
+      std::string rule = spec.substr(pos, len);
+      if (android_log_addFilterRule(format, rule.c_str()) < 0) {
+        ret = -EINVAL;
+        break;
+      }
+      if (!filter.empty()) filter += ',';
+      filter += rule;
+    }
+    pos += len + 1;
+  }
+  android_log_format_free(format);
+  if (ret < 0) {
+    return ret;
+  }
+  if (filter.size() > kMaxFilterLen) {
+    return -E2BIG;
+  }
+
+  char* copy = strdup(filter.c_str());
+  if (!copy) {
+    return -ENOMEM;
+  }
+  free(logger_list->filter);
+  logger_list->filter = copy;
+  return 0;
+}
+
+int android_logger_list_set_format(struct logger_list* logger_list, const char* format) {
+  if (!logger_list || !format) {
+    return -EINVAL;
+  }
+
+  std::string formats;
+  std::string spec = format;
+  for (size_t pos = 0; pos < spec.size();) {
+    size_t len = strcspn(spec.c_str() + pos, " \t,");
+    if (len) {
+      std::string name = spec.substr(pos, len);
+      if (android_log_formatFromString(name.c_str()) == FORMAT_OFF) {
+        return -EINVAL;
+      }
+      if (!formats.empty()) formats += ',';
+      formats += name;
+    }
+    pos += len + 1;
+  }
+  if (formats.empty()) {
+    return -EINVAL;
+  }
+  if (formats.size() > kMaxFormatLen) {
+    return -E2BIG;
+  }
+
+  char* copy = strdup(formats.c_str());
+  if (!copy) {
+    return -ENOMEM;
+  }
+  free(logger_list->format);
+  logger_list->format = copy;
+  return 0;
+}
+
 /* Open the named log and add it to the logger list */
 struct logger* android_logger_open(struct logger_list* logger_list, log_id_t logId) {
   if (!logger_list || (logId >= LOG_ID_MAX)) {
@@ -145,5 +228,7 @@ void android_logger_list_free(struct logger_list* logger_list) {
   }
 #endif
 
+  free(logger_list->filter);
+  free(logger_list->format);
   free(logger_list);
 }
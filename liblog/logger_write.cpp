@@ -108,6 +108,24 @@ void __android_log_close() {
 #endif
 }
 
+void __android_log_set_logd_batching(size_t threshold_bytes, unsigned int delay_ms) {
+#ifdef __ANDROID__
+  LogdSetBatching(threshold_bytes, delay_ms);
+#else
+  (void)threshold_bytes;
+  (void)delay_ms;
+#endif
+}
+
+int __android_log_set_logd_ring(size_t size) {
+#ifdef __ANDROID__
+  return LogdSetRing(size);
+#else
+  (void)size;
+  return -ENOTSUP;
+#endif
+}
+
 #if defined(__GLIBC__) || defined(_WIN32)
 static const char* getprogname() {
 #if defined(__GLIBC__)
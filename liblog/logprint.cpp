@@ -67,6 +67,14 @@ struct AndroidLogFormat_t {
   bool monotonic_output;
   bool uid_output;
   bool descriptive_output;
+
+  /* localtime_r() and strftime() results for the last second formatted */
+  bool time_cache_valid;
+  bool time_cache_year;
+  time_t time_cache_sec;
+  char time_cache_tz[64];
+  char time_cache_date[32];
+  char time_cache_zone[16];
 };
 
 /*
@@ -1093,6 +1101,34 @@ int android_log_processBinaryLogBuffer(
   return result;
 }
 
+/*
+ * Word at a time checks for bytes that convertPrintable() can not copy as is,
+ * anything but printable ASCII or a backslash. Exact as to whether there is
+ * one, not as to where.
+ */
+#define ONES (~UINT64_C(0) / 255)
+#define HIGHS (ONES * 0x80)
+#define HAS_LESS(x, n) (((x) - ONES * (n)) & ~(x) & HIGHS)
+#define HAS_ZERO(x) HAS_LESS(x, 1)
+
+static inline bool plainPrintable(char c) {
+  return (c >= ' ') && (c < 0x7F) && (c != '\\');
+}
+
+static size_t plainPrintableRun(const char* message, size_t messageLen) {
+  size_t i = 0;
+  for (; (i + sizeof(uint64_t)) <= messageLen; i += sizeof(uint64_t)) {
+    uint64_t x;
+    memcpy(&x, message + i, sizeof(x));
+    if ((x & HIGHS) || HAS_LESS(x, ' ') || HAS_ZERO(x ^ (ONES * 0x7F)) ||
+        HAS_ZERO(x ^ (ONES * '\\'))) {
+      break;
+    }
+  }
+  while ((i < messageLen) && plainPrintable(message[i])) ++i;
+  return i;
+}
+
 /*
  * Convert to printable from message to p buffer, return string length. If p is
  * NULL, do not copy, but still return the expected string length.
@@ -1103,6 +1139,21 @@ size_t convertPrintable(char* p, const char* message, size_t messageLen) {
   mbstate_t mb_state = {};
 
   while (messageLen) {
+    /* Runs of printable ASCII are copied as they are, unless mid character */
+    if (mbsinit(&mb_state)) {
+      size_t run = plainPrintableRun(message, messageLen);
+      if (run) {
+        if (print) {
+          memcpy(p, message, run);
+          p[run] = '\0';
+        }
+        p += run;
+        message += run;
+        messageLen -= run;
+        continue;
+      }
+    }
+
     char buf[6];
     ssize_t len = sizeof(buf) - 1;
     if ((size_t)len > messageLen) {
@@ -1427,16 +1478,130 @@ static void convertMonotonic(struct timespec* result, const AndroidLogEntry* ent
  * Returns NULL on malloc error
  */
 
-char* android_log_formatLogLine(AndroidLogFormat* p_format, char* defaultBuffer,
-                                size_t defaultBufferSize, const AndroidLogEntry* entry,
-                                size_t* p_outLength) {
+/*
+ * Appends to a fixed size buffer with snprintf() semantics: the result is
+ * truncated to size - 1 and null terminated, and len is what would have been
+ * written given a large enough buffer. Only covers the conversions that
+ * android_log_formatLogLine() needs, without parsing a format string for each.
+ */
+struct LineBuilder {
+  char* buf;
+  size_t size;
+  size_t len;
+};
+
+static void lineBuilderInit(struct LineBuilder* lb, char* buf, size_t size) {
+  lb->buf = buf;
+  lb->size = size;
+  lb->len = 0;
+  if (size) buf[0] = '\0';
+}
+
+static void lineBuilderPut(struct LineBuilder* lb, const char* s, size_t n) {
+  if (lb->len < lb->size) {
+    size_t room = lb->size - 1 - lb->len;
+    memcpy(lb->buf + lb->len, s, MIN(n, room));
+    lb->buf[lb->len + MIN(n, room)] = '\0';
+  }
+  lb->len += n;
+}
+
+static void lineBuilderPutc(struct LineBuilder* lb, char c) {
+  lineBuilderPut(lb, &c, 1);
+}
+
+static void lineBuilderPad(struct LineBuilder* lb, char c, size_t n) {
+  char pad[16];
+  memset(pad, c, sizeof(pad));
+  while (n) {
+    size_t chunk = MIN(n, sizeof(pad));
+    lineBuilderPut(lb, pad, chunk);
+    n -= chunk;
+  }
+}
+
+/* %*lld, or %0*lld if zero, the sign counting towards width either way */
+static void lineBuilderPutInt(struct LineBuilder* lb, long long value, size_t width, bool zero) {
+  char digits[24];
+  char* d = digits + sizeof(digits);
+  unsigned long long u = (value < 0) ? -(unsigned long long)value : value;
+  do {
+    *--d = '0' + (u % 10);
+    u /= 10;
+  } while (u);
+  size_t n = digits + sizeof(digits) - d;
+  if (value < 0) ++n;
+  if (zero) {
+    if (value < 0) lineBuilderPutc(lb, '-');
+    if (width > n) lineBuilderPad(lb, '0', width - n);
+  } else {
+    if (width > n) lineBuilderPad(lb, ' ', width - n);
+    if (value < 0) lineBuilderPutc(lb, '-');
+  }
+  lineBuilderPut(lb, d, digits + sizeof(digits) - d);
+}
+
+static void lineBuilderPuts(struct LineBuilder* lb, const char* s) {
+  lineBuilderPut(lb, s, strlen(s));
+}
+
+/* %-8.*s */
+static void lineBuilderPutTag(struct LineBuilder* lb, const AndroidLogEntry* entry) {
+  size_t n = strnlen(entry->tag, entry->tagLen);
+  lineBuilderPut(lb, entry->tag, n);
+  if (n < 8) lineBuilderPad(lb, ' ', 8 - n);
+}
+
+/*
+ * Formats the local date and time, and optionally the zone, of now. Logs are
+ * mostly read in order, so the result of localtime_r() and strftime() for the
+ * last second is kept and reused for as long as TZ does not change. Returns
+ * NULL if localtime_r() fails, else the date, and the zone in zone.
+ */
+static const char* formatDate(AndroidLogFormat* p_format, time_t now, const char** zone) {
+  const char* tz = getenv("TZ");
+  size_t tzLen = tz ? strlen(tz) : 0;
+  /* Cache keys on the TZ environment, the empty string stands for unset */
+  bool cacheable = !tz || ((tzLen > 0) && (tzLen < sizeof(p_format->time_cache_tz)));
+
+  if (cacheable && p_format->time_cache_valid && (p_format->time_cache_sec == now) &&
+      (p_format->time_cache_year == p_format->year_output) &&
+      !strcmp(p_format->time_cache_tz, tz ? tz : "")) {
+    *zone = p_format->time_cache_zone;
+    return p_format->time_cache_date;
+  }
+
 #if !defined(_WIN32)
   struct tm tmBuf;
+  struct tm* ptm = localtime_r(&now, &tmBuf);
+#else
+  struct tm* ptm = localtime(&now);
 #endif
-  struct tm* ptm;
+  if (!ptm) return NULL;
+
+  p_format->time_cache_valid = false;
+  strftime(p_format->time_cache_date, sizeof(p_format->time_cache_date),
+           &"%Y-%m-%d %H:%M:%S"[p_format->year_output ? 0 : 3], ptm);
+  strftime(p_format->time_cache_zone, sizeof(p_format->time_cache_zone), " %z", ptm);
+  if (cacheable) {
+    p_format->time_cache_valid = true;
+    p_format->time_cache_sec = now;
+    p_format->time_cache_year = p_format->year_output;
+    strcpy(p_format->time_cache_tz, tz ? tz : "");
+  }
+  *zone = p_format->time_cache_zone;
+  return p_format->time_cache_date;
+}
+
+char* android_log_formatLogLine(AndroidLogFormat* p_format, char* defaultBuffer,
+                                size_t defaultBufferSize, const AndroidLogEntry* entry,
+                                size_t* p_outLength) {
+  const char* date;
+  const char* zone = "";
   /* good margin, 23+nul for msec, 26+nul for usec, 29+nul to nsec */
   char timeBuf[64];
   char prefixBuf[128], suffixBuf[128];
+  struct LineBuilder lb;
   char priChar;
   int prefixSuffixIsHeaderFooter = 0;
   char* ret;
@@ -1475,28 +1640,22 @@ char* android_log_formatLogLine(AndroidLogFormat* p_format, char* defaultBuffer,
   if (now < 0) {
     nsec = NS_PER_SEC - nsec;
   }
+  lineBuilderInit(&lb, timeBuf, sizeof(timeBuf));
   if (p_format->epoch_output || p_format->monotonic_output) {
-    ptm = NULL;
-    snprintf(timeBuf, sizeof(timeBuf), p_format->monotonic_output ? "%6lld" : "%19lld",
-             (long long)now);
-  } else {
-#if !defined(_WIN32)
-    ptm = localtime_r(&now, &tmBuf);
-#else
-    ptm = localtime(&now);
-#endif
-    strftime(timeBuf, sizeof(timeBuf), &"%Y-%m-%d %H:%M:%S"[p_format->year_output ? 0 : 3], ptm);
+    lineBuilderPutInt(&lb, now, p_format->monotonic_output ? 6 : 19, false);
+  } else if ((date = formatDate(p_format, now, &zone)) != NULL) {
+    lineBuilderPuts(&lb, date);
   }
-  len = strlen(timeBuf);
+  lineBuilderPutc(&lb, '.');
   if (p_format->nsec_time_output) {
-    len += snprintf(timeBuf + len, sizeof(timeBuf) - len, ".%09ld", nsec);
+    lineBuilderPutInt(&lb, (long)nsec, 9, true);
   } else if (p_format->usec_time_output) {
-    len += snprintf(timeBuf + len, sizeof(timeBuf) - len, ".%06ld", nsec / US_PER_NSEC);
+    lineBuilderPutInt(&lb, (long)(nsec / US_PER_NSEC), 6, true);
   } else {
-    len += snprintf(timeBuf + len, sizeof(timeBuf) - len, ".%03ld", nsec / MS_PER_NSEC);
+    lineBuilderPutInt(&lb, (long)(nsec / MS_PER_NSEC), 3, true);
   }
-  if (p_format->zone_output && ptm) {
-    strftime(timeBuf + len, sizeof(timeBuf) - len, " %z", ptm);
+  if (p_format->zone_output) {
+    lineBuilderPuts(&lb, zone);
   }
 
   /*
@@ -1535,36 +1694,55 @@ char* android_log_formatLogLine(AndroidLogFormat* p_format, char* defaultBuffer,
     }
   }
 
+  lineBuilderInit(&lb, prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen);
   switch (p_format->format) {
     case FORMAT_TAG:
-      len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen, "%c/%-8.*s: ", priChar,
-                     (int)entry->tagLen, entry->tag);
+      lineBuilderPutc(&lb, priChar);
+      lineBuilderPutc(&lb, '/');
+      lineBuilderPutTag(&lb, entry);
+      lineBuilderPut(&lb, ": ", 2);
       strcpy(suffixBuf + suffixLen, "\n");
       ++suffixLen;
       break;
-    case FORMAT_PROCESS:
-      len = snprintf(suffixBuf + suffixLen, sizeof(suffixBuf) - suffixLen, "  (%.*s)\n",
-                     (int)entry->tagLen, entry->tag);
-      suffixLen += MIN(len, sizeof(suffixBuf) - suffixLen);
-      len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen, "%c(%s%5d) ", priChar,
-                     uid, entry->pid);
+    case FORMAT_PROCESS: {
+      struct LineBuilder suffix;
+      lineBuilderInit(&suffix, suffixBuf + suffixLen, sizeof(suffixBuf) - suffixLen);
+      lineBuilderPut(&suffix, "  (", 3);
+      lineBuilderPut(&suffix, entry->tag, strnlen(entry->tag, entry->tagLen));
+      lineBuilderPut(&suffix, ")\n", 2);
+      suffixLen += MIN(suffix.len, sizeof(suffixBuf) - suffixLen);
+      lineBuilderPutc(&lb, priChar);
+      lineBuilderPutc(&lb, '(');
+      lineBuilderPuts(&lb, uid);
+      lineBuilderPutInt(&lb, entry->pid, 5, false);
+      lineBuilderPut(&lb, ") ", 2);
       break;
+    }
     case FORMAT_THREAD:
-      len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen, "%c(%s%5d:%5d) ",
-                     priChar, uid, entry->pid, entry->tid);
+      lineBuilderPutc(&lb, priChar);
+      lineBuilderPutc(&lb, '(');
+      lineBuilderPuts(&lb, uid);
+      lineBuilderPutInt(&lb, entry->pid, 5, false);
+      lineBuilderPutc(&lb, ':');
+      lineBuilderPutInt(&lb, entry->tid, 5, false);
+      lineBuilderPut(&lb, ") ", 2);
       strcpy(suffixBuf + suffixLen, "\n");
       ++suffixLen;
       break;
     case FORMAT_RAW:
-      prefixBuf[prefixLen] = 0;
-      len = 0;
       strcpy(suffixBuf + suffixLen, "\n");
       ++suffixLen;
       break;
     case FORMAT_TIME:
-      len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
-                     "%s %c/%-8.*s(%s%5d): ", timeBuf, priChar, (int)entry->tagLen, entry->tag, uid,
-                     entry->pid);
+      lineBuilderPut(&lb, timeBuf, strlen(timeBuf));
+      lineBuilderPutc(&lb, ' ');
+      lineBuilderPutc(&lb, priChar);
+      lineBuilderPutc(&lb, '/');
+      lineBuilderPutTag(&lb, entry);
+      lineBuilderPutc(&lb, '(');
+      lineBuilderPuts(&lb, uid);
+      lineBuilderPutInt(&lb, entry->pid, 5, false);
+      lineBuilderPut(&lb, "): ", 3);
       strcpy(suffixBuf + suffixLen, "\n");
       ++suffixLen;
       break;
@@ -1573,31 +1751,53 @@ char* android_log_formatLogLine(AndroidLogFormat* p_format, char* defaultBuffer,
       if (ret) {
         *ret = ' ';
       }
-      len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
-                     "%s %s%5d %5d %c %-8.*s: ", timeBuf, uid, entry->pid, entry->tid, priChar,
-                     (int)entry->tagLen, entry->tag);
+      lineBuilderPut(&lb, timeBuf, strlen(timeBuf));
+      lineBuilderPutc(&lb, ' ');
+      lineBuilderPuts(&lb, uid);
+      lineBuilderPutInt(&lb, entry->pid, 5, false);
+      lineBuilderPutc(&lb, ' ');
+      lineBuilderPutInt(&lb, entry->tid, 5, false);
+      lineBuilderPutc(&lb, ' ');
+      lineBuilderPutc(&lb, priChar);
+      lineBuilderPutc(&lb, ' ');
+      lineBuilderPutTag(&lb, entry);
+      lineBuilderPut(&lb, ": ", 2);
       strcpy(suffixBuf + suffixLen, "\n");
       ++suffixLen;
       break;
     case FORMAT_LONG:
-      len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
-                     "[ %s %s%5d:%5d %c/%-8.*s ]\n", timeBuf, uid, entry->pid, entry->tid, priChar,
-                     (int)entry->tagLen, entry->tag);
+      lineBuilderPut(&lb, "[ ", 2);
+      lineBuilderPut(&lb, timeBuf, strlen(timeBuf));
+      lineBuilderPutc(&lb, ' ');
+      lineBuilderPuts(&lb, uid);
+      lineBuilderPutInt(&lb, entry->pid, 5, false);
+      lineBuilderPutc(&lb, ':');
+      lineBuilderPutInt(&lb, entry->tid, 5, false);
+      lineBuilderPutc(&lb, ' ');
+      lineBuilderPutc(&lb, priChar);
+      lineBuilderPutc(&lb, '/');
+      lineBuilderPutTag(&lb, entry);
+      lineBuilderPut(&lb, " ]\n", 3);
       strcpy(suffixBuf + suffixLen, "\n\n");
       suffixLen += 2;
       prefixSuffixIsHeaderFooter = 1;
       break;
     case FORMAT_BRIEF:
     default:
-      len =
-          snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
-                   "%c/%-8.*s(%s%5d): ", priChar, (int)entry->tagLen, entry->tag, uid, entry->pid);
+      lineBuilderPutc(&lb, priChar);
+      lineBuilderPutc(&lb, '/');
+      lineBuilderPutTag(&lb, entry);
+      lineBuilderPutc(&lb, '(');
+      lineBuilderPuts(&lb, uid);
+      lineBuilderPutInt(&lb, entry->pid, 5, false);
+      lineBuilderPut(&lb, "): ", 3);
       strcpy(suffixBuf + suffixLen, "\n");
       ++suffixLen;
       break;
   }
+  len = lb.len;
 
-  /* snprintf has a weird return value.   It returns what would have been
+  /* LineBuilder, like snprintf, returns what would have been
    * written given a large enough buffer.  In the case that the prefix is
    * longer then our buffer(128), it messes up the calculations below
    * possibly causing heap corruption.  To avoid this we double check and
@@ -1632,11 +1832,17 @@ char* android_log_formatLogLine(AndroidLogFormat* p_format, char* defaultBuffer,
      * The line-end finding here must match the line-end finding
      * in for ( ... numLines...) loop below
      */
-    while (pm < (entry->message + entry->messageLen)) {
-      if (*pm++ == '\n') numLines++;
+    const char* end = entry->message + entry->messageLen;
+    while (pm < end) {
+      const char* nl = (const char*)memchr(pm, '\n', end - pm);
+      if (!nl) {
+        /* plus one line for anything not newline-terminated at the end */
+        numLines++;
+        break;
+      }
+      numLines++;
+      pm = nl + 1;
     }
-    /* plus one line for anything not newline-terminated at the end */
-    if (pm > entry->message && *(pm - 1) != '\n') numLines++;
   }
 
   /*
@@ -1661,46 +1867,47 @@ char* android_log_formatLogLine(AndroidLogFormat* p_format, char* defaultBuffer,
     }
   }
 
-  ret[0] = '\0'; /* to start strcat off */
-
   p = ret;
   pm = entry->message;
 
   if (prefixSuffixIsHeaderFooter) {
-    strcat(p, prefixBuf);
+    memcpy(p, prefixBuf, prefixLen);
     p += prefixLen;
     if (p_format->printable_output) {
       p += convertPrintable(p, entry->message, entry->messageLen);
     } else {
-      strncat(p, entry->message, entry->messageLen);
+      memcpy(p, entry->message, entry->messageLen);
       p += entry->messageLen;
     }
-    strcat(p, suffixBuf);
+    memcpy(p, suffixBuf, suffixLen);
     p += suffixLen;
   } else {
+    const char* end = entry->message + entry->messageLen;
     do {
       const char* lineStart;
       size_t lineLen;
       lineStart = pm;
 
       /* Find the next end-of-line in message */
-      while (pm < (entry->message + entry->messageLen) && *pm != '\n') pm++;
+      pm = (const char*)memchr(pm, '\n', end - pm);
+      if (!pm) pm = end;
       lineLen = pm - lineStart;
 
-      strcat(p, prefixBuf);
+      memcpy(p, prefixBuf, prefixLen);
       p += prefixLen;
       if (p_format->printable_output) {
         p += convertPrintable(p, lineStart, lineLen);
       } else {
-        strncat(p, lineStart, lineLen);
+        memcpy(p, lineStart, lineLen);
         p += lineLen;
       }
-      strcat(p, suffixBuf);
+      memcpy(p, suffixBuf, suffixLen);
       p += suffixLen;
 
-      if (*pm == '\n') pm++;
-    } while (pm < (entry->message + entry->messageLen));
+      if ((pm < end) && (*pm == '\n')) pm++;
+    } while (pm < end);
   }
+  *p = '\0';
 
   if (p_outLength != NULL) {
     *p_outLength = p - ret;
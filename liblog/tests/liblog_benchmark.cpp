@@ -617,6 +617,25 @@ static void BM_log_light_overhead(benchmark::State& state) {
 }
 BENCHMARK(BM_log_light_overhead);
 
+/*
+ *	Measure the sustained rate of android printing logging calls per thread,
+ * with __android_log_set_logd_batching() off (0) and batching 16KiB. Expect
+ * batching to save most of the per message syscall cost under contention.
+ */
+static void BM_log_batching(benchmark::State& state) {
+  if (state.thread_index == 0) {
+    __android_log_set_logd_batching(state.range(0), 10);
+  }
+  while (state.KeepRunning()) {
+    __android_log_print(ANDROID_LOG_INFO, "BM_log_batching", "%" PRIu64, state.iterations());
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index == 0) {
+    __android_log_set_logd_batching(0, 0);
+  }
+}
+BENCHMARK(BM_log_batching)->Arg(0)->Arg(16384)->ThreadRange(1, 8);
+
 static void caught_latency(int /*signum*/) {
   unsigned long long v = 0xDEADBEEFA55A5AA5ULL;
 
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include <memory>
@@ -330,6 +331,171 @@ TEST(liblog, __android_log_write__android_logger_list_read) {
 #endif
 }
 
+TEST(liblog, android_logger_list_set_filter) {
+  auto logger_list = std::unique_ptr<struct logger_list, ListCloser>{
+      android_logger_list_alloc(ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK, 0, getpid())};
+  ASSERT_TRUE(logger_list);
+  EXPECT_EQ(-EINVAL, android_logger_list_set_filter(logger_list.get(), "tag:Q"));
+  EXPECT_EQ(-EINVAL, android_logger_list_set_format(logger_list.get(), "nonsense"));
+  EXPECT_EQ(-E2BIG, android_logger_list_set_filter(logger_list.get(),
+                                                    (std::string(1024, 'a') + ":V").c_str()));
+  EXPECT_EQ(0, android_logger_list_set_filter(logger_list.get(), "a:V  b:S\t*:E"));
+  EXPECT_EQ(0, android_logger_list_set_format(logger_list.get(), "brief,uid"));
+
+#ifdef __ANDROID__
+  pid_t pid = getpid();
+  static const char keep[] = "liblog.android_logger_list_set_filter.keep";
+  static const char drop[] = "liblog.android_logger_list_set_filter.drop";
+  std::string buf = android::base::StringPrintf("pid=%u", pid);
+  ASSERT_LT(0, __android_log_write(ANDROID_LOG_INFO, keep, buf.c_str()));
+  ASSERT_LT(0, __android_log_write(ANDROID_LOG_INFO, drop, buf.c_str()));
+  ASSERT_LT(0, __android_log_write(ANDROID_LOG_VERBOSE, keep, buf.c_str()));
+
+  auto check = [&](const char* format, const std::string& expected) {
+    auto logger_list = std::unique_ptr<struct logger_list, ListCloser>{
+        android_logger_list_alloc(ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK, 1000, pid)};
+    ASSERT_TRUE(logger_list);
+    ASSERT_TRUE(android_logger_open(logger_list.get(), LOG_ID_MAIN));
+    ASSERT_EQ(0, android_logger_list_set_filter(
+                     logger_list.get(), (std::string(keep) + ":I *:S").c_str()));
+    if (format) {
+      ASSERT_EQ(0, android_logger_list_set_format(logger_list.get(), format));
+    }
+
+    size_t count = 0;
+    log_msg log_msg;
+    int ret;
+    while ((ret = android_logger_list_read(logger_list.get(), &log_msg)) > 0) {
+      std::string payload(log_msg.msg(), log_msg.entry.len);
+      EXPECT_EQ(std::string::npos, payload.find(drop));
+      count += payload.find(expected) != std::string::npos;
+    }
+    EXPECT_EQ(-EAGAIN, ret);
+    EXPECT_EQ(1U, count);
+  };
+
+  check(nullptr, std::string(1, ANDROID_LOG_INFO) + keep);
+  check("brief", android::base::StringPrintf("I/%s(%5d): %s", keep, pid, buf.c_str()));
+
+  // A filter that would not fit in what older logd read is left to the reader.
+  std::string long_filter = std::string(keep) + ":I";
+  while (long_filter.size() < 300) {
+    long_filter += " padding:S";
+  }
+  auto long_list = std::unique_ptr<struct logger_list, ListCloser>{
+      android_logger_list_alloc(ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK, 1000, pid)};
+  ASSERT_TRUE(long_list);
+  ASSERT_TRUE(android_logger_open(long_list.get(), LOG_ID_MAIN));
+  ASSERT_EQ(0, android_logger_list_set_filter(long_list.get(), long_filter.c_str()));
+  bool unfiltered = false;
+  log_msg log_msg;
+  while (android_logger_list_read(long_list.get(), &log_msg) > 0) {
+    unfiltered |= std::string(log_msg.msg(), log_msg.entry.len).find(drop) != std::string::npos;
+  }
+  EXPECT_TRUE(unfiltered);
+#else
+  GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+}
+
+TEST(liblog, __android_log_set_logd_ring) {
+#ifdef __ANDROID__
+  // Registration cannot be undone, keep it out of this process.
+  static const char tag[] = "liblog.__android_log_set_logd_ring";
+  static const size_t count = 1000;
+  pid_t pid = fork();
+  ASSERT_LE(0, pid);
+  if (!pid) {
+    if (__android_log_set_logd_ring(0)) {
+      _exit(1);
+    }
+    for (size_t i = 0; i < count; ++i) {
+      __android_log_print(ANDROID_LOG_INFO, tag, "%zu", i);
+    }
+    _exit(0);
+  }
+  int status;
+  ASSERT_EQ(pid, TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)));
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(0, WEXITSTATUS(status));
+
+  // logd drains the rest of the ring once it notices the child is gone.
+  size_t found = 0;
+  for (int retry = 0; (retry < 10) && (found < count); ++retry) {
+    usleep(100000);
+    auto logger_list = std::unique_ptr<struct logger_list, ListCloser>{
+        android_logger_list_alloc(ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK, 0, pid)};
+    ASSERT_TRUE(logger_list);
+    ASSERT_TRUE(android_logger_open(logger_list.get(), LOG_ID_MAIN));
+
+    found = 0;
+    log_msg log_msg;
+    while (android_logger_list_read(logger_list.get(), &log_msg) > 0) {
+      if (strcmp(log_msg.msg() + 1, tag)) {
+        continue;
+      }
+      EXPECT_EQ(getuid(), log_msg.entry.uid);
+      EXPECT_EQ(pid, log_msg.entry.pid);
+      ++found;
+    }
+  }
+  EXPECT_EQ(count, found);
+#else
+  GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+}
+
+TEST(liblog, __android_log_set_logd_batching) {
+#ifdef __ANDROID__
+  static const char tag[] = "liblog.__android_log_set_logd_batching";
+  static const size_t count = 20;
+  pid_t pid = getpid();
+
+  // Few enough entries that none reach the threshold, the flusher has to send them.
+  __android_log_set_logd_batching(16 * 1024, 50);
+  auto batching_guard =
+      android::base::make_scope_guard([] { __android_log_set_logd_batching(0, 0); });
+  for (size_t i = 0; i < count; ++i) {
+    ASSERT_LT(0, __android_log_print(ANDROID_LOG_INFO, tag, "%zu", i));
+  }
+
+  // fork() while entries are pending must leave neither process holding a batch lock.
+  pid_t child = fork();
+  ASSERT_LE(0, child);
+  if (!child) {
+    __android_log_print(ANDROID_LOG_INFO, tag, "child");
+    _exit(0);
+  }
+  int status;
+  ASSERT_EQ(child, TEMP_FAILURE_RETRY(waitpid(child, &status, 0)));
+  ASSERT_TRUE(WIFEXITED(status));
+
+  size_t found = 0;
+  for (int retry = 0; (retry < 10) && (found < count); ++retry) {
+    usleep(100000);
+    auto logger_list = std::unique_ptr<struct logger_list, ListCloser>{
+        android_logger_list_alloc(ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK, 0, pid)};
+    ASSERT_TRUE(logger_list);
+    ASSERT_TRUE(android_logger_open(logger_list.get(), LOG_ID_MAIN));
+
+    found = 0;
+    log_msg log_msg;
+    while (android_logger_list_read(logger_list.get(), &log_msg) > 0) {
+      if (strcmp(log_msg.msg() + 1, tag)) {
+        continue;
+      }
+      // In the order they were logged.
+      const char* text = log_msg.msg() + 1 + sizeof(tag);
+      EXPECT_EQ(android::base::StringPrintf("%zu", found), text);
+      ++found;
+    }
+  }
+  EXPECT_EQ(count, found);
+#else
+  GTEST_LOG_(INFO) << "This test does nothing.\n";
+#endif
+}
+
 static void bswrite_test(const char* message) {
 #ifdef __ANDROID__
   pid_t pid = getpid();
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <private/android_log_columnar.h>
+#include <private/android_logger.h>
+
+static log_msg MakeText(uint32_t sec, const char* tag, const char* message) {
+  log_msg msg = {};
+  msg.entry.hdr_size = sizeof(msg.entry);
+  msg.entry.sec = sec;
+  msg.entry.nsec = 1000;
+  msg.entry.pid = 1234;
+  msg.entry.tid = 1235;
+  msg.entry.uid = 10001;
+  msg.entry.lid = LOG_ID_MAIN;
+  char* payload = msg.msg();
+  payload[0] = ANDROID_LOG_INFO;
+  strcpy(payload + 1, tag);
+  strcpy(payload + 1 + strlen(tag) + 1, message);
+  msg.entry.len = 1 + strlen(tag) + 1 + strlen(message) + 1;
+  return msg;
+}
+
+static log_msg MakeEvent(uint32_t sec, uint32_t tag, int32_t value) {
+  log_msg msg = {};
+  msg.entry.hdr_size = sizeof(msg.entry);
+  msg.entry.sec = sec;
+  msg.entry.lid = LOG_ID_EVENTS;
+  android_log_event_int_t event = {{static_cast<int32_t>(tag)}, {EVENT_TYPE_INT, value}};
+  memcpy(msg.msg(), &event, sizeof(event));
+  msg.entry.len = sizeof(event);
+  return msg;
+}
+
+static void ExpectSame(log_msg& expected, log_msg& actual) {
+  EXPECT_EQ(expected.entry.len, actual.entry.len);
+  EXPECT_EQ(expected.entry.sec, actual.entry.sec);
+  EXPECT_EQ(expected.entry.nsec, actual.entry.nsec);
+  EXPECT_EQ(expected.entry.pid, actual.entry.pid);
+  EXPECT_EQ(expected.entry.tid, actual.entry.tid);
+  EXPECT_EQ(expected.entry.uid, actual.entry.uid);
+  EXPECT_EQ(expected.entry.lid, actual.entry.lid);
+  EXPECT_EQ(0, memcmp(expected.msg(), actual.msg(), expected.entry.len));
+}
+
+TEST(liblog, columnar_round_trip) {
+  TemporaryFile tf;
+  std::vector<log_msg> written;
+  written.push_back(MakeText(100, "tag", "message"));
+  written.push_back(MakeEvent(101, 42, -1));
+  written.push_back(MakeText(102, "other", ""));
+  log_msg malformed = MakeText(103, "tag", "message");
+  malformed.entry.len = 3;  // no tag terminator
+  written.push_back(malformed);
+
+  android_log_columnar_writer* writer = android_log_columnar_writer_alloc(tf.fd);
+  for (auto& msg : written) {
+    EXPECT_EQ(0, android_log_columnar_writer_add(writer, &msg));
+  }
+  EXPECT_LT(0, android_log_columnar_writer_flush(writer));
+  EXPECT_EQ(0, android_log_columnar_writer_flush(writer));
+  android_log_columnar_writer_free(writer);
+
+  ASSERT_EQ(0, lseek(tf.fd, 0, SEEK_SET));
+  android_log_columnar_reader* reader = android_log_columnar_reader_alloc(tf.fd);
+  for (auto& expected : written) {
+    log_msg msg;
+    ASSERT_EQ(expected.entry.len, android_log_columnar_reader_read(reader, &msg));
+    ExpectSame(expected, msg);
+  }
+  log_msg msg;
+  EXPECT_EQ(0, android_log_columnar_reader_read(reader, &msg));
+  android_log_columnar_reader_free(reader);
+}
+
+TEST(liblog, columnar_seek_and_filter) {
+  TemporaryFile tf;
+  // Two blocks, one per tag, and one in between with both.
+  android_log_columnar_writer* writer = android_log_columnar_writer_alloc(tf.fd);
+  for (uint32_t sec = 0; sec < 100; ++sec) {
+    log_msg msg = MakeText(sec, "early", "x");
+    android_log_columnar_writer_add(writer, &msg);
+  }
+  android_log_columnar_writer_flush(writer);
+  for (uint32_t sec = 100; sec < 200; ++sec) {
+    log_msg msg = MakeText(sec, (sec % 2) ? "early" : "late", "x");
+    android_log_columnar_writer_add(writer, &msg);
+  }
+  android_log_columnar_writer_flush(writer);
+  for (uint32_t sec = 200; sec < 300; ++sec) {
+    log_msg msg = MakeText(sec, "late", "x");
+    android_log_columnar_writer_add(writer, &msg);
+  }
+  android_log_columnar_writer_flush(writer);
+  android_log_columnar_writer_free(writer);
+
+  auto read_all = [&](const char* tag, uint32_t start, size_t* inflated) {
+    lseek(tf.fd, 0, SEEK_SET);
+    android_log_columnar_reader* reader = android_log_columnar_reader_alloc(tf.fd);
+    if (tag) android_log_columnar_reader_add_tag(reader, tag);
+    android_log_columnar_reader_set_start(reader, log_time(start, 0));
+    std::vector<uint32_t> secs;
+    log_msg msg;
+    while (android_log_columnar_reader_read(reader, &msg) > 0) {
+      secs.push_back(msg.entry.sec);
+    }
+    *inflated = android_log_columnar_reader_inflated(reader);
+    android_log_columnar_reader_free(reader);
+    return secs;
+  };
+
+  size_t inflated;
+  std::vector<uint32_t> secs = read_all(nullptr, 250, &inflated);
+  ASSERT_EQ(50U, secs.size());
+  EXPECT_EQ(250U, secs.front());
+  EXPECT_EQ(1U, inflated);
+
+  secs = read_all("early", 0, &inflated);
+  ASSERT_EQ(150U, secs.size());
+  EXPECT_EQ(199U, secs.back());
+  EXPECT_EQ(2U, inflated);
+
+  secs = read_all("late", 150, &inflated);
+  ASSERT_EQ(125U, secs.size());
+  EXPECT_EQ(150U, secs.front());
+  EXPECT_EQ(2U, inflated);
+}
@@ -16,6 +16,10 @@
 
 #include <log/logprint.h>
 
+#include <stdlib.h>
+#include <time.h>
+
+#include <initializer_list>
 #include <string>
 
 #include <gtest/gtest.h>
@@ -150,4 +154,137 @@ TEST(liblog, log_print_different_header_size) {
   AndroidLogEntry entry_odd_size;
   ASSERT_EQ(0, android_log_processLogBuffer(reinterpret_cast<logger_entry*>(buf), &entry_odd_size));
   check_entry(entry_odd_size);
-}
\ No newline at end of file
+}
+
+// Formats a line as the kernel's epoch second 1600000000.123456789, which is
+// 09-13 12:26:40 in UTC, from pid 1234, tid 5678 and uid 1000. The buffer is
+// small enough for longer lines to take the allocating path.
+static std::string FormatLogLine(std::initializer_list<const char*> formats,
+                                 android_LogPriority priority, const std::string& tag,
+                                 const std::string& message) {
+  const char* old_tz = getenv("TZ");
+  std::string saved_tz(old_tz ? old_tz : "");
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  AndroidLogFormat* p_format = android_log_format_new();
+  for (const char* format : formats) {
+    android_log_setPrintFormat(p_format, android_log_formatFromString(format));
+  }
+  AndroidLogEntry entry = {};
+  entry.tv_sec = 1600000000;
+  entry.tv_nsec = 123456789;
+  entry.priority = priority;
+  entry.uid = 1000;
+  entry.pid = 1234;
+  entry.tid = 5678;
+  entry.tag = tag.c_str();
+  entry.tagLen = tag.size();
+  entry.message = message.c_str();
+  entry.messageLen = message.size();
+
+  char buffer[64];
+  size_t len = 0;
+  char* line = android_log_formatLogLine(p_format, buffer, sizeof(buffer), &entry, &len);
+  std::string result = line ? std::string(line, len) : "";
+  if (line != buffer) {
+    free(line);
+  }
+  android_log_format_free(p_format);
+
+  if (old_tz) {
+    setenv("TZ", saved_tz.c_str(), 1);
+  } else {
+    unsetenv("TZ");
+  }
+  tzset();
+  return result;
+}
+
+TEST(liblog, formatLogLine_formats) {
+  auto format = [](const char* format) {
+    return FormatLogLine({format}, ANDROID_LOG_INFO, "tag", "message");
+  };
+  EXPECT_EQ("I/tag     ( 1234): message\n", format("brief"));
+  EXPECT_EQ("I( 1234) message  (tag)\n", format("process"));
+  EXPECT_EQ("I/tag     : message\n", format("tag"));
+  EXPECT_EQ("I( 1234: 5678) message\n", format("thread"));
+  EXPECT_EQ("message\n", format("raw"));
+  EXPECT_EQ("09-13 12:26:40.123 I/tag     ( 1234): message\n", format("time"));
+  EXPECT_EQ("09-13 12:26:40.123  1234  5678 I tag     : message\n", format("threadtime"));
+  EXPECT_EQ("[ 09-13 12:26:40.123  1234: 5678 I/tag      ]\nmessage\n\n", format("long"));
+}
+
+TEST(liblog, formatLogLine_modifiers) {
+  auto format = [](std::initializer_list<const char*> formats) {
+    return FormatLogLine(formats, ANDROID_LOG_INFO, "tag", "message");
+  };
+  EXPECT_EQ("09-13 12:26:40.123456  1234  5678 I tag     : message\n",
+            format({"threadtime", "usec"}));
+  EXPECT_EQ("09-13 12:26:40.123456789  1234  5678 I tag     : message\n",
+            format({"threadtime", "nsec"}));
+  EXPECT_EQ("2020-09-13 12:26:40.123 +0000  1234  5678 I tag     : message\n",
+            format({"threadtime", "year", "zone"}));
+  EXPECT_EQ("         1600000000.123  1234  5678 I tag     : message\n",
+            format({"threadtime", "epoch"}));
+  EXPECT_EQ("09-13 12:26:40.123  1000  1234  5678 I tag     : message\n",
+            format({"threadtime", "uid"}));
+}
+
+TEST(liblog, formatLogLine_color) {
+  EXPECT_EQ("\x1B[38;5;196mE/tag     ( 1234): message\x1B[0m\n",
+            FormatLogLine({"brief", "color"}, ANDROID_LOG_ERROR, "tag", "message"));
+  EXPECT_EQ("\x1B[38;5;166m09-13 12:26:40.123  1234  5678 W tag     : message\x1B[0m\n",
+            FormatLogLine({"threadtime", "color"}, ANDROID_LOG_WARN, "tag", "message"));
+  EXPECT_EQ(
+      "\x1B[38;5;75mD/tag     ( 1234): one\x1B[0m\n"
+      "\x1B[38;5;75mD/tag     ( 1234): two\x1B[0m\n",
+      FormatLogLine({"brief", "color"}, ANDROID_LOG_DEBUG, "tag", "one\ntwo"));
+}
+
+TEST(liblog, formatLogLine_printable) {
+  // Control characters, valid and invalid UTF-8. Tabs, DEL and valid UTF-8
+  // are left as is.
+  const std::string message = "\x01tab\there caf\xC3\xA9 \xE2\x82\xAC \xFF\x80 \x7F" " end";
+  EXPECT_EQ("09-13 12:26:40.123  1234  5678 I tag     : " + message + "\n",
+            FormatLogLine({"threadtime"}, ANDROID_LOG_INFO, "tag", message));
+  EXPECT_EQ(
+      "09-13 12:26:40.123  1234  5678 I tag     : "
+      "\\x01tab\there caf\xC3\xA9 \xE2\x82\xAC \\xFF\\x80 \x7F" " end\n",
+      FormatLogLine({"threadtime", "printable"}, ANDROID_LOG_INFO, "tag", message));
+  EXPECT_EQ("I/tag     ( 1234): a\\x02\nI/tag     ( 1234): b\\xC3\n",
+            FormatLogLine({"brief", "printable"}, ANDROID_LOG_INFO, "tag", "a\x02\nb\xC3"));
+}
+
+TEST(liblog, formatLogLine_long_tag) {
+  std::string tag;
+  for (size_t i = 0; i < 300; ++i) {
+    tag += 'a' + i % 26;
+  }
+  EXPECT_EQ("I/" + tag.substr(0, 100) + "( 1234): message\n",
+            FormatLogLine({"brief"}, ANDROID_LOG_INFO, tag.substr(0, 100), "message"));
+  // The prefix is clamped, which cuts off the tag along with what follows it.
+  EXPECT_EQ("09-13 12:26:40.123  1234  5678 I " + tag.substr(0, 94) + "message\n",
+            FormatLogLine({"threadtime"}, ANDROID_LOG_INFO, tag.substr(0, 100), "message"));
+  EXPECT_EQ("I/" + tag.substr(0, 125) + "message\n",
+            FormatLogLine({"tag"}, ANDROID_LOG_INFO, tag, "message"));
+}
+
+TEST(liblog, formatLogLine_multi_line) {
+  EXPECT_EQ(
+      "09-13 12:26:40.123  1234  5678 I tag     : first\n"
+      "09-13 12:26:40.123  1234  5678 I tag     : second\n"
+      "09-13 12:26:40.123  1234  5678 I tag     : \n"
+      "09-13 12:26:40.123  1234  5678 I tag     : fourth\n",
+      FormatLogLine({"threadtime"}, ANDROID_LOG_INFO, "tag", "first\nsecond\n\nfourth"));
+  // A trailing newline does not add an empty line.
+  EXPECT_EQ(
+      "09-13 12:26:40.123  1234  5678 I tag     : first\n"
+      "09-13 12:26:40.123  1234  5678 I tag     : second\n",
+      FormatLogLine({"threadtime"}, ANDROID_LOG_INFO, "tag", "first\nsecond\n"));
+  EXPECT_EQ("[ 09-13 12:26:40.123  1234: 5678 I/tag      ]\nfirst\nsecond\n\n",
+            FormatLogLine({"long"}, ANDROID_LOG_INFO, "tag", "first\nsecond"));
+  EXPECT_EQ("first\nsecond\n", FormatLogLine({"raw"}, ANDROID_LOG_INFO, "tag", "first\nsecond"));
+  EXPECT_EQ("I/tag     : first\nI/tag     : second\n",
+            FormatLogLine({"tag"}, ANDROID_LOG_INFO, "tag", "first\nsecond"));
+}
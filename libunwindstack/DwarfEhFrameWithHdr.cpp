@@ -132,21 +132,22 @@ const DwarfFde* DwarfEhFrameWithHdr<AddressType>::GetFdeFromPc(uint64_t pc) {
 template <typename AddressType>
 const typename DwarfEhFrameWithHdr<AddressType>::FdeInfo*
 DwarfEhFrameWithHdr<AddressType>::GetFdeInfoFromIndex(size_t index) {
-  auto entry = fde_info_.find(index);
-  if (entry != fde_info_.end()) {
-    return &fde_info_[index];
+  if (!fde_info_.empty()) {
+    FdeInfoCacheEntry* entry = &fde_info_[index % kFdeInfoCacheSize];
+    if (entry->index == index) {
+      return &entry->info;
+    }
   }
-  FdeInfo* info = &fde_info_[index];
 
   memory_.set_data_offset(hdr_entries_data_offset_);
   memory_.set_cur_offset(hdr_entries_offset_ + 2 * index * table_entry_size_);
   memory_.set_pc_offset(0);
   uint64_t value;
+  uint64_t offset;
   if (!memory_.template ReadEncodedValue<AddressType>(table_encoding_, &value) ||
-      !memory_.template ReadEncodedValue<AddressType>(table_encoding_, &info->offset)) {
+      !memory_.template ReadEncodedValue<AddressType>(table_encoding_, &offset)) {
     last_error_.code = DWARF_ERROR_MEMORY_INVALID;
     last_error_.address = memory_.cur_offset();
-    fde_info_.erase(index);
     return nullptr;
   }
 
@@ -154,10 +155,23 @@ DwarfEhFrameWithHdr<AddressType>::GetFdeInfoFromIndex(size_t index) {
   if (IsEncodingRelative(table_encoding_)) {
     value += hdr_section_bias_;
   }
+  FdeInfo* info = CacheFdeInfo(index);
   info->pc = value;
+  info->offset = offset;
   return info;
 }
 
+template <typename AddressType>
+typename DwarfEhFrameWithHdr<AddressType>::FdeInfo* DwarfEhFrameWithHdr<AddressType>::CacheFdeInfo(
+    size_t index) {
+  if (fde_info_.empty()) {
+    fde_info_.resize(kFdeInfoCacheSize, FdeInfoCacheEntry{static_cast<size_t>(-1), FdeInfo{}});
+  }
+  FdeInfoCacheEntry* entry = &fde_info_[index % kFdeInfoCacheSize];
+  entry->index = index;
+  return &entry->info;
+}
+
 template <typename AddressType>
 bool DwarfEhFrameWithHdr<AddressType>::GetFdeOffsetFromPc(uint64_t pc, uint64_t* fde_offset) {
   if (fde_count_ == 0) {
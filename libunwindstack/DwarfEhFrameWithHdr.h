@@ -19,7 +19,7 @@
 
 #include <stdint.h>
 
-#include <unordered_map>
+#include <vector>
 
 #include <unwindstack/DwarfSection.h>
 
@@ -69,6 +69,10 @@ class DwarfEhFrameWithHdr : public DwarfSectionImpl<AddressType> {
   void GetFdes(std::vector<const DwarfFde*>* fdes) override;
 
  protected:
+  // Returns the cache slot for the table entry at index, taking it over
+  // from any other entry that was in it.
+  FdeInfo* CacheFdeInfo(size_t index);
+
   uint8_t version_ = 0;
   uint8_t table_encoding_ = 0;
   size_t table_entry_size_ = 0;
@@ -78,7 +82,17 @@ class DwarfEhFrameWithHdr : public DwarfSectionImpl<AddressType> {
   uint64_t hdr_section_bias_ = 0;
 
   uint64_t fde_count_ = 0;
-  std::unordered_map<uint64_t, FdeInfo> fde_info_;
+
+  // The table entries that have been read, direct mapped by index. Every
+  // binary search goes through the same few entries near the top of the
+  // search, so those tend to stay cached, and the cache is a fixed size
+  // rather than growing with every entry read.
+  static constexpr size_t kFdeInfoCacheSize = 64;
+  struct FdeInfoCacheEntry {
+    size_t index;
+    FdeInfo info;
+  };
+  std::vector<FdeInfoCacheEntry> fde_info_;
 };
 
 }  // namespace unwindstack
@@ -16,6 +16,11 @@
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
 #include <unwindstack/DwarfError.h>
 #include <unwindstack/DwarfLocation.h>
 #include <unwindstack/DwarfMemory.h>
@@ -64,19 +69,17 @@ bool DwarfSection::Step(uint64_t pc, Regs* regs, Memory* process_memory, bool* f
 
 template <typename AddressType>
 const DwarfCie* DwarfSectionImpl<AddressType>::GetCieFromOffset(uint64_t offset) {
-  auto cie_entry = cie_entries_.find(offset);
-  if (cie_entry != cie_entries_.end()) {
-    return &cie_entry->second;
+  DwarfCie* cie_entry = cie_entries_.Find(offset);
+  if (cie_entry != nullptr) {
+    return cie_entry;
   }
-  DwarfCie* cie = &cie_entries_[offset];
+  DwarfCie cie;
   memory_.set_data_offset(entries_offset_);
   memory_.set_cur_offset(offset);
-  if (!FillInCieHeader(cie) || !FillInCie(cie)) {
-    // Erase the cached entry.
-    cie_entries_.erase(offset);
+  if (!FillInCieHeader(&cie) || !FillInCie(&cie)) {
     return nullptr;
   }
-  return cie;
+  return cie_entries_.Add(offset, std::move(cie));
 }
 
 template <typename AddressType>
@@ -247,18 +250,17 @@ bool DwarfSectionImpl<AddressType>::FillInCie(DwarfCie* cie) {
 
 template <typename AddressType>
 const DwarfFde* DwarfSectionImpl<AddressType>::GetFdeFromOffset(uint64_t offset) {
-  auto fde_entry = fde_entries_.find(offset);
-  if (fde_entry != fde_entries_.end()) {
-    return &fde_entry->second;
+  DwarfFde* fde_entry = fde_entries_.Find(offset);
+  if (fde_entry != nullptr) {
+    return fde_entry;
   }
-  DwarfFde* fde = &fde_entries_[offset];
+  DwarfFde fde;
   memory_.set_data_offset(entries_offset_);
   memory_.set_cur_offset(offset);
-  if (!FillInFdeHeader(fde) || !FillInFde(fde)) {
-    fde_entries_.erase(offset);
+  if (!FillInFdeHeader(&fde) || !FillInFde(&fde)) {
     return nullptr;
   }
-  return fde;
+  return fde_entries_.Add(offset, std::move(fde));
 }
 
 template <typename AddressType>
@@ -607,32 +609,6 @@ bool DwarfSectionImpl<AddressType>::Init(uint64_t offset, uint64_t size, int64_t
   return true;
 }
 
-// Create a cached version of the fde information such that it is a std::map
-// that is indexed by end pc and contains a pair that represents the start pc
-// followed by the fde object. The fde pointers are owned by fde_entries_
-// and not by the map object.
-// It is possible for an fde to be represented by multiple entries in
-// the map. This can happen if the the start pc and end pc overlap already
-// existing entries. For example, if there is already an entry of 0x400, 0x200,
-// and an fde has a start pc of 0x100 and end pc of 0x500, two new entries
-// will be added: 0x200, 0x100 and 0x500, 0x400.
-template <typename AddressType>
-void DwarfSectionImpl<AddressType>::InsertFde(const DwarfFde* fde) {
-  uint64_t start = fde->pc_start;
-  uint64_t end = fde->pc_end;
-  auto it = fdes_.upper_bound(start);
-  while (it != fdes_.end() && start < end && it->second.first < end) {
-    if (start < it->second.first) {
-      fdes_[it->second.first] = std::make_pair(start, fde);
-    }
-    start = it->first;
-    ++it;
-  }
-  if (start < end) {
-    fdes_[end] = std::make_pair(start, fde);
-  }
-}
-
 template <typename AddressType>
 bool DwarfSectionImpl<AddressType>::GetNextCieOrFde(const DwarfFde** fde_entry) {
   uint64_t start_offset = next_entries_offset_;
@@ -691,33 +667,31 @@ bool DwarfSectionImpl<AddressType>::GetNextCieOrFde(const DwarfFde** fde_entry)
   }
 
   if (entry_is_cie) {
-    auto entry = cie_entries_.find(start_offset);
-    if (entry == cie_entries_.end()) {
-      DwarfCie* cie = &cie_entries_[start_offset];
-      cie->lsda_encoding = DW_EH_PE_omit;
-      cie->cfa_instructions_end = next_entries_offset_;
-      cie->fde_address_encoding = cie_fde_encoding;
-
-      if (!FillInCie(cie)) {
-        cie_entries_.erase(start_offset);
+    if (cie_entries_.Find(start_offset) == nullptr) {
+      DwarfCie cie;
+      cie.lsda_encoding = DW_EH_PE_omit;
+      cie.cfa_instructions_end = next_entries_offset_;
+      cie.fde_address_encoding = cie_fde_encoding;
+
+      if (!FillInCie(&cie)) {
         return false;
       }
+      cie_entries_.Add(start_offset, std::move(cie));
     }
     *fde_entry = nullptr;
   } else {
-    auto entry = fde_entries_.find(start_offset);
-    if (entry != fde_entries_.end()) {
-      *fde_entry = &entry->second;
+    DwarfFde* entry = fde_entries_.Find(start_offset);
+    if (entry != nullptr) {
+      *fde_entry = entry;
     } else {
-      DwarfFde* fde = &fde_entries_[start_offset];
-      fde->cfa_instructions_end = next_entries_offset_;
-      fde->cie_offset = cie_offset;
+      DwarfFde fde;
+      fde.cfa_instructions_end = next_entries_offset_;
+      fde.cie_offset = cie_offset;
 
-      if (!FillInFde(fde)) {
-        fde_entries_.erase(start_offset);
+      if (!FillInFde(&fde)) {
         return false;
       }
-      *fde_entry = fde;
+      *fde_entry = fde_entries_.Add(start_offset, std::move(fde));
     }
   }
   return true;
@@ -728,17 +702,17 @@ void DwarfSectionImpl<AddressType>::GetFdes(std::vector<const DwarfFde*>* fdes)
   // Loop through the already cached entries.
   uint64_t entry_offset = entries_offset_;
   while (entry_offset < next_entries_offset_) {
-    auto cie_it = cie_entries_.find(entry_offset);
-    if (cie_it != cie_entries_.end()) {
-      entry_offset = cie_it->second.cfa_instructions_end;
+    const DwarfCie* cie = cie_entries_.Find(entry_offset);
+    if (cie != nullptr) {
+      entry_offset = cie->cfa_instructions_end;
     } else {
-      auto fde_it = fde_entries_.find(entry_offset);
-      if (fde_it == fde_entries_.end()) {
+      const DwarfFde* fde = fde_entries_.Find(entry_offset);
+      if (fde == nullptr) {
         // No fde or cie at this entry, should not be possible.
         return;
       }
-      entry_offset = fde_it->second.cfa_instructions_end;
-      fdes->push_back(&fde_it->second);
+      entry_offset = fde->cfa_instructions_end;
+      fdes->push_back(fde);
     }
   }
 
@@ -748,7 +722,6 @@ void DwarfSectionImpl<AddressType>::GetFdes(std::vector<const DwarfFde*>* fdes)
       break;
     }
     if (fde != nullptr) {
-      InsertFde(fde);
       fdes->push_back(fde);
     }
 
@@ -759,36 +732,88 @@ void DwarfSectionImpl<AddressType>::GetFdes(std::vector<const DwarfFde*>* fdes)
   }
 }
 
+// Create the table of pc ranges from every fde in the section. It is
+// possible for fdes to overlap, in which case the fde that comes first in
+// the section covers the overlapping pcs, and a later fde only gets the
+// pieces of its range that are not already covered. For example, if the
+// first fde covers 0x200 to 0x400, and a later one covers 0x100 to 0x500,
+// the later one is entered twice: 0x100 to 0x200 and 0x400 to 0x500.
 template <typename AddressType>
-const DwarfFde* DwarfSectionImpl<AddressType>::GetFdeFromPc(uint64_t pc) {
-  // Search in the list of fdes we already have.
-  auto it = fdes_.upper_bound(pc);
-  if (it != fdes_.end()) {
-    if (pc >= it->second.first) {
-      return it->second.second;
+void DwarfSectionImpl<AddressType>::BuildFdeIndex() {
+  fde_index_built_ = true;
+
+  // Call this class's version, a subclass might only return the fdes from a
+  // separate table.
+  std::vector<const DwarfFde*> fdes;
+  DwarfSectionImpl<AddressType>::GetFdes(&fdes);
+
+  fde_index_.reserve(fdes.size());
+  for (const DwarfFde* fde : fdes) {
+    if (fde->pc_start < fde->pc_end) {
+      fde_index_.push_back(FdeRange{fde->pc_end, fde->pc_start, fde});
     }
   }
+  std::stable_sort(fde_index_.begin(), fde_index_.end(),
+                   [](const FdeRange& a, const FdeRange& b) { return a.pc_start < b.pc_start; });
 
-  // The section might have overlapping pcs in fdes, so it is necessary
-  // to do a linear search of the fdes by pc. As fdes are read, a cached
-  // search map is created.
-  while (next_entries_offset_ < entries_end_) {
-    const DwarfFde* fde;
-    if (!GetNextCieOrFde(&fde)) {
-      return nullptr;
+  bool overlap = false;
+  for (size_t i = 1; i < fde_index_.size(); i++) {
+    if (fde_index_[i].pc_start < fde_index_[i - 1].pc_end) {
+      overlap = true;
+      break;
     }
-    if (fde != nullptr) {
-      InsertFde(fde);
-      if (pc >= fde->pc_start && pc < fde->pc_end) {
-        return fde;
+  }
+  if (!overlap) {
+    return;
+  }
+
+  // Overlapping fdes are rare, so handle them by adding the fdes in section
+  // order to a map indexed by end pc, then flattening it into the table.
+  std::map<uint64_t, std::pair<uint64_t, const DwarfFde*>> ranges;
+  for (const DwarfFde* fde : fdes) {
+    uint64_t start = fde->pc_start;
+    uint64_t end = fde->pc_end;
+    auto it = ranges.upper_bound(start);
+    while (it != ranges.end() && start < end && it->second.first < end) {
+      if (start < it->second.first) {
+        ranges[it->second.first] = std::make_pair(start, fde);
       }
+      start = it->first;
+      ++it;
     }
-
-    if (next_entries_offset_ < memory_.cur_offset()) {
-      // Simply consider the processing done in this case.
-      break;
+    if (start < end) {
+      ranges[end] = std::make_pair(start, fde);
     }
   }
+  fde_index_.clear();
+  for (const auto& entry : ranges) {
+    fde_index_.push_back(FdeRange{entry.first, entry.second.first, entry.second.second});
+  }
+  fde_index_.shrink_to_fit();
+}
+
+template <typename AddressType>
+const DwarfFde* DwarfSectionImpl<AddressType>::GetFdeFromPc(uint64_t pc) {
+  if (!fde_index_built_) {
+    BuildFdeIndex();
+  }
+  if (fde_index_.empty()) {
+    return nullptr;
+  }
+
+  // Find the first range that ends after pc. The loop always runs the same
+  // number of iterations for a given table, and the comparison only selects
+  // the next base, so it compiles to a conditional move.
+  const FdeRange* base = fde_index_.data();
+  size_t count = fde_index_.size();
+  while (count > 1) {
+    size_t half = count / 2;
+    base = (base[half - 1].pc_end <= pc) ? base + half : base;
+    count -= half;
+  }
+  if (pc >= base->pc_start && pc < base->pc_end) {
+    return base->fde;
+  }
   return nullptr;
 }
 
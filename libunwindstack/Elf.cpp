@@ -39,6 +39,7 @@ namespace unwindstack {
 bool Elf::cache_enabled_;
 std::unordered_map<std::string, std::pair<std::shared_ptr<Elf>, bool>>* Elf::cache_;
 std::mutex* Elf::cache_lock_;
+std::string* Elf::gnu_debugdata_cache_dir_;
 
 bool Elf::Init() {
   load_bias_ = 0;
@@ -150,12 +151,14 @@ std::string Elf::GetBuildID() {
 
 void Elf::GetLastError(ErrorData* data) {
   if (valid_) {
+    std::lock_guard<std::mutex> guard(lock_);
     *data = interface_->last_error();
   }
 }
 
 ErrorCode Elf::GetLastErrorCode() {
   if (valid_) {
+    std::lock_guard<std::mutex> guard(lock_);
     return interface_->LastErrorCode();
   }
   return ERROR_INVALID_ELF;
@@ -163,6 +166,7 @@ ErrorCode Elf::GetLastErrorCode() {
 
 uint64_t Elf::GetLastErrorAddress() {
   if (valid_) {
+    std::lock_guard<std::mutex> guard(lock_);
     return interface_->LastErrorAddress();
   }
   return 0;
@@ -182,14 +186,19 @@ bool Elf::StepIfSignalHandler(uint64_t rel_pc, Regs* regs, Memory* process_memor
 }
 
 // The relative pc is always relative to the start of the map from which it comes.
-bool Elf::Step(uint64_t rel_pc, Regs* regs, Memory* process_memory, bool* finished) {
+bool Elf::Step(uint64_t rel_pc, Regs* regs, Memory* process_memory, bool* finished,
+               ErrorData* error) {
   if (!valid_) {
     return false;
   }
 
   // Lock during the step which can update information in the object.
   std::lock_guard<std::mutex> guard(lock_);
-  return interface_->Step(rel_pc, regs, process_memory, finished);
+  bool stepped = interface_->Step(rel_pc, regs, process_memory, finished);
+  if (error != nullptr) {
+    *error = interface_->last_error();
+  }
+  return stepped;
 }
 
 bool Elf::IsValidElf(Memory* memory) {
@@ -332,6 +341,11 @@ void Elf::SetCachingEnabled(bool enable) {
   }
 }
 
+void Elf::SetGnuDebugdataCacheDir(const std::string& dir) {
+  delete gnu_debugdata_cache_dir_;
+  gnu_debugdata_cache_dir_ = dir.empty() ? nullptr : new std::string(dir);
+}
+
 void Elf::CacheLock() {
   cache_lock_->lock();
 }
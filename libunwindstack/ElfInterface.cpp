@@ -15,18 +15,28 @@
  */
 
 #include <elf.h>
+#include <fcntl.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
 
 #include <memory>
 #include <string>
 #include <utility>
 
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+
 #include <7zCrc.h>
 #include <Xz.h>
 #include <XzCrc64.h>
 
 #include <unwindstack/DwarfError.h>
 #include <unwindstack/DwarfSection.h>
+#include <unwindstack/Elf.h>
 #include <unwindstack/ElfInterface.h>
 #include <unwindstack/Log.h>
 #include <unwindstack/Regs.h>
@@ -69,11 +79,66 @@ bool ElfInterface::IsValidPc(uint64_t pc) {
   return false;
 }
 
+// The decompressed .gnu_debugdata of an elf is cached in a file named after
+// its build id, see Elf::SetGnuDebugdataCacheDir.
+static std::string GnuDebugdataCachePath(const std::string& build_id) {
+  const std::string* dir = Elf::GnuDebugdataCacheDir();
+  if (dir == nullptr || build_id.empty()) {
+    return "";
+  }
+  std::string path = *dir + '/';
+  for (const char& c : build_id) {
+    // Use %hhx to avoid sign extension on abis that have signed chars.
+    path += android::base::StringPrintf("%02hhx", c);
+  }
+  return path + ".gnu_debugdata";
+}
+
+static Memory* OpenGnuDebugdataCache(const std::string& path) {
+  // Anyone else able to write the file could make it say anything.
+  struct stat st;
+  if (lstat(path.c_str(), &st) == -1 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+      (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+    return nullptr;
+  }
+
+  std::unique_ptr<Memory> memory = Memory::CreateFileMemory(path, 0);
+  if (memory == nullptr || !Elf::IsValidElf(memory.get())) {
+    return nullptr;
+  }
+
+  // Whoever trims the cache removes the least recently used files first.
+  utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+  return memory.release();
+}
+
+static void WriteGnuDebugdataCache(const std::string& path, const uint8_t* data, size_t size) {
+  // Write to a temporary file and rename it, so that a partially written file
+  // is never used.
+  std::string tmp_path = path + android::base::StringPrintf(".%d.tmp", getpid());
+  android::base::unique_fd fd(
+      TEMP_FAILURE_RETRY(open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)));
+  if (fd == -1) {
+    return;
+  }
+  if (!android::base::WriteFully(fd, data, size) || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+  }
+}
+
 Memory* ElfInterface::CreateGnuDebugdataMemory() {
   if (gnu_debugdata_offset_ == 0 || gnu_debugdata_size_ == 0) {
     return nullptr;
   }
 
+  std::string cache_path = GnuDebugdataCachePath(GetBuildID());
+  if (!cache_path.empty()) {
+    Memory* memory = OpenGnuDebugdataCache(cache_path);
+    if (memory != nullptr) {
+      return memory;
+    }
+  }
+
   // TODO: Only call these initialization functions once.
   CrcGenerateTable();
   Crc64GenerateTable();
@@ -143,6 +208,9 @@ Memory* ElfInterface::CreateGnuDebugdataMemory() {
     return nullptr;
   }
 
+  if (!cache_path.empty()) {
+    WriteGnuDebugdataCache(cache_path, dst->GetPtr(0), dst->Size());
+  }
   return dst.release();
 }
 
@@ -26,6 +26,8 @@
 
 #include <algorithm>
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include <android-base/unique_fd.h>
 
@@ -40,6 +42,7 @@
 #include "MemoryOfflineBuffer.h"
 #include "MemoryRange.h"
 #include "MemoryRemote.h"
+#include "MemorySnapshot.h"
 
 namespace unwindstack {
 
@@ -200,6 +203,13 @@ std::shared_ptr<Memory> Memory::CreateProcessMemoryCached(pid_t pid) {
   return std::shared_ptr<Memory>(new MemoryCache(new MemoryRemote(pid)));
 }
 
+std::shared_ptr<Memory> Memory::CreateProcessMemoryThreadCached(pid_t pid) {
+  if (pid == getpid()) {
+    return std::shared_ptr<Memory>(new MemoryThreadCache(new MemoryLocal()));
+  }
+  return std::shared_ptr<Memory>(new MemoryThreadCache(new MemoryRemote(pid)));
+}
+
 std::shared_ptr<Memory> Memory::CreateOfflineMemory(const uint8_t* data, uint64_t start,
                                                     uint64_t end) {
   return std::shared_ptr<Memory>(new MemoryOfflineBuffer(data, start, end));
@@ -429,22 +439,22 @@ size_t MemoryOfflineParts::Read(uint64_t addr, void* dst, size_t size) {
   return 0;
 }
 
-size_t MemoryCache::Read(uint64_t addr, void* dst, size_t size) {
+size_t MemoryCacheBase::CachedRead(uint64_t addr, void* dst, size_t size, CacheDataType* cache) {
   // Only bother caching and looking at the cache if this is a small read for now.
   if (size > 64) {
     return impl_->Read(addr, dst, size);
   }
 
   uint64_t addr_page = addr >> kCacheBits;
-  auto entry = cache_.find(addr_page);
+  auto entry = cache->find(addr_page);
   uint8_t* cache_dst;
-  if (entry != cache_.end()) {
+  if (entry != cache->end()) {
     cache_dst = entry->second;
   } else {
-    cache_dst = cache_[addr_page];
+    cache_dst = (*cache)[addr_page];
     if (!impl_->ReadFully(addr_page << kCacheBits, cache_dst, kCacheSize)) {
       // Erase the entry.
-      cache_.erase(addr_page);
+      cache->erase(addr_page);
       return impl_->Read(addr, dst, size);
     }
   }
@@ -460,14 +470,14 @@ size_t MemoryCache::Read(uint64_t addr, void* dst, size_t size) {
   dst = &reinterpret_cast<uint8_t*>(dst)[max_read];
   addr_page++;
 
-  entry = cache_.find(addr_page);
-  if (entry != cache_.end()) {
+  entry = cache->find(addr_page);
+  if (entry != cache->end()) {
     cache_dst = entry->second;
   } else {
-    cache_dst = cache_[addr_page];
+    cache_dst = (*cache)[addr_page];
     if (!impl_->ReadFully(addr_page << kCacheBits, cache_dst, kCacheSize)) {
       // Erase the entry.
-      cache_.erase(addr_page);
+      cache->erase(addr_page);
       return impl_->Read(addr_page << kCacheBits, dst, size - max_read) + max_read;
     }
   }
@@ -475,4 +485,141 @@ size_t MemoryCache::Read(uint64_t addr, void* dst, size_t size) {
   return size;
 }
 
+MemoryThreadCache::MemoryThreadCache(Memory* memory) : MemoryCacheBase(memory) {
+  thread_cache_valid_ = pthread_key_create(&thread_cache_, nullptr) == 0;
+}
+
+MemoryThreadCache::~MemoryThreadCache() {
+  if (thread_cache_valid_) {
+    pthread_key_delete(thread_cache_);
+  }
+}
+
+MemoryCacheBase::CacheDataType* MemoryThreadCache::GetThreadCache() {
+  CacheDataType* cache = reinterpret_cast<CacheDataType*>(pthread_getspecific(thread_cache_));
+  if (cache == nullptr) {
+    std::lock_guard<std::mutex> guard(caches_lock_);
+    caches_.emplace_back(new CacheDataType);
+    cache = caches_.back().get();
+    pthread_setspecific(thread_cache_, cache);
+  }
+  return cache;
+}
+
+size_t MemoryThreadCache::Read(uint64_t addr, void* dst, size_t size) {
+  if (!thread_cache_valid_) {
+    return impl_->Read(addr, dst, size);
+  }
+  return CachedRead(addr, dst, size, GetThreadCache());
+}
+
+void MemoryThreadCache::Clear() {
+  if (!thread_cache_valid_) {
+    return;
+  }
+
+  CacheDataType* cache = reinterpret_cast<CacheDataType*>(pthread_getspecific(thread_cache_));
+  if (cache != nullptr) {
+    cache->clear();
+  }
+}
+
+size_t MemorySnapshot::Snapshot(pid_t pid, std::vector<std::pair<uint64_t, uint64_t>> ranges) {
+  ranges_.clear();
+  data_.clear();
+
+  // Merge overlapping ranges so that every byte is only copied once.
+  std::sort(ranges.begin(), ranges.end());
+  std::vector<Range> merged;
+  size_t total = 0;
+  for (const auto& [start, end] : ranges) {
+    if (start >= end) {
+      continue;
+    }
+#if !defined(__LP64__)
+    // struct iovec uses void* for iov_base.
+    if (end > UINT32_MAX) {
+      continue;
+    }
+#endif
+    if (!merged.empty() && start < merged.back().end) {
+      if (end > merged.back().end) {
+        total += end - merged.back().end;
+        merged.back().end = end;
+      }
+      continue;
+    }
+    merged.push_back({start, end, total});
+    total += end - start;
+  }
+  data_.resize(total);
+
+  // The ranges are laid out back to back in data_, so each call needs a single
+  // local iovec. A range that cannot be read ends the transfer early, keep
+  // whatever was read of it and carry on with the ranges after it.
+  constexpr size_t kMaxIovecs = 64;
+  struct iovec src_iovs[kMaxIovecs];
+  size_t bytes_read = 0;
+  size_t next = 0;
+  while (next < merged.size()) {
+    size_t iovecs_used = std::min(kMaxIovecs, merged.size() - next);
+    size_t len = 0;
+    for (size_t i = 0; i < iovecs_used; i++) {
+      const Range& range = merged[next + i];
+      src_iovs[i].iov_base = reinterpret_cast<void*>(range.start);
+      src_iovs[i].iov_len = range.end - range.start;
+      len += src_iovs[i].iov_len;
+    }
+    struct iovec dst_iov = {
+        .iov_base = &data_[merged[next].offset], .iov_len = len,
+    };
+
+    ssize_t rc = process_vm_readv(pid, &dst_iov, 1, src_iovs, iovecs_used, 0);
+    if (rc == -1) {
+      if (errno != EFAULT) {
+        // Nothing can be read this way, leave every read to the wrapped memory.
+        break;
+      }
+      rc = 0;
+    }
+
+    size_t left = rc;
+    size_t done = 0;
+    for (; done < iovecs_used; done++) {
+      Range range = merged[next + done];
+      if (left < range.end - range.start) {
+        if (left != 0) {
+          range.end = range.start + left;
+          ranges_.push_back(range);
+          bytes_read += left;
+        }
+        // Skip the range that failed.
+        done++;
+        break;
+      }
+      ranges_.push_back(range);
+      bytes_read += range.end - range.start;
+      left -= range.end - range.start;
+    }
+    next += done;
+  }
+  return bytes_read;
+}
+
+size_t MemorySnapshot::Read(uint64_t addr, void* dst, size_t size) {
+  auto entry = std::upper_bound(ranges_.begin(), ranges_.end(), addr,
+                                [](uint64_t addr, const Range& range) { return addr < range.end; });
+  if (entry == ranges_.end() || addr < entry->start) {
+    return memory_->Read(addr, dst, size);
+  }
+
+  size_t bytes = std::min(size, static_cast<size_t>(entry->end - addr));
+  memcpy(dst, &data_[entry->offset + addr - entry->start], bytes);
+  if (bytes < size) {
+    // The read runs off the end of the range, get the rest from the process.
+    bytes += memory_->Read(addr + bytes, reinterpret_cast<uint8_t*>(dst) + bytes, size - bytes);
+  }
+  return bytes;
+}
+
 }  // namespace unwindstack
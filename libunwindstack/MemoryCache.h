@@ -17,32 +17,72 @@
 #ifndef _LIBUNWINDSTACK_MEMORY_CACHE_H
 #define _LIBUNWINDSTACK_MEMORY_CACHE_H
 
+#include <pthread.h>
 #include <stdint.h>
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <unwindstack/Memory.h>
 
 namespace unwindstack {
 
-class MemoryCache : public Memory {
+class MemoryCacheBase : public Memory {
  public:
-  MemoryCache(Memory* memory) : impl_(memory) {}
+  MemoryCacheBase(Memory* memory) : impl_(memory) {}
+  virtual ~MemoryCacheBase() = default;
+
+ protected:
+  constexpr static size_t kCacheBits = 12;
+  constexpr static size_t kCacheMask = (1 << kCacheBits) - 1;
+  constexpr static size_t kCacheSize = 1 << kCacheBits;
+  using CacheDataType = std::unordered_map<uint64_t, uint8_t[kCacheSize]>;
+
+  size_t CachedRead(uint64_t addr, void* dst, size_t size, CacheDataType* cache);
+
+  std::unique_ptr<Memory> impl_;
+};
+
+class MemoryCache : public MemoryCacheBase {
+ public:
+  MemoryCache(Memory* memory) : MemoryCacheBase(memory) {}
   virtual ~MemoryCache() = default;
 
-  size_t Read(uint64_t addr, void* dst, size_t size) override;
+  size_t Read(uint64_t addr, void* dst, size_t size) override {
+    return CachedRead(addr, dst, size, &cache_);
+  }
 
   void Clear() override { cache_.clear(); }
 
  private:
-  constexpr static size_t kCacheBits = 12;
-  constexpr static size_t kCacheMask = (1 << kCacheBits) - 1;
-  constexpr static size_t kCacheSize = 1 << kCacheBits;
-  std::unordered_map<uint64_t, uint8_t[kCacheSize]> cache_;
+  CacheDataType cache_;
+};
 
-  std::unique_ptr<Memory> impl_;
+// Keeps a separate cache for every thread that reads through it, so that
+// several threads can unwind through the same object at once.
+class MemoryThreadCache : public MemoryCacheBase {
+ public:
+  MemoryThreadCache(Memory* memory);
+  virtual ~MemoryThreadCache();
+
+  size_t Read(uint64_t addr, void* dst, size_t size) override;
+
+  // Only clears the cache of the calling thread.
+  void Clear() override;
+
+ private:
+  CacheDataType* GetThreadCache();
+
+  pthread_key_t thread_cache_;
+  bool thread_cache_valid_ = false;
+
+  // The caches of every thread, including those that have exited, which are
+  // all freed along with this object.
+  std::mutex caches_lock_;
+  std::vector<std::unique_ptr<CacheDataType>> caches_;
 };
 
 }  // namespace unwindstack
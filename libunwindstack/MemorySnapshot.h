@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBUNWINDSTACK_MEMORY_SNAPSHOT_H
+#define _LIBUNWINDSTACK_MEMORY_SNAPSHOT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <unwindstack/Memory.h>
+
+namespace unwindstack {
+
+// Serves reads within a set of ranges, copied out of a stopped process up
+// front, from memory. All other reads are passed to the wrapped memory.
+class MemorySnapshot : public Memory {
+ public:
+  MemorySnapshot(const std::shared_ptr<Memory>& memory) : memory_(memory) {}
+  virtual ~MemorySnapshot() = default;
+
+  // Copies the [start, end) ranges out of pid using as few process_vm_readv
+  // calls as possible. Ranges that cannot be read are left to the wrapped
+  // memory. Returns the number of bytes copied.
+  size_t Snapshot(pid_t pid, std::vector<std::pair<uint64_t, uint64_t>> ranges);
+
+  size_t Read(uint64_t addr, void* dst, size_t size) override;
+
+  void Clear() override { memory_->Clear(); }
+
+ private:
+  struct Range {
+    uint64_t start;
+    uint64_t end;
+    size_t offset;
+  };
+
+  std::shared_ptr<Memory> memory_;
+  std::vector<Range> ranges_;
+  std::vector<uint8_t> data_;
+};
+
+}  // namespace unwindstack
+
+#endif  // _LIBUNWINDSTACK_MEMORY_SNAPSHOT_H
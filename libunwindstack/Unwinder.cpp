@@ -19,10 +19,13 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <utility>
+#include <vector>
 
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
@@ -36,6 +39,8 @@
 
 #include <unwindstack/DexFiles.h>
 
+#include "MemorySnapshot.h"
+
 // Use the demangler from libc++.
 extern "C" char* __cxa_demangle(const char*, char*, size_t*, int* status);
 
@@ -250,10 +255,10 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
               frame->pc += pc_adjustment;
               step_pc = rel_pc;
             }
-          } else if (elf->Step(step_pc, regs_, process_memory_.get(), &finished)) {
+            elf->GetLastError(&last_error_);
+          } else if (elf->Step(step_pc, regs_, process_memory_.get(), &finished, &last_error_)) {
             stepped = true;
           }
-          elf->GetLastError(&last_error_);
         }
       }
     }
@@ -381,7 +386,11 @@ bool UnwinderFromPid::Init(ArchEnum arch) {
   }
   maps_ = maps_ptr_.get();
 
-  process_memory_ = Memory::CreateProcessMemoryCached(pid_);
+  if (thread_cached_memory_) {
+    process_memory_ = Memory::CreateProcessMemoryThreadCached(pid_);
+  } else {
+    process_memory_ = Memory::CreateProcessMemoryCached(pid_);
+  }
 
   jit_debug_ptr_.reset(new JitDebug(process_memory_));
   jit_debug_ = jit_debug_ptr_.get();
@@ -395,4 +404,31 @@ bool UnwinderFromPid::Init(ArchEnum arch) {
   return true;
 }
 
+bool UnwinderFromPid::SnapshotStacks(const std::vector<uint64_t>& sps) {
+  // A running process would change underneath the copy.
+  if (maps_ == nullptr || pid_ == getpid()) {
+    return false;
+  }
+
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  for (uint64_t sp : sps) {
+    MapInfo* map_info = maps_->Find(sp);
+    if (map_info == nullptr || !(map_info->flags & PROT_READ)) {
+      continue;
+    }
+    // Deeper frames than this are still read from the process.
+    uint64_t end = map_info->end;
+    if (end - sp > kMaxStackSnapshotSize) {
+      end = sp + kMaxStackSnapshotSize;
+    }
+    ranges.emplace_back(sp, end);
+  }
+
+  if (snapshot_memory_ == nullptr) {
+    snapshot_memory_.reset(new MemorySnapshot(process_memory_));
+    process_memory_ = snapshot_memory_;
+  }
+  return snapshot_memory_->Snapshot(pid_, std::move(ranges)) != 0;
+}
+
 }  // namespace unwindstack
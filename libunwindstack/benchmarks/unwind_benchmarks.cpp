@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <malloc.h>
 #include <stdint.h>
 
 #include <memory>
@@ -83,6 +84,35 @@ static void BM_cached_unwind(benchmark::State& state) {
 }
 BENCHMARK(BM_cached_unwind);
 
+// Every iteration uses new maps, so the elf files are opened and their
+// unwind information is read from scratch, as in a process unwinding for
+// the first time. Also reports the heap kept by the maps after the unwind.
+static void BM_cold_unwind(benchmark::State& state) {
+  auto process_memory = unwindstack::Memory::CreateProcessMemory(getpid());
+  size_t total_bytes = 0;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::unique_ptr<unwindstack::LocalMaps> maps(new unwindstack::LocalMaps);
+    if (!maps->Parse()) {
+      state.SkipWithError("Failed to parse local maps.");
+      break;
+    }
+    size_t allocated_bytes = mallinfo().uordblks;
+    state.ResumeTiming();
+
+    benchmark::DoNotOptimize(Call1(process_memory, maps.get()));
+
+    state.PauseTiming();
+    total_bytes += mallinfo().uordblks - allocated_bytes;
+    maps.reset();
+    state.ResumeTiming();
+  }
+  state.counters["heap_bytes"] =
+      benchmark::Counter(total_bytes, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_cold_unwind);
+
 static void Initialize(benchmark::State& state, unwindstack::Maps& maps,
                        unwindstack::MapInfo** build_id_map_info) {
   if (!maps.Parse()) {
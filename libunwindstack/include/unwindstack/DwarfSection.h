@@ -19,9 +19,12 @@
 
 #include <stdint.h>
 
+#include <deque>
 #include <iterator>
 #include <map>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <unwindstack/DwarfError.h>
 #include <unwindstack/DwarfLocation.h>
@@ -36,6 +39,74 @@ class Regs;
 template <typename AddressType>
 struct RegsInfo;
 
+// Decoded CIEs or FDEs, indexed by their offset in the section. The entries
+// are kept in a deque so that pointers to them stay valid as more are added,
+// and the index is a single open addressed table instead of a node per entry.
+template <typename T>
+class DwarfEntryCache {
+ public:
+  T* Find(uint64_t offset) {
+    if (slots_.empty()) {
+      return nullptr;
+    }
+    for (size_t i = Hash(offset);; i = (i + 1) & (slots_.size() - 1)) {
+      const Slot& slot = slots_[i];
+      if (slot.entry == nullptr) {
+        return nullptr;
+      }
+      if (slot.offset == offset) {
+        return slot.entry;
+      }
+    }
+  }
+
+  // The caller must have checked that no entry exists at this offset.
+  T* Add(uint64_t offset, T&& value) {
+    if (2 * (entries_.size() + 1) > slots_.size()) {
+      Grow();
+    }
+    T* entry = &entries_.emplace_back(std::move(value));
+    Insert(offset, entry);
+    return entry;
+  }
+
+  size_t size() { return entries_.size(); }
+
+ private:
+  struct Slot {
+    uint64_t offset;
+    T* entry;
+  };
+
+  size_t Hash(uint64_t offset) { return (offset * 0x9e3779b97f4a7c15ULL) >> hash_shift_; }
+
+  void Insert(uint64_t offset, T* entry) {
+    size_t i = Hash(offset);
+    while (slots_[i].entry != nullptr) {
+      i = (i + 1) & (slots_.size() - 1);
+    }
+    slots_[i] = Slot{offset, entry};
+  }
+
+  void Grow() {
+    std::vector<Slot> old_slots(slots_.empty() ? 16 : 2 * slots_.size(), Slot{0, nullptr});
+    old_slots.swap(slots_);
+    hash_shift_ = 64;
+    for (size_t size = slots_.size(); size > 1; size >>= 1) {
+      hash_shift_--;
+    }
+    for (const Slot& slot : old_slots) {
+      if (slot.entry != nullptr) {
+        Insert(slot.offset, slot.entry);
+      }
+    }
+  }
+
+  std::deque<T> entries_;
+  std::vector<Slot> slots_;
+  uint32_t hash_shift_ = 64;
+};
+
 class DwarfSection {
  public:
   DwarfSection(Memory* memory);
@@ -113,8 +184,8 @@ class DwarfSection {
   uint32_t cie32_value_ = 0;
   uint64_t cie64_value_ = 0;
 
-  std::unordered_map<uint64_t, DwarfFde> fde_entries_;
-  std::unordered_map<uint64_t, DwarfCie> cie_entries_;
+  DwarfEntryCache<DwarfFde> fde_entries_;
+  DwarfEntryCache<DwarfCie> cie_entries_;
   std::unordered_map<uint64_t, dwarf_loc_regs_t> cie_loc_regs_;
   std::map<uint64_t, dwarf_loc_regs_t> loc_regs_;  // Single row indexed by pc_end.
 };
@@ -158,7 +229,7 @@ class DwarfSectionImpl : public DwarfSection {
   bool EvalExpression(const DwarfLocation& loc, Memory* regular_memory, AddressType* value,
                       RegsInfo<AddressType>* regs_info, bool* is_dex_pc);
 
-  void InsertFde(const DwarfFde* fde);
+  void BuildFdeIndex();
 
   int64_t section_bias_ = 0;
   uint64_t entries_offset_ = 0;
@@ -166,7 +237,15 @@ class DwarfSectionImpl : public DwarfSection {
   uint64_t next_entries_offset_ = 0;
   uint64_t pc_offset_ = 0;
 
-  std::map<uint64_t, std::pair<uint64_t, const DwarfFde*>> fdes_;
+  // The pc ranges covered by the fdes, sorted and non-overlapping, so a
+  // lookup is a binary search over contiguous memory.
+  struct FdeRange {
+    uint64_t pc_end;
+    uint64_t pc_start;
+    const DwarfFde* fde;
+  };
+  std::vector<FdeRange> fde_index_;
+  bool fde_index_built_ = false;
 };
 
 }  // namespace unwindstack
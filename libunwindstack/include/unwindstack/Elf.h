@@ -69,7 +69,11 @@ class Elf {
 
   bool StepIfSignalHandler(uint64_t rel_pc, Regs* regs, Memory* process_memory);
 
-  bool Step(uint64_t rel_pc, Regs* regs, Memory* process_memory, bool* finished);
+  // When error is not nullptr, it is set to the error of this step, which
+  // GetLastError could already report for another step if several threads
+  // share this object.
+  bool Step(uint64_t rel_pc, Regs* regs, Memory* process_memory, bool* finished,
+            ErrorData* error = nullptr);
 
   ElfInterface* CreateInterfaceFromMemory(Memory* memory);
 
@@ -114,6 +118,15 @@ class Elf {
   static bool CacheGet(MapInfo* info);
   static bool CacheAfterCreateMemory(MapInfo* info);
 
+  // Keeps the decompressed .gnu_debugdata of every elf with a build id in a
+  // file in dir, so that later processes map it in rather than decompress it
+  // again. Only files owned by the current user are used. The modification
+  // time of a file is updated whenever it is used, but nothing is ever
+  // removed, so the owner of dir has to limit its size. An empty dir turns
+  // this off.
+  static void SetGnuDebugdataCacheDir(const std::string& dir);
+  static const std::string* GnuDebugdataCacheDir() { return gnu_debugdata_cache_dir_; }
+
  protected:
   bool valid_ = false;
   int64_t load_bias_ = 0;
@@ -131,6 +144,8 @@ class Elf {
   static bool cache_enabled_;
   static std::unordered_map<std::string, std::pair<std::shared_ptr<Elf>, bool>>* cache_;
   static std::mutex* cache_lock_;
+
+  static std::string* gnu_debugdata_cache_dir_;
 };
 
 }  // namespace unwindstack
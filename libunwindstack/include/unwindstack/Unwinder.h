@@ -35,6 +35,7 @@ namespace unwindstack {
 
 // Forward declarations.
 class Elf;
+class MemorySnapshot;
 enum ArchEnum : uint8_t;
 
 struct FrameData {
@@ -143,8 +144,23 @@ class UnwinderFromPid : public Unwinder {
 
   bool Init(ArchEnum arch);
 
+  // Gives every thread that unwinds through copies of this object its own
+  // cache of the process memory, instead of one cache that only a single
+  // thread can use at a time. Has to be called before Init.
+  void SetThreadCachedMemory(bool thread_cached) { thread_cached_memory_ = thread_cached; }
+
+  // Copies the stack of each thread, from its sp to the end of the map that
+  // holds it, out of the stopped process in one batch of reads. Later unwinds
+  // read the stacks from this copy instead of making a system call for each
+  // read. Returns false if nothing could be copied.
+  bool SnapshotStacks(const std::vector<uint64_t>& sps);
+
+  static constexpr size_t kMaxStackSnapshotSize = 256 * 1024;
+
  private:
   pid_t pid_;
+  bool thread_cached_memory_ = false;
+  std::shared_ptr<MemorySnapshot> snapshot_memory_;
   std::unique_ptr<Maps> maps_ptr_;
   std::unique_ptr<JitDebug> jit_debug_ptr_;
   std::unique_ptr<DexFiles> dex_files_ptr_;
@@ -870,6 +870,33 @@ TYPED_TEST_P(DwarfDebugFrameTest, GetFdeFromPc_overlap) {
   ASSERT_TRUE(fde == nullptr);
 }
 
+TYPED_TEST_P(DwarfDebugFrameTest, GetFdeFromPc_many) {
+  SetCie32(&this->memory_, 0x5000, 0xfc, std::vector<uint8_t>{1, '\0', 0, 0, 1});
+
+  // 100 FDEs of 0x80 bytes, every 0x100 bytes, added in reverse pc order.
+  for (size_t i = 0; i < 100; i++) {
+    SetFde32(&this->memory_, 0x5100 + i * 0x100, 0xfc, 0, 0x10000 - i * 0x100, 0x80);
+  }
+  this->debug_frame_->Init(0x5000, 0x100 * 101, 0);
+
+  for (size_t i = 0; i < 100; i++) {
+    uint64_t pc_start = 0x10000 - i * 0x100;
+    SCOPED_TRACE(testing::Message() << "pc_start 0x" << std::hex << pc_start);
+
+    const DwarfFde* fde = this->debug_frame_->GetFdeFromPc(pc_start);
+    ASSERT_TRUE(fde != nullptr);
+    EXPECT_EQ(pc_start, fde->pc_start);
+    fde = this->debug_frame_->GetFdeFromPc(pc_start + 0x7f);
+    ASSERT_TRUE(fde != nullptr);
+    EXPECT_EQ(pc_start, fde->pc_start);
+
+    ASSERT_TRUE(this->debug_frame_->GetFdeFromPc(pc_start - 1) == nullptr);
+    ASSERT_TRUE(this->debug_frame_->GetFdeFromPc(pc_start + 0x80) == nullptr);
+  }
+  ASSERT_TRUE(this->debug_frame_->GetFdeFromPc(0) == nullptr);
+  ASSERT_TRUE(this->debug_frame_->GetFdeFromPc(0x20000) == nullptr);
+}
+
 REGISTER_TYPED_TEST_SUITE_P(
     DwarfDebugFrameTest, GetFdes32, GetFdes32_after_GetFdeFromPc, GetFdes32_not_in_section,
     GetFdeFromPc32, GetFdeFromPc32_reverse, GetFdeFromPc32_not_in_section, GetFdes64,
@@ -880,7 +907,8 @@ REGISTER_TYPED_TEST_SUITE_P(
     GetCieFromOffset64_version4, GetCieFromOffset32_version5, GetCieFromOffset64_version5,
     GetCieFromOffset_version_invalid, GetCieFromOffset32_augment, GetCieFromOffset64_augment,
     GetFdeFromOffset32_augment, GetFdeFromOffset64_augment, GetFdeFromOffset32_lsda_address,
-    GetFdeFromOffset64_lsda_address, GetFdeFromPc_interleaved, GetFdeFromPc_overlap);
+    GetFdeFromOffset64_lsda_address, GetFdeFromPc_interleaved, GetFdeFromPc_overlap,
+    GetFdeFromPc_many);
 
 typedef ::testing::Types<uint32_t, uint64_t> DwarfDebugFrameTestTypes;
 INSTANTIATE_TYPED_TEST_SUITE_P(Libunwindstack, DwarfDebugFrameTest, DwarfDebugFrameTestTypes);
@@ -42,7 +42,7 @@ class TestDwarfEhFrameWithHdr : public DwarfEhFrameWithHdr<TypeParam> {
 
   void TestSetFdeCount(uint64_t count) { this->fde_count_ = count; }
   void TestSetFdeInfo(uint64_t index, const typename DwarfEhFrameWithHdr<TypeParam>::FdeInfo& info) {
-    this->fde_info_[index] = info;
+    *this->CacheFdeInfo(index) = info;
   }
 
   uint8_t TestGetVersion() { return this->version_; }
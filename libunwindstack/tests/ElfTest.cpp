@@ -20,6 +20,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <string>
+
+#include <android-base/file.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
@@ -499,4 +502,100 @@ TEST_F(ElfTest, error_code_valid) {
   EXPECT_EQ(0x1000U, elf.GetLastErrorAddress());
 }
 
+TEST_F(ElfTest, step_error) {
+  ElfFake elf(memory_);
+  elf.FakeSetValid(true);
+  ElfInterfaceFake* interface = new ElfInterfaceFake(memory_);
+  elf.FakeSetInterface(interface);
+  interface->FakeSetErrorCode(ERROR_MEMORY_INVALID);
+  interface->FakeSetErrorAddress(0x1000);
+  ElfInterfaceFake::FakeClear();
+
+  RegsArm regs;
+  MemoryFake process_memory;
+  bool finished;
+  ErrorData error{ERROR_NONE, 0};
+  ASSERT_FALSE(elf.Step(0x1000, &regs, &process_memory, &finished, &error));
+  EXPECT_EQ(ERROR_MEMORY_INVALID, error.code);
+  EXPECT_EQ(0x1000U, error.address);
+
+  // Not set at all for an invalid elf.
+  elf.FakeSetValid(false);
+  error = ErrorData{ERROR_NONE, 0};
+  ASSERT_FALSE(elf.Step(0x1000, &regs, &process_memory, &finished, &error));
+  EXPECT_EQ(ERROR_NONE, error.code);
+  EXPECT_EQ(0U, error.address);
+}
+
+TEST(ElfGnuDebugdataCacheTest, read_and_write) {
+  std::string lib = TestGetFileDirectory() + "offline/gnu_debugdata_arm/libandroid_runtime.so";
+  TemporaryDir cache_dir;
+  std::string cache_file =
+      std::string(cache_dir.path) + "/d75bc4c9ec2b53085c418234f8cd717c.gnu_debugdata";
+  Elf::SetGnuDebugdataCacheDir(cache_dir.path);
+
+  // Decompressing the section writes the cache file.
+  uint64_t gnu_debugdata_offset;
+  {
+    Elf elf(Memory::CreateFileMemory(lib, 0).release());
+    ASSERT_TRUE(elf.Init());
+    ASSERT_TRUE(elf.gnu_debugdata_interface() != nullptr);
+    gnu_debugdata_offset = elf.interface()->gnu_debugdata_offset();
+  }
+  std::string cached;
+  ASSERT_TRUE(android::base::ReadFileToString(cache_file, &cached));
+  ASSERT_LT(4U, cached.size());
+  ASSERT_EQ(0, memcmp(cached.data(), ELFMAG, SELFMAG));
+
+  // Make a copy of the library that cannot be decompressed.
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(lib, &contents));
+  ASSERT_LT(gnu_debugdata_offset + 64, contents.size());
+  contents.replace(gnu_debugdata_offset, 64, 64, '\0');
+  TemporaryFile corrupt_lib;
+  ASSERT_TRUE(android::base::WriteStringToFd(contents, corrupt_lib.fd));
+
+  // The cache file is used instead of decompressing the section, and marked
+  // as recently used.
+  struct timespec times[2] = {{.tv_sec = 1000}, {.tv_sec = 1000}};
+  ASSERT_EQ(0, utimensat(AT_FDCWD, cache_file.c_str(), times, 0));
+  {
+    Elf elf(Memory::CreateFileMemory(corrupt_lib.path, 0).release());
+    ASSERT_TRUE(elf.Init());
+    ASSERT_TRUE(elf.gnu_debugdata_interface() != nullptr);
+  }
+  struct stat st;
+  ASSERT_EQ(0, stat(cache_file.c_str(), &st));
+  ASSERT_LT(1000, st.st_mtime);
+
+  // A symlink to the cache file is ignored.
+  std::string real_file = cache_file + ".real";
+  ASSERT_EQ(0, rename(cache_file.c_str(), real_file.c_str()));
+  ASSERT_EQ(0, symlink(real_file.c_str(), cache_file.c_str()));
+  {
+    Elf elf(Memory::CreateFileMemory(corrupt_lib.path, 0).release());
+    ASSERT_TRUE(elf.Init());
+    ASSERT_TRUE(elf.gnu_debugdata_interface() == nullptr);
+  }
+  ASSERT_EQ(0, rename(real_file.c_str(), cache_file.c_str()));
+
+  // A cache file that others can write is ignored.
+  ASSERT_EQ(0, chmod(cache_file.c_str(), 0666));
+  {
+    Elf elf(Memory::CreateFileMemory(corrupt_lib.path, 0).release());
+    ASSERT_TRUE(elf.Init());
+    ASSERT_TRUE(elf.gnu_debugdata_interface() == nullptr);
+  }
+
+  // Nothing is cached once the directory is cleared.
+  Elf::SetGnuDebugdataCacheDir("");
+  ASSERT_EQ(0, unlink(cache_file.c_str()));
+  {
+    Elf elf(Memory::CreateFileMemory(lib, 0).release());
+    ASSERT_TRUE(elf.Init());
+    ASSERT_TRUE(elf.gnu_debugdata_interface() != nullptr);
+  }
+  ASSERT_EQ(-1, access(cache_file.c_str(), F_OK));
+}
+
 }  // namespace unwindstack
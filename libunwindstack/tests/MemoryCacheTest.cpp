@@ -16,6 +16,10 @@
 
 #include <stdint.h>
 
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -139,4 +143,83 @@ TEST_F(MemoryCacheTest, read_for_cache_fail_cross) {
   ASSERT_EQ(expect, buffer);
 }
 
+TEST_F(MemoryCacheTest, thread_cached_read) {
+  MemoryFake* memory = new MemoryFake;
+  MemoryThreadCache thread_cache(memory);
+  memory->SetMemoryBlock(0x8000, 4096, 0xab);
+
+  std::vector<uint8_t> buffer(kMaxCachedSize);
+  ASSERT_TRUE(thread_cache.ReadFully(0x8010, buffer.data(), buffer.size()));
+  ASSERT_EQ(std::vector<uint8_t>(kMaxCachedSize, 0xab), buffer);
+
+  // Verify the cached data is used by this thread.
+  memory->SetMemoryBlock(0x8000, 4096, 0xff);
+  ASSERT_TRUE(thread_cache.ReadFully(0x8010, buffer.data(), buffer.size()));
+  ASSERT_EQ(std::vector<uint8_t>(kMaxCachedSize, 0xab), buffer);
+
+  // Verify another thread does not see this thread's cache.
+  std::thread thread([&thread_cache, &buffer]() {
+    ASSERT_TRUE(thread_cache.ReadFully(0x8010, buffer.data(), buffer.size()));
+  });
+  thread.join();
+  ASSERT_EQ(std::vector<uint8_t>(kMaxCachedSize, 0xff), buffer);
+
+  // Verify the cached data is not used after a reset.
+  thread_cache.Clear();
+  memory->SetMemoryBlock(0x8000, 4096, 0x12);
+  ASSERT_TRUE(thread_cache.ReadFully(0x8010, buffer.data(), buffer.size()));
+  ASSERT_EQ(std::vector<uint8_t>(kMaxCachedSize, 0x12), buffer);
+}
+
+TEST_F(MemoryCacheTest, thread_cached_freed_with_live_threads) {
+  MemoryFake* memory = new MemoryFake;
+  memory->SetMemoryBlock(0x8000, 4096, 0xab);
+  std::unique_ptr<MemoryThreadCache> thread_cache(new MemoryThreadCache(memory));
+
+  // The thread outlives the object, so the object has to free its cache.
+  std::mutex lock;
+  std::condition_variable cv;
+  bool read = false;
+  bool destroyed = false;
+  std::thread thread([&]() {
+    uint64_t value;
+    EXPECT_TRUE(thread_cache->Read64(0x8000, &value));
+    std::unique_lock<std::mutex> guard(lock);
+    read = true;
+    cv.notify_all();
+    cv.wait(guard, [&destroyed]() { return destroyed; });
+  });
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    cv.wait(guard, [&read]() { return read; });
+    thread_cache.reset();
+    destroyed = true;
+    cv.notify_all();
+  }
+  thread.join();
+}
+
+TEST_F(MemoryCacheTest, thread_cached_read_multiple_threads) {
+  MemoryFake* memory = new MemoryFake;
+  MemoryThreadCache thread_cache(memory);
+  for (size_t i = 0; i < 16; i++) {
+    memory->SetMemoryBlock(0x10000 + i * 4096, 4096, i);
+  }
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < 4; i++) {
+    threads.emplace_back([&thread_cache]() {
+      for (size_t j = 0; j < 1000; j++) {
+        size_t page = j % 16;
+        uint64_t value;
+        ASSERT_TRUE(thread_cache.Read64(0x10000 + page * 4096 + 8, &value));
+        ASSERT_EQ(0x0101010101010101ULL * page, value);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
 }  // namespace unwindstack
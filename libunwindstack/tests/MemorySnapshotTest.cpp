@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "MemoryFake.h"
+#include "MemorySnapshot.h"
+
+namespace unwindstack {
+
+class MemorySnapshotTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    memory_ = new MemoryFake;
+    snapshot_.reset(new MemorySnapshot(std::shared_ptr<Memory>(memory_)));
+  }
+
+  static uint64_t Addr(const void* ptr) { return reinterpret_cast<uint64_t>(ptr); }
+
+  MemoryFake* memory_;
+  std::unique_ptr<MemorySnapshot> snapshot_;
+};
+
+TEST_F(MemorySnapshotTest, empty) {
+  memory_->SetMemoryBlock(0x1000, 16, 0x23);
+
+  ASSERT_EQ(0U, snapshot_->Snapshot(getpid(), {}));
+
+  std::vector<uint8_t> buffer(16);
+  ASSERT_TRUE(snapshot_->ReadFully(0x1000, buffer.data(), buffer.size()));
+  ASSERT_EQ(std::vector<uint8_t>(16, 0x23), buffer);
+}
+
+TEST_F(MemorySnapshotTest, read_from_copy) {
+  std::vector<uint8_t> src(4096, 0x4c);
+
+  ASSERT_EQ(4096U, snapshot_->Snapshot(getpid(), {{Addr(src.data()), Addr(src.data()) + 4096}}));
+
+  // Verify the copy is read, not the process.
+  memset(src.data(), 0xff, src.size());
+  std::vector<uint8_t> buffer(100);
+  for (size_t offset : {0U, 1U, 2000U, 3996U}) {
+    ASSERT_TRUE(snapshot_->ReadFully(Addr(src.data()) + offset, buffer.data(), buffer.size()))
+        << "Failed at offset " << offset;
+    ASSERT_EQ(std::vector<uint8_t>(100, 0x4c), buffer) << "Failed at offset " << offset;
+  }
+}
+
+TEST_F(MemorySnapshotTest, read_outside_copy) {
+  std::vector<uint8_t> src(4096, 0x4c);
+  uint64_t addr = Addr(src.data());
+  memory_->SetMemoryBlock(addr - 16, 16, 0x11);
+  memory_->SetMemoryBlock(addr + 4096, 16, 0x22);
+
+  ASSERT_EQ(4096U, snapshot_->Snapshot(getpid(), {{addr, addr + 4096}}));
+
+  std::vector<uint8_t> buffer(16);
+  ASSERT_TRUE(snapshot_->ReadFully(addr - 16, buffer.data(), buffer.size()));
+  ASSERT_EQ(std::vector<uint8_t>(16, 0x11), buffer);
+  ASSERT_TRUE(snapshot_->ReadFully(addr + 4096, buffer.data(), buffer.size()));
+  ASSERT_EQ(std::vector<uint8_t>(16, 0x22), buffer);
+
+  // A read off the end of the copy gets the rest from the wrapped memory.
+  std::vector<uint8_t> expected(8, 0x4c);
+  expected.resize(16, 0x22);
+  ASSERT_TRUE(snapshot_->ReadFully(addr + 4088, buffer.data(), buffer.size()));
+  ASSERT_EQ(expected, buffer);
+}
+
+TEST_F(MemorySnapshotTest, multiple_ranges) {
+  std::vector<uint8_t> src1(1000, 0x10);
+  std::vector<uint8_t> src2(2000, 0x20);
+  std::vector<uint8_t> src3(3000, 0x30);
+  uint64_t addr1 = Addr(src1.data());
+  uint64_t addr2 = Addr(src2.data());
+  uint64_t addr3 = Addr(src3.data());
+
+  // Overlapping ranges are only copied once.
+  ASSERT_EQ(6000U, snapshot_->Snapshot(getpid(), {{addr3, addr3 + 3000},
+                                                  {addr1, addr1 + 1000},
+                                                  {addr2 + 1000, addr2 + 2000},
+                                                  {addr2, addr2 + 1500}}));
+
+  src1.assign(src1.size(), 0);
+  src2.assign(src2.size(), 0);
+  src3.assign(src3.size(), 0);
+  uint8_t value;
+  ASSERT_TRUE(snapshot_->ReadFully(addr1 + 999, &value, 1));
+  ASSERT_EQ(0x10, value);
+  ASSERT_TRUE(snapshot_->ReadFully(addr2 + 1999, &value, 1));
+  ASSERT_EQ(0x20, value);
+  ASSERT_TRUE(snapshot_->ReadFully(addr3, &value, 1));
+  ASSERT_EQ(0x30, value);
+}
+
+TEST_F(MemorySnapshotTest, unreadable_range) {
+  size_t page_size = getpagesize();
+  void* mapping =
+      mmap(nullptr, 3 * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ASSERT_NE(MAP_FAILED, mapping);
+  uint64_t addr = Addr(mapping);
+  memset(mapping, 0x5a, 3 * page_size);
+  ASSERT_EQ(0, munmap(reinterpret_cast<void*>(addr + page_size), page_size));
+  memory_->SetMemoryBlock(addr + page_size, page_size, 0x77);
+
+  // The unmapped page does not stop the pages after it from being copied.
+  ASSERT_EQ(2 * page_size,
+            snapshot_->Snapshot(getpid(), {{addr, addr + page_size},
+                                           {addr + page_size, addr + 2 * page_size},
+                                           {addr + 2 * page_size, addr + 3 * page_size}}));
+  memset(mapping, 0, page_size);
+  memset(reinterpret_cast<void*>(addr + 2 * page_size), 0, page_size);
+
+  uint8_t value;
+  ASSERT_TRUE(snapshot_->ReadFully(addr, &value, 1));
+  ASSERT_EQ(0x5a, value);
+  ASSERT_TRUE(snapshot_->ReadFully(addr + page_size, &value, 1));
+  ASSERT_EQ(0x77, value);
+  ASSERT_TRUE(snapshot_->ReadFully(addr + 2 * page_size, &value, 1));
+  ASSERT_EQ(0x5a, value);
+
+  munmap(mapping, page_size);
+  munmap(reinterpret_cast<void*>(addr + 2 * page_size), page_size);
+}
+
+TEST_F(MemorySnapshotTest, partially_readable_range) {
+  size_t page_size = getpagesize();
+  void* mapping =
+      mmap(nullptr, 2 * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ASSERT_NE(MAP_FAILED, mapping);
+  uint64_t addr = Addr(mapping);
+  memset(mapping, 0x5a, page_size);
+  ASSERT_EQ(0, munmap(reinterpret_cast<void*>(addr + page_size), page_size));
+
+  // Whatever was read before the fault is kept.
+  size_t bytes = snapshot_->Snapshot(getpid(), {{addr, addr + 2 * page_size}});
+  ASSERT_TRUE(bytes == 0 || bytes == page_size) << "Unexpected bytes " << bytes;
+  memset(mapping, 0, page_size);
+
+  uint8_t value;
+  if (bytes != 0) {
+    ASSERT_TRUE(snapshot_->ReadFully(addr, &value, 1));
+    ASSERT_EQ(0x5a, value);
+  }
+  ASSERT_FALSE(snapshot_->ReadFully(addr + page_size, &value, 1));
+
+  munmap(mapping, page_size);
+}
+
+TEST_F(MemorySnapshotTest, snapshot_replaces_previous) {
+  std::vector<uint8_t> src1(100, 0x10);
+  std::vector<uint8_t> src2(100, 0x20);
+  uint64_t addr1 = Addr(src1.data());
+  uint64_t addr2 = Addr(src2.data());
+  memory_->SetMemoryBlock(addr1, 100, 0xee);
+
+  ASSERT_EQ(100U, snapshot_->Snapshot(getpid(), {{addr1, addr1 + 100}}));
+  ASSERT_EQ(100U, snapshot_->Snapshot(getpid(), {{addr2, addr2 + 100}}));
+
+  uint8_t value;
+  ASSERT_TRUE(snapshot_->ReadFully(addr1, &value, 1));
+  ASSERT_EQ(0xee, value);
+  ASSERT_TRUE(snapshot_->ReadFully(addr2, &value, 1));
+  ASSERT_EQ(0x20, value);
+}
+
+}  // namespace unwindstack
@@ -34,9 +34,15 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <queue>
 #include <regex>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -51,6 +57,7 @@
 #include <log/event_tag_map.h>
 #include <log/log_id.h>
 #include <log/logprint.h>
+#include <private/android_log_columnar.h>
 #include <private/android_logger.h>
 #include <processgroup/sched_policy.h>
 #include <system/thread_defs.h>
@@ -62,15 +69,27 @@ using android::base::ParseByteCount;
 using android::base::ParseUint;
 using android::base::Split;
 using android::base::StringPrintf;
+using android::base::WriteFully;
 
 class Logcat {
   public:
     int Run(int argc, char** argv);
 
   private:
+    friend class ParallelReader;
+
     void RotateLogs();
+    void OpenEventTagMap();
+    int DecodeBuffer(struct log_msg* buf, AndroidLogEntry* entry, char* binaryMsgBuf,
+                     size_t binaryMsgBufSize);
+    bool FilterEntry(const AndroidLogEntry& entry, bool* counted) const;
+    bool FormatBuffer(struct log_msg* buf, AndroidLogFormat* format, std::string* out,
+                      bool* counted);
+    AndroidLogFormat* NewLogFormat() const;
     void ProcessBuffer(struct log_msg* buf);
-    void PrintDividers(log_id_t log_id, bool print_dividers);
+    void ReadParallel(struct logger_list* logger_list, unsigned id_mask, bool print_dividers);
+    void WriteColumnar(struct log_msg* buf);
+    bool PrintDividers(log_id_t log_id, bool print_dividers);
     void SetupOutputAndSchedulingPolicy(bool blocking);
     int SetLogFormat(const char* format_string);
 
@@ -78,6 +97,7 @@ class Logcat {
     android::base::unique_fd output_fd_{dup(STDOUT_FILENO)};
     std::unique_ptr<AndroidLogFormat, decltype(&android_log_format_free)> logformat_{
             android_log_format_new(), &android_log_format_free};
+    std::vector<AndroidLogPrintFormat> print_formats_;  // as set on logformat_, in order
 
     // For logging to a file and log rotation
     const char* output_file_name_ = nullptr;
@@ -91,6 +111,15 @@ class Logcat {
             nullptr, &android_closeEventTagMap};
     bool has_opened_event_tag_map_ = false;
 
+    // For -B -v columnar, one writer per output file. Unless dumping, the
+    // pending block is also written out once it is a second old, so that a
+    // killed logcat does not lose a whole block.
+    bool columnar_ = false;
+    bool columnar_streaming_ = false;
+    uint64_t columnar_pending_since_ns_ = 0;  // CLOCK_MONOTONIC, 0 if none pending
+    std::unique_ptr<android_log_columnar_writer, decltype(&android_log_columnar_writer_free)>
+            columnar_writer_{nullptr, &android_log_columnar_writer_free};
+
     // For the related --regex, --max-count, --print
     std::unique_ptr<std::regex> regex_;
     size_t max_count_ = 0;  // 0 means "infinite"
@@ -101,9 +130,32 @@ class Logcat {
     log_id_t last_printed_id_ = LOG_ID_MAX;
     bool printed_start_[LOG_ID_MAX] = {};
 
+    // For --parallel
+    bool parallel_ = false;
+
     bool debug_ = false;
 };
 
+// Exits for a result of android_logger_list_read() other than an entry or -EAGAIN.
+static void ReadFailed(int ret) {
+    if (!ret) {
+        error(EXIT_FAILURE, 0, R"init(Unexpected EOF!
+
+This means that either the device shut down, logd crashed, or this instance of logcat was unable to read log
+messages as quickly as they were being produced.
+
+If you have enabled significant logging, look into using the -G option to increase log buffer sizes.)init");
+    }
+
+    if (ret == -EIO) {
+        error(EXIT_FAILURE, 0, "Unexpected EOF!");
+    }
+    if (ret == -EINVAL) {
+        error(EXIT_FAILURE, 0, "Unexpected length.");
+    }
+    error(EXIT_FAILURE, errno, "Logcat read failure");
+}
+
 #ifndef F2FS_IOC_SET_PIN_FILE
 #define F2FS_IOCTL_MAGIC       0xf5
 #define F2FS_IOC_SET_PIN_FILE _IOW(F2FS_IOCTL_MAGIC, 13, __u32)
@@ -138,6 +190,14 @@ void Logcat::RotateLogs() {
     // Can't rotate logs if we're not outputting to a file
     if (!output_file_name_) return;
 
+    if (columnar_writer_) {
+        ssize_t ret = android_log_columnar_writer_flush(columnar_writer_.get());
+        if (ret < 0) {
+            error(EXIT_FAILURE, -ret, "Output error.");
+        }
+        columnar_writer_.reset();
+        columnar_pending_since_ns_ = 0;
+    }
     output_fd_.reset();
 
     // Compute the maximum number of digits needed to count up to
@@ -182,41 +242,117 @@ void Logcat::RotateLogs() {
     out_byte_count_ = 0;
 }
 
+void Logcat::OpenEventTagMap() {
+    if (!event_tag_map_ && !has_opened_event_tag_map_) {
+        event_tag_map_.reset(android_openEventTagMap(nullptr));
+        has_opened_event_tag_map_ = true;
+    }
+}
+
+int Logcat::DecodeBuffer(struct log_msg* buf, AndroidLogEntry* entry, char* binaryMsgBuf,
+                         size_t binaryMsgBufSize) {
+    bool is_binary =
+            buf->id() == LOG_ID_EVENTS || buf->id() == LOG_ID_STATS || buf->id() == LOG_ID_SECURITY;
+
+    if (is_binary) {
+        OpenEventTagMap();
+        return android_log_processBinaryLogBuffer(&buf->entry, entry, event_tag_map_.get(),
+                                                  binaryMsgBuf, binaryMsgBufSize);
+    }
+    return android_log_processLogBuffer(&buf->entry, entry);
+}
+
+// Returns whether entry is to be printed, counted is set if it counts towards --max-count.
+bool Logcat::FilterEntry(const AndroidLogEntry& entry, bool* counted) const {
+    *counted = false;
+    if (!android_log_shouldPrintLine(logformat_.get(), std::string(entry.tag, entry.tagLen).c_str(),
+                                     entry.priority)) {
+        return false;
+    }
+    *counted = !regex_ || std::regex_search(entry.message, entry.message + entry.messageLen, *regex_);
+    return *counted || print_it_anyways_;
+}
+
+// Appends buf as ProcessBuffer() would print it to out, and sets counted to whether it counts
+// towards --max-count. Returns false if the line could not be formatted. Safe to call from
+// several threads as long as each has its own format, see NewLogFormat().
+bool Logcat::FormatBuffer(struct log_msg* buf, AndroidLogFormat* format, std::string* out,
+                          bool* counted) {
+    AndroidLogEntry entry;
+    char binaryMsgBuf[1024];
+
+    *counted = false;
+    int err = DecodeBuffer(buf, &entry, binaryMsgBuf, sizeof(binaryMsgBuf));
+    if (err < 0 && !debug_) return true;
+
+    if (!FilterEntry(entry, counted)) return true;
+
+    char defaultBuffer[512];
+    size_t len;
+    char* line =
+            android_log_formatLogLine(format, defaultBuffer, sizeof(defaultBuffer), &entry, &len);
+    if (!line) return false;
+    out->append(line, len);
+    if (line != defaultBuffer) free(line);
+    return true;
+}
+
+// android_log_formatLogLine() caches in its format, so threads each need their own.
+AndroidLogFormat* Logcat::NewLogFormat() const {
+    AndroidLogFormat* format = android_log_format_new();
+    for (auto print_format : print_formats_) {
+        android_log_setPrintFormat(format, print_format);
+    }
+    return format;
+}
+
 void Logcat::ProcessBuffer(struct log_msg* buf) {
     int bytesWritten = 0;
     int err;
     AndroidLogEntry entry;
     char binaryMsgBuf[1024];
 
-    bool is_binary =
-            buf->id() == LOG_ID_EVENTS || buf->id() == LOG_ID_STATS || buf->id() == LOG_ID_SECURITY;
+    err = DecodeBuffer(buf, &entry, binaryMsgBuf, sizeof(binaryMsgBuf));
+    if (err < 0 && !debug_) return;
 
-    if (is_binary) {
-        if (!event_tag_map_ && !has_opened_event_tag_map_) {
-            event_tag_map_.reset(android_openEventTagMap(nullptr));
-            has_opened_event_tag_map_ = true;
+    bool counted;
+    if (FilterEntry(entry, &counted)) {
+        bytesWritten = android_log_printLogLine(logformat_.get(), output_fd_.get(), &entry);
+
+        if (bytesWritten < 0) {
+            error(EXIT_FAILURE, 0, "Output error.");
         }
-        err = android_log_processBinaryLogBuffer(&buf->entry, &entry, event_tag_map_.get(),
-                                                 binaryMsgBuf, sizeof(binaryMsgBuf));
-        // printf(">>> pri=%d len=%d msg='%s'\n",
-        //    entry.priority, entry.messageLen, entry.message);
-    } else {
-        err = android_log_processLogBuffer(&buf->entry, &entry);
     }
-    if (err < 0 && !debug_) return;
+    print_count_ += counted;
 
-    if (android_log_shouldPrintLine(logformat_.get(), std::string(entry.tag, entry.tagLen).c_str(),
-                                    entry.priority)) {
-        bool match = !regex_ ||
-                     std::regex_search(entry.message, entry.message + entry.messageLen, *regex_);
+    out_byte_count_ += bytesWritten;
 
-        print_count_ += match;
-        if (match || print_it_anyways_) {
-            bytesWritten = android_log_printLogLine(logformat_.get(), output_fd_.get(), &entry);
+    if (log_rotate_size_kb_ > 0 && (out_byte_count_ / 1024) >= log_rotate_size_kb_) {
+        RotateLogs();
+    }
+}
 
+void Logcat::WriteColumnar(struct log_msg* buf) {
+    if (!columnar_writer_) {
+        columnar_writer_.reset(android_log_columnar_writer_alloc(output_fd_.get()));
+    }
+    ssize_t bytesWritten = android_log_columnar_writer_add(columnar_writer_.get(), buf);
+    if (bytesWritten < 0) {
+        error(EXIT_FAILURE, -bytesWritten, "Output error.");
+    }
+
+    if (columnar_streaming_) {
+        uint64_t now = log_time(CLOCK_MONOTONIC).nsec();
+        if (bytesWritten) {
+            columnar_pending_since_ns_ = 0;
+        } else if (!columnar_pending_since_ns_) {
+            columnar_pending_since_ns_ = now;
+        } else if (now - columnar_pending_since_ns_ >= NS_PER_SEC) {
+            bytesWritten = android_log_columnar_writer_flush(columnar_writer_.get());
             if (bytesWritten < 0) {
-                error(EXIT_FAILURE, 0, "Output error.");
+                error(EXIT_FAILURE, -bytesWritten, "Output error.");
             }
+            columnar_pending_since_ns_ = 0;
         }
     }
 
@@ -227,19 +363,362 @@ void Logcat::ProcessBuffer(struct log_msg* buf) {
     }
 }
 
-void Logcat::PrintDividers(log_id_t log_id, bool print_dividers) {
+// Returns false, with errno set, on output errors.
+bool Logcat::PrintDividers(log_id_t log_id, bool print_dividers) {
     if (log_id == last_printed_id_ || print_binary_) {
-        return;
+        return true;
     }
     if (!printed_start_[log_id] || print_dividers) {
         if (dprintf(output_fd_.get(), "--------- %s %s\n",
                     printed_start_[log_id] ? "switch to" : "beginning of",
                     android_log_id_to_name(log_id)) < 0) {
-            error(EXIT_FAILURE, errno, "Output error");
+            return false;
         }
     }
     last_printed_id_ = log_id;
     printed_start_[log_id] = true;
+    return true;
+}
+
+// For --parallel: one thread reads the entries, a worker per buffer decodes, filters and
+// formats them, and the caller takes them back in the order read. The workers' results are
+// merged on the sequence number that each entry was given when read.
+class ParallelReader {
+  public:
+    ParallelReader(Logcat* logcat, struct logger_list* logger_list, unsigned id_mask);
+    ~ParallelReader();
+
+    // Returns the next entry, blocking until it has been formatted, or false once all have
+    // been returned. text is only valid until the next call.
+    bool Next(log_id_t* id, const char** text, size_t* len, bool* counted);
+
+    // The last result of android_logger_list_read() and its errno, the id of an entry for
+    // an unexpected buffer, or whether formatting failed, once Next() has returned false.
+    int result() const { return result_; }
+    int result_errno() const { return result_errno_; }
+    int bad_id() const { return bad_id_; }
+    bool format_failed() const { return format_failed_; }
+
+  private:
+    // Raw entries back to back on the way in, formatted lines on the way out.
+    struct Batch {
+        struct Entry {
+            uint64_t sequence;
+            size_t offset;
+            size_t length;
+            bool counted;
+        };
+        std::vector<Entry> entries;
+        std::string data;
+    };
+
+    struct Worker {
+        std::thread thread;
+        std::condition_variable cv;
+        std::deque<std::unique_ptr<Batch>> in;
+        std::deque<std::unique_ptr<Batch>> out;
+
+        // Only used by Next()
+        std::unique_ptr<Batch> current;
+        size_t index = 0;
+    };
+
+    static constexpr size_t kBatchEntries = 256;
+    static constexpr uint64_t kMaxEntries = 64 * kBatchEntries;  // in flight, bounds the memory
+
+    void ReadThread();
+    bool WaitForSpace(uint64_t sequence, std::unique_ptr<Batch>* pending);
+    void FormatThread(log_id_t id);
+    void SubmitLocked(log_id_t id, std::unique_ptr<Batch> batch);
+    void Release(size_t entries);
+
+    Logcat* logcat_;
+    struct logger_list* logger_list_;
+    std::unique_ptr<Worker> workers_[LOG_ID_MAX];
+    std::thread reader_;
+
+    std::mutex lock_;
+    std::condition_variable out_cv_;    // the caller waits for output
+    std::condition_variable space_cv_;  // the reader waits for entries to be released
+    uint64_t released_ = 0;             // entries that Next() is done with
+    bool reading_ = true;
+    bool stopping_ = false;
+    uint64_t read_count_ = 0;  // final once !reading_
+
+    int result_ = 0;
+    int result_errno_ = 0;
+    int bad_id_ = -1;
+    bool format_failed_ = false;
+
+    // Only used by Next(), the heads of each worker's current batch
+    uint64_t next_sequence_ = 0;
+    log_id_t last_id_ = LOG_ID_MAX;
+    std::priority_queue<std::pair<uint64_t, log_id_t>, std::vector<std::pair<uint64_t, log_id_t>>,
+                        std::greater<std::pair<uint64_t, log_id_t>>>
+            heads_;
+};
+
+ParallelReader::ParallelReader(Logcat* logcat, struct logger_list* logger_list, unsigned id_mask)
+    : logcat_(logcat), logger_list_(logger_list) {
+    for (int i = LOG_ID_MIN; i < LOG_ID_MAX; ++i) {
+        if (!(id_mask & (1 << i))) continue;
+        workers_[i].reset(new Worker);
+        workers_[i]->thread = std::thread(&ParallelReader::FormatThread, this, static_cast<log_id_t>(i));
+    }
+    reader_ = std::thread(&ParallelReader::ReadThread, this);
+}
+
+ParallelReader::~ParallelReader() {
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        stopping_ = true;
+    }
+    space_cv_.notify_all();
+    for (auto& worker : workers_) {
+        if (worker) worker->cv.notify_all();
+    }
+    // Reads do not block, so the reader ends with the dump at the latest.
+    reader_.join();
+    for (auto& worker : workers_) {
+        if (worker) worker->thread.join();
+    }
+}
+
+void ParallelReader::SubmitLocked(log_id_t id, std::unique_ptr<Batch> batch) {
+    workers_[id]->in.emplace_back(std::move(batch));
+    workers_[id]->cv.notify_one();
+}
+
+// Waits until fewer than kMaxEntries of the entries read are in flight. Next() can only
+// release them in order, and the one it needs may still be in a partial batch of any buffer,
+// so all of those are handed over before waiting. Returns false once stopping.
+bool ParallelReader::WaitForSpace(uint64_t sequence, std::unique_ptr<Batch>* pending) {
+    std::unique_lock<std::mutex> lock(lock_);
+    auto space = [&] { return sequence - released_ < kMaxEntries || stopping_; };
+    if (!space()) {
+        for (int i = LOG_ID_MIN; i < LOG_ID_MAX; ++i) {
+            if (pending[i]) SubmitLocked(static_cast<log_id_t>(i), std::move(pending[i]));
+        }
+        space_cv_.wait(lock, space);
+    }
+    return !stopping_;
+}
+
+void ParallelReader::ReadThread() {
+    std::unique_ptr<Batch> pending[LOG_ID_MAX];
+    uint64_t sequence = 0;
+    int ret = 0;
+    int bad_id = -1;
+
+    while (WaitForSpace(sequence, pending)) {
+        struct log_msg log_msg;
+        ret = android_logger_list_read(logger_list_, &log_msg);
+        if (ret <= 0) break;
+
+        log_id_t id = log_msg.id();
+        if (id >= LOG_ID_MAX || !workers_[id]) {
+            bad_id = id;
+            break;
+        }
+
+        if (!pending[id]) pending[id].reset(new Batch);
+        Batch* batch = pending[id].get();
+        batch->entries.push_back({sequence++, batch->data.size(), log_msg.len(), false});
+        batch->data.append(reinterpret_cast<const char*>(&log_msg), log_msg.len());
+        if (batch->entries.size() >= kBatchEntries) {
+            std::lock_guard<std::mutex> lock(lock_);
+            SubmitLocked(id, std::move(pending[id]));
+        }
+    }
+    int saved_errno = errno;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    for (int i = LOG_ID_MIN; i < LOG_ID_MAX; ++i) {
+        if (pending[i]) SubmitLocked(static_cast<log_id_t>(i), std::move(pending[i]));
+    }
+    reading_ = false;
+    read_count_ = sequence;
+    result_ = ret;
+    result_errno_ = saved_errno;
+    bad_id_ = bad_id;
+    out_cv_.notify_one();
+    for (auto& worker : workers_) {
+        if (worker) worker->cv.notify_one();
+    }
+}
+
+void ParallelReader::FormatThread(log_id_t id) {
+    std::unique_ptr<AndroidLogFormat, decltype(&android_log_format_free)> format{
+            logcat_->NewLogFormat(), &android_log_format_free};
+    Worker* worker = workers_[id].get();
+
+    while (true) {
+        std::unique_ptr<Batch> in;
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            worker->cv.wait(lock,
+                            [&] { return !worker->in.empty() || !reading_ || stopping_; });
+            if (stopping_ || worker->in.empty()) return;
+            in = std::move(worker->in.front());
+            worker->in.pop_front();
+        }
+
+        std::unique_ptr<Batch> out(new Batch);
+        out->entries.reserve(in->entries.size());
+        for (const auto& entry : in->entries) {
+            struct log_msg log_msg;
+            memcpy(&log_msg, in->data.data() + entry.offset, entry.length);
+            size_t offset = out->data.size();
+            bool counted;
+            if (!logcat_->FormatBuffer(&log_msg, format.get(), &out->data, &counted)) {
+                // Stop everything, the caller reports the error once the threads are gone.
+                std::lock_guard<std::mutex> lock(lock_);
+                format_failed_ = true;
+                stopping_ = true;
+                space_cv_.notify_all();
+                out_cv_.notify_one();
+                for (auto& other : workers_) {
+                    if (other) other->cv.notify_all();
+                }
+                return;
+            }
+            out->entries.push_back({entry.sequence, offset, out->data.size() - offset, counted});
+        }
+
+        std::lock_guard<std::mutex> lock(lock_);
+        worker->out.emplace_back(std::move(out));
+        out_cv_.notify_one();
+    }
+}
+
+void ParallelReader::Release(size_t entries) {
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        released_ += entries;
+    }
+    space_cv_.notify_one();
+}
+
+bool ParallelReader::Next(log_id_t* id, const char** text, size_t* len, bool* counted) {
+    // Done with the entry returned last, move that worker on to its next one.
+    if (last_id_ != LOG_ID_MAX) {
+        Worker* worker = workers_[last_id_].get();
+        if (++worker->index < worker->current->entries.size()) {
+            heads_.emplace(worker->current->entries[worker->index].sequence, last_id_);
+        } else {
+            Release(worker->current->entries.size());
+            worker->current.reset();
+        }
+        last_id_ = LOG_ID_MAX;
+    }
+
+    // Unless already at the head of a current batch, the next entry is at the start of a
+    // worker's next batch.
+    while (heads_.empty() || heads_.top().first != next_sequence_) {
+        std::unique_lock<std::mutex> lock(lock_);
+        auto ready = [this] {
+            if (format_failed_) return true;
+            if (!reading_ && next_sequence_ == read_count_) return true;
+            for (auto& worker : workers_) {
+                if (worker && !worker->current && !worker->out.empty()) return true;
+            }
+            return false;
+        };
+        out_cv_.wait(lock, ready);
+        if (format_failed_) return false;
+        if (!reading_ && next_sequence_ == read_count_) return false;
+        for (int i = LOG_ID_MIN; i < LOG_ID_MAX; ++i) {
+            Worker* worker = workers_[i].get();
+            if (!worker || worker->current || worker->out.empty()) continue;
+            worker->current = std::move(worker->out.front());
+            worker->out.pop_front();
+            worker->index = 0;
+            heads_.emplace(worker->current->entries[0].sequence, static_cast<log_id_t>(i));
+        }
+    }
+
+    last_id_ = heads_.top().second;
+    heads_.pop();
+    ++next_sequence_;
+
+    Worker* worker = workers_[last_id_].get();
+    const auto& entry = worker->current->entries[worker->index];
+    *id = last_id_;
+    *text = worker->current->data.data() + entry.offset;
+    *len = entry.length;
+    *counted = entry.counted;
+    return true;
+}
+
+void Logcat::ReadParallel(struct logger_list* logger_list, unsigned id_mask,
+                          bool print_dividers) {
+    if (id_mask & ((1 << LOG_ID_EVENTS) | (1 << LOG_ID_STATS) | (1 << LOG_ID_SECURITY))) {
+        OpenEventTagMap();
+    }
+
+    // Errors are only reported once the reader's threads are gone, exiting under them is not
+    // safe.
+    std::string pending;
+    int output_errno = 0;
+    auto flush = [&] {
+        if (!output_errno && !WriteFully(output_fd_, pending.data(), pending.size())) {
+            output_errno = errno;
+        }
+        pending.clear();
+        return !output_errno;
+    };
+
+    int result, result_errno, bad_id;
+    bool format_failed;
+    {
+        ParallelReader reader(this, logger_list, id_mask);
+        log_id_t id;
+        const char* text;
+        size_t len;
+        bool counted;
+        while ((!max_count_ || print_count_ < max_count_) &&
+               reader.Next(&id, &text, &len, &counted)) {
+            if (id != last_printed_id_) {
+                if (!flush()) break;
+                if (!PrintDividers(id, print_dividers)) {
+                    output_errno = errno;
+                    break;
+                }
+            }
+            pending.append(text, len);
+            print_count_ += counted;
+            out_byte_count_ += len;
+
+            if (log_rotate_size_kb_ > 0 && (out_byte_count_ / 1024) >= log_rotate_size_kb_) {
+                if (!flush()) break;
+                RotateLogs();
+            } else if (pending.size() >= 65536) {
+                if (!flush()) break;
+            }
+        }
+        flush();
+
+        result = reader.result();
+        result_errno = reader.result_errno();
+        bad_id = reader.bad_id();
+        format_failed = reader.format_failed();
+    }
+
+    if (output_errno) {
+        error(EXIT_FAILURE, output_errno, "Output error.");
+    }
+    if (max_count_ && print_count_ >= max_count_) return;
+    if (format_failed) {
+        error(EXIT_FAILURE, 0, "Output error.");
+    }
+    if (bad_id >= 0) {
+        error(EXIT_FAILURE, 0, "Unexpected log id (%d) over LOG_ID_MAX (%d).", bad_id,
+              LOG_ID_MAX);
+    }
+    if (result != -EAGAIN) {
+        errno = result_errno;
+        ReadFailed(result);
+    }
 }
 
 void Logcat::SetupOutputAndSchedulingPolicy(bool blocking) {
@@ -301,6 +780,8 @@ General options:
                               log files instead.
                               if -L is specified, clear pstore log instead.
   -d                          Dump the log and then exit (don't block).
+  --parallel                  With -d or -t, decode and format each buffer on its own thread.
+                              The output is the same, in the same order.
   --pid=<pid>                 Only print logs from the given pid.
   --wrap                      Sleep for 2 hours or when buffer about to wrap whichever
                               comes first. Improves efficiency of polling by providing
@@ -314,7 +795,8 @@ Formatting:
                               Multiple -v parameters or comma separated list of format and format
                               modifiers are allowed.
   -D, --dividers              Print dividers between each log buffer.
-  -B, --binary                Output the log in binary.
+  -B, --binary                Output the log in binary. With -v columnar, as compressed
+                              column blocks indexed by time and tag.
 
 Outfile files:
   -f, --file=<file>           Log to file instead of stdout.
@@ -384,6 +866,7 @@ static void show_format_help() {
         "    brief long process raw tag thread threadtime time\n"
         "  and individually flagged modifying adverbs can be added:\n"
         "    color descriptive epoch monotonic printable uid usec UTC year zone\n"
+        "  or columnar, with -B.\n"
         "\nSingle format verbs:\n"
         "  brief      — Display priority/tag and PID of the process issuing the message.\n"
         "  long       — Display all metadata fields, separate messages with blank lines.\n"
@@ -395,6 +878,8 @@ static void show_format_help() {
         "               and TID of the thread issuing the message. (the default format).\n"
         "  time       — Display the date, invocation time, priority/tag, and PID of the\n"
         "             process issuing the message.\n"
+        "  columnar   — Binary output as compressed blocks of columns, each indexed by time\n"
+        "               range and tag set, see private/android_log_columnar.h. Requires -B.\n"
         "\nAdverb modifiers can be used in combination:\n"
         "  color       — Display in highlighted color to match priority. i.e. \x1B[38;5;231mVERBOSE\n"
         "                \x1B[38;5;75mDEBUG \x1B[38;5;40mINFO \x1B[38;5;166mWARNING \x1B[38;5;196mERROR FATAL\x1B[0m\n"
@@ -418,6 +903,7 @@ int Logcat::SetLogFormat(const char* format_string) {
     // invalid string?
     if (format == FORMAT_OFF) return -1;
 
+    print_formats_.push_back(format);
     return android_log_setPrintFormat(logformat_.get(), format);
 }
 
@@ -529,6 +1015,8 @@ int Logcat::Run(int argc, char** argv) {
     const char* setId = nullptr;
     int mode = ANDROID_LOG_RDONLY;
     std::string forceFilters;
+    // The same filterspecs, in order, for logd to apply before sending.
+    std::string pushdownFilters;
     size_t tail_lines = 0;
     log_time tail_time(log_time::EPOCH);
     size_t pid = 0;
@@ -553,6 +1041,7 @@ int Logcat::Run(int argc, char** argv) {
         static const char id_str[] = "id";
         static const char wrap_str[] = "wrap";
         static const char print_str[] = "print";
+        static const char parallel_str[] = "parallel";
         // clang-format off
         static const struct option long_options[] = {
           { "binary",        no_argument,       nullptr, 'B' },
@@ -571,6 +1060,7 @@ int Logcat::Run(int argc, char** argv) {
           { id_str,          required_argument, nullptr, 0 },
           { "last",          no_argument,       nullptr, 'L' },
           { "max-count",     required_argument, nullptr, 'm' },
+          { parallel_str,    no_argument,       nullptr, 0 },
           { pid_str,         required_argument, nullptr, 0 },
           { print_str,       no_argument,       nullptr, 0 },
           { "prune",         optional_argument, nullptr, 'p' },
@@ -624,6 +1114,10 @@ int Logcat::Run(int argc, char** argv) {
                     print_it_anyways_ = true;
                     break;
                 }
+                if (long_options[option_index].name == parallel_str) {
+                    parallel_ = true;
+                    break;
+                }
                 if (long_options[option_index].name == debug_str) {
                     debug_ = true;
                     break;
@@ -636,6 +1130,7 @@ int Logcat::Run(int argc, char** argv) {
             case 's':
                 // default to all silent
                 android_log_addFilterRule(logformat_.get(), "*:s");
+                pushdownFilters += " *:s";
                 break;
 
             case 'c':
@@ -766,6 +1261,10 @@ int Logcat::Run(int argc, char** argv) {
                     return EXIT_SUCCESS;
                 }
                 for (const auto& arg : Split(optarg, delimiters)) {
+                    if (arg == "columnar") {
+                        columnar_ = true;
+                        continue;
+                    }
                     int err = SetLogFormat(arg.c_str());
                     if (err < 0) {
                         error(EXIT_FAILURE, 0, "Invalid parameter '%s' to -v.", arg.c_str());
@@ -942,6 +1441,7 @@ int Logcat::Run(int argc, char** argv) {
         if (err < 0) {
             error(EXIT_FAILURE, 0, "Invalid filter expression in logcat args.");
         }
+        pushdownFilters += " " + forceFilters;
     } else if (argc == optind) {
         // Add from environment variable
         const char* env_tags_orig = getenv("ANDROID_LOG_TAGS");
@@ -952,6 +1452,7 @@ int Logcat::Run(int argc, char** argv) {
             if (err < 0) {
                 error(EXIT_FAILURE, 0, "Invalid filter expression in ANDROID_LOG_TAGS.");
             }
+            pushdownFilters += " " + std::string(env_tags_orig);
         }
     } else {
         // Add from commandline
@@ -960,9 +1461,19 @@ int Logcat::Run(int argc, char** argv) {
             if (err < 0) {
                 error(EXIT_FAILURE, 0, "Invalid filter expression '%s'.", argv[i]);
             }
+            pushdownFilters += " " + std::string(argv[i]);
         }
     }
 
+    if (columnar_ && !print_binary_) {
+        error(EXIT_FAILURE, 0, "-v columnar requires -B.");
+    }
+    columnar_streaming_ = columnar_ && !(mode & ANDROID_LOG_NONBLOCK);
+
+    if (parallel_ && (!(mode & ANDROID_LOG_NONBLOCK) || print_binary_)) {
+        error(EXIT_FAILURE, 0, "--parallel requires -d or -t, and is incompatible with -B.");
+    }
+
     if (mode & ANDROID_LOG_PSTORE) {
         if (output_file_name_) {
             error(EXIT_FAILURE, 0, "-c is ambiguous with both -f and -L specified.");
@@ -1015,6 +1526,12 @@ int Logcat::Run(int argc, char** argv) {
     } else {
         logger_list.reset(android_logger_list_alloc(mode, tail_lines, pid));
     }
+    // Best effort, entries are still filtered here when logd can not. Binary
+    // output (-B, -v columnar) never applied the filters, so it must not have
+    // logd drop entries either.
+    if (!pushdownFilters.empty() && !print_binary_) {
+        android_logger_list_set_filter(logger_list.get(), pushdownFilters.c_str());
+    }
     // We have three orthogonal actions below to clear, set log size and
     // get log size. All sharing the same iteration loop.
     std::vector<std::string> open_device_failures;
@@ -1137,43 +1654,42 @@ int Logcat::Run(int argc, char** argv) {
 
     SetupOutputAndSchedulingPolicy(!(mode & ANDROID_LOG_NONBLOCK));
 
+    // liblog's conversion to monotonic time is not thread safe, fall back to reading serially.
+    if (parallel_ && std::find(print_formats_.begin(), print_formats_.end(),
+                               FORMAT_MODIFIER_MONOTONIC) == print_formats_.end()) {
+        ReadParallel(logger_list.get(), id_mask, printDividers);
+        return EXIT_SUCCESS;
+    }
+
     while (!max_count_ || print_count_ < max_count_) {
         struct log_msg log_msg;
         int ret = android_logger_list_read(logger_list.get(), &log_msg);
-        if (!ret) {
-            error(EXIT_FAILURE, 0, R"init(Unexpected EOF!
-
-This means that either the device shut down, logd crashed, or this instance of logcat was unable to read log
-messages as quickly as they were being produced.
-
-If you have enabled significant logging, look into using the -G option to increase log buffer sizes.)init");
-        }
-
-        if (ret < 0) {
-            if (ret == -EAGAIN) break;
-
-            if (ret == -EIO) {
-                error(EXIT_FAILURE, 0, "Unexpected EOF!");
-            }
-            if (ret == -EINVAL) {
-                error(EXIT_FAILURE, 0, "Unexpected length.");
-            }
-            error(EXIT_FAILURE, errno, "Logcat read failure");
-        }
+        if (ret == -EAGAIN) break;
+        if (ret <= 0) ReadFailed(ret);
 
         if (log_msg.id() > LOG_ID_MAX) {
             error(EXIT_FAILURE, 0, "Unexpected log id (%d) over LOG_ID_MAX (%d).", log_msg.id(),
                   LOG_ID_MAX);
         }
 
-        PrintDividers(log_msg.id(), printDividers);
+        if (!PrintDividers(log_msg.id(), printDividers)) {
+            error(EXIT_FAILURE, errno, "Output error");
+        }
 
-        if (print_binary_) {
+        if (columnar_) {
+            WriteColumnar(&log_msg);
+        } else if (print_binary_) {
             TEMP_FAILURE_RETRY(write(output_fd_.get(), &log_msg, log_msg.len()));
         } else {
             ProcessBuffer(&log_msg);
         }
     }
+    if (columnar_writer_) {
+        ssize_t ret = android_log_columnar_writer_flush(columnar_writer_.get());
+        if (ret < 0) {
+            error(EXIT_FAILURE, -ret, "Output error.");
+        }
+    }
     return EXIT_SUCCESS;
 }
 
@@ -17,8 +17,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <benchmark/benchmark.h>
+#include <log/logprint.h>
 
 static const char begin[] = "--------- beginning of ";
 
@@ -130,4 +132,81 @@ static void BM_logcat_sorted_order(benchmark::State& state) {
 }
 BENCHMARK(BM_logcat_sorted_order);
 
+static AndroidLogEntry make_entry(const char* message) {
+    AndroidLogEntry entry = {};
+    entry.tv_sec = 1577836800;
+    entry.tv_nsec = 123456789;
+    entry.priority = ANDROID_LOG_INFO;
+    entry.uid = 1000;
+    entry.pid = 1234;
+    entry.tid = 5678;
+    entry.tag = "ActivityManager";
+    entry.tagLen = strlen(entry.tag);
+    entry.message = message;
+    entry.messageLen = strlen(message);
+    return entry;
+}
+
+static const char* const messages[] = {
+    "Start proc 1234:com.android.settings/1000 for activity "
+    "{com.android.settings/com.android.settings.Settings}",
+    "Displayed com.android.settings/.Settings: +412ms caf\xc3\xa9 \xe2\x82\xac"
+    " tab\tseparated",
+    "first line of a stack\n    at com.example.Foo.bar(Foo.java:42)\n"
+    "    at com.example.Foo.baz(Foo.java:17)\n",
+};
+
+// Measures android_log_formatLogLine(), the per entry cost of logcat's
+// output. Arg selects the message above, a plain line, printable output of
+// a line with UTF-8 and escapes, or a multi line message.
+static void BM_logcat_format(benchmark::State& state) {
+    AndroidLogFormat* format = android_log_format_new();
+    android_log_setPrintFormat(format, FORMAT_THREADTIME);
+    if (state.range(0) == 1) {
+        android_log_setPrintFormat(format, FORMAT_MODIFIER_PRINTABLE);
+    }
+    AndroidLogEntry entry = make_entry(messages[state.range(0)]);
+
+    char buffer[1024];
+    size_t total = 0;
+    while (state.KeepRunning()) {
+        ++entry.tv_nsec;  // a new line, within the same second
+        size_t len;
+        char* line = android_log_formatLogLine(format, buffer, sizeof(buffer),
+                                               &entry, &len);
+        benchmark::DoNotOptimize(line);
+        total += len;
+        if (line != buffer) free(line);
+    }
+    state.SetBytesProcessed(total);
+    android_log_format_free(format);
+}
+BENCHMARK(BM_logcat_format)->Arg(0)->Arg(1)->Arg(2);
+
+// The same threadtime line put together with snprintf() and localtime_r()
+// for every entry, as android_log_formatLogLine() used to, for comparison.
+static void BM_logcat_format_snprintf(benchmark::State& state) {
+    AndroidLogEntry entry = make_entry(messages[0]);
+
+    char buffer[1024];
+    size_t total = 0;
+    while (state.KeepRunning()) {
+        ++entry.tv_nsec;
+        time_t now = entry.tv_sec;
+        struct tm tm;
+        char date[64];
+        strftime(date, sizeof(date), "%m-%d %H:%M:%S",
+                 localtime_r(&now, &tm));
+        int len = snprintf(buffer, sizeof(buffer),
+                           "%s.%03ld %5d %5d %c %-8.*s: %.*s\n", date,
+                           entry.tv_nsec / 1000000, entry.pid, entry.tid, 'I',
+                           (int)entry.tagLen, entry.tag,
+                           (int)entry.messageLen, entry.message);
+        benchmark::DoNotOptimize(buffer);
+        total += len;
+    }
+    state.SetBytesProcessed(total);
+}
+BENCHMARK(BM_logcat_format_snprintf);
+
 BENCHMARK_MAIN();
@@ -147,6 +147,30 @@ TEST(logcat, event_tag_filter) {
     EXPECT_EQ(count % 3, 0);
 }
 
+TEST(logcat, binary_ignores_filter) {
+    FILE* fp;
+
+    // Binary output is not tag filtered, nor may logd filter it on our behalf.
+    __android_log_write(ANDROID_LOG_ERROR, "inject.binary", logcat_executable);
+    rest();
+
+    std::string command = android::base::StringPrintf(
+        logcat_executable " -b main --pid=%d -d -B -s inject.filter 2>/dev/null",
+        getpid());
+    ASSERT_TRUE(NULL != (fp = popen(command.c_str(), "r")));
+
+    std::string output;
+    char buffer[BIG_BUFFER];
+    size_t len;
+    while ((len = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        output.append(buffer, len);
+    }
+
+    pclose(fp);
+
+    EXPECT_NE(std::string::npos, output.find("inject.binary"));
+}
+
 // If there is not enough background noise in the logs, then spam the logs to
 // permit tail checking so that the tests can progress.
 static size_t inject(ssize_t count) {
@@ -1530,6 +1554,76 @@ static bool End_to_End(const char* tag, const char* fmt, ...) {
     return count && (count <= 3);
 }
 
+TEST(logcat, parallel) {
+    for (int i = 0; i < 100; ++i) {
+        LOG_FAILURE_RETRY(__android_log_print(ANDROID_LOG_WARN, "logcat_test",
+                                              "logcat_test parallel %d", i));
+        LOG_FAILURE_RETRY(__android_log_buf_print(LOG_ID_SYSTEM, ANDROID_LOG_WARN, "logcat_test",
+                                                  "logcat_test parallel %d", i));
+    }
+
+    rest();
+
+    // Nothing else logs with our pid, so both see the same entries.
+    auto dump = [](const char* options) {
+        char command[BIG_BUFFER];
+        snprintf(command, sizeof(command), logcat_executable " --pid %d -d -b main,system %s",
+                 getpid(), options);
+        FILE* fp = popen(command, "r");
+        std::string output;
+        if (fp) {
+            android::base::ReadFdToString(fileno(fp), &output);
+            pclose(fp);
+        }
+        return output;
+    };
+    std::string serial = dump("");
+    EXPECT_NE(std::string::npos, serial.find("logcat_test parallel 99"));
+    EXPECT_EQ(serial, dump("--parallel"));
+    EXPECT_EQ(dump("-m 10"), dump("--parallel -m 10"));
+
+    EXPECT_NE(0, system(logcat_executable " --parallel -b main -t 1 -B >/dev/null 2>&1"));
+}
+
+TEST(logcat, parallel_unbalanced) {
+    // A short system batch followed by far more main entries than the reader
+    // keeps in flight; the system batch must not stall the output.
+    static const int kEntries = 20000;
+    for (int i = 0; i < 5; ++i) {
+        LOG_FAILURE_RETRY(__android_log_buf_print(LOG_ID_SYSTEM, ANDROID_LOG_WARN, "logcat_test",
+                                                  "unbalanced %d", i));
+    }
+    for (int i = 0; i < kEntries; ++i) {
+        LOG_FAILURE_RETRY(
+                __android_log_print(ANDROID_LOG_WARN, "logcat_test", "unbalanced %d", i));
+    }
+
+    rest();
+
+    auto dump = [](const char* options) {
+        char command[BIG_BUFFER];
+        snprintf(command, sizeof(command),
+                 "timeout 60 " logcat_executable " --pid %d -d -b main,system %s", getpid(),
+                 options);
+        FILE* fp = popen(command, "r");
+        std::string output;
+        if (fp) {
+            android::base::ReadFdToString(fileno(fp), &output);
+            EXPECT_EQ(0, pclose(fp)) << options;
+        }
+        return output;
+    };
+    std::string serial = dump("");
+    EXPECT_NE(std::string::npos,
+              serial.find(android::base::StringPrintf("unbalanced %d", kEntries - 1)));
+    EXPECT_EQ(serial, dump("--parallel"));
+}
+
+TEST(logcat, columnar_requires_binary) {
+    EXPECT_NE(0, system(logcat_executable " -v columnar -d -t 1 >/dev/null 2>&1"));
+    EXPECT_EQ(0, system(logcat_executable " -B -v columnar -d -t 1 >/dev/null 2>&1"));
+}
+
 TEST(logcat, descriptive) {
     struct tag {
         uint32_t tagNo;
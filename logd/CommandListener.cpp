@@ -39,7 +39,7 @@
 #include "LogUtils.h"
 
 CommandListener::CommandListener(LogBuffer* buf, LogReader* /*reader*/,
-                                 LogListener* /*swl*/)
+                                 LogListener* swl, LogRingListener* rings)
     : FrameworkListener(getLogSocket()) {
     // registerCmd(new ShutdownCmd(buf, writer, swl));
     registerCmd(new ClearCmd(buf));
@@ -47,6 +47,7 @@ CommandListener::CommandListener(LogBuffer* buf, LogReader* /*reader*/,
     registerCmd(new SetBufSizeCmd(buf));
     registerCmd(new GetBufSizeUsedCmd(buf));
     registerCmd(new GetStatisticsCmd(buf));
+    registerCmd(new GetListenerStatisticsCmd(swl, rings));
     registerCmd(new SetPruneListCmd(buf));
     registerCmd(new GetPruneListCmd(buf));
     registerCmd(new GetEventTagCmd(buf));
@@ -245,6 +246,21 @@ int CommandListener::GetStatisticsCmd::runCommand(SocketClient* cli, int argc,
     return 0;
 }
 
+CommandListener::GetListenerStatisticsCmd::GetListenerStatisticsCmd(
+    LogListener* swl, LogRingListener* rings)
+    : LogCommand("getListenerStatistics"), mSwl(*swl), mRings(*rings) {
+}
+
+int CommandListener::GetListenerStatisticsCmd::runCommand(SocketClient* cli,
+                                                          int /*argc*/,
+                                                          char** /*argv*/) {
+    setname();
+    cli->sendMsg(
+        PackageString(mSwl.formatStatistics() + mRings.formatStatistics())
+            .c_str());
+    return 0;
+}
+
 CommandListener::GetPruneListCmd::GetPruneListCmd(LogBuffer* buf)
     : LogCommand("getPruneList"), mBuf(*buf) {
 }
@@ -22,13 +22,15 @@
 #include "LogCommand.h"
 #include "LogListener.h"
 #include "LogReader.h"
+#include "LogRingListener.h"
 
 // See main.cpp for implementation
 void reinit_signal_handler(int /*signal*/);
 
 class CommandListener : public FrameworkListener {
    public:
-    CommandListener(LogBuffer* buf, LogReader* reader, LogListener* swl);
+    CommandListener(LogBuffer* buf, LogReader* reader, LogListener* swl,
+                    LogRingListener* rings);
     virtual ~CommandListener() {
     }
 
@@ -66,6 +68,17 @@ class CommandListener : public FrameworkListener {
     LogBufferCmd(SetPruneList);
     LogBufferCmd(GetEventTag);
 
+    class GetListenerStatisticsCmd : public LogCommand {
+        LogListener& mSwl;
+        LogRingListener& mRings;
+
+       public:
+        GetListenerStatisticsCmd(LogListener* swl, LogRingListener* rings);
+        virtual ~GetListenerStatisticsCmd() {
+        }
+        int runCommand(SocketClient* c, int argc, char** argv);
+    };
+
 #define LogCmd(name)                                            \
     class name##Cmd : public LogCommand {                       \
        public:                                                  \
@@ -196,8 +196,9 @@ static enum match_type identical(LogBufferElement* elem,
     return SAME;
 }
 
-int LogBuffer::log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
-                   pid_t tid, const char* msg, uint16_t len) {
+int LogBuffer::prepareLog(log_id_t log_id, log_time realtime, uid_t uid,
+                          pid_t pid, pid_t tid, const char* msg, uint16_t len,
+                          PendingLog* pending) {
     if (log_id >= LOG_ID_MAX) {
         return -EINVAL;
     }
@@ -208,14 +209,11 @@ int LogBuffer::log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
     if ((realtime.tv_nsec % 1000) == 0) ++realtime.tv_nsec;
 
     LogBufferElement* elem = new LogBufferElement(log_id, realtime, uid, pid, tid, msg, len);
+    *pending = {log_id, realtime, uid, pid, tid, msg, len, true, elem};
 
-    // b/137093665: don't coalesce security messages.
+    // Security messages are never filtered.
     if (log_id == LOG_ID_SECURITY) {
-        wrlock();
-        log(elem);
-        unlock();
-
-        return len;
+        return 0;
     }
 
     int prio = ANDROID_LOG_INFO;
@@ -231,16 +229,30 @@ int LogBuffer::log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
         tag = msg + 1;
         tag_len = strnlen(tag, len - 1);
     }
-    if (!__android_log_is_loggable_len(prio, tag, tag_len, ANDROID_LOG_VERBOSE)) {
+    pending->loggable = __android_log_is_loggable_len(prio, tag, tag_len, ANDROID_LOG_VERBOSE);
+    return 0;
+}
+
+// assumes LogBuffer::wrlock() held
+int LogBuffer::commitLocked(PendingLog* pending) {
+    log_id_t log_id = pending->log_id;
+    uint16_t len = pending->len;
+    LogBufferElement* elem = pending->elem;
+    pending->elem = nullptr;
+
+    if (!pending->loggable) {
         // Log traffic received to total
-        wrlock();
         stats.addTotal(elem);
-        unlock();
         delete elem;
         return -EACCES;
     }
 
-    wrlock();
+    // b/137093665: don't coalesce security messages.
+    if (log_id == LOG_ID_SECURITY) {
+        log(elem);
+        return len;
+    }
+
     LogBufferElement* currentLast = lastLoggedElements[log_id];
     if (currentLast) {
         LogBufferElement* dropped = droppedElements[log_id];
@@ -341,14 +353,12 @@ int LogBuffer::log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
                     // check for overflow
                     if (total >= UINT32_MAX) {
                         log(currentLast);
-                        unlock();
                         return len;
                     }
                     stats.addTotal(currentLast);
                     delete currentLast;
                     swab = total;
                     event->payload.data = htole32(swab);
-                    unlock();
                     return len;
                 }
                 if (count == USHRT_MAX) {
@@ -365,7 +375,6 @@ int LogBuffer::log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
             }
             droppedElements[log_id] = currentLast;
             lastLoggedElements[log_id] = elem;
-            unlock();
             return len;
         }
         if (dropped) {         // State 1 or 2
@@ -383,7 +392,6 @@ int LogBuffer::log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
     lastLoggedElements[log_id] = new LogBufferElement(*elem);
 
     log(elem);
-    unlock();
 
     return len;
 }
@@ -501,6 +509,19 @@ LogBufferElementCollection::iterator LogBuffer::erase(
         }
     }
 
+    // Readers resume after this element's predecessor instead, prune()
+    // holds LogTimeEntry::rdlock() for us.
+    for (const auto& entry : mTimes) {
+        LogReaderCursor& cursor = entry->mCursor;
+        if (cursor.set && !cursor.beforeBegin && (cursor.last == it)) {
+            if (it == mLogElements.begin()) {
+                cursor.beforeBegin = true;
+            } else {
+                cursor.last = std::prev(it);
+            }
+        }
+    }
+
     bool setLast[LOG_ID_MAX];
     bool doSetLast = false;
     log_id_for_each(i) {
@@ -1115,13 +1136,35 @@ log_time LogBuffer::flushTo(SocketClient* reader, const log_time& start,
                             pid_t* lastTid, bool privileged, bool security,
                             int (*filter)(const LogBufferElement* element,
                                           void* arg),
-                            void* arg) {
+                            void* arg, LogReaderCursor* cursor,
+                            AndroidLogFormat* format) {
     LogBufferElementCollection::iterator it;
     uid_t uid = reader->getUid();
 
+    // With a cursor, always step from where it was left as erase() moves it
+    // back should its element be pruned while we are unlocked below.
+    auto next = [this, cursor](LogBufferElementCollection::iterator it) {
+        if (!cursor) {
+            return ++it;
+        }
+        return cursor->beforeBegin ? mLogElements.begin()
+                                   : std::next(cursor->last);
+    };
+    // Only step the cursor over elements that were dealt with, the next
+    // pass resumes with the one we broke out on.
+    auto handled = [cursor](LogBufferElementCollection::iterator it) {
+        if (cursor) {
+            cursor->last = it;
+            cursor->set = true;
+            cursor->beforeBegin = false;
+        }
+    };
+
     rdlock();
 
-    if (start == log_time::EPOCH) {
+    if (cursor && cursor->set) {
+        it = next(mLogElements.end());
+    } else if (start == log_time::EPOCH) {
         // client wants to start from the beginning
         it = mLogElements.begin();
     } else {
@@ -1152,7 +1195,7 @@ log_time LogBuffer::flushTo(SocketClient* reader, const log_time& start,
     LogBufferElement* lastElement = nullptr;  // iterator corruption paranoia
     static const size_t maxSkip = 4194304;    // maximum entries to skip
     size_t skip = maxSkip;
-    for (; it != mLogElements.end(); ++it) {
+    for (; it != mLogElements.end(); it = next(it)) {
         LogBufferElement* element = *it;
 
         if (!--skip) {
@@ -1161,27 +1204,26 @@ log_time LogBuffer::flushTo(SocketClient* reader, const log_time& start,
         }
         if (element == lastElement) {
             android::prdebug("reader.per: identical elements");
+            handled(it);  // it was already sent
             break;
         }
         lastElement = element;
 
-        if (!privileged && (element->getUid() != uid)) {
-            continue;
-        }
-
-        if (!security && (element->getLogId() == LOG_ID_SECURITY)) {
-            continue;
-        }
+        bool send = (privileged || (element->getUid() == uid)) &&
+                    (security || (element->getLogId() != LOG_ID_SECURITY));
 
         // NB: calling out to another object with wrlock() held (safe)
-        if (filter) {
+        if (send && filter) {
             int ret = (*filter)(element, arg);
-            if (ret == false) {
-                continue;
-            }
-            if (ret != true) {
+            if ((ret != false) && (ret != true)) {
                 break;
             }
+            send = ret;
+        }
+
+        handled(it);
+        if (!send) {
+            continue;
         }
 
         bool sameTid = false;
@@ -1199,7 +1241,7 @@ log_time LogBuffer::flushTo(SocketClient* reader, const log_time& start,
         unlock();
 
         // range locking in LastLogTimes looks after us
-        curr = element->flushTo(reader, this, sameTid);
+        curr = element->flushTo(reader, this, sameTid, format);
 
         if (curr == element->FLUSH_ERROR) {
             return curr;
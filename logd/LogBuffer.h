@@ -76,9 +76,6 @@ typedef std::list<LogBufferElement*> LogBufferElementCollection;
 
 class LogBuffer {
     LogBufferElementCollection mLogElements;
-    pthread_rwlock_t mLogElementsLock;
-
-    LogStatistics stats;
 
     PruneList mPrune;
     // watermark for last per log id
@@ -93,8 +90,6 @@ class LogBuffer {
         LogBufferPidIteratorMap;
     LogBufferPidIteratorMap mLastWorstPidOfSystem[LOG_ID_MAX];
 
-    unsigned long mMaxSize[LOG_ID_MAX];
-
     bool monotonic;
 
     LogTags tags;
@@ -103,32 +98,84 @@ class LogBuffer {
     LogBufferElement* droppedElements[LOG_ID_MAX];
     void log(LogBufferElement* elem);
 
+   protected:
+    // Shared with the alternate storage engines (see SerializedLogBuffer),
+    // which keep their own entries but reuse the locking, statistics and
+    // size configuration of this class.
+    pthread_rwlock_t mLogElementsLock;
+
+    LogStatistics stats;
+
+    unsigned long mMaxSize[LOG_ID_MAX];
+
    public:
     LastLogTimes& mTimes;
 
     explicit LogBuffer(LastLogTimes* times);
-    ~LogBuffer();
+    virtual ~LogBuffer();
     void init();
     bool isMonotonic() {
         return monotonic;
     }
 
-    int log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid, pid_t tid, const char* msg,
-            uint16_t len);
+    // An entry on its way into the buffer, see prepareLog().
+    struct PendingLog {
+        log_id_t log_id;
+        log_time realtime;
+        uid_t uid;
+        pid_t pid;
+        pid_t tid;
+        const char* msg;  // must stay valid until commitLocked()
+        uint16_t len;
+        bool loggable;
+        LogBufferElement* elem;  // owned, if the engine allocated one
+    };
+
+    int log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid, pid_t tid,
+            const char* msg, uint16_t len) {
+        PendingLog pending;
+        int ret = prepareLog(log_id, realtime, uid, pid, tid, msg, len, &pending);
+        if (ret < 0) {
+            return ret;
+        }
+        wrlock();
+        ret = commitLocked(&pending);
+        unlock();
+        return ret;
+    }
+
+    // The storage engine entry points below are virtual so that logd can
+    // select an alternate engine at startup (logd.buffer_type).
+
+    // log() in two halves, so that LogListener can commit a batch of entries
+    // under a single lock acquisition. prepareLog() does the work that needs
+    // no lock, validation, the loggable check and any allocation, and
+    // returns 0 or -EINVAL. commitLocked() stores a prepared entry with
+    // wrlock() held and returns len or -EACCES.
+    virtual int prepareLog(log_id_t log_id, log_time realtime, uid_t uid,
+                           pid_t pid, pid_t tid, const char* msg, uint16_t len,
+                           PendingLog* pending);
+    virtual int commitLocked(PendingLog* pending);
     // lastTid is an optional context to help detect if the last previous
     // valid message was from the same source so we can differentiate chatty
     // filter types (identical or expired)
-    log_time flushTo(SocketClient* writer, const log_time& start,
-                     pid_t* lastTid,  // &lastTid[LOG_ID_MAX] or nullptr
-                     bool privileged, bool security,
-                     int (*filter)(const LogBufferElement* element,
-                                   void* arg) = nullptr,
-                     void* arg = nullptr);
-
-    bool clear(log_id_t id, uid_t uid = AID_ROOT);
+    // cursor, if set, takes precedence over start and is advanced past each
+    // element once it has been sent or filtered out; SerializedLogBuffer
+    // always resumes from start, and only keeps its chunk cache in it
+    // format, if set, sends elements pre-formatted (LogBufferElement::flushTo)
+    virtual log_time flushTo(SocketClient* writer, const log_time& start,
+                             pid_t* lastTid,  // &lastTid[LOG_ID_MAX] or nullptr
+                             bool privileged, bool security,
+                             int (*filter)(const LogBufferElement* element,
+                                           void* arg) = nullptr,
+                             void* arg = nullptr,
+                             LogReaderCursor* cursor = nullptr,
+                             AndroidLogFormat* format = nullptr);
+
+    virtual bool clear(log_id_t id, uid_t uid = AID_ROOT);
     unsigned long getSize(log_id_t id);
-    int setSize(log_id_t id, unsigned long size);
-    unsigned long getSizeUsed(log_id_t id);
+    virtual int setSize(log_id_t id, unsigned long size);
+    virtual unsigned long getSizeUsed(log_id_t id);
 
     std::string formatStatistics(uid_t uid, pid_t pid, unsigned int logMask);
 
@@ -22,6 +22,9 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+
+#include <log/event_tag_map.h>
 #include <private/android_logger.h>
 
 #include "LogBuffer.h"
@@ -47,6 +50,19 @@ LogBufferElement::LogBufferElement(log_id_t log_id, log_time realtime,
     memcpy(mMsg, msg, len);
 }
 
+LogBufferElement::LogBufferElement(Borrowed, log_id_t log_id,
+                                   log_time realtime, uid_t uid, pid_t pid,
+                                   pid_t tid, char* msg, uint16_t len)
+    : mUid(uid),
+      mPid(pid),
+      mTid(tid),
+      mRealTime(realtime),
+      mMsg(msg),
+      mMsgLen(len),
+      mLogId(log_id),
+      mDropped(false) {
+}
+
 LogBufferElement::LogBufferElement(const LogBufferElement& elem)
     : mUid(elem.mUid),
       mPid(elem.mPid),
@@ -244,7 +260,52 @@ size_t LogBufferElement::populateDroppedMessage(char*& buffer, LogBuffer* parent
     return retval;
 }
 
-log_time LogBufferElement::flushTo(SocketClient* reader, LogBuffer* parent, bool lastSame) {
+// Replace the payload described by entry and iovec[1] with the line of text
+// that liblog's android_log_formatLogLine() would print for it. Returns false
+// if liblog can not parse the payload, logcat would not print it either.
+static bool formatPayload(AndroidLogFormat* format, bool binary,
+                          struct logger_entry& entry, struct iovec& payload,
+                          char* line, size_t lineSize) {
+    static EventTagMap* eventTagMap = android_openEventTagMap(nullptr);
+
+    // liblog parses in place, and may write terminators, so work on a copy.
+    union {
+        struct logger_entry entry;
+        char buf[LOGGER_ENTRY_MAX_LEN + 1];
+    } msg;
+    msg.entry = entry;
+    memcpy(msg.buf + entry.hdr_size, payload.iov_base, entry.len);
+    msg.buf[entry.hdr_size + entry.len] = '\0';
+
+    AndroidLogEntry logEntry;
+    char binaryMsgBuf[1024];
+    int err = binary ? android_log_processBinaryLogBuffer(
+                           &msg.entry, &logEntry, eventTagMap, binaryMsgBuf,
+                           sizeof(binaryMsgBuf))
+                     : android_log_processLogBuffer(&msg.entry, &logEntry);
+    if (err < 0) {
+        return false;
+    }
+
+    size_t len = 0;
+    char* formatted = android_log_formatLogLine(format, line, lineSize,
+                                                &logEntry, &len);
+    if (!formatted) {
+        return false;
+    }
+    len = std::min(len, lineSize);
+    if (formatted != line) {
+        memcpy(line, formatted, len);
+        free(formatted);
+    }
+    entry.len = len;
+    payload.iov_base = line;
+    payload.iov_len = len;
+    return true;
+}
+
+log_time LogBufferElement::flushTo(SocketClient* reader, LogBuffer* parent, bool lastSame,
+                                   AndroidLogFormat* format) {
     struct logger_entry entry = {};
 
     entry.hdr_size = sizeof(struct logger_entry);
@@ -271,6 +332,13 @@ log_time LogBufferElement::flushTo(SocketClient* reader, LogBuffer* parent, bool
     }
     iovec[1].iov_len = entry.len;
 
+    char line[LOGGER_ENTRY_MAX_PAYLOAD];
+    if (format && !formatPayload(format, isBinary(), entry, iovec[1], line,
+                                 sizeof(line))) {
+        if (buffer) free(buffer);
+        return mRealTime;
+    }
+
     log_time retval = reader->sendDatav(iovec, 1 + (entry.len != 0))
                           ? FLUSH_ERROR
                           : mRealTime;
@@ -22,6 +22,7 @@
 #include <sys/types.h>
 
 #include <log/log.h>
+#include <log/logprint.h>
 #include <sysutils/SocketClient.h>
 
 class LogBuffer;
@@ -34,6 +35,7 @@ class LogBuffer;
 
 class __attribute__((packed)) LogBufferElement {
     friend LogBuffer;
+    friend class SerializedLogBuffer;
 
     // sized to match reality of incoming log packets
     const uint32_t mUid;
@@ -57,6 +59,13 @@ class __attribute__((packed)) LogBufferElement {
     size_t populateDroppedMessage(char*& buffer, LogBuffer* parent,
                                   bool lastSame);
 
+    // Wraps msg without taking a copy, for presenting entries that live in
+    // other storage to LogStatistics and the flushTo() filters. The owner
+    // must reset mMsg to nullptr before the element is destroyed.
+    struct Borrowed {};
+    LogBufferElement(Borrowed, log_id_t log_id, log_time realtime, uid_t uid,
+                     pid_t pid, pid_t tid, char* msg, uint16_t len);
+
    public:
     LogBufferElement(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
                      pid_t tid, const char* msg, uint16_t len);
@@ -95,5 +104,8 @@ class __attribute__((packed)) LogBufferElement {
     }
 
     static const log_time FLUSH_ERROR;
-    log_time flushTo(SocketClient* writer, LogBuffer* parent, bool lastSame);
+    // format, if set, sends the entry as a line of text formatted by liblog
+    // rather than as its raw payload.
+    log_time flushTo(SocketClient* writer, LogBuffer* parent, bool lastSame,
+                     AndroidLogFormat* format = nullptr);
 };
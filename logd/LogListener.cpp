@@ -14,7 +14,10 @@
  * limitations under the License.
  */
 
+#include <inttypes.h>
 #include <limits.h>
+#include <pthread.h>
+#include <string.h>
 #include <sys/cdefs.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
@@ -22,6 +25,7 @@
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <android-base/stringprintf.h>
 #include <cutils/sockets.h>
 #include <private/android_filesystem_config.h>
 #include <private/android_logger.h>
@@ -30,8 +34,118 @@
 #include "LogListener.h"
 #include "LogUtils.h"
 
+// Must hold a few bursts of maximum sized entries, and be a power of two.
+static const size_t kStagingQueueSize = 256 * 1024;
+// Bounds how long readers wait on the committer holding wrlock().
+static const size_t kMaxBatchEntries = 256;
+
 LogListener::LogListener(LogBuffer* buf, LogReader* reader)
-    : SocketListener(getLogSocket(), false), logbuf(buf), reader(reader) {}
+    : SocketListener(getLogSocket(), false),
+      logbuf(buf),
+      reader(reader),
+      mQueue(kStagingQueueSize),
+      mBatches(0),
+      mCommitted(0),
+      mLockWaitNs(0),
+      mCommitInline(true) {
+    mPending.reserve(kMaxBatchEntries);
+
+    pthread_attr_t attr;
+    if (!pthread_attr_init(&attr)) {
+        struct sched_param param;
+
+        memset(&param, 0, sizeof(param));
+        pthread_attr_setschedparam(&attr, &param);
+        pthread_attr_setschedpolicy(&attr, SCHED_BATCH);
+        if (!pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED)) {
+            pthread_t thread;
+            if (!pthread_create(&thread, &attr, commitThreadStart, this)) {
+                mCommitInline = false;
+            }
+        }
+        pthread_attr_destroy(&attr);
+    }
+    if (mCommitInline) {
+        // Nothing would ever drain mQueue, commit each datagram as it
+        // arrives instead.
+        android::prdebug("LogListener: failed to start commit thread, committing inline");
+    }
+}
+
+void* LogListener::commitThreadStart(void* me) {
+    prctl(PR_SET_NAME, "logd.commit");
+    LogListener* listener = static_cast<LogListener*>(me);
+    for (;;) {
+        listener->commitBatch();
+    }
+    return nullptr;
+}
+
+// Move up to kMaxBatchEntries staged entries into the LogBuffer under a
+// single wrlock(), then wake the readers once for the whole batch. Entries
+// are prepared before the lock is taken, so only storing them is done under
+// it.
+void LogListener::commitBatch() {
+    log_mask_t mask = 0;
+    mPending.clear();
+    size_t count = mQueue.consume(
+        kMaxBatchEntries,
+        [&](const LogStagingQueue::Entry* entry) {
+            LogBuffer::PendingLog pending;
+            if (logbuf->prepareLog(static_cast<log_id_t>(entry->id),
+                                   entry->realtime, entry->uid, entry->pid,
+                                   entry->tid, entry->msg(), entry->len,
+                                   &pending) == 0) {
+                mPending.push_back(pending);
+            }
+        },
+        [&]() {
+            if (mPending.empty()) {
+                return;
+            }
+            log_time start(CLOCK_MONOTONIC);
+            logbuf->wrlock();
+            mLockWaitNs.fetch_add((log_time(CLOCK_MONOTONIC) - start).nsec(),
+                                  std::memory_order_relaxed);
+            for (LogBuffer::PendingLog& pending : mPending) {
+                if (logbuf->commitLocked(&pending) > 0) {
+                    mask |= static_cast<log_mask_t>(1 << pending.log_id);
+                }
+            }
+            logbuf->unlock();
+        });
+
+    mBatches.fetch_add(1, std::memory_order_relaxed);
+    mCommitted.fetch_add(count, std::memory_order_relaxed);
+
+    if (mask) {
+        reader->notifyNewLog(mask);
+    }
+}
+
+std::string LogListener::formatStatistics() const {
+    uint64_t batches = mBatches.load(std::memory_order_relaxed);
+    uint64_t committed = mCommitted.load(std::memory_order_relaxed);
+    return mQueue.formatStatistics() +
+           android::base::StringPrintf(
+               "Committed: %" PRIu64 " entries in %" PRIu64
+               " batches, average %" PRIu64 " per batch\n"
+               "Committer blocked on readers: %" PRIu64 "ms\n",
+               committed, batches, batches ? (committed / batches) : 0,
+               mLockWaitNs.load(std::memory_order_relaxed) / 1000000);
+}
+
+// liblog may send a burst of datagrams with a single sendmmsg(), drain up to
+// this many per wakeup with a single recvmmsg(). Only the logd.writer thread
+// uses this scratch space.
+static const unsigned kMaxDatagrams = 16;
+static struct {
+    // + 1 to ensure null terminator if MAX_PAYLOAD buffer is received
+    char buffer[sizeof(android_log_header_t) + LOGGER_ENTRY_MAX_PAYLOAD + 1];
+    alignas(4) char control[CMSG_SPACE(sizeof(struct ucred))];
+    struct iovec iov;
+} datagrams[kMaxDatagrams];
+static struct mmsghdr msgs[kMaxDatagrams];
 
 bool LogListener::onDataAvailable(SocketClient* cli) {
     static bool name_set;
@@ -40,14 +154,14 @@ bool LogListener::onDataAvailable(SocketClient* cli) {
         name_set = true;
     }
 
-    // + 1 to ensure null terminator if MAX_PAYLOAD buffer is received
-    char buffer[sizeof(android_log_header_t) + LOGGER_ENTRY_MAX_PAYLOAD + 1];
-    struct iovec iov = { buffer, sizeof(buffer) - 1 };
-
-    alignas(4) char control[CMSG_SPACE(sizeof(struct ucred))];
-    struct msghdr hdr = {
-        nullptr, 0, &iov, 1, control, sizeof(control), 0,
-    };
+    for (unsigned i = 0; i < kMaxDatagrams; ++i) {
+        datagrams[i].iov = { datagrams[i].buffer, sizeof(datagrams[i].buffer) - 1 };
+        msgs[i].msg_hdr = {
+            nullptr, 0, &datagrams[i].iov, 1, datagrams[i].control,
+            sizeof(datagrams[i].control), 0,
+        };
+        msgs[i].msg_len = 0;
+    }
 
     int socket = cli->getSocket();
 
@@ -55,34 +169,46 @@ bool LogListener::onDataAvailable(SocketClient* cli) {
     // overhead under logging load. We are safe because we check counts, but
     // still need to clear null terminator
     // memset(buffer, 0, sizeof(buffer));
-    ssize_t n = recvmsg(socket, &hdr, 0);
-    if (n <= (ssize_t)(sizeof(android_log_header_t))) {
+    int count = recvmmsg(socket, msgs, kMaxDatagrams, MSG_WAITFORONE, nullptr);
+    if (count <= 0) {
         return false;
     }
 
+    for (int i = 0; i < count; ++i) {
+        handleDatagram(datagrams[i].buffer, msgs[i].msg_len, &msgs[i].msg_hdr);
+    }
+
+    return true;
+}
+
+void LogListener::handleDatagram(char* buffer, ssize_t n, struct msghdr* hdr) {
+    if (n <= (ssize_t)(sizeof(android_log_header_t))) {
+        return;
+    }
+
     buffer[n] = 0;
 
     struct ucred* cred = nullptr;
 
-    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(hdr);
     while (cmsg != nullptr) {
         if (cmsg->cmsg_level == SOL_SOCKET &&
             cmsg->cmsg_type == SCM_CREDENTIALS) {
             cred = (struct ucred*)CMSG_DATA(cmsg);
             break;
         }
-        cmsg = CMSG_NXTHDR(&hdr, cmsg);
+        cmsg = CMSG_NXTHDR(hdr, cmsg);
     }
 
     if (cred == nullptr) {
-        return false;
+        return;
     }
 
     if (cred->uid == AID_LOGD) {
         // ignore log messages we send to ourself.
         // Such log messages are often generated by libraries we depend on
         // which use standard Android logging.
-        return false;
+        return;
     }
 
     android_log_header_t* header =
@@ -90,28 +216,26 @@ bool LogListener::onDataAvailable(SocketClient* cli) {
     log_id_t logId = static_cast<log_id_t>(header->id);
     if (/* logId < LOG_ID_MIN || */ logId >= LOG_ID_MAX ||
         logId == LOG_ID_KERNEL) {
-        return false;
+        return;
     }
 
     if ((logId == LOG_ID_SECURITY) &&
         (!__android_log_security() ||
          !clientHasLogCredentials(cred->uid, cred->gid, cred->pid))) {
-        return false;
+        return;
     }
 
     char* msg = ((char*)buffer) + sizeof(android_log_header_t);
     n -= sizeof(android_log_header_t);
 
-    // NB: hdr.msg_flags & MSG_TRUNC is not tested, silently passing a
+    // NB: hdr->msg_flags & MSG_TRUNC is not tested, silently passing a
     // truncated message to the logs.
 
-    int res = logbuf->log(logId, header->realtime, cred->uid, cred->pid, header->tid, msg,
-                          ((size_t)n <= UINT16_MAX) ? (uint16_t)n : UINT16_MAX);
-    if (res > 0) {
-        reader->notifyNewLog(static_cast<log_mask_t>(1 << logId));
+    mQueue.push(logId, header->realtime, cred->uid, cred->pid, header->tid, msg,
+                ((size_t)n <= UINT16_MAX) ? (uint16_t)n : UINT16_MAX);
+    if (mCommitInline) {
+        commitBatch();
     }
-
-    return true;
 }
 
 int LogListener::getLogSocket() {
@@ -17,21 +17,44 @@
 #ifndef _LOGD_LOG_LISTENER_H__
 #define _LOGD_LOG_LISTENER_H__
 
+#include <atomic>
+#include <string>
+#include <vector>
+
 #include <sysutils/SocketListener.h>
 #include "LogReader.h"
+#include "LogStagingQueue.h"
 
 class LogListener : public SocketListener {
     LogBuffer* logbuf;
     LogReader* reader;
 
+    // Datagrams are staged here by the writer thread and committed to
+    // logbuf in batches by the logd.commit thread.
+    LogStagingQueue mQueue;
+    // Entries of the batch being committed, only used by logd.commit.
+    std::vector<LogBuffer::PendingLog> mPending;
+
+    std::atomic<uint64_t> mBatches;
+    std::atomic<uint64_t> mCommitted;
+    std::atomic<uint64_t> mLockWaitNs;  // committer blocked on wrlock()
+    // Set when logd.commit could not be started, the writer thread then
+    // commits each entry itself.
+    bool mCommitInline;
+
    public:
      LogListener(LogBuffer* buf, LogReader* reader);
 
+    std::string formatStatistics() const;
+
    protected:
     virtual bool onDataAvailable(SocketClient* cli);
 
    private:
     static int getLogSocket();
+    static void* commitThreadStart(void* me);
+    void commitBatch();
+    void handleDatagram(char* buffer, ssize_t n, struct msghdr* hdr);
 };
 
 #endif
@@ -21,6 +21,10 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include <memory>
+#include <string>
+
+#include <android-base/strings.h>
 #include <cutils/sockets.h>
 #include <private/android_logger.h>
 
@@ -49,7 +53,7 @@ bool LogReader::onDataAvailable(SocketClient* cli) {
         name_set = true;
     }
 
-    char buffer[255];
+    char buffer[1024];  // room for a filter= list
 
     int len = read(cli->getSocket(), buffer, sizeof(buffer) - 1);
     if (len <= 0) {
@@ -120,6 +124,49 @@ bool LogReader::onDataAvailable(SocketClient* cli) {
         pid = atol(cp + sizeof(_pid) - 1);
     }
 
+    // Comma separated logcat filterspecs, tag:priority, applied to the text
+    // buffers before sending. The reader still sees only what it would
+    // print itself, but the rest never crosses the socket.
+    std::unique_ptr<AndroidLogFormat, decltype(&android_log_format_free)>
+        format(nullptr, &android_log_format_free);
+    static const char _filter[] = " filter=";
+    cp = strstr(buffer, _filter);
+    if (cp) {
+        format.reset(android_log_format_new());
+        std::string rules(cp + sizeof(_filter) - 1,
+                          strcspn(cp + sizeof(_filter) - 1, " "));
+        for (const auto& rule : android::base::Split(rules, ",")) {
+            if (!rule.empty() &&
+                (android_log_addFilterRule(format.get(), rule.c_str()) < 0)) {
+                doSocketDelete(cli);
+                return false;
+            }
+        }
+    }
+
+    // Comma separated logcat -v formats. Each entry is then sent as its
+    // formatted line of text in place of the payload.
+    bool formatted = false;
+    static const char _format[] = " format=";
+    cp = strstr(buffer, _format);
+    if (cp) {
+        if (!format) {
+            format.reset(android_log_format_new());
+        }
+        std::string formats(cp + sizeof(_format) - 1,
+                            strcspn(cp + sizeof(_format) - 1, " "));
+        for (const auto& name : android::base::Split(formats, ",")) {
+            AndroidLogPrintFormat printFormat =
+                android_log_formatFromString(name.c_str());
+            if (printFormat == FORMAT_OFF) {
+                doSocketDelete(cli);
+                return false;
+            }
+            android_log_setPrintFormat(format.get(), printFormat);
+        }
+        formatted = true;
+    }
+
     bool nonBlock = false;
     if (!fastcmp<strncmp>(buffer, "dumpAndClose", 12)) {
         // Allow writer to get some cycles, and wait for pending notifications
@@ -208,17 +255,19 @@ bool LogReader::onDataAvailable(SocketClient* cli) {
 
     android::prdebug(
         "logdr: UID=%d GID=%d PID=%d %c tail=%lu logMask=%x pid=%d "
-        "start=%" PRIu64 "ns timeout=%" PRIu64 "ns\n",
+        "start=%" PRIu64 "ns timeout=%" PRIu64 "ns%s%s\n",
         cli->getUid(), cli->getGid(), cli->getPid(), nonBlock ? 'n' : 'b', tail,
-        logMask, (int)pid, sequence.nsec(), timeout);
+        logMask, (int)pid, sequence.nsec(), timeout, format ? " filtered" : "",
+        formatted ? " formatted" : "");
 
     if (sequence == log_time::EPOCH) {
         timeout = 0;
     }
 
     LogTimeEntry::wrlock();
-    auto entry = std::make_unique<LogTimeEntry>(
-        *this, cli, nonBlock, tail, logMask, pid, sequence, timeout);
+    auto entry = std::make_unique<LogTimeEntry>(*this, cli, nonBlock, tail,
+                                                logMask, pid, sequence, timeout,
+                                                format.release(), formatted);
     if (!entry->startReader_Locked()) {
         LogTimeEntry::unlock();
         return false;
@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <android-base/stringprintf.h>
+#include <cutils/sockets.h>
+#include <private/android_filesystem_config.h>
+
+#include "LogBuffer.h"
+#include "LogRingListener.h"
+#include "LogUtils.h"
+
+// Bounds the memory logd maps on behalf of clients.
+static const size_t kMaxRings = 64;
+// Keeps a single uid from taking every ring slot.
+static const size_t kMaxRingsPerUid = 8;
+// Bounds how long readers wait on the drain holding wrlock().
+static const size_t kMaxBatchEntries = 256;
+
+struct LogRingListener::Ring {
+    SocketClient* client;
+    uid_t uid;
+    pid_t pid;
+    int doorbell;
+    android_log_ring_header_t* header;
+    char* data;
+    size_t size;  // of data
+    uint64_t head;  // header->head is only for the writers to read
+    bool corrupt;
+
+    ~Ring() {
+        munmap(header, LOG_RING_HEADER_SIZE + size);
+        close(doorbell);
+    }
+
+    uint32_t* sizeAt(uint64_t position) const {
+        return reinterpret_cast<uint32_t*>(data + (position & (size - 1)));
+    }
+};
+
+LogRingListener::LogRingListener(LogBuffer* buf, LogReader* reader)
+    : SocketListener(getLogSocket(), true),
+      logbuf(buf),
+      reader(reader),
+      mEpoll(epoll_create1(EPOLL_CLOEXEC)),
+      mNextId(0),
+      mRejected(0),
+      mCorrupt(0),
+      mDoorbells(0),
+      mDrained(0) {
+    pthread_mutex_init(&mLock, nullptr);
+    mCopied.reserve(kMaxBatchEntries);
+    mPending.reserve(kMaxBatchEntries);
+
+    pthread_attr_t attr;
+    if (!pthread_attr_init(&attr)) {
+        struct sched_param param;
+
+        memset(&param, 0, sizeof(param));
+        pthread_attr_setschedparam(&attr, &param);
+        pthread_attr_setschedpolicy(&attr, SCHED_BATCH);
+        if (!pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED)) {
+            pthread_t thread;
+            if (pthread_create(&thread, &attr, drainThreadStart, this)) {
+                android::prdebug("LogRingListener: failed to start drain thread");
+            }
+        }
+        pthread_attr_destroy(&attr);
+    }
+}
+
+bool LogRingListener::onDataAvailable(SocketClient* cli) {
+    static bool name_set;
+    if (!name_set) {
+        prctl(PR_SET_NAME, "logd.ringreg");
+        name_set = true;
+    }
+
+    char buffer[16];
+    struct iovec iov = { buffer, sizeof(buffer) };
+    alignas(struct cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))];
+    struct msghdr hdr = {
+        nullptr, 0, &iov, 1, control, sizeof(control), 0,
+    };
+
+    ssize_t n = recvmsg(cli->getSocket(), &hdr, MSG_CMSG_CLOEXEC);
+
+    int fds[2] = { -1, -1 };
+    size_t nfds = 0;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+            if (nfds < 2) {
+                fds[nfds] = fd;
+            } else {
+                close(fd);
+            }
+            ++nfds;
+        }
+    }
+
+    if (n <= 0) {
+        for (int fd : fds) {
+            if (fd >= 0) close(fd);
+        }
+        unregisterRing(cli);
+        return false;
+    }
+
+    int32_t status = -EINVAL;
+    if ((nfds == 2) && (n == sizeof("ring")) && !memcmp(buffer, "ring", n)) {
+        status = registerRing(cli, fds[0], fds[1]);
+    }
+    close(fds[0]);
+    if (status && (fds[1] >= 0)) {
+        close(fds[1]);
+    }
+    if (status) {
+        mRejected.fetch_add(1, std::memory_order_relaxed);
+    }
+    cli->sendData(&status, sizeof(status));
+    return true;
+}
+
+// Takes ownership of doorbell on success.
+int LogRingListener::registerRing(SocketClient* cli, int memfd, int doorbell) {
+    if (cli->getUid() == AID_LOGD) {
+        return -EPERM;
+    }
+
+    // The client could otherwise truncate the memfd and fault us.
+    int seals = fcntl(memfd, F_GET_SEALS);
+    struct stat st;
+    if ((seals < 0) || !(seals & F_SEAL_SHRINK) || fstat(memfd, &st)) {
+        return -EINVAL;
+    }
+    size_t size = st.st_size - LOG_RING_HEADER_SIZE;
+    if ((st.st_size < LOG_RING_HEADER_SIZE) || (size < LOG_RING_MIN_SIZE) ||
+        (size > LOG_RING_MAX_SIZE) || (size & (size - 1))) {
+        return -EINVAL;
+    }
+
+    // Only ever read from, or polled, if it is anything but an eventfd.
+    char path[32];
+    char link[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", doorbell);
+    ssize_t len = readlink(path, link, sizeof(link) - 1);
+    if ((len <= 0) || (link[len] = '\0', strcmp(link, "anon_inode:[eventfd]"))) {
+        return -EINVAL;
+    }
+    fcntl(doorbell, F_SETFL, fcntl(doorbell, F_GETFL) | O_NONBLOCK);
+
+    void* map = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     memfd, 0);
+    if (map == MAP_FAILED) {
+        return -errno;
+    }
+    android_log_ring_header_t* header =
+        static_cast<android_log_ring_header_t*>(map);
+    if (header->magic != LOG_RING_MAGIC) {
+        munmap(map, st.st_size);
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&mLock);
+    bool busy = mRings.size() >= kMaxRings;
+    size_t uidRings = 0;
+    for (auto& it : mRings) {
+        busy = busy || (it.second->client == cli);
+        uidRings += it.second->uid == cli->getUid();
+    }
+    busy = busy || (uidRings >= kMaxRingsPerUid);
+    if (busy) {
+        pthread_mutex_unlock(&mLock);
+        munmap(map, st.st_size);
+        return -EBUSY;
+    }
+
+    uint64_t id = mNextId++;
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = id;
+    if (epoll_ctl(mEpoll, EPOLL_CTL_ADD, doorbell, &event)) {
+        int ret = -errno;
+        pthread_mutex_unlock(&mLock);
+        munmap(map, st.st_size);
+        return ret;
+    }
+
+    Ring* ring = new Ring;
+    ring->client = cli;
+    ring->uid = cli->getUid();
+    ring->pid = cli->getPid();
+    ring->doorbell = doorbell;
+    ring->header = header;
+    ring->data = static_cast<char*>(map) + LOG_RING_HEADER_SIZE;
+    ring->size = size;
+    ring->head = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+    ring->corrupt = false;
+    mRings.emplace(id, ring);
+    pthread_mutex_unlock(&mLock);
+
+    // Pick up anything logged before the first doorbell could ring.
+    uint64_t one = 1;
+    TEMP_FAILURE_RETRY(write(doorbell, &one, sizeof(one)));
+    return 0;
+}
+
+void LogRingListener::unregisterRing(SocketClient* cli) {
+    pthread_mutex_lock(&mLock);
+    for (auto it = mRings.begin(); it != mRings.end(); ++it) {
+        Ring& ring = *it->second;
+        if (ring.client != cli) {
+            continue;
+        }
+        // Whatever the process managed to log before it exited.
+        if (!ring.corrupt) {
+            while (drainBatch(ring)) {
+            }
+            epoll_ctl(mEpoll, EPOLL_CTL_DEL, ring.doorbell, nullptr);
+        }
+        mRings.erase(it);
+        break;
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+void* LogRingListener::drainThreadStart(void* me) {
+    prctl(PR_SET_NAME, "logd.ring");
+    LogRingListener* listener = static_cast<LogRingListener*>(me);
+    for (;;) {
+        listener->waitAndDrain();
+    }
+    return nullptr;
+}
+
+void LogRingListener::waitAndDrain() {
+    struct epoll_event events[16];
+    int n = TEMP_FAILURE_RETRY(epoll_wait(mEpoll, events, 16, -1));
+    if (n < 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&mLock);
+    for (int i = 0; i < n; ++i) {
+        auto it = mRings.find(events[i].data.u64);
+        if (it == mRings.end()) {  // unregistered meanwhile
+            continue;
+        }
+        Ring& ring = *it->second;
+        uint64_t count;
+        TEMP_FAILURE_RETRY(read(ring.doorbell, &count, sizeof(count)));
+        mDoorbells.fetch_add(1, std::memory_order_relaxed);
+        drain(ring);
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+// Drain until the ring is empty, then tell the writers to ring the doorbell
+// for the next entry. Sleeping is set before the final check, and the
+// writers publish before they check it, so either we see the entry or the
+// writer sees us asleep.
+void LogRingListener::drain(Ring& ring) {
+    for (;;) {
+        while (drainBatch(ring)) {
+        }
+        if (ring.corrupt) {
+            return;
+        }
+        __atomic_store_n(&ring.header->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(ring.sizeAt(ring.head), __ATOMIC_SEQ_CST)) {
+            return;
+        }
+        __atomic_store_n(&ring.header->sleeping, 0, __ATOMIC_RELAXED);
+    }
+}
+
+// Log up to kMaxBatchEntries published entries under a single wrlock(), then
+// hand their space back to the writers. Returns true if there may be more.
+bool LogRingListener::drainBatch(Ring& ring) {
+    uint64_t start = ring.head;
+    size_t count = 0;
+    log_mask_t mask = 0;
+    mCopied.clear();
+    mPayloads.clear();
+    mPending.clear();
+
+    while (count < kMaxBatchEntries) {
+        size_t offset = ring.head & (ring.size - 1);
+        uint32_t size = __atomic_load_n(ring.sizeAt(ring.head), __ATOMIC_ACQUIRE);
+        if (!size) {
+            break;
+        }
+        if (size & LOG_RING_PAD) {
+            if ((size & ~LOG_RING_PAD) != (ring.size - offset)) {
+                setCorrupt(ring);
+                break;
+            }
+            ring.head += ring.size - offset;
+            continue;
+        }
+
+        size_t aligned = (size + 7) & ~7;
+        if ((size <= sizeof(android_log_ring_entry_t)) ||
+            (aligned > (ring.size - offset)) ||
+            ((size - sizeof(android_log_ring_entry_t)) > LOGGER_ENTRY_MAX_PAYLOAD)) {
+            setCorrupt(ring);
+            break;
+        }
+
+        // Copy out first, the writer could still be scribbling over it.
+        android_log_ring_entry_t entry;
+        memcpy(&entry, ring.data + offset, sizeof(entry));
+        uint16_t len = size - sizeof(entry);
+        ring.head += aligned;
+
+        log_id_t logId = static_cast<log_id_t>(entry.header.id);
+        if (logId >= LOG_ID_MAX || logId == LOG_ID_KERNEL ||
+            logId == LOG_ID_SECURITY) {
+            continue;
+        }
+
+        size_t payload = mPayloads.size();
+        mPayloads.resize(payload + len + 1);
+        memcpy(&mPayloads[payload], ring.data + offset + sizeof(entry), len);
+        mPayloads[payload + len] = '\0';
+        mCopied.push_back({logId, entry.header.realtime,
+                           static_cast<pid_t>(entry.header.tid), payload, len});
+        ++count;
+    }
+
+    // mPayloads no longer moves, prepare the entries before taking the lock.
+    for (const CopiedEntry& copied : mCopied) {
+        LogBuffer::PendingLog pending;
+        if (logbuf->prepareLog(copied.id, copied.realtime, ring.uid, ring.pid,
+                               copied.tid, &mPayloads[copied.offset],
+                               copied.len, &pending) == 0) {
+            mPending.push_back(pending);
+        }
+    }
+    if (!mPending.empty()) {
+        logbuf->wrlock();
+        for (LogBuffer::PendingLog& pending : mPending) {
+            if (logbuf->commitLocked(&pending) > 0) {
+                mask |= static_cast<log_mask_t>(1 << pending.log_id);
+            }
+        }
+        logbuf->unlock();
+    }
+
+    // Unpublish everything consumed, entries of the next lap need not start
+    // where those of this one did.
+    for (uint64_t position = start; position != ring.head;) {
+        size_t offset = position & (ring.size - 1);
+        size_t len = std::min<uint64_t>(ring.head - position, ring.size - offset);
+        memset(ring.data + offset, 0, len);
+        position += len;
+    }
+    __atomic_store_n(&ring.header->head, ring.head, __ATOMIC_RELEASE);
+
+    mDrained.fetch_add(count, std::memory_order_relaxed);
+    if (mask) {
+        reader->notifyNewLog(mask);
+    }
+    return !ring.corrupt && (count == kMaxBatchEntries);
+}
+
+// Stop draining, the writers fall back to logdw once it is full.
+void LogRingListener::setCorrupt(Ring& ring) {
+    android::prdebug("LogRingListener: uid %d pid %d corrupted its ring",
+                     ring.uid, ring.pid);
+    ring.corrupt = true;
+    epoll_ctl(mEpoll, EPOLL_CTL_DEL, ring.doorbell, nullptr);
+    mCorrupt.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::string LogRingListener::formatStatistics() {
+    pthread_mutex_lock(&mLock);
+    size_t registered = mRings.size();
+    pthread_mutex_unlock(&mLock);
+    return android::base::StringPrintf(
+        "Shared memory rings: %zu registered, %" PRIu64 " rejected, %" PRIu64
+        " corrupt\n"
+        "Drained: %" PRIu64 " entries on %" PRIu64 " doorbells\n",
+        registered, mRejected.load(std::memory_order_relaxed),
+        mCorrupt.load(std::memory_order_relaxed),
+        mDrained.load(std::memory_order_relaxed),
+        mDoorbells.load(std::memory_order_relaxed));
+}
+
+int LogRingListener::getLogSocket() {
+    static const char socketName[] = "logdring";
+    int sock = android_get_control_socket(socketName);
+
+    if (sock < 0) {
+        sock = socket_local_server(
+            socketName, ANDROID_SOCKET_NAMESPACE_RESERVED, SOCK_SEQPACKET);
+    }
+
+    return sock;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <private/android_logger.h>
+#include <sysutils/SocketListener.h>
+
+#include "LogBuffer.h"
+#include "LogReader.h"
+
+// Listens on /dev/socket/logdring for processes registering a shared memory
+// ring, see android_log_ring_header_t, and drains the registered rings into
+// the LogBuffer from the logd.ring thread whenever their doorbell rings.
+//
+// A ring stays registered for as long as the connection it was registered
+// on is open. Its entries are attributed to the uid and pid of the peer
+// credentials of that connection, never to anything found in the ring.
+class LogRingListener : public SocketListener {
+    struct Ring;
+
+    LogBuffer* logbuf;
+    LogReader* reader;
+
+    int mEpoll;  // doorbells of the registered rings
+    pthread_mutex_t mLock;  // mRings, held while draining
+    std::map<uint64_t, std::unique_ptr<Ring>> mRings;
+    uint64_t mNextId;
+    // The batch being drained, copied out of the ring so that it can be
+    // prepared before the LogBuffer wrlock() is taken. Guarded by mLock.
+    struct CopiedEntry {
+        log_id_t id;
+        log_time realtime;
+        pid_t tid;
+        size_t offset;  // of the payload in mPayloads
+        uint16_t len;
+    };
+    std::vector<CopiedEntry> mCopied;
+    std::vector<char> mPayloads;
+    std::vector<LogBuffer::PendingLog> mPending;
+
+    std::atomic<uint64_t> mRejected;
+    std::atomic<uint64_t> mCorrupt;
+    std::atomic<uint64_t> mDoorbells;
+    std::atomic<uint64_t> mDrained;
+
+   public:
+    LogRingListener(LogBuffer* buf, LogReader* reader);
+
+    std::string formatStatistics();
+
+   protected:
+    virtual bool onDataAvailable(SocketClient* cli);
+
+   private:
+    static int getLogSocket();
+    static void* drainThreadStart(void* me);
+    int registerRing(SocketClient* cli, int memfd, int doorbell);
+    void unregisterRing(SocketClient* cli);
+    void waitAndDrain();
+    void drain(Ring& ring);
+    bool drainBatch(Ring& ring);
+    void setCorrupt(Ring& ring);
+};
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <android-base/stringprintf.h>
+
+#include "LogStagingQueue.h"
+
+LogStagingQueue::LogStagingQueue(size_t capacity)
+    : mCapacity(capacity),
+      mRing(new uint8_t[capacity]),
+      mHead(0),
+      mTail(0),
+      mEntries(0),
+      mConsumerWaiting(false),
+      mProducerWaiting(false),
+      mHighWater(0),
+      mProducerBlocked(0),
+      mProducerBlockedNs(0) {
+    pthread_mutex_init(&mLock, nullptr);
+    pthread_cond_init(&mCond, nullptr);
+}
+
+const LogStagingQueue::Entry* LogStagingQueue::at(uint64_t position) const {
+    size_t offset = position & (mCapacity - 1);
+    if ((mCapacity - offset) < sizeof(Entry)) {
+        return nullptr;
+    }
+    const Entry* entry = reinterpret_cast<const Entry*>(&mRing[offset]);
+    return entry->size ? entry : nullptr;
+}
+
+void LogStagingQueue::push(log_id_t id, log_time realtime, uid_t uid, pid_t pid,
+                           pid_t tid, const char* msg, uint16_t len) {
+    size_t size = sizeof(Entry) + len;
+    uint64_t tail = mTail.load(std::memory_order_relaxed);
+    size_t offset = tail & (mCapacity - 1);
+    size_t toEnd = mCapacity - offset;
+
+    // Entries are contiguous, pad out to the end of the ring if necessary.
+    waitForSpace((toEnd < size) ? (toEnd + size) : size);
+    if (toEnd < size) {
+        if (toEnd >= sizeof(Entry)) {
+            reinterpret_cast<Entry*>(&mRing[offset])->size = 0;
+        }
+        tail += toEnd;
+        offset = 0;
+    }
+
+    Entry* entry = reinterpret_cast<Entry*>(&mRing[offset]);
+    entry->size = size;
+    entry->uid = uid;
+    entry->pid = pid;
+    entry->tid = tid;
+    entry->realtime = realtime;
+    entry->len = len;
+    entry->id = id;
+    memcpy(&mRing[offset + sizeof(Entry)], msg, len);
+    tail += size;
+
+    mEntries.fetch_add(1, std::memory_order_relaxed);
+    mTail.store(tail);
+
+    size_t used = tail - mHead.load(std::memory_order_relaxed);
+    if (used > mHighWater.load(std::memory_order_relaxed)) {
+        mHighWater.store(used, std::memory_order_relaxed);
+    }
+
+    wake(mConsumerWaiting);
+}
+
+void LogStagingQueue::release(uint64_t head, size_t count) {
+    mEntries.fetch_sub(count, std::memory_order_relaxed);
+    mHead.store(head);
+    wake(mProducerWaiting);
+}
+
+// The waiting flag is set before the final check of the queue state, and
+// the positions are stored before the flag is tested, so one side either
+// sees the update or the other sees it asleep and signals under mLock.
+void LogStagingQueue::wake(std::atomic<bool>& waiting) {
+    if (waiting.load()) {
+        pthread_mutex_lock(&mLock);
+        pthread_cond_broadcast(&mCond);
+        pthread_mutex_unlock(&mLock);
+    }
+}
+
+void LogStagingQueue::waitForEntries() {
+    if (mHead.load(std::memory_order_relaxed) != mTail.load()) {
+        return;
+    }
+
+    pthread_mutex_lock(&mLock);
+    mConsumerWaiting.store(true);
+    while (mHead.load(std::memory_order_relaxed) == mTail.load()) {
+        pthread_cond_wait(&mCond, &mLock);
+    }
+    mConsumerWaiting.store(false);
+    pthread_mutex_unlock(&mLock);
+}
+
+void LogStagingQueue::waitForSpace(size_t size) {
+    uint64_t tail = mTail.load(std::memory_order_relaxed);
+    if ((mCapacity - (tail - mHead.load())) >= size) {
+        return;
+    }
+
+    log_time start(CLOCK_MONOTONIC);
+    pthread_mutex_lock(&mLock);
+    mProducerWaiting.store(true);
+    while ((mCapacity - (tail - mHead.load())) < size) {
+        pthread_cond_wait(&mCond, &mLock);
+    }
+    mProducerWaiting.store(false);
+    pthread_mutex_unlock(&mLock);
+
+    mProducerBlocked.fetch_add(1, std::memory_order_relaxed);
+    mProducerBlockedNs.fetch_add((log_time(CLOCK_MONOTONIC) - start).nsec(),
+                                 std::memory_order_relaxed);
+}
+
+std::string LogStagingQueue::formatStatistics() const {
+    uint64_t head = mHead.load(std::memory_order_relaxed);
+    uint64_t tail = mTail.load(std::memory_order_relaxed);
+    return android::base::StringPrintf(
+        "Staging queue depth: %zu entries, %" PRIu64 "/%zu bytes, high water %zu bytes\n"
+        "Listener blocked on a full queue: %" PRIu64 " times, %" PRIu64 "ms\n",
+        mEntries.load(std::memory_order_relaxed), tail - head, mCapacity,
+        mHighWater.load(std::memory_order_relaxed),
+        mProducerBlocked.load(std::memory_order_relaxed),
+        mProducerBlockedNs.load(std::memory_order_relaxed) / 1000000);
+}
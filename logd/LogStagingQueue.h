@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include <log/log.h>
+
+// Lock-free single producer, single consumer queue of log entries.
+//
+// LogListener is the only producer, it stages each datagram here rather
+// than taking the LogBuffer wrlock(), so that a burst of logging does not
+// stall behind reader flushTo() passes and overflow the logdw socket. The
+// commit thread is the only consumer, it moves the staged entries into the
+// LogBuffer in batches, one wrlock() per batch.
+//
+// Entries are serialized into a byte ring, the producer only writes mTail
+// and the consumer only writes mHead. Either side only sleeps, on a mutex
+// and condition shared by both, when the queue is full or empty.
+class LogStagingQueue {
+   public:
+    struct __attribute__((packed)) Entry {
+        uint32_t size;  // of the entry including the payload, 0 to wrap
+        uint32_t uid;
+        uint32_t pid;
+        uint32_t tid;
+        log_time realtime;
+        uint16_t len;
+        uint8_t id;
+
+        const char* msg() const {
+            return reinterpret_cast<const char*>(this) + sizeof(*this);
+        }
+    };
+
+    explicit LogStagingQueue(size_t capacity);
+
+    // Producer, blocks while the queue is full.
+    void push(log_id_t id, log_time realtime, uid_t uid, pid_t pid, pid_t tid,
+              const char* msg, uint16_t len);
+
+    // Consumer, blocks until at least one entry is staged. Calls
+    // callback(entry) for up to maxEntries entries, then done(), then
+    // releases their space, so the entries stay valid until done() returns.
+    // Returns the number of entries consumed.
+    template <typename F, typename G>
+    size_t consume(size_t maxEntries, F callback, G done) {
+        waitForEntries();
+        uint64_t head = mHead.load(std::memory_order_relaxed);
+        uint64_t tail = mTail.load(std::memory_order_acquire);
+        size_t count = 0;
+        while ((head != tail) && (count < maxEntries)) {
+            const Entry* entry = at(head);
+            if (!entry) {  // padding to the end of the ring
+                head += mCapacity - (head & (mCapacity - 1));
+                continue;
+            }
+            callback(entry);
+            head += entry->size;
+            ++count;
+        }
+        done();
+        release(head, count);
+        return count;
+    }
+
+    std::string formatStatistics() const;
+
+   private:
+    const size_t mCapacity;  // power of two
+    std::unique_ptr<uint8_t[]> mRing;
+
+    std::atomic<uint64_t> mHead;  // consumer position
+    std::atomic<uint64_t> mTail;  // producer position
+    std::atomic<size_t> mEntries;
+
+    // slow path, only taken when the consumer or the producer sleeps
+    pthread_mutex_t mLock;
+    pthread_cond_t mCond;
+    std::atomic<bool> mConsumerWaiting;
+    std::atomic<bool> mProducerWaiting;
+
+    // statistics
+    std::atomic<size_t> mHighWater;
+    std::atomic<uint64_t> mProducerBlocked;
+    std::atomic<uint64_t> mProducerBlockedNs;
+
+    const Entry* at(uint64_t position) const;
+    void waitForEntries();
+    void waitForSpace(size_t size);
+    void release(uint64_t head, size_t count);
+    void wake(std::atomic<bool>& waiting);
+};
@@ -29,6 +29,7 @@
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <vector>
 
 #include <android-base/stringprintf.h>
 #include <android/log.h>
@@ -46,8 +47,11 @@ class LogStatistics;
 
 template <typename TKey, typename TEntry>
 class LogHashtable {
+   protected:
     std::unordered_map<TKey, TEntry> map;
 
+   private:
+
     size_t bucket_size() const {
         size_t count = 0;
         for (size_t idx = 0; idx < map.bucket_count(); ++idx) {
@@ -201,6 +205,157 @@ class LogHashtable {
     }
 };
 
+// A LogHashtable that also keeps its entries in a max-heap ordered by
+// getSizes(). add(), subtract() and drop() restore the heap order of the
+// one entry they change in O(log n), so that sort() for the few worst
+// offenders LogBuffer::prune() asks for on every pass only visits the top
+// of the heap instead of walking and sorting the whole table. Each entry
+// records its own heap position in EntryBase::heapIndex.
+template <typename TKey, typename TEntry>
+class LogIndexedHashtable : public LogHashtable<TKey, TEntry> {
+    typedef LogHashtable<TKey, TEntry> base;
+
+    std::vector<TEntry*> heap;
+
+    bool before(size_t a, size_t b) const {
+        return heap[a]->getSizes() > heap[b]->getSizes();
+    }
+
+    void swap(size_t a, size_t b) {
+        std::swap(heap[a], heap[b]);
+        heap[a]->heapIndex = a;
+        heap[b]->heapIndex = b;
+    }
+
+    void siftUp(size_t index) {
+        while (index) {
+            size_t parent = (index - 1) / 2;
+            if (!before(index, parent)) {
+                break;
+            }
+            swap(index, parent);
+            index = parent;
+        }
+    }
+
+    void siftDown(size_t index) {
+        for (;;) {
+            size_t largest = index;
+            size_t child = 2 * index + 1;
+            if ((child < heap.size()) && before(child, largest)) {
+                largest = child;
+            }
+            ++child;
+            if ((child < heap.size()) && before(child, largest)) {
+                largest = child;
+            }
+            if (largest == index) {
+                break;
+            }
+            swap(index, largest);
+            index = largest;
+        }
+    }
+
+    void remove(size_t index) {
+        size_t last = heap.size() - 1;
+        if (index != last) {
+            swap(index, last);
+        }
+        heap.pop_back();
+        if (index < heap.size()) {
+            siftUp(index);
+            siftDown(index);
+        }
+    }
+
+   public:
+    typedef typename base::iterator iterator;
+
+    LogIndexedHashtable() = default;
+    // heap points into this table's own map
+    LogIndexedHashtable(const LogIndexedHashtable&) = delete;
+    LogIndexedHashtable& operator=(const LogIndexedHashtable&) = delete;
+
+    size_t sizeOf() const {
+        return base::sizeOf() + heap.capacity() * sizeof(TEntry*);
+    }
+
+    // Same result as LogHashtable::sort(), found by a best-first walk from
+    // the top of the heap that stops once len matching entries are found.
+    std::unique_ptr<const TEntry* []> sort(uid_t uid, pid_t pid,
+                                           size_t len) const {
+        if (!len) {
+            std::unique_ptr<const TEntry* []> sorted(nullptr);
+            return sorted;
+        }
+
+        const TEntry** retval = new const TEntry*[len];
+        memset(retval, 0, sizeof(*retval) * len);
+
+        // frontier of heap indices still to visit, itself kept as a heap
+        auto later = [this](size_t a, size_t b) { return before(b, a); };
+        std::vector<size_t> frontier;
+        if (!heap.empty()) {
+            frontier.push_back(0);
+        }
+        size_t found = 0;
+        while (!frontier.empty() && (found < len)) {
+            std::pop_heap(frontier.begin(), frontier.end(), later);
+            size_t index = frontier.back();
+            frontier.pop_back();
+
+            const TEntry* entry = heap[index];
+            if (((uid == AID_ROOT) || (uid == entry->getUid())) &&
+                (!pid || !entry->getPid() || (pid == entry->getPid()))) {
+                retval[found++] = entry;
+            }
+
+            for (size_t child = 2 * index + 1;
+                 (child <= 2 * index + 2) && (child < heap.size()); ++child) {
+                frontier.push_back(child);
+                std::push_heap(frontier.begin(), frontier.end(), later);
+            }
+        }
+        std::unique_ptr<const TEntry* []> sorted(retval);
+        return sorted;
+    }
+
+    iterator add(const TKey& key, const LogBufferElement* element) {
+        size_t count = this->size();
+        iterator it = base::add(key, element);
+        TEntry& entry = it->second;
+        if (this->size() != count) {
+            entry.heapIndex = heap.size();
+            heap.push_back(&entry);
+        }
+        siftUp(entry.heapIndex);
+        return it;
+    }
+
+    void subtract(const TKey& key, const LogBufferElement* element) {
+        iterator it = this->map.find(key);
+        if (it == this->map.end()) {
+            return;
+        }
+        TEntry& entry = it->second;
+        if (entry.subtract(element)) {
+            remove(entry.heapIndex);
+            this->map.erase(it);
+        } else {
+            siftDown(entry.heapIndex);
+        }
+    }
+
+    void drop(TKey key, const LogBufferElement* element) {
+        iterator it = this->map.find(key);
+        if (it != this->map.end()) {
+            it->second.drop(element);
+            siftDown(it->second.heapIndex);
+        }
+    }
+};
+
 namespace EntryBaseConstants {
 static constexpr size_t pruned_len = 14;
 static constexpr size_t total_len = 80;
@@ -208,11 +363,12 @@ static constexpr size_t total_len = 80;
 
 struct EntryBase {
     size_t size;
+    size_t heapIndex;  // position in a LogIndexedHashtable
 
-    EntryBase() : size(0) {
+    EntryBase() : size(0), heapIndex(0) {
     }
     explicit EntryBase(const LogBufferElement* element)
-        : size(element->getMsgLen()) {
+        : size(element->getMsgLen()), heapIndex(0) {
     }
 
     size_t getSizes() const {
@@ -678,11 +834,11 @@ class LogStatistics {
     bool enable;
 
     // uid to size list
-    typedef LogHashtable<uid_t, UidEntry> uidTable_t;
+    typedef LogIndexedHashtable<uid_t, UidEntry> uidTable_t;
     uidTable_t uidTable[LOG_ID_MAX];
 
     // pid of system to size list
-    typedef LogHashtable<pid_t, PidEntry> pidSystemTable_t;
+    typedef LogIndexedHashtable<pid_t, PidEntry> pidSystemTable_t;
     pidSystemTable_t pidSystemTable[LOG_ID_MAX];
 
     // pid to uid list
@@ -694,11 +850,12 @@ class LogStatistics {
     tidTable_t tidTable;
 
     // tag list
-    typedef LogHashtable<uint32_t, TagEntry> tagTable_t;
+    typedef LogIndexedHashtable<uint32_t, TagEntry> tagTable_t;
     tagTable_t tagTable;
 
     // security tag list
-    tagTable_t securityTagTable;
+    typedef LogHashtable<uint32_t, TagEntry> securityTagTable_t;
+    securityTagTable_t securityTagTable;
 
     // global tag list
     typedef LogHashtable<TagNameKey, TagNameEntry> tagNameTable_t;
@@ -18,6 +18,8 @@
 #include <string.h>
 #include <sys/prctl.h>
 
+#include <string>
+
 #include <private/android_logger.h>
 
 #include "FlushCommand.h"
@@ -29,7 +31,8 @@ pthread_mutex_t LogTimeEntry::timesLock = PTHREAD_MUTEX_INITIALIZER;
 
 LogTimeEntry::LogTimeEntry(LogReader& reader, SocketClient* client,
                            bool nonBlock, unsigned long tail, log_mask_t logMask,
-                           pid_t pid, log_time start, uint64_t timeout)
+                           pid_t pid, log_time start, uint64_t timeout,
+                           AndroidLogFormat* format, bool formatted)
     : leadingDropped(false),
       mReader(reader),
       mLogMask(logMask),
@@ -37,6 +40,8 @@ LogTimeEntry::LogTimeEntry(LogReader& reader, SocketClient* client,
       mCount(0),
       mTail(tail),
       mIndex(0),
+      mFormat(format, &android_log_format_free),
+      mFormatted(formatted && format),
       mClient(client),
       mStart(start),
       mNonBlock(nonBlock),
@@ -103,7 +108,8 @@ void* LogTimeEntry::threadStart(void* obj) {
             me->leadingDropped = true;
         }
         start = logbuf.flushTo(client, start, me->mLastTid, privileged,
-                               security, FilterSecondPass, me);
+                               security, FilterSecondPass, me, &me->mCursor,
+                               me->mFormatted ? me->mFormat.get() : nullptr);
 
         wrlock();
 
@@ -143,6 +149,43 @@ void* LogTimeEntry::threadStart(void* obj) {
     return nullptr;
 }
 
+// Apply the reader's tag:priority filter as logcat would, extracting the tag
+// the same way as android_log_processLogBuffer(). Binary buffers, and text
+// payloads too short for liblog to parse, are left to the reader.
+bool LogTimeEntry::isFilteredOut(const LogBufferElement* element) const {
+    if (!mFormat || element->isBinary()) {
+        return false;
+    }
+
+    if (element->getDropped()) {  // see populateDroppedMessage()
+        return !android_log_shouldPrintLine(mFormat.get(), "chatty",
+                                            ANDROID_LOG_INFO);
+    }
+
+    const char* msg = element->getMsg();
+    size_t len = element->getMsgLen();
+    if (!msg || (len < 3)) {
+        return false;
+    }
+
+    size_t tagLen = len - 2;  // all tag, no message
+    const char* end = static_cast<const char*>(memchr(msg + 1, '\0', len - 1));
+    if (end) {
+        tagLen = end - (msg + 1);
+    } else {
+        for (size_t i = 1; i < len; ++i) {
+            if ((msg[i] <= ' ') || (msg[i] == ':') || (msg[i] >= 0x7f)) {
+                tagLen = i - 1;
+                break;
+            }
+        }
+    }
+
+    return !android_log_shouldPrintLine(
+        mFormat.get(), std::string(msg + 1, tagLen).c_str(),
+        static_cast<android_LogPriority>(msg[0]));
+}
+
 // A first pass to count the number of elements
 int LogTimeEntry::FilterFirstPass(const LogBufferElement* element, void* obj) {
     LogTimeEntry* me = reinterpret_cast<LogTimeEntry*>(obj);
@@ -223,6 +266,10 @@ int LogTimeEntry::FilterSecondPass(const LogBufferElement* element, void* obj) {
     }
 
 ok:
+    if (me->isFilteredOut(element)) {
+        goto skip;
+    }
+
     if (!me->skipAhead[element->getLogId()]) {
         LogTimeEntry::unlock();
         return true;
@@ -26,13 +26,30 @@
 #include <memory>
 
 #include <log/log.h>
+#include <log/logprint.h>
 #include <sysutils/SocketClient.h>
 
+#include "SerializedLogChunk.h"
+
 typedef unsigned int log_mask_t;
 
 class LogReader;
 class LogBufferElement;
 
+// Where a blocking reader resumes in LogBuffer::mLogElements: the last
+// element its flushTo() pass stepped over. A wakeup then only visits the
+// entries appended since, rather than searching again by mStart. Written
+// by the reader under LogBuffer::rdlock(), moved back by LogBuffer::erase()
+// under wrlock() if its element is pruned.
+struct LogReaderCursor {
+    std::list<LogBufferElement*>::iterator last;
+    bool set = false;          // otherwise resume by time
+    bool beforeBegin = false;  // last was pruned from the head of the list
+    // SerializedLogBuffer resumes by time, but keeps the last chunk it
+    // decompressed for the reader here, where the next wakeup usually starts.
+    SerializedLogChunkCache chunkCache;
+};
+
 class LogTimeEntry {
     static pthread_mutex_t timesLock;
     bool mRelease = false;
@@ -48,14 +65,22 @@ class LogTimeEntry {
     unsigned long mCount;
     unsigned long mTail;
     unsigned long mIndex;
+    // tag:priority filter and output format pushed down by the reader
+    std::unique_ptr<AndroidLogFormat, decltype(&android_log_format_free)>
+        mFormat;
+    const bool mFormatted;
+
+    bool isFilteredOut(const LogBufferElement* element) const;
 
    public:
     LogTimeEntry(LogReader& reader, SocketClient* client, bool nonBlock,
                  unsigned long tail, log_mask_t logMask, pid_t pid,
-                 log_time start, uint64_t timeout);
+                 log_time start, uint64_t timeout,
+                 AndroidLogFormat* format = nullptr, bool formatted = false);
 
     SocketClient* mClient;
     log_time mStart;
+    LogReaderCursor mCursor;
     struct timespec mTimeout;
     const bool mNonBlock;
     const log_time mEnd;  // only relevant if mNonBlock
@@ -0,0 +1,403 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <private/android_logger.h>
+
+#include "LogUtils.h"
+#include "SerializedLogBuffer.h"
+
+// Bounds of the chunk size, which is otherwise a quarter of the log buffer
+// size so that pruning a chunk never gives back more than a fraction of it.
+static constexpr size_t minChunkSize = 4 * 1024;
+static constexpr size_t maxChunkSize = 256 * 1024;
+
+// Presents a SerializedLogEntry as a LogBufferElement to LogStatistics and to
+// the flushTo() filters, borrowing rather than copying the payload.
+class SerializedLogBuffer::ElementView {
+    LogBufferElement mElement;
+
+   public:
+    ElementView(log_id_t id, const SerializedLogEntry* entry)
+        : mElement(LogBufferElement::Borrowed(), id, entry->getRealTime(),
+                   entry->getUid(), entry->getPid(), entry->getTid(),
+                   const_cast<char*>(entry->getMsg()), entry->getMsgLen()) {
+    }
+    ElementView(log_id_t id, log_time realtime, uid_t uid, pid_t pid, pid_t tid,
+                const char* msg, uint16_t len)
+        : mElement(LogBufferElement::Borrowed(), id, realtime, uid, pid, tid,
+                   const_cast<char*>(msg), len) {
+    }
+    ~ElementView() {
+        mElement.mMsg = nullptr;
+    }
+
+    LogBufferElement* get() {
+        return &mElement;
+    }
+};
+
+// A reader position within the chunks of one log id, along with a private
+// copy of the entries that were read ahead while holding rdlock().
+struct SerializedLogBuffer::ChunkCursor {
+    uint64_t chunkId = 0;  // chunk from which the next entries are copied
+    size_t offset = 0;     // offset within that chunk
+    bool positioned = false;  // chunkId and offset are valid
+    bool started = false;     // reached the first entry at or after start
+    std::vector<uint8_t> entries;
+    size_t next = 0;  // read position within entries
+
+    bool empty() const {
+        return next >= entries.size();
+    }
+    const SerializedLogEntry* head() const {
+        return reinterpret_cast<const SerializedLogEntry*>(&entries[next]);
+    }
+    void pop() {
+        next += head()->getTotalLen();
+    }
+};
+
+SerializedLogBuffer::SerializedLogBuffer(LastLogTimes* times)
+    : LogBuffer(times), mNextChunkId(0) {
+    log_id_for_each(i) {
+        mUsed[i] = 0;
+    }
+}
+
+size_t SerializedLogBuffer::chunkSize(log_id_t id, uint16_t len) const {
+    size_t size = std::clamp<size_t>(mMaxSize[id] / 4, minChunkSize, maxChunkSize);
+    return std::max(size, sizeof(SerializedLogEntry) + len);
+}
+
+// Same policy as LogBuffer::log(), minus the need for a LogBufferElement.
+bool SerializedLogBuffer::isLoggable(log_id_t log_id, const char* msg, uint16_t len) {
+    if (log_id == LOG_ID_SECURITY) {
+        return true;
+    }
+
+    int prio = ANDROID_LOG_INFO;
+    const char* tag = nullptr;
+    size_t tag_len = 0;
+    if (log_id == LOG_ID_EVENTS || log_id == LOG_ID_STATS) {
+        // As LogBufferElement::getTag(), only the events buffer has a tag.
+        uint32_t tagId = 0;
+        if ((log_id == LOG_ID_EVENTS) && (len >= sizeof(android_event_header_t))) {
+            tagId = reinterpret_cast<const android_event_header_t*>(msg)->tag;
+        }
+        tag = tagToName(tagId);
+        if (tag) {
+            tag_len = strlen(tag);
+        }
+    } else {
+        prio = *msg;
+        tag = msg + 1;
+        tag_len = strnlen(tag, len - 1);
+    }
+    return __android_log_is_loggable_len(prio, tag, tag_len, ANDROID_LOG_VERBOSE);
+}
+
+int SerializedLogBuffer::prepareLog(log_id_t log_id, log_time realtime,
+                                    uid_t uid, pid_t pid, pid_t tid,
+                                    const char* msg, uint16_t len,
+                                    PendingLog* pending) {
+    if (log_id >= LOG_ID_MAX) {
+        return -EINVAL;
+    }
+
+    // Slip the time by 1 nsec if the incoming lands on xxxxxx000 ns.
+    // This prevents any chance that an outside source can request an
+    // exact entry with time specified in ms or us precision.
+    if ((realtime.tv_nsec % 1000) == 0) ++realtime.tv_nsec;
+
+    bool loggable = isLoggable(log_id, msg, len);
+    *pending = {log_id, realtime, uid, pid, tid, msg, len, loggable, nullptr};
+    return 0;
+}
+
+// assumes wrlock() held
+int SerializedLogBuffer::commitLocked(PendingLog* pending) {
+    if (!pending->loggable) {
+        // Log traffic received to total
+        ElementView view(pending->log_id, pending->realtime, pending->uid,
+                         pending->pid, pending->tid, pending->msg, pending->len);
+        stats.addTotal(view.get());
+        return -EACCES;
+    }
+
+    const SerializedLogEntry* entry =
+        append(pending->log_id, pending->realtime, pending->uid, pending->pid,
+               pending->tid, pending->msg, pending->len);
+    ElementView view(pending->log_id, entry);
+    stats.add(view.get());
+    maybePrune(pending->log_id);
+
+    return pending->len;
+}
+
+// assumes wrlock() held
+const SerializedLogEntry* SerializedLogBuffer::append(log_id_t log_id,
+                                                      log_time realtime,
+                                                      uid_t uid, pid_t pid,
+                                                      pid_t tid, const char* msg,
+                                                      uint16_t len) {
+    std::list<SerializedLogChunk>& logs = mLogs[log_id];
+    if (logs.empty() || !logs.back().canLog(len)) {
+        if (!logs.empty()) {
+            SerializedLogChunk& last = logs.back();
+            mUsed[log_id] -= last.getPruneSize();
+            last.seal();
+            mUsed[log_id] += last.getPruneSize();
+        }
+        logs.emplace_back(mNextChunkId++, chunkSize(log_id, len));
+    }
+
+    const SerializedLogEntry* entry =
+        logs.back().log(realtime, uid, pid, tid, msg, len);
+    mUsed[log_id] += entry->getTotalLen();
+    return entry;
+}
+
+// Prune whole chunks, oldest first, until we fit the log buffer size. Unlike
+// LogBuffer::prune() readers never hold back pruning, they copy what they
+// need under the lock and skip ahead if their position was pruned away.
+//
+// assumes wrlock() held
+void SerializedLogBuffer::maybePrune(log_id_t id) {
+    while ((mUsed[id] > mMaxSize[id]) && !mLogs[id].empty()) {
+        removeOldest(id);
+    }
+}
+
+// assumes wrlock() held
+void SerializedLogBuffer::removeOldest(log_id_t id) {
+    SerializedLogChunk& chunk = mLogs[id].front();
+
+    std::vector<uint8_t> entries;
+    chunk.read(0, entries);
+    for (size_t offset = 0; offset < entries.size();) {
+        const SerializedLogEntry* entry =
+            reinterpret_cast<const SerializedLogEntry*>(&entries[offset]);
+        ElementView view(id, entry);
+        stats.subtract(view.get());
+        offset += entry->getTotalLen();
+    }
+
+    mUsed[id] -= chunk.getPruneSize();
+    mLogs[id].pop_front();
+}
+
+// clear all rows of type "id" from the buffer, or only those of uid.
+bool SerializedLogBuffer::clear(log_id_t id, uid_t uid) {
+    wrlock();
+    if (uid == AID_ROOT) {
+        while (!mLogs[id].empty()) {
+            removeOldest(id);
+        }
+        unlock();
+        return false;
+    }
+
+    // Unprivileged clear, rewrite the chunks without the entries of uid.
+    std::list<SerializedLogChunk> logs;
+    logs.swap(mLogs[id]);
+    mUsed[id] = 0;
+    std::vector<uint8_t> entries;
+    for (const SerializedLogChunk& chunk : logs) {
+        entries.clear();
+        chunk.read(0, entries);
+        for (size_t offset = 0; offset < entries.size();) {
+            const SerializedLogEntry* entry =
+                reinterpret_cast<const SerializedLogEntry*>(&entries[offset]);
+            offset += entry->getTotalLen();
+            if (entry->getUid() == uid) {
+                ElementView view(id, entry);
+                stats.subtract(view.get());
+                continue;
+            }
+            append(id, entry->getRealTime(), entry->getUid(), entry->getPid(),
+                   entry->getTid(), entry->getMsg(), entry->getMsgLen());
+        }
+    }
+    unlock();
+    return false;
+}
+
+// set the total space allocated to "id"
+int SerializedLogBuffer::setSize(log_id_t id, unsigned long size) {
+    int ret = LogBuffer::setSize(id, size);
+    if (!ret) {
+        wrlock();
+        maybePrune(id);
+        unlock();
+    }
+    return ret;
+}
+
+// get the used space associated with "id", compressed chunks at their
+// compressed size.
+unsigned long SerializedLogBuffer::getSizeUsed(log_id_t id) {
+    rdlock();
+    size_t retval = mUsed[id];
+    unlock();
+    return retval;
+}
+
+// Copy the next entries for the reader into cursor. On the first call the
+// cursor is positioned on the first entry at or after start, searching back
+// from the newest chunk. Sealed chunks are decompressed through cache, if set.
+//
+// assumes rdlock() held
+void SerializedLogBuffer::fill(log_id_t id, ChunkCursor& cursor,
+                               const log_time& start,
+                               SerializedLogChunkCache* cache) {
+    std::list<SerializedLogChunk>& logs = mLogs[id];
+
+    cursor.entries.clear();
+    cursor.next = 0;
+    if (logs.empty()) {
+        return;
+    }
+
+    auto it = logs.begin();
+    if (!cursor.positioned) {
+        if (start != log_time::EPOCH) {
+            it = logs.end();
+            do {
+                --it;
+            } while ((it != logs.begin()) && (std::prev(it)->getNewest() >= start));
+        }
+        cursor.chunkId = it->getId();
+        cursor.positioned = true;
+    }
+
+    // Any chunk between our position and the next one was pruned.
+    while ((it != logs.end()) && (it->getId() < cursor.chunkId)) {
+        ++it;
+    }
+    if (it == logs.end()) {
+        return;
+    }
+    if (it->getId() != cursor.chunkId) {
+        cursor.chunkId = it->getId();
+        cursor.offset = 0;
+    }
+
+    while (cursor.empty()) {
+        cursor.offset += it->read(cursor.offset, cursor.entries, cache);
+        if (!cursor.started) {
+            while (!cursor.empty() && (cursor.head()->getRealTime() < start)) {
+                cursor.pop();
+            }
+            cursor.started = !cursor.empty();
+        }
+        if (!cursor.empty() || !it->isSealed() || (++it == logs.end())) {
+            break;
+        }
+        cursor.chunkId = it->getId();
+        cursor.offset = 0;
+        cursor.entries.clear();
+        cursor.next = 0;
+    }
+}
+
+log_time SerializedLogBuffer::flushTo(SocketClient* reader,
+                                      const log_time& start, pid_t* lastTid,
+                                      bool privileged, bool security,
+                                      int (*filter)(const LogBufferElement* element,
+                                                    void* arg),
+                                      void* arg, LogReaderCursor* cursor,
+                                      AndroidLogFormat* format) {
+    // Readers resume by time, fill() already searches for the start from
+    // the newest chunk so a wakeup only decodes the chunks it needs, and a
+    // blocking reader keeps the last of those in its cursor.
+    SerializedLogChunkCache* cache = cursor ? &cursor->chunkCache : nullptr;
+    uid_t uid = reader->getUid();
+    log_time curr = start;
+
+    // Merge the log ids, oldest entry first. Entries are only copied out
+    // under rdlock() once every cursor that ran dry is refilled together.
+    ChunkCursor cursors[LOG_ID_MAX];
+    bool refill = true;
+    for (;;) {
+        if (refill) {
+            rdlock();
+            log_id_for_each(i) {
+                if (cursors[i].empty()) {
+                    fill(i, cursors[i], start, cache);
+                }
+            }
+            unlock();
+            refill = false;
+        }
+
+        log_id_t id = LOG_ID_MAX;
+        log_id_for_each(i) {
+            if (!cursors[i].empty() &&
+                ((id == LOG_ID_MAX) ||
+                 (cursors[i].head()->getRealTime() < cursors[id].head()->getRealTime()))) {
+                id = i;
+            }
+        }
+        if (id == LOG_ID_MAX) {
+            break;
+        }
+
+        const SerializedLogEntry* entry = cursors[id].head();
+        cursors[id].pop();
+        refill = cursors[id].empty();
+
+        if (!privileged && (entry->getUid() != uid)) {
+            continue;
+        }
+
+        if (!security && (id == LOG_ID_SECURITY)) {
+            continue;
+        }
+
+        ElementView view(id, entry);
+        LogBufferElement* element = view.get();
+
+        if (filter) {
+            int ret = (*filter)(element, arg);
+            if (ret == false) {
+                continue;
+            }
+            if (ret != true) {
+                break;
+            }
+        }
+
+        bool sameTid = false;
+        if (lastTid) {
+            sameTid = lastTid[id] == element->getTid();
+            lastTid[id] = element->getTid();
+        }
+
+        curr = element->flushTo(reader, this, sameTid, format);
+
+        if (curr == element->FLUSH_ERROR) {
+            return curr;
+        }
+    }
+
+    return curr;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <list>
+
+#include "LogBuffer.h"
+#include "SerializedLogChunk.h"
+
+// An alternate storage engine for LogBuffer, selected with
+// logd.buffer_type=serialized.
+//
+// Rather than one heap allocated LogBufferElement per entry, entries are
+// serialized back to back into per log id SerializedLogChunks. Every chunk
+// but the last one of each log id is compressed, and only the compressed
+// size is charged against the log buffer size, so the same budget holds
+// several times more history. Pruning drops whole chunks, oldest first.
+//
+// Entries are kept in arrival order and there is no chatty deduplication
+// or worst offender pruning. Readers copy entries out of the chunks under
+// rdlock() and send them to the socket after releasing it.
+class SerializedLogBuffer : public LogBuffer {
+    class ElementView;
+    struct ChunkCursor;
+
+    std::list<SerializedLogChunk> mLogs[LOG_ID_MAX];
+    size_t mUsed[LOG_ID_MAX];  // sum of getPruneSize() of each chunk
+    uint64_t mNextChunkId;
+
+    size_t chunkSize(log_id_t id, uint16_t len) const;
+    bool isLoggable(log_id_t log_id, const char* msg, uint16_t len);
+    const SerializedLogEntry* append(log_id_t log_id, log_time realtime,
+                                     uid_t uid, pid_t pid, pid_t tid,
+                                     const char* msg, uint16_t len);
+    void maybePrune(log_id_t id);
+    void removeOldest(log_id_t id);
+    void fill(log_id_t id, ChunkCursor& cursor, const log_time& start,
+              SerializedLogChunkCache* cache);
+
+   public:
+    explicit SerializedLogBuffer(LastLogTimes* times);
+
+    int prepareLog(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
+                   pid_t tid, const char* msg, uint16_t len,
+                   PendingLog* pending) override;
+    int commitLocked(PendingLog* pending) override;
+    // Readers resume from start, see fill(), cursor only carries their
+    // decompressed chunk cache.
+    log_time flushTo(SocketClient* writer, const log_time& start,
+                     pid_t* lastTid, bool privileged, bool security,
+                     int (*filter)(const LogBufferElement* element, void* arg),
+                     void* arg, LogReaderCursor* cursor,
+                     AndroidLogFormat* format) override;
+
+    bool clear(log_id_t id, uid_t uid = AID_ROOT) override;
+    int setSize(log_id_t id, unsigned long size) override;
+    unsigned long getSizeUsed(log_id_t id) override;
+};
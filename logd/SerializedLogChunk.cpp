@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <new>
+
+#include <zlib.h>
+
+#include "LogUtils.h"
+#include "SerializedLogChunk.h"
+
+SerializedLogChunk::SerializedLogChunk(uint64_t id, size_t size)
+    : mId(id),
+      mSize(size),
+      mContents(new uint8_t[size]),
+      mWriteOffset(0),
+      mSealed(false),
+      mNewest(log_time::EPOCH) {
+}
+
+const SerializedLogEntry* SerializedLogChunk::log(log_time realtime, uid_t uid,
+                                                  pid_t pid, pid_t tid,
+                                                  const char* msg,
+                                                  uint16_t len) {
+    SerializedLogEntry* entry = new (&mContents[mWriteOffset])
+        SerializedLogEntry(uid, pid, tid, realtime, len);
+    memcpy(entry->getMsg(), msg, len);
+    mWriteOffset += entry->getTotalLen();
+    if (mNewest < realtime) {
+        mNewest = realtime;
+    }
+    return entry;
+}
+
+void SerializedLogChunk::seal() {
+    if (mSealed) {
+        return;
+    }
+    mSealed = true;
+
+    // Favour speed, logd runs SCHED_BATCH and sealing happens in the writer.
+    uLongf compressedLen = compressBound(mWriteOffset);
+    mCompressed.resize(compressedLen);
+    if (compress2(mCompressed.data(), &compressedLen, mContents.get(),
+                  mWriteOffset, Z_BEST_SPEED) != Z_OK) {
+        // Keep the uncompressed content rather than lose the logs.
+        android::prdebug("SerializedLogChunk: compression failed");
+        mCompressed.clear();
+        mCompressed.shrink_to_fit();
+        return;
+    }
+    mCompressed.resize(compressedLen);
+    mCompressed.shrink_to_fit();
+    mContents.reset();
+}
+
+size_t SerializedLogChunk::read(size_t offset, std::vector<uint8_t>& out,
+                                SerializedLogChunkCache* cache) const {
+    if (offset >= mWriteOffset) {
+        return 0;
+    }
+
+    const uint8_t* contents = mContents.get();
+    std::vector<uint8_t> decompressed;
+    if (!contents && cache && (cache->id == mId) && !cache->contents.empty()) {
+        contents = cache->contents.data();
+    } else if (!contents) {
+        decompressed.resize(mWriteOffset);
+        uLongf len = mWriteOffset;
+        if ((uncompress(decompressed.data(), &len, mCompressed.data(),
+                        mCompressed.size()) != Z_OK) ||
+            (len != mWriteOffset)) {
+            android::prdebug("SerializedLogChunk: decompression failed");
+            return 0;
+        }
+        if (cache) {
+            cache->id = mId;
+            cache->contents.swap(decompressed);
+            contents = cache->contents.data();
+        } else {
+            contents = decompressed.data();
+        }
+    }
+    out.insert(out.end(), &contents[offset], &contents[mWriteOffset]);
+    return mWriteOffset - offset;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <memory>
+#include <vector>
+
+#include <log/log.h>
+
+#include "SerializedLogEntry.h"
+
+// A reader's private copy of the sealed chunk it decompressed last.
+struct SerializedLogChunkCache {
+    uint64_t id = 0;
+    std::vector<uint8_t> contents;  // empty if none
+};
+
+// A fixed size block of SerializedLogEntry records for a single log id.
+//
+// A chunk is writable until it is full, at which point it is sealed: the
+// entries are compressed and the raw contents released. Sealed chunks are
+// immutable, readers decompress a private copy of them on demand so that no
+// state is shared between concurrent readers.
+//
+// All methods must be called with the owning SerializedLogBuffer locked,
+// rdlock() for the const methods and wrlock() for the others.
+class SerializedLogChunk {
+    const uint64_t mId;  // unique and increasing within the owning buffer
+    const size_t mSize;
+    std::unique_ptr<uint8_t[]> mContents;  // nullptr once compressed
+    size_t mWriteOffset;
+    bool mSealed;
+    std::vector<uint8_t> mCompressed;
+    log_time mNewest;
+
+   public:
+    SerializedLogChunk(uint64_t id, size_t size);
+
+    uint64_t getId() const {
+        return mId;
+    }
+    bool isSealed() const {
+        return mSealed;
+    }
+    // Uncompressed length of the serialized entries.
+    size_t getWriteOffset() const {
+        return mWriteOffset;
+    }
+    // Latest entry timestamp, entries are stored in arrival order so this is
+    // not necessarily that of the last entry.
+    log_time getNewest() const {
+        return mNewest;
+    }
+    // Bytes charged against the log buffer size.
+    size_t getPruneSize() const {
+        return mContents ? mWriteOffset : mCompressed.size();
+    }
+
+    bool canLog(uint16_t len) const {
+        return !isSealed() &&
+               ((mWriteOffset + sizeof(SerializedLogEntry) + len) <= mSize);
+    }
+    // assumes canLog(len)
+    const SerializedLogEntry* log(log_time realtime, uid_t uid, pid_t pid,
+                                  pid_t tid, const char* msg, uint16_t len);
+    // Compress and release the raw contents, no further entries may be added.
+    void seal();
+
+    // Copy the serialized entries from offset onwards to the end of out,
+    // decompressing as required. Returns the number of bytes appended. If
+    // cache is set, it is used instead of decompressing the chunk again, or
+    // replaced with this chunk if it holds another one.
+    size_t read(size_t offset, std::vector<uint8_t>& out,
+                SerializedLogChunkCache* cache = nullptr) const;
+};
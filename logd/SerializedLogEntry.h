@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include <log/log.h>
+
+// Header of a log entry as it is laid out inside of a SerializedLogChunk, the
+// message payload follows immediately after it. Entries are packed back to
+// back, so there is no per entry allocation and no alignment padding.
+class __attribute__((packed)) SerializedLogEntry {
+    // sized to match reality of incoming log packets
+    const uint32_t mUid;
+    const uint32_t mPid;
+    const uint32_t mTid;
+    const log_time mRealTime;
+    const uint16_t mMsgLen;
+
+   public:
+    SerializedLogEntry(uid_t uid, pid_t pid, pid_t tid, log_time realtime,
+                       uint16_t len)
+        : mUid(uid), mPid(pid), mTid(tid), mRealTime(realtime), mMsgLen(len) {
+    }
+
+    uid_t getUid() const {
+        return mUid;
+    }
+    pid_t getPid() const {
+        return mPid;
+    }
+    pid_t getTid() const {
+        return mTid;
+    }
+    log_time getRealTime() const {
+        return mRealTime;
+    }
+    uint16_t getMsgLen() const {
+        return mMsgLen;
+    }
+    const char* getMsg() const {
+        return reinterpret_cast<const char*>(this) + sizeof(*this);
+    }
+    char* getMsg() {
+        return reinterpret_cast<char*>(this) + sizeof(*this);
+    }
+    // header plus payload, the distance to the next entry in the chunk
+    size_t getTotalLen() const {
+        return sizeof(*this) + mMsgLen;
+    }
+};
@@ -52,7 +52,9 @@
 #include "LogBuffer.h"
 #include "LogKlog.h"
 #include "LogListener.h"
+#include "LogRingListener.h"
 #include "LogUtils.h"
+#include "SerializedLogBuffer.h"
 
 #define KMSG_PRIORITY(PRI)                                 \
     '<', '0' + LOG_MAKEPRI(LOG_DAEMON, LOG_PRI(PRI)) / 10, \
@@ -364,9 +366,16 @@ int main(int argc, char* argv[]) {
     LastLogTimes* times = new LastLogTimes();
 
     // LogBuffer is the object which is responsible for holding all
-    // log entries.
-
-    logBuf = new LogBuffer(times);
+    // log entries. logd.buffer_type selects the storage engine, "chatty"
+    // (default) or "serialized" for compressed chunks.
+
+    char buffer_type[PROPERTY_VALUE_MAX];
+    property_get("logd.buffer_type", buffer_type, "chatty");
+    if (!strcmp(buffer_type, "serialized")) {
+        logBuf = new SerializedLogBuffer(times);
+    } else {
+        logBuf = new LogBuffer(times);
+    }
 
     signal(SIGHUP, reinit_signal_handler);
 
@@ -395,10 +404,22 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
 
+    // LogRingListener listens on /dev/socket/logdring for clients
+    // registering a shared memory ring. New log entries are drained from
+    // the rings into LogBuffer and LogReader is notified.
+
+    // Clients fall back to logdw when logdring is unavailable, so this is
+    // not fatal.
+
+    LogRingListener* rings = new LogRingListener(logBuf, reader);
+    if (rings->startListener()) {
+        android::prdebug("failed to start logdring listener, continuing without it");
+    }
+
     // Command listener listens on /dev/socket/logd for incoming logd
     // administrative commands.
 
-    CommandListener* cl = new CommandListener(logBuf, reader, swl);
+    CommandListener* cl = new CommandListener(logBuf, reader, swl, rings);
     if (cl->startListener()) {
         return EXIT_FAILURE;
     }
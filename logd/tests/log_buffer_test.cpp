@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+#include <gtest/gtest.h>
+#include <sysutils/SocketClient.h>
+
+#include "../LogBuffer.h"
+#include "../LogBufferElement.h"
+#include "../LogTimes.h"
+
+using android::base::unique_fd;
+
+// Logs a main buffer entry with the given message, stamped at second sec.
+static void logMain(LogBuffer& buf, uint32_t sec, const std::string& text) {
+    std::string msg = std::string(1, ANDROID_LOG_INFO) + "test" + '\0' + text;
+    msg += '\0';
+    ASSERT_LT(0, buf.log(LOG_ID_MAIN, log_time(sec, 0), 0, 1, 1, msg.data(),
+                         msg.size()));
+}
+
+// Collects the seconds of the elements it's asked about, until it's told to
+// stop at one.
+struct Filter {
+    std::vector<uint32_t> seen;
+    uint32_t stopAt = 0;
+
+    static int filter(const LogBufferElement* element, void* arg) {
+        Filter* me = static_cast<Filter*>(arg);
+        uint32_t sec = element->getRealTime().tv_sec;
+        if (sec == me->stopAt) {
+            return -1;
+        }
+        me->seen.push_back(sec);
+        return true;
+    }
+};
+
+class LogBufferCursorTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        int fds[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        reader_.reset(new SocketClient(fds[0], false));
+        peer_.reset(fds[1]);
+    }
+
+    // Runs a flushTo() pass with cursor_, and returns what it sent.
+    std::vector<uint32_t> flush(LogBuffer& buf, uint32_t stopAt = 0) {
+        Filter filter;
+        filter.stopAt = stopAt;
+        buf.flushTo(reader_.get(), log_time(log_time::EPOCH), nullptr, true, false,
+                    Filter::filter, &filter, &cursor_);
+        // Keep the socket from filling up.
+        char drain[4096];
+        while (recv(peer_.get(), drain, sizeof(drain), MSG_DONTWAIT) > 0) {
+        }
+        return filter.seen;
+    }
+
+    std::unique_ptr<SocketClient> reader_;
+    unique_fd peer_;
+    LogReaderCursor cursor_;
+};
+
+TEST_F(LogBufferCursorTest, resume) {
+    LastLogTimes times;
+    LogBuffer buf(&times);
+    logMain(buf, 1, "one");
+    logMain(buf, 2, "two");
+    ASSERT_EQ((std::vector<uint32_t>{1, 2}), flush(buf));
+
+    // A wakeup only visits what was logged since.
+    logMain(buf, 3, "three");
+    ASSERT_EQ((std::vector<uint32_t>{3}), flush(buf));
+    ASSERT_TRUE(flush(buf).empty());
+}
+
+TEST_F(LogBufferCursorTest, resume_after_stop) {
+    LastLogTimes times;
+    LogBuffer buf(&times);
+    logMain(buf, 1, "one");
+    logMain(buf, 2, "two");
+    logMain(buf, 3, "three");
+
+    // The element that the pass stopped on wasn't sent, so the next pass
+    // starts with it.
+    ASSERT_EQ((std::vector<uint32_t>{1}), flush(buf, 2));
+    ASSERT_EQ((std::vector<uint32_t>{2, 3}), flush(buf));
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <gtest/gtest.h>
+
+#include "../LogStagingQueue.h"
+
+using android::base::StringPrintf;
+
+static void push(LogStagingQueue& queue, const std::string& msg,
+                 uint32_t sequence = 0) {
+    queue.push(LOG_ID_MAIN, log_time(sequence, 0), 1000, 2, 3, msg.data(),
+               msg.size());
+}
+
+// Consumes up to maxEntries entries, appending their messages to messages.
+static size_t consume(LogStagingQueue& queue, size_t maxEntries,
+                      std::vector<std::string>* messages) {
+    return queue.consume(
+        maxEntries,
+        [&](const LogStagingQueue::Entry* entry) {
+            // Entry is packed, so copy its fields out before comparing them.
+            uint8_t id = entry->id;
+            uint32_t uid = entry->uid, pid = entry->pid, tid = entry->tid;
+            EXPECT_EQ(LOG_ID_MAIN, id);
+            EXPECT_EQ(1000U, uid);
+            EXPECT_EQ(2U, pid);
+            EXPECT_EQ(3U, tid);
+            messages->emplace_back(entry->msg(), entry->len);
+        },
+        []() {});
+}
+
+TEST(LogStagingQueue, wrap_around) {
+    // Small enough that every few entries wrap, and that both a padding
+    // marker and a tail too short to hold one are left at the end.
+    LogStagingQueue queue(256);
+    for (size_t i = 0; i < 200; ++i) {
+        std::vector<std::string> messages;
+        std::string first = StringPrintf("%zu", i) + std::string(i % 61, 'a');
+        std::string second = StringPrintf("%zu", i) + std::string(i % 37, 'b');
+        push(queue, first);
+        push(queue, second);
+        ASSERT_EQ(2U, consume(queue, 10, &messages));
+        ASSERT_EQ(first, messages[0]);
+        ASSERT_EQ(second, messages[1]);
+    }
+}
+
+TEST(LogStagingQueue, max_entries) {
+    LogStagingQueue queue(4096);
+    for (int i = 0; i < 5; ++i) {
+        push(queue, StringPrintf("%d", i));
+    }
+    std::vector<std::string> messages;
+    ASSERT_EQ(3U, consume(queue, 3, &messages));
+    ASSERT_EQ(2U, consume(queue, 3, &messages));
+    ASSERT_EQ((std::vector<std::string>{"0", "1", "2", "3", "4"}), messages);
+}
+
+TEST(LogStagingQueue, full) {
+    LogStagingQueue queue(256);
+    std::string msg(100, 'x');
+    push(queue, msg);
+    push(queue, msg);
+
+    // There's no room for a third until the consumer releases one.
+    std::atomic<bool> pushed(false);
+    std::thread producer([&]() {
+        push(queue, msg);
+        pushed = true;
+    });
+    usleep(100000);
+    ASSERT_FALSE(pushed);
+
+    std::vector<std::string> messages;
+    ASSERT_EQ(1U, consume(queue, 1, &messages));
+    producer.join();
+    ASSERT_TRUE(pushed);
+    ASSERT_EQ(2U, consume(queue, 10, &messages));
+    ASSERT_EQ(3U, messages.size());
+    EXPECT_NE(std::string::npos,
+              queue.formatStatistics().find("blocked on a full queue: 1 times"));
+}
+
+TEST(LogStagingQueue, spsc_order) {
+    static const uint32_t kEntries = 100000;
+    LogStagingQueue queue(1024);
+    std::thread producer([&]() {
+        for (uint32_t i = 0; i < kEntries; ++i) {
+            push(queue, std::string(i % 50, 'x'), i);
+        }
+    });
+
+    uint32_t next = 0;
+    while (next < kEntries) {
+        queue.consume(
+            16,
+            [&](const LogStagingQueue::Entry* entry) {
+                uint32_t sec = entry->realtime.tv_sec;
+                uint16_t len = entry->len;
+                ASSERT_EQ(next, sec);
+                ASSERT_EQ(next % 50, len);
+                ++next;
+            },
+            []() {});
+    }
+    producer.join();
+    ASSERT_EQ(kEntries, next);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <memory>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "LogBuffer.h"
+#include "LogStatistics.h"
+#include "LogTimes.h"
+
+// liblogd expects these from main.cpp
+void android::prdebug(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+char* android::uidToName(uid_t) {
+    return nullptr;
+}
+
+BENCHMARK_MAIN();
+
+static const uid_t kFirstAppUid = 10000;
+
+// A LOG_ID_MAIN payload, priority, tag and message.
+static std::vector<char> mainPayload(const char* tag, size_t messageLen) {
+    std::vector<char> payload(1 + strlen(tag) + 1 + messageLen + 1, 'x');
+    payload[0] = ANDROID_LOG_INFO;
+    strcpy(&payload[1], tag);
+    payload.back() = '\0';
+    return payload;
+}
+
+/*
+ *	Cost of picking the two worst offenders, as LogBuffer::prune() does on
+ * every pass, against the number of distinct uids in the statistics. Should
+ * stay flat.
+ */
+static void BM_stats_sort_worst_uid(benchmark::State& state) {
+    LogStatistics stats;
+    std::vector<char> payload = mainPayload("BM_stats_sort_worst_uid", 64);
+    std::vector<std::unique_ptr<LogBufferElement>> elements;
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        for (int64_t j = 0; j <= (i % 8); ++j) {
+            elements.emplace_back(new LogBufferElement(
+                LOG_ID_MAIN, log_time(CLOCK_REALTIME), kFirstAppUid + i, i + 1,
+                i + 1, payload.data(), payload.size()));
+            stats.add(elements.back().get());
+        }
+    }
+
+    while (state.KeepRunning()) {
+        int worst = -1;
+        size_t worst_sizes = 0;
+        size_t second_worst_sizes = 0;
+        stats.sort(AID_ROOT, (pid_t)0, 2, LOG_ID_MAIN)
+            .findWorst(worst, worst_sizes, second_worst_sizes, 0);
+        benchmark::DoNotOptimize(worst);
+    }
+}
+BENCHMARK(BM_stats_sort_worst_uid)->RangeMultiplier(4)->Range(16, 65536);
+
+/*
+ *	Steady state cost of logging into a full LOG_ID_MAIN, so that every few
+ * entries trigger a prune, against the buffer size. One uid spams while a
+ * long tail of 4096 uids log occasionally. Should stay flat.
+ */
+static void BM_log_prune(benchmark::State& state) {
+    LastLogTimes times;
+    LogBuffer logbuf(&times);
+    logbuf.setSize(LOG_ID_MAIN, state.range(0));
+
+    std::vector<char> payload = mainPayload("BM_log_prune", 128);
+    uint16_t len = payload.size();
+    uint32_t count = 0;
+    auto logOne = [&]() {
+        uid_t uid = (count % 2) ? kFirstAppUid : (kFirstAppUid + 1 + (count / 2) % 4096);
+        logbuf.log(LOG_ID_MAIN, log_time(CLOCK_REALTIME), uid, uid, uid, payload.data(), len);
+        ++count;
+    };
+
+    // Wrap the buffer a couple of times so that prune state has settled.
+    while ((uint64_t)count * len < 2 * (uint64_t)state.range(0)) {
+        logOne();
+    }
+
+    while (state.KeepRunning()) {
+        logOne();
+    }
+    logbuf.clear(LOG_ID_MAIN);
+}
+BENCHMARK(BM_log_prune)->RangeMultiplier(4)->Range(256 * 1024, 16 * 1024 * 1024);
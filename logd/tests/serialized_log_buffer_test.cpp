@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+#include <gtest/gtest.h>
+#include <sysutils/SocketClient.h>
+
+#include "../LogBufferElement.h"
+#include "../LogTimes.h"
+#include "../SerializedLogBuffer.h"
+#include "../SerializedLogChunk.h"
+
+using android::base::StringPrintf;
+using android::base::unique_fd;
+
+// What a reader was sent of an entry.
+struct Sent {
+    log_id_t id;
+    uint32_t sec;
+    std::string text;
+
+    bool operator==(const Sent& other) const {
+        return (id == other.id) && (sec == other.sec) && (text == other.text);
+    }
+};
+
+static std::ostream& operator<<(std::ostream& os, const Sent& sent) {
+    return os << sent.id << "@" << sent.sec << ":" << sent.text;
+}
+
+static std::string logText(uint32_t sec) {
+    return StringPrintf("message number %u, which compresses well", sec);
+}
+
+class SerializedLogBufferTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        int fds[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        reader_.reset(new SocketClient(fds[0], true));
+        // Consume what the reader is sent, so flushTo() never blocks on it.
+        drainer_ = std::thread([peer = unique_fd(fds[1])]() {
+            char buf[4096];
+            while (read(peer.get(), buf, sizeof(buf)) > 0) {
+            }
+        });
+        buf_.reset(new SerializedLogBuffer(&times_));
+    }
+
+    void TearDown() override {
+        reader_.reset();
+        drainer_.join();
+    }
+
+    // Logs an entry with the text logText(sec), stamped at second sec.
+    void log(log_id_t id, uint32_t sec, const std::string& text = "") {
+        std::string msg = std::string(1, ANDROID_LOG_INFO) + "test" + '\0' +
+                          (text.empty() ? logText(sec) : text);
+        msg += '\0';
+        ASSERT_LT(0, buf_->log(id, log_time(sec, 0), 0, 1, 1, msg.data(),
+                               msg.size()));
+    }
+
+    // Runs a flushTo() pass from start, and returns what it sent.
+    std::vector<Sent> flush(const log_time& start,
+                            LogReaderCursor* cursor = nullptr) {
+        std::vector<Sent> sent;
+        buf_->flushTo(reader_.get(), start, nullptr, true, false, collect,
+                      &sent, cursor, nullptr);
+        return sent;
+    }
+
+    static int collect(const LogBufferElement* element, void* arg) {
+        const char* msg = element->getMsg();
+        const char* text = msg + 1 + strlen(msg + 1) + 1;
+        static_cast<std::vector<Sent>*>(arg)->push_back(
+            {element->getLogId(), element->getRealTime().tv_sec, text});
+        return true;
+    }
+
+    LastLogTimes times_;
+    std::unique_ptr<SerializedLogBuffer> buf_;
+    std::unique_ptr<SocketClient> reader_;
+    std::thread drainer_;
+};
+
+TEST_F(SerializedLogBufferTest, log_and_flush) {
+    log(LOG_ID_MAIN, 1);
+    log(LOG_ID_SYSTEM, 2);
+    log(LOG_ID_MAIN, 3);
+    log(LOG_ID_SYSTEM, 4);
+
+    // The log ids are merged by time.
+    std::vector<Sent> expected = {
+        {LOG_ID_MAIN, 1, logText(1)},
+        {LOG_ID_SYSTEM, 2, logText(2)},
+        {LOG_ID_MAIN, 3, logText(3)},
+        {LOG_ID_SYSTEM, 4, logText(4)},
+    };
+    EXPECT_EQ(expected, flush(log_time(log_time::EPOCH)));
+
+    expected.erase(expected.begin(), expected.begin() + 2);
+    EXPECT_EQ(expected, flush(log_time(3, 0)));
+}
+
+TEST_F(SerializedLogBufferTest, compression_round_trip) {
+    ASSERT_EQ(0, buf_->setSize(LOG_ID_MAIN, 256 * 1024));
+
+    // Enough to seal a couple of 64KiB chunks, but not to prune any.
+    static const uint32_t kEntries = 2000;
+    size_t logged = 0;
+    for (uint32_t sec = 1; sec <= kEntries; ++sec) {
+        log(LOG_ID_MAIN, sec);
+        logged += logText(sec).size();
+    }
+    // Sealed chunks are charged at their compressed size.
+    EXPECT_LT(buf_->getSizeUsed(LOG_ID_MAIN), logged);
+
+    std::vector<Sent> sent = flush(log_time(log_time::EPOCH));
+    ASSERT_EQ(kEntries, sent.size());
+    for (uint32_t sec = 1; sec <= kEntries; ++sec) {
+        ASSERT_EQ((Sent{LOG_ID_MAIN, sec, logText(sec)}), sent[sec - 1]);
+    }
+}
+
+TEST_F(SerializedLogBufferTest, prune) {
+    static const unsigned long kSize = 64 * 1024;
+    ASSERT_EQ(0, buf_->setSize(LOG_ID_MAIN, kSize));
+
+    // Text that doesn't compress, so that chunks have to be pruned.
+    std::string noise;
+    unsigned seed = 1;
+    uint32_t last = 0;
+    for (uint32_t sec = 1; sec <= 2000; ++sec) {
+        noise.clear();
+        for (int i = 0; i < 100; ++i) {
+            noise += static_cast<char>('!' + (rand_r(&seed) % 90));
+        }
+        log(LOG_ID_MAIN, sec, noise);
+        EXPECT_LE(buf_->getSizeUsed(LOG_ID_MAIN), kSize);
+        last = sec;
+    }
+
+    // What's left is the newest entries, without a gap.
+    std::vector<Sent> sent = flush(log_time(log_time::EPOCH));
+    ASSERT_FALSE(sent.empty());
+    EXPECT_GT(sent.front().sec, 1U);
+    EXPECT_EQ(last, sent.back().sec);
+    for (size_t i = 1; i < sent.size(); ++i) {
+        ASSERT_EQ(sent[i - 1].sec + 1, sent[i].sec);
+    }
+}
+
+TEST_F(SerializedLogBufferTest, clear) {
+    log(LOG_ID_MAIN, 1);
+    log(LOG_ID_SYSTEM, 2);
+    buf_->clear(LOG_ID_MAIN);
+    EXPECT_EQ((std::vector<Sent>{{LOG_ID_SYSTEM, 2, logText(2)}}),
+              flush(log_time(log_time::EPOCH)));
+    EXPECT_EQ(0U, buf_->getSizeUsed(LOG_ID_MAIN));
+}
+
+TEST_F(SerializedLogBufferTest, reader_chunk_cache) {
+    ASSERT_EQ(0, buf_->setSize(LOG_ID_MAIN, 256 * 1024));
+    static const uint32_t kEntries = 2000;
+    for (uint32_t sec = 1; sec <= kEntries; ++sec) {
+        log(LOG_ID_MAIN, sec);
+    }
+
+    // Reading the sealed chunks leaves the last of them in the cursor.
+    LogReaderCursor cursor;
+    ASSERT_EQ(kEntries, flush(log_time(log_time::EPOCH), &cursor).size());
+    std::vector<uint8_t>& cached = cursor.chunkCache.contents;
+    ASSERT_FALSE(cached.empty());
+
+    // Mark the first entry of the cached copy, a later pass that is sent
+    // the mark read the chunk through the cache rather than decompress it.
+    SerializedLogEntry* entry = reinterpret_cast<SerializedLogEntry*>(cached.data());
+    uint32_t marked = entry->getRealTime().tv_sec;
+    char* text = entry->getMsg() + 1 + strlen(entry->getMsg() + 1) + 1;
+    ASSERT_EQ('m', *text);
+    *text = 'M';
+
+    std::vector<Sent> sent = flush(log_time(marked, 0), &cursor);
+    ASSERT_EQ(kEntries - marked + 1, sent.size());
+    std::string expected = logText(marked);
+    expected[0] = 'M';
+    EXPECT_EQ((Sent{LOG_ID_MAIN, marked, expected}), sent.front());
+    EXPECT_EQ((Sent{LOG_ID_MAIN, kEntries, logText(kEntries)}), sent.back());
+
+    // Without a cursor, the chunk is decompressed again.
+    sent = flush(log_time(marked, 0));
+    EXPECT_EQ((Sent{LOG_ID_MAIN, marked, logText(marked)}), sent.front());
+}
+
+TEST(SerializedLogChunk, read_through_cache) {
+    SerializedLogChunk chunk(7, 4096);
+    std::string text = "some text to compress, some text to compress";
+    chunk.log(log_time(1, 0), 0, 1, 1, text.data(), text.size());
+    chunk.log(log_time(2, 0), 0, 1, 1, text.data(), text.size());
+    std::vector<uint8_t> raw;
+    ASSERT_EQ(chunk.getWriteOffset(), chunk.read(0, raw));
+
+    chunk.seal();
+    ASSERT_TRUE(chunk.isSealed());
+    ASSERT_LT(chunk.getPruneSize(), chunk.getWriteOffset());
+
+    SerializedLogChunkCache cache;
+    std::vector<uint8_t> out;
+    ASSERT_EQ(chunk.getWriteOffset(), chunk.read(0, out, &cache));
+    EXPECT_EQ(raw, out);
+    EXPECT_EQ(7U, cache.id);
+    EXPECT_EQ(raw, cache.contents);
+
+    // A cached read of part of the chunk.
+    size_t second = reinterpret_cast<const SerializedLogEntry*>(raw.data())
+                        ->getTotalLen();
+    out.clear();
+    ASSERT_EQ(raw.size() - second, chunk.read(second, out, &cache));
+    EXPECT_EQ(std::vector<uint8_t>(raw.begin() + second, raw.end()), out);
+
+    // A cache of another chunk is replaced.
+    cache.id = 8;
+    cache.contents.assign(16, 0);
+    out.clear();
+    ASSERT_EQ(chunk.getWriteOffset(), chunk.read(0, out, &cache));
+    EXPECT_EQ(raw, out);
+    EXPECT_EQ(7U, cache.id);
+}